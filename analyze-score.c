@@ -0,0 +1,412 @@
+#include <stdio.h>    /* printf(), fprintf(), stderr                          */
+#include <stdlib.h>   /* malloc(), realloc(), free(), qsort(), atof()         */
+#include <string.h>   /* memset(), strcmp()                                   */
+#include <stddef.h>   /* offsetof()                                           */
+#include <math.h>     /* log(), sqrt(), fabs()                                */
+
+#include "include/player.h"
+#include "include/score.h"
+#include "include/stub.h"
+
+/* Limits of the quality gate, which may be changed on the command line. A
+   note fails if it is further off than these. A note may wait for the rest
+   of the last note's period before its pin first turns on, so the onset limit
+   is about a period of c2. */
+#define LIMIT_CENTS  10.0   /* Frequency (cents).                             */
+#define LIMIT_JITTER 8.0    /* Period jitter (RMS, microseconds).             */
+#define LIMIT_DUTY   0.02   /* Duty cycle.                                    */
+#define LIMIT_PHASE  64.0   /* Period across a beat boundary (microseconds).  */
+#define LIMIT_GLITCH 0.0    /* Glitches in a song.                            */
+#define LIMIT_ONSET  16000.0 /* Time before the pin turns on (microseconds).  */
+
+
+
+/* Times of something happening, in microseconds from the start. */
+typedef struct times_t {
+    unsigned long *t;
+    unsigned int length, size;
+} times_t;
+
+/* Rising and falling edges of a pin, and glitches: pulses with no length,
+   where the pin turns on and off (or off and on) at the same time. */
+typedef struct edges_t {
+    times_t rise, fall, glitch;
+} edges_t;
+
+/* What was sent to DMA while playing a score. */
+typedef struct timeline_t {
+    edges_t pin[32];
+    unsigned long *beat;    /* Start of each beat.                            */
+    unsigned int beats, beatsSize;
+    unsigned long now;      /* End of the last beat.                          */
+    unsigned int level;     /* Pins that are on (1<<pin).                     */
+    unsigned int touched;   /* Pins changed since time last moved on.         */
+    unsigned int from;      /* level when time last moved on.                 */
+} timeline_t;
+
+/* Measurements of a note: a run of beats of a voice with the same pitch and
+   duty cycle. */
+typedef struct note_t {
+    unsigned int voice, beat, beats;
+    double freq, duty;      /* Requested.                                     */
+    double achFreq, achDuty;
+    double cents, jitter, phase, onset;
+    unsigned int rises, periods, glitches;
+    int effect;             /* 1 if any beat of it is shaped by an effect.    */
+} note_t;
+
+/* Effects in use on a voice. Vibrato and tremolo stay in use until they are
+   changed, and slides may last several beats. */
+typedef struct effects_t {
+    double vInt, tInt;      /* Vibrato and tremolo range.                     */
+    double freqAE, dutyAE;  /* Beat in which a pitch or duty slide ends.      */
+    int ff, fd;             /* 1 while a pitch or duty slide is going on.     */
+} effects_t;
+
+/* Percentiles of a measurement of every note. */
+typedef struct summary_t {
+    double p50, p90, p99, max;
+} summary_t;
+
+
+
+/* Add a time. */
+static void timeAdd(times_t *times, unsigned long t) {
+    if (times->length == times->size) {
+        times->size = times->size ? 2*times->size : 1024;
+        times->t = realloc(times->t, times->size*sizeof(unsigned long));
+    }
+    times->t[times->length++] = t;
+}
+
+/* Add the edges and glitches of the transitions made at the current time. */
+static void timelineStep(timeline_t *tl) {
+    unsigned int pin, changed = tl->from ^ tl->level;
+
+    for (pin = 0; pin < 32; pin++) {
+        if (changed & (1u<<pin))
+            timeAdd(tl->level & (1u<<pin) ? &tl->pin[pin].rise
+                                          : &tl->pin[pin].fall, tl->now);
+        else if (tl->touched & (1u<<pin))
+            timeAdd(&tl->pin[pin].glitch, tl->now);
+    }
+    tl->from    = tl->level;
+    tl->touched = 0;
+}
+
+/* Add the transitions of a beat to the timeline, for stub_record(). */
+static void record(const stub_pulse_t *pulses, unsigned int length,
+                   void *arg) {
+    timeline_t *tl = arg;
+    unsigned int i, on, off;
+
+    if (tl->beats == tl->beatsSize) {
+        tl->beatsSize = tl->beatsSize ? 2*tl->beatsSize : 1024;
+        tl->beat = realloc(tl->beat, tl->beatsSize*sizeof(unsigned long));
+    }
+    tl->beat[tl->beats++] = tl->now;
+
+    for (i = 0; i < length; i++) {
+        /* Only changes of level are edges */
+        on  = pulses[i].set & ~tl->level;
+        off = pulses[i].clr &  tl->level;
+        tl->level    = (tl->level | on) & ~off;
+        tl->touched |= on | off;
+        if (pulses[i].us) {
+            timelineStep(tl);
+            tl->now += pulses[i].us;
+        }
+    }
+}
+
+/* Free a timeline. */
+static void timelineFree(timeline_t *tl) {
+    unsigned int pin;
+    for (pin = 0; pin < 32; pin++) {
+        free(tl->pin[pin].rise.t);
+        free(tl->pin[pin].fall.t);
+        free(tl->pin[pin].glitch.t);
+    }
+    free(tl->beat);
+}
+
+
+
+/* Measure a note from the edges of its pin between start and end.
+   r, f, g: Index of the first rising edge, falling edge and glitch at or
+            after start. They are moved past end. */
+static void measure(note_t *n, const timeline_t *tl, const edges_t *e,
+                    unsigned int *r, unsigned int *f, unsigned int *g,
+                    unsigned long start, unsigned long end) {
+    const unsigned long *rise = e->rise.t, *fall = e->fall.t;
+    unsigned int first, last, i, b;
+    double period, sum = 0, duty = 0, d;
+
+    while (*g < e->glitch.length && e->glitch.t[*g] < start) (*g)++;
+    while (*g < e->glitch.length && e->glitch.t[*g] < end) {
+        n->glitches++;
+        (*g)++;
+    }
+
+    while (*r < e->rise.length && rise[*r] < start) (*r)++;
+    while (*f < e->fall.length && fall[*f] < start) (*f)++;
+    first = *r;
+    while (*r < e->rise.length && rise[*r] < end) (*r)++;
+    last = *r;
+
+    n->rises   = last - first;
+    n->periods = last > first ? last - first - 1 : 0;
+    n->onset   = last > first ? rise[first] - start : 0;
+    if (!n->periods) return;
+
+    /* Frequency and jitter over the whole periods of the note */
+    period     = (double)(rise[last-1] - rise[first])/n->periods;
+    n->achFreq = 1e6/period;
+    n->cents   = 1200*log(n->achFreq/n->freq)/log(2);
+    for (i = first; i < last-1; i++) {
+        d    = rise[i+1] - rise[i] - period;
+        sum += d*d;
+
+        /* The pin turns off once in each period */
+        while (*f < e->fall.length && fall[*f] < rise[i]) (*f)++;
+        if (*f < e->fall.length && fall[*f] < rise[i+1])
+            duty += (fall[*f] - rise[i])/(double)(rise[i+1] - rise[i]);
+    }
+    n->jitter  = sqrt(sum/n->periods);
+    n->achDuty = duty/n->periods;
+
+    /* Waves of consecutive beats of a note should join without a jump in
+       phase, so the period across each boundary should be like the others */
+    i = first;
+    for (b = n->beat + 1; b < n->beat + n->beats; b++) {
+        while (i < last-1 && rise[i+1] <= tl->beat[b]) i++;
+        if (i < last-1 && rise[i] <= tl->beat[b]) {
+            d = fabs(rise[i+1] - rise[i] - period);
+            if (d > n->phase) n->phase = d;
+        }
+    }
+}
+
+
+
+/* Follow the effects of a voice into the next beat in the same way as the
+   player does.
+   m: Effect of the beat, or NULL.
+   Returns 1 if the wave of the beat is shaped by an effect, 0 if it is a
+   plain note. */
+static int effectsNext(effects_t *fx, const misc_t *m, unsigned int beat) {
+    int shaped = m && m->value && m->value < 1;
+
+    if (m && m->usingPs && !fx->ff) {
+        fx->ff     = 1;
+        fx->freqAE = m->freqE + beat;
+    }
+    if (m && m->usingDs && !fx->fd) {
+        fx->fd     = 1;
+        fx->dutyAE = m->dutyE + beat;
+    }
+    if (m && m->usingV) fx->vInt = m->vInt;
+    if (m && m->usingT) fx->tInt = m->tInt;
+
+    shaped |= fx->ff || fx->fd || fx->vInt || fx->tInt;
+    if (fx->ff && beat + 1 >= fx->freqAE) fx->ff = 0;
+    if (fx->fd && beat + 1 >= fx->dutyAE) fx->fd = 0;
+    return shaped;
+}
+
+
+
+/* Compare two doubles, for qsort(). */
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Percentiles of the absolute values of some notes' measurement.
+   offset: Offset of the measurement in note_t. */
+static summary_t summarize(const note_t *notes, unsigned int count,
+                           size_t offset) {
+    summary_t s = {0, 0, 0, 0};
+    double *v;
+    unsigned int i, n = 0;
+
+    v = malloc((count + 1)*sizeof(double));
+    for (i = 0; i < count; i++)
+        if (notes[i].periods && !notes[i].effect)
+            v[n++] = fabs(*(const double *)((const char *)&notes[i] + offset));
+    if (n) {
+        qsort(v, n, sizeof(double), compare);
+        s.p50 = v[(n*50 + 99)/100 - 1];
+        s.p90 = v[(n*90 + 99)/100 - 1];
+        s.p99 = v[(n*99 + 99)/100 - 1];
+        s.max = v[n-1];
+    }
+    free(v);
+    return s;
+}
+
+/* Print the percentiles of a measurement and check it against its limit.
+   Returns 1 if its maximum is over the limit, 0 otherwise. */
+static int report(const char *path, const char *name, summary_t s,
+                  double limit) {
+    fprintf(stderr, "analyze: %s %-6s p50=%.3f p90=%.3f p99=%.3f max=%.3f "
+                    "limit=%.3f%s\n", path, name, s.p50, s.p90, s.p99, s.max,
+            limit, s.max > limit ? " FAIL" : "");
+    return s.max > limit;
+}
+
+
+
+/* Play a score with the stub driver, and measure each note of each voice
+   against what the score asks for.
+   limit: Limits of cents, jitter, duty cycle, phase, glitches and onset.
+   Returns 0 if every note is within the limits, 1 if not, -1 on error. */
+static int analyze(const char *path, const double *limit) {
+    static timeline_t tl;
+    score_t score;
+    note_t *notes = NULL, *n;
+    unsigned int count = 0, size = 0, v, b, pi, di, e, r, f, g;
+    unsigned int stray = 0, glitches = 0;
+    unsigned long end;
+    effects_t fx;
+    int effect, fail = 0;
+
+    if (scoreOpen(&score, path)) return -1;
+
+    memset(&tl, 0, sizeof(tl));
+    stub_record(record, &tl);
+    if (queuePlayFile(path)) {
+        stub_record(NULL, NULL);
+        scoreClose(&score);
+        return -1;
+    }
+    stub_record(NULL, NULL);
+    timelineStep(&tl);
+
+    if (tl.beats != score.header->beats) {
+        fprintf(stderr, "ERROR: analyze(): %u beats were sent for the %u "
+                        "beats of \"%s\".\n", tl.beats, score.header->beats,
+                path);
+        timelineFree(&tl);
+        scoreClose(&score);
+        return -1;
+    }
+
+    for (v = 0; v < score.header->voices; v++) {
+        r = f = g = 0;
+        memset(&fx, 0, sizeof(fx));
+        for (b = 0; b < score.header->beats; b += n->beats) {
+            if (count == size) {
+                size  = size ? 2*size : 256;
+                notes = realloc(notes, size*sizeof(note_t));
+            }
+            n = &notes[count];
+            memset(n, 0, sizeof(note_t));
+            n->voice = v;
+            n->beat  = b;
+            pi = scorePitch(&score, v, b);
+            di = scoreDuty(&score, v, b);
+            n->freq = score.pitch[pi];
+            n->duty = score.duty[di];
+
+            /* The note lasts while the pitch and duty cycle stay the same */
+            effect = 0;
+            do {
+                e = scoreEffect(&score, v, b + n->beats);
+                effect |= effectsNext(&fx, e ? &score.effect[e-1] : NULL,
+                                      b + n->beats);
+                n->beats++;
+            } while (b + n->beats < score.header->beats &&
+                     scorePitch(&score, v, b + n->beats) == pi &&
+                     scoreDuty(&score, v, b + n->beats) == di);
+            n->effect = effect;
+
+            end = b + n->beats < tl.beats ? tl.beat[b + n->beats] : tl.now;
+            measure(n, &tl, &tl.pin[score.voice[v].pin], &r, &f, &g,
+                    tl.beat[b], end);
+            glitches += n->glitches;
+
+            /* Rests should be silent */
+            if (!n->freq || n->duty <= 0 || n->duty >= 1) {
+                if (n->rises && !n->effect) stray++;
+                continue;
+            }
+            count++;
+        }
+    }
+
+    printf("file,voice,pin,beat,beats,freq,achieved_freq,cents,jitter_us,"
+           "duty,achieved_duty,phase_us,onset_us,periods,glitches,effect\n");
+    for (n = notes; n < notes + count; n++)
+        printf("%s,%u,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.4f,%.4f,%.0f,%.0f,%u,"
+               "%u,%d\n", path, n->voice, score.voice[n->voice].pin, n->beat,
+               n->beats, n->freq, n->achFreq, n->cents, n->jitter, n->duty,
+               n->achDuty, n->phase, n->onset, n->periods, n->glitches,
+               n->effect);
+    fflush(stdout);
+
+    /* Duty cycle errors are kept in achDuty for summarize() */
+    for (n = notes; n < notes + count; n++) n->achDuty -= n->duty;
+
+    fprintf(stderr, "analyze: %s notes=%u glitches=%u limit=%.0f%s "
+                    "stray=%u%s\n", path, count, glitches, limit[4],
+            glitches > limit[4] ? " FAIL" : "", stray, stray ? " FAIL" : "");
+    fail |= report(path, "cents", summarize(notes, count,
+                   offsetof(note_t, cents)), limit[0]);
+    fail |= report(path, "jitter", summarize(notes, count,
+                   offsetof(note_t, jitter)), limit[1]);
+    fail |= report(path, "duty", summarize(notes, count,
+                   offsetof(note_t, achDuty)), limit[2]);
+    fail |= report(path, "phase", summarize(notes, count,
+                   offsetof(note_t, phase)), limit[3]);
+    fail |= report(path, "onset", summarize(notes, count,
+                   offsetof(note_t, onset)), limit[5]);
+    fail |= glitches > limit[4] || stray != 0;
+
+    free(notes);
+    timelineFree(&tl);
+    scoreClose(&score);
+    return fail;
+}
+
+
+
+/* Check how accurately score files are played: the waveform of every voice
+   is read back from the control blocks sent to DMA and compared with the
+   score, note by note.
+   Usage: ./analyze-score [-c cents] [-j us] [-d duty] [-p us] [-g glitches]
+                          [-o us] file.rps ...
+   Build with "make analyze", which links the stub driver instead of the real
+   one, so no hardware is used. A line of comma separated values is printed
+   for each note, with the frequency and duty cycle asked for and achieved,
+   how far off the frequency was (cents), the jitter of its periods (RMS),
+   the largest jump in phase where one beat of the note meets the next, and
+   how long after the note started the pin first turned on. Percentiles of
+   these over all notes are printed to stderr. Notes with effects are listed
+   but left out of the percentiles, since their frequency is meant to change.
+   The exit status is 1 if any note was further off than the limits given
+   with -c, -j, -d, -p and -o, if there were more glitches than -g allows, or
+   if a rest was not silent. */
+int main(int argc, char **argv) {
+    static const char *options[6] = {"-c", "-j", "-d", "-p", "-g", "-o"};
+    double limit[6] = {LIMIT_CENTS, LIMIT_JITTER, LIMIT_DUTY, LIMIT_PHASE,
+                       LIMIT_GLITCH, LIMIT_ONSET};
+    int i, o, status = 0, result;
+
+    for (i = 1; i < argc; i++) {
+        for (o = 0; o < 6 && strcmp(argv[i], options[o]); o++);
+        if (o < 6 && i+1 < argc) limit[o] = atof(argv[++i]);
+        else if (argv[i][0] == '-') break;
+        else {
+            result = analyze(argv[i], limit);
+            if (result < 0) return 2;
+            status |= result;
+        }
+    }
+    if (i < argc || argc < 2) {
+        fprintf(stderr, "Usage: %s [-c cents] [-j us] [-d duty] [-p us] "
+                        "[-g glitches] [-o us] file.rps ...\n", argv[0]);
+        return 2;
+    }
+    return status;
+}
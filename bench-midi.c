@@ -0,0 +1,103 @@
+#define _BSD_SOURCE
+
+#include <stdio.h>    /* printf(), fprintf(), tmpfile()                       */
+#include <stdlib.h>   /* atoi()                                               */
+#include <fcntl.h>    /* open()                                               */
+#include <unistd.h>   /* close(), lseek()                                     */
+#include <sys/time.h> /* gettimeofday()                                       */
+
+#include "include/midi.h"
+
+
+
+/* Write a big-endian number of n bytes. */
+static void putBig(FILE *f, unsigned long v, int n) {
+    while (n--) fputc((v >> (8*n)) & 0xFF, f);
+}
+
+/* Write a variable-length quantity. */
+static void putNumber(FILE *f, unsigned long v) {
+    unsigned char b[5];
+    int n = 0;
+    do {
+        b[n++] = v & 0x7F;
+        v >>= 7;
+    } while (v);
+    while (n--) fputc(b[n] | (n ? 0x80 : 0), f);
+}
+
+
+
+/* Measure how fast MIDI files are read, without playing them.
+   Usage: ./bench-midi [file.mid]
+   Without a file, a format 1 file with 16 tracks of 50000 notes each (with
+   pitch bends) is made up and read. No hardware is used. */
+int main(int argc, char **argv) {
+    int pins[4] = {21, 20, 16, 13};
+    static midi_t m;
+    event_t ev;
+    struct timeval t0, t1;
+    unsigned long events = 0, bytes;
+    double s;
+    FILE *f;
+    int fd, track, i;
+    long len;
+
+    if (argc > 1) {
+        if ((fd = open(argv[1], O_RDONLY)) < 0) {
+            fprintf(stderr, "ERROR: Cannot open \"%s\".\n", argv[1]);
+            return 1;
+        }
+    } else {
+        f = tmpfile();
+        fwrite("MThd", 1, 4, f);
+        putBig(f, 6, 4);
+        putBig(f, 1, 2);
+        putBig(f, 16, 2);
+        putBig(f, 96, 2);
+        for (track = 0; track < 16; track++) {
+            fwrite("MTrk", 1, 4, f);
+            putBig(f, 0, 4);
+            len = ftell(f);
+            for (i = 0; i < 50000; i++) {
+                putNumber(f, 0);
+                putBig(f, 0x90 | track, 1);
+                putBig(f, 48 + (i*7 + track) % 36, 1);
+                putBig(f, 100, 1);
+                putNumber(f, 24);
+                putBig(f, 0xE0 | track, 1);
+                putBig(f, 0, 1);
+                putBig(f, 0x40 + i % 32, 1);
+                putNumber(f, 24);
+                putBig(f, 0x80 | track, 1);
+                putBig(f, 48 + (i*7 + track) % 36, 1);
+                putBig(f, 0, 1);
+            }
+            putNumber(f, 0);
+            putBig(f, 0xFF2F00, 3);
+
+            /* Fill in the track length */
+            len = ftell(f) - len;
+            fseek(f, -len - 4, SEEK_CUR);
+            putBig(f, len, 4);
+            fseek(f, 0, SEEK_END);
+        }
+        fflush(f);
+        fd = fileno(f);
+    }
+    bytes = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+
+    gettimeofday(&t0, NULL);
+    if (midiOpen(&m, fd, pins, 4, MIDI_NOTES)) return 1;
+    while (midiNext(&ev, &m)) events++;
+    gettimeofday(&t1, NULL);
+
+    s = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec)/1e6;
+    printf("%lu bytes, %lu MIDI events, %lu player events in %.3f s\n",
+           bytes, m.events, events, s);
+    printf("%.2f MB/s, %.0f MIDI events/s\n",
+           bytes/s/1e6, m.events/s);
+    printf("Reader state: %lu bytes\n", (unsigned long)sizeof(midi_t));
+    return m.error ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+#define _BSD_SOURCE
+
+#include <stdio.h>    /* printf(), fprintf(), stderr                          */
+#include <stdlib.h>   /* malloc(), free()                                     */
+#include <math.h>     /* pow()                                                */
+#include <sys/time.h> /* gettimeofday()                                       */
+
+#include "include/player.h"
+#include "include/score.h"
+
+/* The numbers come from timingStats() */
+#if !TIMING
+#   error "Build with make bench"
+#endif
+
+/* Transitions to aim for in each synthetic workload, so that each one takes
+   long enough to time but not much longer. */
+#define TRANSITIONS 200000
+
+/* Most transitions of a beat, leaving room in the wave buffers (PAGES*64). */
+#define BEAT_TRANSITIONS (PAGES*48)
+
+static const unsigned int voiceCounts[] = {1, 2, 4, 8, 16, 32};
+static const double pitches[] = {c2, c3, c4, c5, c6, c7, c8, b8};
+static const char *pitchNames[] = {"c2","c3","c4","c5","c6","c7","c8","b8"};
+static const unsigned int beatLengths[] = {10000, 100000, 1000000};
+static const char *effects[] = {"plain", "slide", "vibrato", "tremolo"};
+
+#define COUNT(a) (sizeof(a)/sizeof(a[0]))
+
+
+
+/* Print one line of results.
+   us: Wall time of the whole workload (microseconds). */
+static void report(const char *workload, unsigned int voices, const char *pitch,
+                   const char *effect, unsigned int beatUs, unsigned int beats,
+                   unsigned long us) {
+    timing_stats_t t;
+    const timing_phase_t *gen, *merge, *emit;
+
+    timingStats(&t);
+    gen   = &t.phase[TIMING_GEN];
+    merge = &t.phase[TIMING_MERGE];
+    emit  = &t.phase[TIMING_EMIT];
+
+    printf("%s,%u,%s,%s,%u,%u,%lu,%.0f,%lu,%.0f,%lu,%.0f,%lu,"
+           "%.1f,%.1f,%.1f,%.0f,%.0f,%.0f\n",
+           workload, voices, pitch, effect, beatUs, beats, us,
+           gen->transitions, gen->us, merge->transitions, merge->us,
+           emit->transitions, emit->us,
+           gen->transitions ? gen->us*1000/gen->transitions : 0,
+           merge->transitions ? merge->us*1000/merge->transitions : 0,
+           emit->transitions ? emit->us*1000/emit->transitions : 0,
+           gen->us ? gen->transitions*1e6/gen->us : 0,
+           merge->us ? merge->transitions*1e6/merge->us : 0,
+           emit->us ? 2*emit->transitions*1e6/emit->us : 0);
+    fflush(stdout);
+}
+
+/* Microseconds since a time. */
+static unsigned long usSince(const struct timeval *t) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - t->tv_sec)*1000000UL + now.tv_usec - t->tv_usec;
+}
+
+
+
+/* Play a made up song and report it. Every voice plays the same note all
+   along, each a semitone lower than the one before (repeating every octave),
+   so that their edges do not line up.
+   Returns 0, or -1 if its beats would not fit in the wave buffers. */
+static int synthetic(unsigned int voices, unsigned int p, unsigned int effect,
+                     unsigned int beatUs) {
+    double *freq, *duty, f, perBeat = 0;
+    misc_t *misc, **miscs;
+    struct timeval start;
+    unsigned int v, b, beats;
+
+    /* Slides go up a fifth and vibrato up to a semitone */
+    for (v = 0; v < voices; v++)
+        perBeat += 2*pitches[p]*pow(2, -(v%12)/12.0)*1.5*beatUs/1e6 + 2;
+    if (perBeat > BEAT_TRANSITIONS) return -1;
+    beats = TRANSITIONS/perBeat;
+    if (beats < 4) beats = 4;
+    if (beats > 10000) beats = 10000;
+
+    freq  = malloc(voices*beats*sizeof(double));
+    duty  = malloc(voices*beats*sizeof(double));
+    misc  = calloc(voices, sizeof(misc_t));
+    miscs = malloc(voices*beats*sizeof(misc_t *));
+
+    for (v = 0; v < voices; v++) {
+        f = pitches[p]*pow(2, -(v%12)/12.0);
+        misc[v].usingPs = effect == 1;
+        misc[v].freqTo  = f*1.5;
+        misc[v].freqS   = 0;
+        misc[v].freqE   = 1;
+        misc[v].usingV  = effect == 2;
+        misc[v].vInt    = 100;
+        misc[v].vWth    = 20000;
+        misc[v].usingT  = effect == 3;
+        misc[v].tInt    = 0.25;
+        misc[v].tWth    = 20000;
+        for (b = 0; b < beats; b++) {
+            freq[v*beats + b]  = f;
+            duty[v*beats + b]  = 0.5;
+            miscs[v*beats + b] = effect ? &misc[v] : NULL;
+        }
+        queueAdd(v, freq + v*beats, duty + v*beats, miscs + v*beats);
+    }
+
+    gettimeofday(&start, NULL);
+    queuePlay(beatUs, beats);
+    report("synthetic", voices, pitchNames[p], effects[effect], beatUs, beats,
+           usSince(&start));
+
+    free(freq);
+    free(duty);
+    free(misc);
+    free(miscs);
+    return 0;
+}
+
+/* Play a score file and report it. */
+static void song(const char *path) {
+    score_t score;
+    struct timeval start;
+    unsigned int voices, beats, us;
+
+    if (scoreOpen(&score, path)) {
+        fprintf(stderr, "ERROR: song(): Cannot open \"%s\".\n", path);
+        return;
+    }
+    voices = score.header->voices;
+    beats  = score.header->beats;
+    us     = score.header->us;
+    scoreClose(&score);
+
+    gettimeofday(&start, NULL);
+    queuePlayFile(path);
+    report(path, voices, "-", "-", us, beats, usSince(&start));
+}
+
+
+
+/* Measure how fast waveforms are generated (waveGen()), merged and written
+   to control blocks, on made up songs and on score files.
+   Usage: ./bench-player [file.rps ...]
+   Build with "make bench", which links the stub driver instead of the real
+   one, so no hardware is used and nothing waits for DMA. The made up songs
+   cover every combination of voices, pitch, effect and beat length whose
+   beats fit in the wave buffers. One line of comma separated values is
+   printed for each song, after a line naming the columns: nanoseconds per
+   transition and transitions per second of generating and merging, and
+   nanoseconds per transition and control blocks per second of writing
+   control blocks. */
+int main(int argc, char **argv) {
+    unsigned int v, p, e, b;
+    int i;
+
+    printf("workload,voices,pitch,effect,beat_us,beats,wall_us,"
+           "gen_transitions,gen_us,merge_transitions,merge_us,"
+           "emit_transitions,emit_us,gen_ns,merge_ns,emit_ns,"
+           "gen_per_s,merge_per_s,emit_cbs_per_s\n");
+
+    for (v = 0; v < COUNT(voiceCounts); v++)
+        for (p = 0; p < COUNT(pitches); p++)
+            for (e = 0; e < COUNT(effects); e++)
+                for (b = 0; b < COUNT(beatLengths); b++)
+                    synthetic(voiceCounts[v], p, e, beatLengths[b]);
+
+    for (i = 1; i < argc; i++) song(argv[i]);
+    return 0;
+}
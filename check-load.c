@@ -0,0 +1,506 @@
+#include <stdio.h>    /* printf(), fprintf(), fopen(), fgets(), fclose()      */
+#include <stdlib.h>   /* calloc(), realloc(), free(), qsort(), atof(), atoi() */
+#include <string.h>   /* memset(), memmove(), strcmp(), strtok()              */
+
+#include "include/player.h"
+#include "include/score.h"
+#include "include/stub.h"
+
+/* Percentage of each beat the player may spend generating and writing it,
+   which may be changed on the command line. The rest is left to the system
+   and to whatever else runs on the Pi. */
+#define CPU_BUDGET 75.0
+
+/* Transitions the control blocks hold at once (two control blocks and a
+   GPIO command word each, see cbWrite()). */
+#define RING (PAGES*64)
+
+/* Parts of playing in the cost model. */
+#define COST_GEN   0        /* waveGen() of one pin.                          */
+#define COST_MERGE 1        /* Combining one pin with the others.             */
+#define COST_EMIT  2        /* Writing the control blocks of a beat.          */
+#define COSTS      3
+
+/* Most columns of bench.csv. */
+#define BENCH_COLUMNS 32
+
+
+
+/* What a Pi can do. The times are per call (waveGen() or merging one pin,
+   or writing one beat) and per transition, as fitted by calibrate() to the
+   output of bench-player. */
+typedef struct board_t {
+    const char *name;
+    unsigned int cores;
+    unsigned int depth;     /* Pipeline depth of its build (see Makefile).    */
+    double cbsPerMs;        /* Most control blocks DMA keeps up with in a
+                               millisecond, on top of its delays.             */
+    double callNs[COSTS];
+    double transitionNs[COSTS];
+} board_t;
+
+/* The Pis, with the pipeline depth "make pi0" and so on build with. The
+   times are rough estimates, scaled from a desktop machine by the clock and
+   core of each Pi; running "make bench" on the Pi itself and giving its
+   bench.csv with -c is much more accurate. */
+static const board_t boards[] = {
+    {"pi0", 1, 0, 1000, {2500, 9000, 1500}, {1300, 150, 350}},
+    {"pi1", 1, 0, 1000, {2500, 9000, 1500}, {1300, 150, 350}},
+    {"pi2", 4, 8, 1200, {1800, 6500, 1000}, { 900, 100, 250}},
+    {"pi3", 4, 8, 1200, {1100, 4000,  600}, { 550,  60, 150}},
+    {"pi4", 4, 8, 2000, { 500, 1800,  300}, { 250,  30,  70}}
+};
+
+#define BOARDS (sizeof(boards)/sizeof(boards[0]))
+
+/* Load of a beat. */
+typedef struct beat_t {
+    double us;              /* Length.                                        */
+    unsigned int transitions; /* Transitions written.                         */
+    unsigned int generated; /* Transitions generated, over every pin.         */
+    unsigned int peak;      /* Most transitions in a millisecond ending in
+                               the beat.                                      */
+    unsigned int pin;       /* Pin with the most transitions.                 */
+    unsigned int pinTransitions;
+
+    /* Predicted by simulate() */
+    double cpuUs;           /* Generating and writing it.                     */
+    double load;            /* Time of the busiest thread, as a percentage of
+                               the length of the beat.                        */
+    double generatedAt;     /* When it was generated.                         */
+    double sent;            /* When its control blocks were written.          */
+    double start;           /* When DMA starts playing it.                    */
+    double slack;           /* Sound waiting for DMA when it was sent.        */
+    double ring;            /* Transitions waiting for DMA then.              */
+} beat_t;
+
+/* Load of a song. */
+typedef struct load_t {
+    beat_t *beat;
+    unsigned int beats, size;
+    double now;             /* End of the last beat (microseconds).           */
+
+    /* Times of the transitions in the last millisecond */
+    double *window;
+    unsigned int first, length, windowSize;
+
+    unsigned long pinTransitions[32];
+    double pinPeak[32];     /* Most transitions of a pin per millisecond of a
+                               beat.                                          */
+    unsigned int pinFlagged[32]; /* Flagged beats a pin was the busiest in.   */
+} load_t;
+
+/* Flags of a beat. Those from FLAG_FAIL on make the check fail. */
+#define FLAG_CPU      1     /* Over the CPU budget.                           */
+#define FLAG_RING     2     /* Does not fit in the control blocks with the
+                               beat before it.                                */
+#define FLAG_FAIL     4
+#define FLAG_DMA      4     /* More control blocks per ms than DMA keeps up
+                               with.                                          */
+#define FLAG_UNDERRUN 8     /* Sent after DMA had run out.                    */
+#define FLAG_OVERFLOW 16    /* More transitions than the wave buffers hold.   */
+
+static const char *flagNames[] = {"cpu", "ring", "dma", "underrun",
+                                  "overflow"};
+
+
+
+/* Fit ns = call*calls + transition*transitions to the rows of bench.csv by
+   least squares, for one part of playing. A part with no calls or
+   transitions keeps the times it had.
+   rows: calls, transitions and ns of each row. */
+static void fit(const double (*rows)[3], unsigned int count, double *call,
+                double *transition) {
+    double cc = 0, cn = 0, nn = 0, cy = 0, ny = 0, det;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        cc += rows[i][0]*rows[i][0];
+        cn += rows[i][0]*rows[i][1];
+        nn += rows[i][1]*rows[i][1];
+        cy += rows[i][0]*rows[i][2];
+        ny += rows[i][1]*rows[i][2];
+    }
+    det = cc*nn - cn*cn;
+    if (!cc || !nn) return;
+    *call       = det ? (cy*nn - ny*cn)/det : 0;
+    *transition = det ? (ny*cc - cy*cn)/det : ny/nn;
+
+    /* Neither can take less than no time */
+    if (*call < 0) {
+        *call = 0;
+        *transition = ny/nn;
+    } else if (*transition < 0) {
+        *transition = 0;
+        *call = cy/cc;
+    }
+}
+
+/* Fit the times of a board to the output of bench-player run on it.
+   Returns 0, or -1 (after printing an error). */
+static int calibrate(board_t *board, const char *path) {
+    static const char *names[] = {"voices", "beats", "gen_transitions",
+                                  "gen_us", "merge_transitions", "merge_us",
+                                  "emit_transitions", "emit_us"};
+    FILE *f = fopen(path, "r");
+    char line[1024], *field[BENCH_COLUMNS];
+    int column[8], c, n, i;
+    double (*rows[COSTS])[3] = {NULL, NULL, NULL}, *v;
+    unsigned int count = 0, size = 0, part;
+
+    if (!f || !fgets(line, sizeof(line), f)) {
+        fprintf(stderr, "ERROR: calibrate(): Could not read %s.\n", path);
+        if (f) fclose(f);
+        return -1;
+    }
+    for (i = 0; i < 8; i++) column[i] = -1;
+    for (n = 0, field[n] = strtok(line, ",\n"); field[n] && n+1 < BENCH_COLUMNS;
+         field[++n] = strtok(NULL, ",\n"))
+        for (i = 0; i < 8; i++) if (!strcmp(field[n], names[i])) column[i] = n;
+    for (i = 0; i < 8 && column[i] >= 0; i++);
+    if (i < 8) {
+        fprintf(stderr, "ERROR: calibrate(): %s has no %s column.\n", path,
+                names[i]);
+        fclose(f);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        for (n = 0, field[n] = strtok(line, ",\n");
+             field[n] && n+1 < BENCH_COLUMNS; field[++n] = strtok(NULL, ",\n"));
+        for (i = 0; i < 8 && column[i] < n; i++);
+        if (i < 8) continue;
+
+        if (count == size) {
+            size = size ? 2*size : 256;
+            for (part = 0; part < COSTS; part++)
+                rows[part] = realloc(rows[part], size*sizeof(rows[part][0]));
+        }
+        /* Each beat has a waveGen() call and a merge for every voice */
+        for (part = 0; part < COSTS; part++) {
+            v = rows[part][count];
+            c = column[2 + 2*part];
+            v[0] = atof(field[column[1]]);
+            if (part != COST_EMIT) v[0] *= atof(field[column[0]]);
+            v[1] = atof(field[c]);
+            v[2] = atof(field[c + 1])*1000;
+        }
+        count++;
+    }
+    fclose(f);
+
+    if (!count) {
+        fprintf(stderr, "ERROR: calibrate(): %s has no results.\n", path);
+        return -1;
+    }
+    for (part = 0; part < COSTS; part++) {
+        fit((const double (*)[3])rows[part], count, &board->callNs[part],
+            &board->transitionNs[part]);
+        free(rows[part]);
+    }
+    return 0;
+}
+
+
+
+/* Add the transitions of a beat, for stub_record(). */
+static void record(const stub_pulse_t *pulses, unsigned int length,
+                   void *arg) {
+    load_t *load = arg;
+    unsigned int i, pin, count[32], bits;
+    beat_t *b;
+
+    if (load->beats == load->size) {
+        load->size = load->size ? 2*load->size : 1024;
+        load->beat = realloc(load->beat, load->size*sizeof(beat_t));
+    }
+    b = &load->beat[load->beats++];
+    memset(b, 0, sizeof(beat_t));
+    memset(count, 0, sizeof(count));
+    b->transitions = length;
+
+    for (i = 0; i < length; i++) {
+        /* Forget transitions more than a millisecond ago */
+        while (load->length &&
+               load->window[load->first] <= load->now - 1000) {
+            load->first++;
+            load->length--;
+        }
+        if (load->first + load->length == load->windowSize) {
+            if (load->first) {
+                memmove(load->window, load->window + load->first,
+                        load->length*sizeof(double));
+                load->first = 0;
+            } else {
+                load->windowSize = load->windowSize ? 2*load->windowSize
+                                                    : 1024;
+                load->window = realloc(load->window,
+                                       load->windowSize*sizeof(double));
+            }
+        }
+        load->window[load->first + load->length++] = load->now;
+        if (load->length > b->peak) b->peak = load->length;
+
+        /* Transitions are generated for one pin at a time */
+        bits = pulses[i].set | pulses[i].clr;
+        for (pin = 0; pin < 32; pin++) {
+            if (!(bits & (1u<<pin))) continue;
+            count[pin]++;
+            b->generated++;
+        }
+
+        b->us     += pulses[i].us;
+        load->now += pulses[i].us;
+    }
+
+    for (pin = 0; pin < 32; pin++) {
+        load->pinTransitions[pin] += count[pin];
+        if (b->us && count[pin]*1000/b->us > load->pinPeak[pin])
+            load->pinPeak[pin] = count[pin]*1000/b->us;
+        if (count[pin] > b->pinTransitions) {
+            b->pin = pin;
+            b->pinTransitions = count[pin];
+        }
+    }
+}
+
+
+
+/* Predict when each beat of a song is generated and sent to DMA on a board,
+   and how much sound is waiting for DMA then, in the same way as the player
+   does it: with depth 0 (or one core) each beat is generated and its control
+   blocks written on one thread; otherwise beats are generated up to depth
+   ahead on one core while another writes control blocks. Control blocks are
+   only written over once DMA has read them. DMA starts once the first beat
+   is sent, and if a beat is sent after DMA has run out it starts again from
+   that beat, as after an underrun. */
+static void simulate(load_t *load, const board_t *board, unsigned int voices,
+                     unsigned int depth) {
+    unsigned int i, played = 0, j;
+    double gen, emit, prevGen = 0, prevSent = 0, ready, due, left, waiting = 0;
+    beat_t *b, *last;
+    int pipelined = depth && board->cores > 1;
+
+    for (i = 0; i < load->beats; i++) {
+        b = &load->beat[i];
+        gen  = (board->callNs[COST_GEN] + board->callNs[COST_MERGE])*voices
+             + (board->transitionNs[COST_GEN]
+                + board->transitionNs[COST_MERGE])*b->generated;
+        emit = board->callNs[COST_EMIT]
+             + board->transitionNs[COST_EMIT]*b->transitions;
+        gen  /= 1000;
+        emit /= 1000;
+        b->cpuUs = gen + emit;
+        b->load  = b->us ? 100*(pipelined ? (gen > emit ? gen : emit)
+                                          : gen + emit)/b->us : 0;
+
+        /* Beats from played on are still in the control blocks: this one
+           is written once DMA has played enough of those before it to make
+           room, the last of them only in part */
+        waiting += b->transitions;
+        while (waiting > RING && played < i)
+            waiting -= load->beat[played++].transitions;
+        ready = 0;
+        if (played) {
+            last = &load->beat[played-1];
+            left = waiting + last->transitions - RING;
+            if (waiting > RING) ready = last->start + last->us;
+            else if (left > 0)
+                ready = last->start + last->us*left/last->transitions;
+            else ready = last->start;
+        }
+
+        if (pipelined) {
+            b->generatedAt = prevGen + gen;
+            if (i >= depth && load->beat[i-depth].sent > prevGen)
+                b->generatedAt = load->beat[i-depth].sent + gen;
+            prevGen = b->generatedAt;
+            ready = ready > b->generatedAt ? ready : b->generatedAt;
+            b->sent = (ready > prevSent ? ready : prevSent) + emit;
+        } else {
+            b->sent = (ready > prevSent ? ready : prevSent) + gen + emit;
+            b->generatedAt = b->sent - emit;
+        }
+        prevSent = b->sent;
+
+        if (!i) b->start = b->sent;
+        else {
+            due = load->beat[i-1].start + load->beat[i-1].us;
+            b->slack = due - b->sent;
+            b->start = b->slack < 0 ? b->sent : due;
+        }
+
+        /* Transitions not yet played when it was sent */
+        b->ring = b->transitions;
+        for (j = i; j-- > (played ? played - 1 : 0) &&
+                    load->beat[j].start + load->beat[j].us > b->sent;) {
+            left = load->beat[j].start > b->sent ? 1 :
+                   (load->beat[j].start + load->beat[j].us - b->sent)
+                   /load->beat[j].us;
+            b->ring += load->beat[j].transitions*left;
+        }
+        b->ring /= RING;
+    }
+}
+
+/* Returns the flags of a beat. */
+static unsigned int flags(const load_t *load, unsigned int i,
+                          const board_t *board, double budget) {
+    const beat_t *b = &load->beat[i];
+    unsigned int f = 0;
+
+    if (b->load > budget) f |= FLAG_CPU;
+    if (i && load->beat[i-1].transitions + b->transitions > RING)
+        f |= FLAG_RING;
+    if (2*b->peak > board->cbsPerMs) f |= FLAG_DMA;
+    if (b->slack < 0) f |= FLAG_UNDERRUN;
+    if (b->transitions >= RING) f |= FLAG_OVERFLOW;
+    return f;
+}
+
+/* Compare two doubles, for qsort(). */
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+
+
+/* Play a score with the stub driver, predict its load on a board and print
+   a line for each beat.
+   Returns 0 if every beat can be played, 1 if not, -1 on error. */
+static int check(const char *path, const board_t *board, unsigned int depth,
+                 double budget) {
+    static load_t load;
+    score_t score;
+    unsigned int voices, i, f, all = 0, flagged = 0, n, pin, peak = 0;
+    double *loads, ring = 0, slack = 0;
+    unsigned long underruns = 0;
+    beat_t *b;
+    int result;
+
+    if (scoreOpen(&score, path)) return -1;
+    voices = score.header->voices;
+    scoreClose(&score);
+
+    free(load.beat);
+    free(load.window);
+    memset(&load, 0, sizeof(load));
+    stub_record(record, &load);
+    result = queuePlayFile(path);
+    stub_record(NULL, NULL);
+    if (result) return -1;
+
+    simulate(&load, board, voices, depth);
+
+    loads = malloc((load.beats + 1)*sizeof(double));
+    for (i = 0; i < load.beats; i++) {
+        b = &load.beat[i];
+        f = flags(&load, i, board, budget);
+        all |= f;
+        if (f) {
+            flagged++;
+            load.pinFlagged[b->pin]++;
+        }
+        if (b->slack < 0) underruns++;
+        if (i && (i == 1 || b->slack < slack)) slack = b->slack;
+        if (b->ring > ring) ring = b->ring;
+        if (b->peak > peak) peak = b->peak;
+        loads[i] = b->load;
+
+        printf("%s,%s,%u,%.0f,%u,%u,%u,%.1f,%.0f,%.2f,%.0f,%u,%u,",
+               path, board->name, i, b->us, 2*b->transitions, b->transitions,
+               2*b->peak, 100*b->ring, b->cpuUs, b->load,
+               i ? b->slack : 0, b->pin, b->pinTransitions);
+        if (!f) printf("ok");
+        for (n = 0; f; n++, f >>= 1)
+            if (f & 1) printf("%s%s", flagNames[n], f > 1 ? "+" : "");
+        printf("\n");
+    }
+
+    qsort(loads, load.beats, sizeof(double), compare);
+    fprintf(stderr, "load: %s board=%s depth=%u beats=%u flagged=%u%s\n",
+            path, board->name, depth, load.beats, flagged,
+            all >= FLAG_FAIL ? " FAIL" : "");
+    fprintf(stderr, "load: %s dma peak=%u cbs/ms limit=%.0f ring max=%.1f%%\n",
+            path, 2*peak, board->cbsPerMs, 100*ring);
+    if (load.beats)
+        fprintf(stderr, "load: %s cpu p50=%.2f%% p99=%.2f%% max=%.2f%% "
+                        "budget=%.0f%% slack min=%.0f us underruns=%lu\n", path,
+                loads[load.beats/2], loads[load.beats*99/100],
+                loads[load.beats-1], budget, slack, underruns);
+    for (pin = 0; pin < 32; pin++)
+        if (load.pinFlagged[pin])
+            fprintf(stderr, "load: %s pin %u transitions=%lu peak=%.0f/ms "
+                            "busiest in %u flagged beats\n", path, pin,
+                    load.pinTransitions[pin], load.pinPeak[pin],
+                    load.pinFlagged[pin]);
+    free(loads);
+    return all >= FLAG_FAIL;
+}
+
+
+
+/* Predict whether score files can be played on a Pi without hardware: each
+   score is played with the stub driver, and the control blocks of every
+   beat are counted and the time to generate and write them estimated from
+   a model of the board, to find the beats DMA or the CPU cannot keep up with.
+   Usage: ./check-load [-b pi0|pi1|pi2|pi3|pi4] [-c bench.csv] [-p depth]
+                       [-u percent] file.rps ...
+   Build with "make load". The board (-b) is pi0 by default, with the
+   pipeline depth its build uses unless -p is given. The times of the board
+   may be replaced by those fitted to bench.csv written by "make bench" on
+   it (-c). A line of comma separated values is printed for each beat: its
+   length, control blocks and GPIO command words, most control blocks in a
+   millisecond, how full the control blocks are when it is sent (percent),
+   its CPU time and load (of the busiest thread, over the length of the
+   beat), its predicted slack and its busiest pin, with flags: cpu if its
+   load is over the budget (-u, 75%), ring if it does not fit in the control
+   blocks with the beat before it, dma if DMA cannot keep up with its control
+   blocks, underrun if it would be late and overflow if it has more
+   transitions than the wave buffers hold. A summary and the pins busiest in
+   flagged beats are printed to stderr. The exit status is 1 if any beat is
+   flagged dma, underrun or overflow. */
+int main(int argc, char **argv) {
+    board_t board = boards[0];
+    const char *bench = NULL;
+    double budget = CPU_BUDGET;
+    int i, depth = -1, status = 0, result;
+    unsigned int n;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-b") && i+1 < argc) {
+            for (n = 0; n < BOARDS && strcmp(argv[i+1], boards[n].name); n++);
+            if (n == BOARDS) break;
+            board = boards[n];
+            i++;
+        }
+        else if (!strcmp(argv[i], "-c") && i+1 < argc) bench = argv[++i];
+        else if (!strcmp(argv[i], "-p") && i+1 < argc) depth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-u") && i+1 < argc) budget = atof(argv[++i]);
+        else break;
+    }
+    if (i == argc || argv[i][0] == '-' || depth < -1 || budget <= 0) {
+        fprintf(stderr, "Usage: %s [-b pi0|pi1|pi2|pi3|pi4] [-c bench.csv] "
+                        "[-p depth] [-u percent] file.rps ...\n", argv[0]);
+        return 2;
+    }
+    if (bench && calibrate(&board, bench)) return 2;
+    if (depth >= 0) board.depth = depth;
+    fprintf(stderr, "load: %s cores=%u depth=%u dma=%.0f cbs/ms gen=%.0f+%.0f "
+                    "merge=%.0f+%.0f emit=%.0f+%.0f ns (per call+per "
+                    "transition)\n", board.name, board.cores, board.depth,
+            board.cbsPerMs, board.callNs[COST_GEN],
+            board.transitionNs[COST_GEN], board.callNs[COST_MERGE],
+            board.transitionNs[COST_MERGE], board.callNs[COST_EMIT],
+            board.transitionNs[COST_EMIT]);
+
+    printf("score,board,beat,us,cbs,words,peak_cbs_per_ms,ring_pct,cpu_us,"
+           "load_pct,slack_us,pin,pin_transitions,flags\n");
+    for (; i < argc; i++) {
+        result = check(argv[i], &board, board.depth, budget);
+        if (result < 0) return 2;
+        status |= result;
+    }
+    return status;
+}
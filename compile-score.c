@@ -0,0 +1,18 @@
+#include <stdio.h>    /* fprintf(), stderr                                    */
+
+#include "include/player.h"
+
+
+
+/* Compile a score file made with "make scores" or queueSave() into a header
+   that can be played with compiledPlay() (see include/compile.h).
+   No hardware is used.
+   Usage: ./compile-score file.rps file.rpc.h */
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s file.rps file.rpc.h\n", argv[0]);
+        return 1;
+    }
+
+    return queueCompileFile(argv[1], argv[2]) ? 1 : 0;
+}
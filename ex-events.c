@@ -0,0 +1,33 @@
+#include "include/player.h"
+
+/* GPIO pins to use (BCM number) */
+#define PIN1   21
+#define PIN2   20
+#define PIN3   16
+
+/* Ticks per beat */
+#define TICKS  4
+
+/* Pitch slide up an octave over 2 beats */
+static misc_t slide = { 0, 1,c5,0,2, 0,0,0,0, 0,0,0, 0,0,0, 0 };
+
+int main(void) {
+    /* Melody, one note per beat, ending with a note held for 3 beats */
+    eventAdd(PIN1,  0*TICKS, 1*TICKS, c4, .5, NULL);
+    eventAdd(PIN1,  1*TICKS, 1*TICKS, d4, .5, NULL);
+    eventAdd(PIN1,  2*TICKS, 1*TICKS, e4, .5, NULL);
+    eventAdd(PIN1,  3*TICKS, 1*TICKS, f4, .5, NULL);
+    eventAdd(PIN1,  4*TICKS, 3*TICKS, g4, .5, NULL);
+
+    /* Pedal note with a pitch slide, held for the whole song */
+    eventAdd(PIN2,  0*TICKS, 7*TICKS, c4, .5, &slide);
+
+    /* Short notes, a quarter of a beat each */
+    eventAdd(PIN3,  4*TICKS, 1,       g3, .5, NULL);
+    eventAdd(PIN3,  5*TICKS, 1,       b3, .5, NULL);
+    eventAdd(PIN3,  6*TICKS, 1,       d4, .5, NULL);
+
+    eventPlay(1000000, TICKS);
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>    /* fopen(), fprintf(), fclose(), stderr                 */
+#include <string.h>   /* strlen(), strcpy(), strcmp()                         */
+#include <stdlib.h>   /* malloc(), free()                                     */
+
+#include "include/player.h"
+#include "include/score.h"
+#include "include/stub.h"
+
+/* Identifier of the beat counter in the dump. Pins use '!' onwards. */
+#define BEAT_ID "b"
+
+
+
+/* Dump being written. */
+typedef struct vcd_t {
+    FILE *f;
+    unsigned int pins;      /* Pins in the dump (1<<pin).                     */
+    unsigned int level;     /* Pins that are on.                              */
+    unsigned int beat;      /* Beats written.                                 */
+    double now;             /* Time (microseconds). A double holds any song
+                               exactly, however long.                         */
+    double written;         /* Last time written.                             */
+} vcd_t;
+
+
+
+/* Write the time, if it has moved on since it was last written. */
+static void vcdTime(vcd_t *vcd) {
+    if (vcd->now != vcd->written) {
+        fprintf(vcd->f, "#%.0f\n", vcd->now);
+        vcd->written = vcd->now;
+    }
+}
+
+/* Write the transitions of a beat, for stub_record(). Each change of a pin
+   is written, so glitches (a pin turning on and off at the same time) are
+   kept. */
+static void record(const stub_pulse_t *pulses, unsigned int length,
+                   void *arg) {
+    vcd_t *vcd = arg;
+    unsigned int i, pin, on, off, beat = vcd->beat++;
+    char bits[33];
+
+    /* The beat counter is written in binary */
+    i = 32;
+    bits[i] = 0;
+    do bits[--i] = '0' + (beat & 1); while (beat >>= 1);
+    vcdTime(vcd);
+    fprintf(vcd->f, "b%s " BEAT_ID "\n", bits + i);
+
+    for (i = 0; i < length; i++) {
+        on  = pulses[i].set & ~vcd->level & vcd->pins;
+        off = pulses[i].clr &  vcd->level & vcd->pins;
+        if (on | off) {
+            vcdTime(vcd);
+            for (pin = 0; pin < 32; pin++) {
+                if (on  & (1u<<pin)) fprintf(vcd->f, "1%c\n", '!' + pin);
+                if (off & (1u<<pin)) fprintf(vcd->f, "0%c\n", '!' + pin);
+            }
+            vcd->level = (vcd->level | on) & ~off;
+        }
+        vcd->now += pulses[i].us;
+    }
+}
+
+
+
+/* Play a score with the stub driver, writing what its pins do to a file as
+   it goes.
+   Returns 0, or -1 (after printing an error). */
+static int export(const char *score, const char *path) {
+    score_t s;
+    vcd_t vcd;
+    unsigned int v, pin;
+    int result;
+
+    if (scoreOpen(&s, score)) return -1;
+    if (!(vcd.f = fopen(path, "w"))) {
+        fprintf(stderr, "ERROR: export(): Could not write %s.\n", path);
+        scoreClose(&s);
+        return -1;
+    }
+
+    vcd.pins    = 0;
+    vcd.level   = 0;
+    vcd.beat    = 0;
+    vcd.now     = 0;
+    vcd.written = 0;
+
+    fprintf(vcd.f, "$comment %s, %u beats $end\n", score, s.header->beats);
+    fprintf(vcd.f, "$timescale 1us $end\n");
+    fprintf(vcd.f, "$scope module player $end\n");
+    for (v = 0; v < s.header->voices; v++) {
+        pin = s.voice[v].pin;
+        if (vcd.pins & (1u<<pin)) continue;
+        vcd.pins |= 1u<<pin;
+        fprintf(vcd.f, "$var wire 1 %c gpio%u $end\n", '!' + pin, pin);
+    }
+    fprintf(vcd.f, "$var integer 32 " BEAT_ID " beat $end\n");
+    fprintf(vcd.f, "$upscope $end\n$enddefinitions $end\n");
+    fprintf(vcd.f, "#0\n$dumpvars\n");
+    for (pin = 0; pin < 32; pin++)
+        if (vcd.pins & (1u<<pin)) fprintf(vcd.f, "0%c\n", '!' + pin);
+    fprintf(vcd.f, "$end\n");
+    scoreClose(&s);
+
+    stub_record(record, &vcd);
+    result = queuePlayFile(score);
+    stub_record(NULL, NULL);
+
+    /* Mark the end, so that the last beat is shown whole */
+    vcdTime(&vcd);
+    if (fclose(vcd.f) || result) {
+        fprintf(stderr, "ERROR: export(): Could not write %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+/* Write what the pins do while a score file is played as a Value Change Dump,
+   for GTKWave or PulseView.
+   Usage: ./export-vcd file.rps [file.vcd]
+   Without a second file, the dump is written next to the score with .vcd
+   instead of .rps. Build with "make vcd", which links the stub driver
+   instead of the real one, so no hardware is used. There is a signal for
+   each pin of the score and a counter of beats that changes at the start of
+   each beat. Times are in microseconds, which is the resolution of the
+   player. Each beat is written as soon as it is sent to DMA, so songs of any
+   length take the same memory. */
+int main(int argc, char **argv) {
+    char *path;
+    size_t length;
+    int result;
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s file.rps [file.vcd]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 3) return export(argv[1], argv[2]) ? 1 : 0;
+
+    length = strlen(argv[1]);
+    path = malloc(length + 5);
+    strcpy(path, argv[1]);
+    if (length > 4 && !strcmp(path + length - 4, ".rps")) length -= 4;
+    strcpy(path + length, ".vcd");
+    result = export(argv[1], path);
+    free(path);
+    return result ? 1 : 0;
+}
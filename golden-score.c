@@ -0,0 +1,334 @@
+#include <stdio.h>    /* printf(), fprintf(), fscanf(), fopen(), fclose()     */
+#include <stdlib.h>   /* calloc(), realloc(), free()                          */
+#include <string.h>   /* memset(), strcmp()                                   */
+
+#include "include/player.h"
+#include "include/score.h"
+#include "include/stub.h"
+
+/* First line of golden files. */
+#define GOLDEN_MAGIC "rpi-player golden 1"
+
+/* Beats that differ that are described one by one. */
+#define GOLDEN_SHOWN 20
+
+/* Starting value of hashes (32 bit FNV-1a). */
+#define HASH_START 2166136261U
+
+
+
+/* Hashes of a beat. */
+typedef struct beat_t {
+    unsigned int cbs;       /* Control blocks and the words they read.        */
+    unsigned int pin[32];   /* When each pin turned on and off in the beat.   */
+} beat_t;
+
+/* Hashes of a song. */
+typedef struct song_t {
+    beat_t *beat;
+    unsigned int beats, size;
+    unsigned int pins;      /* Pins of the song (1<<pin).                     */
+    unsigned int level;     /* Pins that are on.                              */
+    unsigned int used;      /* Pins turned on or off so far.                  */
+} song_t;
+
+
+
+/* Add a word to a hash. */
+static unsigned int hash(unsigned int h, unsigned int word) {
+    int i;
+    for (i = 0; i < 4; i++, word >>= 8) {
+        h ^= word & 0xFF;
+        h *= 16777619U;
+    }
+    return h & 0xFFFFFFFFU;
+}
+
+/* Hash what each pin does in a beat, for stub_record(). Glitches (a pin
+   turning on and off at the same time) count, but transitions that leave a
+   pin as it was do not, so that only the waveform of each pin is hashed. */
+static void recordPins(const stub_pulse_t *pulses, unsigned int length,
+                       void *arg) {
+    song_t *song = arg;
+    beat_t *b;
+    unsigned int i, pin, on, off, us = 0;
+
+    if (song->beats == song->size) {
+        song->size = song->size ? 2*song->size : 1024;
+        song->beat = realloc(song->beat, song->size*sizeof(beat_t));
+    }
+    b = &song->beat[song->beats++];
+    for (pin = 0; pin < 32; pin++) b->pin[pin] = HASH_START;
+    b->cbs = HASH_START;
+
+    for (i = 0; i < length; i++) {
+        song->used |= pulses[i].set | pulses[i].clr;
+        on  = pulses[i].set & ~song->level;
+        off = pulses[i].clr &  song->level;
+        song->level = (song->level | on) & ~off;
+        for (pin = 0; pin < 32; pin++) {
+            if ((on | off) & (1u<<pin))
+                b->pin[pin] = hash(hash(b->pin[pin], us), (on >> pin) & 1);
+        }
+        us += pulses[i].us;
+    }
+    for (pin = 0; pin < 32; pin++) b->pin[pin] = hash(b->pin[pin], us);
+}
+
+/* Hash the control blocks of a beat, for stub_record_cbs(). */
+static void recordCbs(const stub_cb_t *cbs, unsigned int length, void *arg) {
+    song_t *song = arg;
+    beat_t *b = &song->beat[song->beats-1];
+    unsigned int i;
+
+    for (i = 0; i < length; i++) {
+        b->cbs = hash(b->cbs, cbs[i].ti);
+        b->cbs = hash(b->cbs, cbs[i].source);
+        b->cbs = hash(b->cbs, cbs[i].dest);
+        b->cbs = hash(b->cbs, cbs[i].length);
+        b->cbs = hash(b->cbs, cbs[i].next);
+        b->cbs = hash(b->cbs, cbs[i].word);
+    }
+}
+
+/* Returns the hash of a whole song. */
+static unsigned int songHash(const song_t *song) {
+    unsigned int h = HASH_START, i, pin;
+
+    for (i = 0; i < song->beats; i++) {
+        h = hash(h, song->beat[i].cbs);
+        for (pin = 0; pin < 32; pin++)
+            if (song->pins & (1u<<pin)) h = hash(h, song->beat[i].pin[pin]);
+    }
+    return h;
+}
+
+
+
+/* Write the hashes of a song. Returns 0, or -1 (after printing an error). */
+static int goldenWrite(const char *path, const char *score,
+                       const song_t *song) {
+    FILE *f = fopen(path, "w");
+    unsigned int i, pin;
+
+    if (!f) {
+        fprintf(stderr, "ERROR: goldenWrite(): Could not write %s.\n", path);
+        return -1;
+    }
+    fprintf(f, GOLDEN_MAGIC "\n%s beats %u pins %08x song %08x\n", score,
+            song->beats, song->pins, songHash(song));
+    for (i = 0; i < song->beats; i++) {
+        fprintf(f, "%u %08x", i, song->beat[i].cbs);
+        for (pin = 0; pin < 32; pin++)
+            if (song->pins & (1u<<pin))
+                fprintf(f, " %u:%08x", pin, song->beat[i].pin[pin]);
+        fprintf(f, "\n");
+    }
+    if (fclose(f)) {
+        fprintf(stderr, "ERROR: goldenWrite(): Could not write %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef GOLDEN_OUT
+/* Start hashing every beat sent to the stub driver. */
+static void recordStart(song_t *song) {
+    memset(song, 0, sizeof(song_t));
+    stub_record(recordPins, song);
+    stub_record_cbs(recordCbs, song);
+}
+
+/* Stop hashing and write the hashes to a golden file. The pins of the song
+   are the ones it turned on or off, which for a score file are the pins of
+   its voices. Returns 0, or -1 (after printing an error). */
+static int recordWrite(const char *path, song_t *song) {
+    int result;
+
+    stub_record(NULL, NULL);
+    stub_record_cbs(NULL, NULL);
+    song->pins = song->used;
+    result = goldenWrite(path, path, song);
+    free(song->beat);
+    return result;
+}
+
+/* Play the queue with the stub driver and write the hashes of every beat to
+   a golden file, for songs built with -DGOLDEN_OUT (see player.h).
+   Returns 0, or -1 (after printing an error). */
+int queueGolden(const char *path, unsigned int us, unsigned int beats) {
+    song_t song;
+
+    recordStart(&song);
+#ifdef PATTERN_BEATS
+    queuePlayPatterns(us, beats, PATTERN_BEATS);
+#else
+    /* The parentheses keep queuePlay() from being queueGolden() again */
+    (queuePlay)(us, beats);
+#endif
+    return recordWrite(path, &song);
+}
+
+
+
+#ifdef COMPILED_SONG
+#include COMPILED_SONG
+
+/* Play a compiled song (see compile.h) and write the hashes of every beat to
+   the golden file GOLDEN_OUT. Build with -DCOMPILED_SONG='"song.rpc.h"' and
+   -DCOMPILED_NAME=song, the name of the compiled_t it declares, as
+   "make roundtrip" does. */
+int main(void) {
+    song_t song;
+
+    recordStart(&song);
+    compiledPlay(&COMPILED_NAME);
+    return recordWrite(GOLDEN_OUT, &song) ? 2 : 0;
+}
+#endif
+
+
+
+#else
+/* Read the hashes of a song. Returns 0, or -1 (after printing an error). */
+static int goldenRead(const char *path, song_t *song, unsigned int *whole) {
+    FILE *f = fopen(path, "r");
+    char magic[sizeof(GOLDEN_MAGIC)], name[256];
+    unsigned int i, n, pin, p;
+    beat_t *b;
+
+    memset(song, 0, sizeof(song_t));
+    if (!f || !fgets(magic, sizeof(magic), f) ||
+        strcmp(magic, GOLDEN_MAGIC) ||
+        fscanf(f, "%255s beats %u pins %x song %x", name, &song->beats,
+               &song->pins, whole) != 4) {
+        fprintf(stderr, "ERROR: goldenRead(): %s is not a golden file.\n",
+                path);
+        if (f) fclose(f);
+        return -1;
+    }
+
+    song->size = song->beats;
+    song->beat = calloc(song->beats + 1, sizeof(beat_t));
+    for (i = 0; i < song->beats; i++) {
+        b = &song->beat[i];
+        if (fscanf(f, "%u %x", &n, &b->cbs) != 2 || n != i) break;
+        for (pin = 0; pin < 32; pin++) {
+            if (!(song->pins & (1u<<pin))) continue;
+            if (fscanf(f, " %u:%x", &p, &b->pin[pin]) != 2 || p != pin) break;
+        }
+        if (pin < 32) break;
+    }
+    fclose(f);
+    if (i < song->beats) {
+        fprintf(stderr, "ERROR: goldenRead(): Beat %u of %s cannot be "
+                        "read.\n", i, path);
+        free(song->beat);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+/* Compare a song with its golden hashes, describing where they differ.
+   Returns 0 if they are the same, 1 if not. */
+static int goldenCompare(const char *score, const song_t *song,
+                         const song_t *golden, unsigned int whole) {
+    unsigned int i, pin, pins, differ = 0, first = 0;
+
+    if (songHash(song) == whole && song->beats == golden->beats &&
+        song->pins == golden->pins)
+        return 0;
+
+    if (song->pins != golden->pins)
+        printf("golden: %s: pins %08x, expected %08x\n", score, song->pins,
+               golden->pins);
+    if (song->beats != golden->beats)
+        printf("golden: %s: %u beats, expected %u\n", score, song->beats,
+               golden->beats);
+
+    for (i = 0; i < song->beats && i < golden->beats; i++) {
+        for (pins = 0, pin = 0; pin < 32; pin++)
+            if (song->beat[i].pin[pin] != golden->beat[i].pin[pin] &&
+                ((song->pins | golden->pins) & (1u<<pin)))
+                pins |= 1u<<pin;
+        if (!pins && song->beat[i].cbs == golden->beat[i].cbs) continue;
+
+        if (!differ++) first = i;
+        if (differ > GOLDEN_SHOWN) continue;
+        printf("golden: %s: beat %u:", score, i);
+        if (!pins)
+            printf(" control blocks differ, waveform of every pin is the "
+                   "same\n");
+        else {
+            for (pin = 0; pin < 32; pin++)
+                if (pins & (1u<<pin)) printf(" pin %u", pin);
+            printf(" differ%s\n", song->beat[i].cbs == golden->beat[i].cbs ?
+                                  " (control blocks are the same)" : "");
+        }
+    }
+    printf("golden: %s: %u of %u beats differ", score, differ, song->beats);
+    if (differ) printf(", the first is beat %u", first);
+    printf("; song %08x, expected %08x\n", songHash(song), whole);
+    return 1;
+}
+
+
+
+/* Play a score with the stub driver and hash every beat.
+   Returns 0, or -1 (after printing an error). */
+static int hashScore(const char *score, song_t *song) {
+    score_t s;
+    unsigned int v;
+    int result;
+
+    if (scoreOpen(&s, score)) return -1;
+    memset(song, 0, sizeof(song_t));
+    for (v = 0; v < s.header->voices; v++) song->pins |= 1u<<s.voice[v].pin;
+    scoreClose(&s);
+
+    stub_record(recordPins, song);
+    stub_record_cbs(recordCbs, song);
+    result = queuePlayFile(score);
+    stub_record(NULL, NULL);
+    stub_record_cbs(NULL, NULL);
+    return result;
+}
+
+
+
+/* Check that score files are played exactly as before: every control block
+   sent to DMA, and the word each GPIO command reads, is hashed for each beat,
+   as is what each pin does, and compared with hashes kept in a golden file.
+   Usage: ./golden-score [-w] file.rps file.golden
+   With -w, the golden file is written instead. Build with "make golden",
+   which links the stub driver instead of the real one, so no hardware is
+   used. Addresses of control blocks and commands are made relative to the
+   memory they are in, so the hashes are the same on every run. When the
+   song is not the same, the beats that differ are listed with the pins
+   whose waveform changed, and the exit status is 1. */
+int main(int argc, char **argv) {
+    song_t song, golden;
+    unsigned int whole;
+    int write = argc == 4 && !strcmp(argv[1], "-w"), result;
+
+    if (argc != 3 + write) {
+        fprintf(stderr, "Usage: %s [-w] file.rps file.golden\n", argv[0]);
+        return 2;
+    }
+
+    if (hashScore(argv[1 + write], &song)) return 2;
+    if (write) result = goldenWrite(argv[3], argv[2], &song) ? 2 : 0;
+    else if (goldenRead(argv[2], &golden, &whole)) result = 2;
+    else {
+        result = goldenCompare(argv[1], &song, &golden, whole);
+        if (!result)
+            printf("golden: %s: %u beats, song %08x, the same\n", argv[1],
+                   song.beats, whole);
+        free(golden.beat);
+    }
+    free(song.beat);
+    return result;
+}
+#endif
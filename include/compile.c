@@ -0,0 +1,139 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* compile - Songs compiled ahead of time into tables of wave periods */
+
+#include <stdio.h>     /* fprintf(), fopen(), stderr                          */
+#include <string.h>    /* strrchr()                                           */
+#include <ctype.h>     /* isalnum(), isdigit()                                */
+
+#include "compile.h"
+
+
+
+
+/* Longest variable name written by compileWrite(). */
+#define NAME_MAX_LENGTH 64
+
+
+
+
+/*############################################################################*/
+
+
+/* Encode the waveform of a voice in a beat as a block.
+   out:    Where to write the block. It needs room for 2 + 3*(length+1)/2
+           words.
+   trans:  Transitions, as delays with COMPILED_ON set if the pin turns on.
+   length: Amount of transitions.
+   Returns the amount of words written. */
+unsigned int compileEncode(unsigned int *out, const unsigned int *trans,
+                           unsigned int length) {
+    unsigned int words = 0, i = 0, count, a, b;
+
+    out[words++] = length;
+
+    /* Count how often each pair of transitions repeats */
+    while (i < length) {
+        a = trans[i];
+        b = (i + 1 < length) ? trans[i+1] : 0;
+        for (count = 1, i += 2;
+             i + 1 < length && trans[i] == a && trans[i+1] == b;
+             count++, i += 2);
+        /* A last single transition that is the same as a can join the run */
+        if (i + 1 == length && trans[i] == a) {
+            count++;
+            i++;
+        }
+        out[words++] = count;
+        out[words++] = a;
+        out[words++] = b;
+    }
+
+    return words;
+}
+
+
+/*############################################################################*/
+
+
+/* Write an array of words as C. */
+static void writeArray(FILE *f, const char *name, const char *suffix,
+                       const unsigned int *words, unsigned int length) {
+    unsigned int i;
+    fprintf(f, "static const unsigned int %s_%s[%u] = {", name, suffix,
+            length ? length : 1);
+    for (i = 0; i < length; i++)
+        fprintf(f, "%s0x%x,", (i % 8) ? "" : "\n    ", words[i]);
+    fprintf(f, "%s\n};\n\n", length ? "" : "\n    0");
+}
+
+
+/*############################################################################*/
+
+
+/* Write a compiled song as a C header that declares it as a compiled_t.
+   The variable is named after the file, for example "ex-player.rpc.h"
+   declares "ex_player".
+   path:   Header to write.
+   song:   Song to write.
+   length: Amount of words in song->data.
+   Returns 0 on success, or -1 (after printing an error). */
+int compileWrite(const char *path, const compiled_t *song, unsigned int length) {
+    char name[NAME_MAX_LENGTH];
+    const char *base = strrchr(path, '/');
+    unsigned int i;
+    FILE *f;
+
+    /* Name the variable after the file, up to its first dot */
+    base = base ? base + 1 : path;
+    for (i = 0; base[i] && base[i] != '.' && i < NAME_MAX_LENGTH - 1; i++)
+        name[i] = isalnum((unsigned char)base[i]) ? base[i] : '_';
+    name[i] = 0;
+    if (!i || isdigit((unsigned char)name[0])) {
+        fprintf(stderr, "ERROR: compileWrite(): \"%s\" cannot be used to "
+                        "name a variable.\n", path);
+        return -1;
+    }
+
+    if (!(f = fopen(path, "w"))) {
+        fprintf(stderr, "ERROR: compileWrite(): Cannot write \"%s\".\n", path);
+        return -1;
+    }
+
+    fprintf(f, "/* Compiled song: %u voices, %u beats, %u words. */\n\n"
+               "#pragma once\n\n#include \"include/compile.h\"\n\n",
+            song->voices, song->beats, length);
+    writeArray(f, name, "pins",  song->pins,  song->voices);
+    writeArray(f, name, "index", song->index, song->voices*song->beats);
+    writeArray(f, name, "data",  song->data,  length);
+    fprintf(f, "static const compiled_t %s = {\n"
+               "    %u, %u, %s_pins, %s_index, %s_data\n};\n",
+            name, song->voices, song->beats, name, name, name);
+
+    if (fclose(f)) {
+        fprintf(stderr, "ERROR: compileWrite(): Cannot write \"%s\".\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*############################################################################*/
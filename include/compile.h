@@ -0,0 +1,75 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* compile - Songs compiled ahead of time into tables of wave periods */
+
+#pragma once
+
+#include "player.h"
+
+/* A compiled song contains the waveform of every voice in every beat, as
+   generated by the player, so that playing it needs no floating point maths.
+   Periods are in microseconds, which is the resolution of the player.
+
+   The waveform of a voice in a beat is stored as a block of words in "data":
+   the amount of transitions in the waveform, then runs of three words.
+   A run is a count followed by two transitions, which repeat "count" times
+   (a run may stop after any transition once the waveform is complete).
+   A constant note is therefore stored as a single run. Each transition is a
+   delay in microseconds, with COMPILED_ON set if the pin turns on. */
+
+/* Set in a transition if the pin turns on, clear if it turns off. */
+#define COMPILED_ON 0x80000000U
+
+/* A compiled song, as declared by headers written by compileWrite(). */
+typedef struct compiled_t {
+    unsigned int voices;       /* Amount of voices.                           */
+    unsigned int beats;        /* Amount of beats.                            */
+    const unsigned int *pins;  /* GPIO pin number (BCM) of each voice.        */
+    const unsigned int *index; /* Offset in data of the block of each voice in
+                                  each beat: index[beat*voices + voice].      */
+    const unsigned int *data;  /* Blocks, see above.                          */
+} compiled_t;
+
+/* Play a compiled song. No waveforms are generated: the transitions of each
+   voice are copied from the song and combined.
+   song: Song declared by a header written by queueCompile(). */
+void compiledPlay(const compiled_t *song);
+
+/* The same as compiledPlay(), on player p (see playerNew()). */
+void playerCompiledPlay(player_t *p, const compiled_t *song);
+
+/* Encode the waveform of a voice in a beat as a block (see above).
+   out:    Where to write the block. It needs room for 2 + 3*(length+1)/2
+           words.
+   trans:  Transitions, as delays with COMPILED_ON set if the pin turns on.
+   length: Amount of transitions.
+   Returns the amount of words written. */
+unsigned int compileEncode(unsigned int *out, const unsigned int *trans,
+                           unsigned int length);
+
+/* Write a compiled song as a C header that declares it as a compiled_t.
+   The variable is named after the file, for example "ex-player.rpc.h"
+   declares "ex_player".
+   path:   Header to write.
+   song:   Song to write.
+   length: Amount of words in song->data.
+   Returns 0 on success, or -1 (after printing an error). */
+int compileWrite(const char *path, const compiled_t *song, unsigned int length);
@@ -0,0 +1,61 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* daemon - Commands understood by play-daemon over its Unix domain socket */
+
+#pragma once
+
+/* Socket that play-daemon listens on, unless another one is given. */
+#define DAEMON_SOCKET "/run/rpi-player.sock"
+
+/* Largest score that may be sent (bytes). */
+#define DAEMON_MAX_SCORE (64*1024*1024)
+
+/* Longest command line, including the newline. */
+#define DAEMON_LINE 128
+
+/* Each command is one line of text, and is answered with one line starting
+   with "ok" or "error". A score (the contents of a score file, see score.h)
+   follows its command line directly.
+
+       play <bytes>\n<score>   Stop playing, forget the queue and play the
+                               score. Answer: "ok <job>".
+       queue <bytes>\n<score>  Play the score after the queue (at once if
+                               nothing is playing). Answer: "ok <job>".
+       stop\n                  Stop playing and forget the queue.
+                               Answer: "ok".
+       status\n                Answer: "ok" followed by name=value pairs:
+                               job       Job playing, or 0.
+                               beat      Beats of it sent to DMA.
+                               beats     Beats in it.
+                               queued    Jobs waiting.
+                               played    Jobs finished or stopped.
+                               commands  Commands answered.
+                               cmd_us    Mean and largest time taken to
+                                         answer a command ("mean/max").
+                               start_us  Time from "play" or "queue" until
+                                         the first beat was sent to DMA, for
+                                         jobs started while nothing was
+                                         playing: the last one and largest
+                                         ("last/max"). Jobs that follow
+                                         another are sent to DMA straight
+                                         after it, without a gap.
+
+   Jobs are numbered from 1 in the order they are received. */
@@ -23,11 +23,12 @@
 #define _BSD_SOURCE
 
 #include <stdio.h>     /* fprintf(), stderr                                   */
-#include <stdlib.h>    /* exit()                                              */
+#include <stdlib.h>    /* exit(), malloc(), free()                            */
 #include <fcntl.h>     /* open()                                              */
 #include <unistd.h>    /* close(), usleep()                                   */
 #include <sys/mman.h>  /* mmap(), mlock(), munlock()                          */
 #include <string.h>    /* memset()                                            */
+#include <pthread.h>   /* pthread_mutex_lock(), pthread_mutex_unlock()        */
 #include <sys/ioctl.h> /* ioctl(), _IOWR()                                    */
 
 #include "driver.h"
@@ -35,25 +36,25 @@
 
 
 
-/* DMA channel to use.
-   Only channels 0, 4, 5 and 6 are available for use. */
-static unsigned int dch = 5;
+/* Channel used by the functions that do not take a driver_t. Only channels
+   0, 4, 5 and 6 are available for use. */
+static driver_t dflt = {5, PACER_PWM};
 
 /* These pointers provide access to the part of the memory that contains
    DMA control blocks. */
 cb_t *cbs_v, *cbs_b;
 
-/* This is used to free the memory for the DMA control blocks later. */
-static unsigned int dmah;
-
-/* Length of cbs_v in pages (1 page = 128 control blocks = 4096 bytes). */
-static unsigned int cbs_pages;
+/* DMA channels and pacers in use (1<<n), and the amount of users of the
+   register mappings. Several channels may be set up from different threads. */
+static unsigned int dchUsed, pacerUsed, mapUsers;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* These pointers provide access to the parts of the memory that
    control the GPIO pins and other hardware peripherals. */
 static volatile unsigned int *gpio_reg;  /* GPIO Register          */
 static volatile unsigned int *dma_reg;   /* DMA Register           */
 static volatile unsigned int *pwm_reg;   /* PWM Register           */
+static volatile unsigned int *pcm_reg;   /* PCM Register           */
 static volatile unsigned int *cm_reg;    /* Clock Manager Register */
 
 /* Each register corresponds to
@@ -61,9 +62,9 @@ static volatile unsigned int *cm_reg;    /* Clock Manager Register */
    Each register is an array of 32-bit unsigned integers which
    control certain Raspberry Pi hardware features.
 
-   Info on the GPIO, DMA and PWM registers can be found here:
+   Info on the GPIO, DMA, PWM and PCM registers can be found here:
    https://www.raspberrypi.org/app/uploads/2012/02/BCM2835-ARM-Peripherals.pdf
-   Pages 90, 39 and 141.
+   Pages 90, 39, 141 and 119.
 
    The CM (clock manager) register is undocumented. Info on it is here:
    https://www.scribd.com/doc/127599939/BCM2835-Audio-clocks
@@ -236,7 +237,7 @@ unsigned int vc_create(void **virtAddr, void **busAddr, unsigned int pages) {
 void vc_destroy(unsigned int handle, void *virtAddr, unsigned int pages) {
     int fd = mailbox_open();
     unsigned int size = 4096*pages;
-    mailbox_unmapmem(cbs_v, size);
+    mailbox_unmapmem(virtAddr, size);
     mailbox_unlock(fd, handle);
     mailbox_free(fd, handle);
     mailbox_close(fd);
@@ -250,9 +251,14 @@ void vc_destroy(unsigned int handle, void *virtAddr, unsigned int pages) {
    You can also set to
    ALT0 (4), ALT1 (5), ALT2 (6), ALT3 (7), ALT4 (3) or ALT5 (2). */
 void gpio_mode(int pin, int mode) {
+    unsigned int fsel;
+
+    /* Ten pins share each word, and several channels may be playing */
+    pthread_mutex_lock(&lock);
+
     /* Record the 32-bit integer from GPIO_FSEL in the
        GPIO register that contains the pin's state */
-    unsigned int fsel = gpio_reg[GPIO_FSEL + pin/10];
+    fsel = gpio_reg[GPIO_FSEL + pin/10];
 
     /* Replace the pin's corresponding three bits with the desired mode: */
     /* Set all of the three bits to 0 first, using a bitwise AND */
@@ -262,6 +268,8 @@ void gpio_mode(int pin, int mode) {
 
     /* Write the modified pin mode to GPIO_FSEL in the GPIO register */
     gpio_reg[GPIO_FSEL + pin/10] = fsel;
+
+    pthread_mutex_unlock(&lock);
 }
 
 
@@ -308,7 +316,7 @@ int gpio_read(int pin) {
 /* Set DMA channel to use. You can use channel 0, 4, 5 or 6. Default 5.
    Run this before driver_setup(). */
 void set_dmach(int dmach) {
-    dch = dmach;
+    dflt.dch = dmach;
 }
 
 
@@ -317,7 +325,7 @@ void set_dmach(int dmach) {
 
 /* Get maximum length (in bytes) of cbs_v. */
 unsigned int cbs_len(void) {
-    return 4096*cbs_pages;
+    return 4096*dflt.pages;
 }
 
 
@@ -327,9 +335,50 @@ unsigned int cbs_len(void) {
 /* Start DMA.
    index: The index of the first DMA control block to load from cbs_v. */
 void activate_dma(unsigned int index) {
+    driver_activate_dma(&dflt, index);
+}
+
+
+/*############################################################################*/
+
+
+/* Stop DMA. This is called automatically with driver_cleanup(). */
+void stop_dma(void) {
+    driver_stop_dma(&dflt);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns 1 if DMA is active, otherwise returns 0. */
+int dma_running(void) {
+    return driver_dma_running(&dflt);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the index of the DMA control block currently being output. */
+unsigned int dma_current_cb(void) {
+    return driver_dma_current_cb(&dflt);
+}
+
+
+/*############################################################################*/
+
+
+/* Start DMA on a channel.
+   index: The index of the first DMA control block to load from its cbs_v. */
+void driver_activate_dma(driver_t *driver, unsigned int index) {
+    unsigned int dch = driver->dch;
+
     /* Make sure DMA channel is enabled by
        writing the corresponding bit in DMA_ENABLE in the DMA register to 1 */
+    pthread_mutex_lock(&lock);
     dma_reg[DMA_ENABLE] |= 1 << dch;
+    pthread_mutex_unlock(&lock);
 
     /* Stop DMA, if it was already started */
     dma_reg[DMACH(dch) + DMA_CS] = DMA_CS_RESET;
@@ -339,7 +388,7 @@ void activate_dma(unsigned int index) {
                                    DMA_CS_END;   /* Transmission ended flag */
 
     /* Set the bus address of the control block to load */
-    dma_reg[DMACH(dch) + DMA_CONBLK_AD] = (unsigned int)&cbs_b[index];
+    dma_reg[DMACH(dch) + DMA_CONBLK_AD] = (unsigned int)&driver->cbs_b[index];
 
     /* Clear any DMA errors from previous transmissions */
     dma_reg[DMACH(dch) + DMA_DEBUG] = DMA_DEBUG_FIFO_ERROR |
@@ -357,27 +406,73 @@ void activate_dma(unsigned int index) {
 /*############################################################################*/
 
 
-/* Stop DMA. This is called automatically with driver_cleanup(). */
-void stop_dma(void) {
-    dma_reg[DMACH(dch) + DMA_CS] = DMA_CS_RESET;
+/* Stop DMA on a channel. */
+void driver_stop_dma(driver_t *driver) {
+    dma_reg[DMACH(driver->dch) + DMA_CS] = DMA_CS_RESET;
 }
 
 
 /*############################################################################*/
 
 
-/* Returns 1 if DMA is active, otherwise returns 0. */
-int dma_running(void) {
-    return !!(dma_reg[DMACH(dch) + DMA_CS] & DMA_CS_ACTIVE);
+/* Returns 1 if DMA is active on a channel, otherwise returns 0. */
+int driver_dma_running(driver_t *driver) {
+    return !!(dma_reg[DMACH(driver->dch) + DMA_CS] & DMA_CS_ACTIVE);
 }
 
 
 /*############################################################################*/
 
 
-/* Returns the index of the DMA control block currently being output. */
-unsigned int dma_current_cb(void) {
-    return (dma_reg[DMACH(dch) + DMA_CONBLK_AD] - (int)cbs_b) / sizeof(cb_t);
+/* Returns the index of the control block a channel is currently at. */
+unsigned int driver_dma_current_cb(driver_t *driver) {
+    return (dma_reg[DMACH(driver->dch) + DMA_CONBLK_AD] - (int)driver->cbs_b)
+           / sizeof(cb_t);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the contents of DMA_DEBUG for the DMA channel in use.
+   Mask with DMA_DEBUG_READ_NOT_LAST_SET_ERROR, DMA_DEBUG_FIFO_ERROR or
+   DMA_DEBUG_READ_ERROR to check for individual errors. */
+unsigned int dma_debug(void) {
+    return dma_reg[DMACH(dflt.dch) + DMA_DEBUG];
+}
+
+
+/*############################################################################*/
+
+
+/* Clear error flags in DMA_DEBUG for the DMA channel in use.
+   flags: Any combination of the DMA_DEBUG_* error flags. */
+void dma_debug_clear(unsigned int flags) {
+    /* Error flags in DMA_DEBUG are cleared by writing 1 to them */
+    dma_reg[DMACH(dflt.dch) + DMA_DEBUG] = flags;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the contents of PWM_STA.
+   Mask with PWM_STA_WERR, PWM_STA_RERR, PWM_STA_GAPO or PWM_STA_BERR to check
+   for individual errors. */
+unsigned int pwm_status(void) {
+    return pwm_reg[PWM_STA];
+}
+
+
+/*############################################################################*/
+
+
+/* Clear error flags in PWM_STA.
+   flags: Any combination of PWM_STA_WERR, PWM_STA_RERR, PWM_STA_GAPO and
+          PWM_STA_BERR. */
+void pwm_status_clear(unsigned int flags) {
+    /* Error flags in PWM_STA are cleared by writing 1 to them */
+    pwm_reg[PWM_STA] = flags;
 }
 
 
@@ -396,67 +491,80 @@ unsigned int periph(unsigned int base, unsigned int offset) {
 /*############################################################################*/
 
 
-/* Setup. Run before other functions.
-   dmaPages: Amount of pages to allocate for cbs_v.
-             Each page allows for 128 more control blocks in cbs_v.
-             Set this to 0 if you are not planning to use DMA.
-             A reminder that one page is 4096 bytes.
-             Try not to allocate more than 4096 pages (16 MiB) of memory. */
-void driver_setup(unsigned int dmaPages) {
+/* Map the registers, unless another channel has already done so.
+   Run with lock held. */
+static void registers_map(void) {
+    if (mapUsers++) return;
+
     /* Map certain parts of the Raspberry Pi's memory to virtual memory. */
     dma_reg   = (unsigned int *)memory_map(DMA_BASE,  1);
     pwm_reg   = (unsigned int *)memory_map(PWM_BASE,  1);
+    pcm_reg   = (unsigned int *)memory_map(PCM_BASE,  1);
     cm_reg    = (unsigned int *)memory_map(CM_BASE,   1);
     gpio_reg  = (unsigned int *)memory_map(GPIO_BASE, 1);
+}
 
-    cbs_pages = 0;
-
-    if (dmaPages) {
-        cbs_pages = dmaPages;
-
-        /* Stop DMA */
-        stop_dma();
 
-        /* Allocate pages for DMA control blocks */
-        dmah = vc_create((void **)&cbs_v, (void **)&cbs_b, cbs_pages);
-    }
+/*############################################################################*/
 
 
+/* Unmap the registers, unless another channel still uses them.
+   Run with lock held. */
+static void registers_unmap(void) {
+    if (--mapUsers) return;
 
-    /* Now we need to start and configure the PWM clock so that we may
-       use it for accurate DMA delays. */
+    munmap((void *)dma_reg,  4096);
+    munmap((void *)pwm_reg,  4096);
+    munmap((void *)pcm_reg,  4096);
+    munmap((void *)cm_reg,   4096);
+    munmap((void *)gpio_reg, 4096);
+}
 
 
+/*############################################################################*/
 
-    /* Disable PWM */
-    pwm_reg[PWM_CTL] &= (~PWM_CTL_PWEN1);
-    pwm_reg[PWM_CTL] &= (~PWM_CTL_PWEN2);
 
-    /* Disable the PWM clock by turning off the ENAB bit in CM_PWMCTL */
-    cm_reg[CM_PWMCTL] = CM_PASSWD | (cm_reg[CM_PWMCTL] & (~CM_CTL_ENAB));
+/* Start a clock at 10 MHz.
+   ctl, div: Its control and divisor registers in the Clock Manager register
+             (CM_PWMCTL and CM_PWMDIV, or CM_PCMCTL and CM_PCMDIV). */
+static void clock_setup(unsigned int ctl, unsigned int div) {
+    /* Disable the clock by turning off the ENAB bit in its control register */
+    cm_reg[ctl] = CM_PASSWD | (cm_reg[ctl] & (~CM_CTL_ENAB));
 
-    /* Wait until the BUSY bit in CM_PWMCTL is off
-      (wait until clock turns off) */
-    if (cm_reg[CM_PWMCTL] & CM_CTL_BUSY) {
+    /* Wait until the BUSY bit is off (wait until clock turns off) */
+    if (cm_reg[ctl] & CM_CTL_BUSY) {
         do {
-            cm_reg[CM_PWMCTL] = CM_PASSWD | CM_CTL_KILL;
-        } while (cm_reg[CM_PWMCTL] & CM_CTL_BUSY);
+            cm_reg[ctl] = CM_PASSWD | CM_CTL_KILL;
+        } while (cm_reg[ctl] & CM_CTL_BUSY);
     }
 
     /* Set clock source to source 6 "PLLD" (constant 500 MHz clock source) */
-    cm_reg[CM_PWMCTL] = CM_PASSWD | CM_CTL_SRC(6);
+    cm_reg[ctl] = CM_PASSWD | CM_CTL_SRC(6);
     usleep(10);
 
     /* Set clock divisor to 50 (500 MHz / 50 = 10 MHz) */
-    cm_reg[CM_PWMDIV] = CM_PASSWD | CM_DIV_DIVI(50);
+    cm_reg[div] = CM_PASSWD | CM_DIV_DIVI(50);
     usleep(10);
 
     /* Enable clock */
-    cm_reg[CM_PWMCTL] |= CM_PASSWD | CM_CTL_ENAB;
+    cm_reg[ctl] |= CM_PASSWD | CM_CTL_ENAB;
+
+    /* Wait until the BUSY bit is on (wait until clock turns on) */
+    do {} while ((cm_reg[ctl] & CM_CTL_BUSY) == 0);
+}
+
+
+/*############################################################################*/
+
+
+/* Start and configure PWM so that we may use it for accurate DMA delays. */
+static void pwm_setup(void) {
+    /* Disable PWM */
+    pwm_reg[PWM_CTL] &= (~PWM_CTL_PWEN1);
+    pwm_reg[PWM_CTL] &= (~PWM_CTL_PWEN2);
 
-    /* Wait until the BUSY bit in CM_PWMCTL is on
-      (wait until clock turns on) */
-    do {} while ((cm_reg[CM_PWMCTL] & CM_CTL_BUSY) == 0);
+    /* Start the PWM clock */
+    clock_setup(CM_PWMCTL, CM_PWMDIV);
 
     /* Reset PWM */
     pwm_reg[PWM_CTL] = 0;   /* Set every bit in PWM_CTL to 0 */
@@ -485,21 +593,181 @@ void driver_setup(unsigned int dmaPages) {
 /*############################################################################*/
 
 
-/* Cleanup. Run at end. */
-void driver_cleanup(void) {
-    if (cbs_pages) {
+/* Start and configure PCM in the same way, for a second DMA channel. */
+static void pcm_setup(void) {
+    /* Disable PCM */
+    pcm_reg[PCM_CS] = 0;
+    usleep(10);
+
+    /* Start the PCM clock */
+    clock_setup(CM_PCMCTL, CM_PCMDIV);
+
+    /* Set frame length to 10 bits (10 MHz / 10 = 1 MHz), with one word of
+       10 bits in each frame.
+       1 MHz => 1 microsecond delay per 32-bit word written to FIFO */
+    pcm_reg[PCM_CS]   = PCM_CS_EN;
+    pcm_reg[PCM_MODE] = PCM_MODE_FLEN(9);
+    pcm_reg[PCM_TXC]  = PCM_TXC_CH1EN | PCM_TXC_CH1WID(2);
+    pcm_reg[PCM_CS]  |= PCM_CS_STBY;
+    usleep(1000);
+
+    /* Clear FIFO */
+    pcm_reg[PCM_CS]  |= PCM_CS_TXCLR;
+    usleep(10);
+
+    /* Enable sending DREQ signal to DMA */
+    pcm_reg[PCM_DREQ]   = PCM_DREQ_TX(15) | PCM_DREQ_TX_PANIC(15);
+    pcm_reg[PCM_INTSTC] = 15;  /* Clear every interrupt flag */
+    pcm_reg[PCM_CS]    |= PCM_CS_DMAEN;
+    usleep(10);
+
+    /* Start transmitting */
+    pcm_reg[PCM_CS]  |= PCM_CS_TXON;
+}
+
+
+/*############################################################################*/
+
+
+/* Stop a channel, allocate its control blocks and start its pacer.
+   Run with lock held. */
+static void channel_setup(driver_t *driver, unsigned int dmaPages) {
+    if (driver->pacer == PACER_PCM) {
+        driver->permap = DREQ_PCM_TX;
+        driver->fifo   = periph(PCM_BASE, PCM_FIFO);
+    } else {
+        driver->permap = DREQ_PWM;
+        driver->fifo   = periph(PWM_BASE, PWM_FIF1);
+    }
+
+    driver->pages = 0;
+
+    if (dmaPages) {
+        driver->pages = dmaPages;
+
         /* Stop DMA */
-        stop_dma();
+        driver_stop_dma(driver);
+
+        /* Allocate pages for DMA control blocks */
+        driver->handle = vc_create((void **)&driver->cbs_v,
+                                   (void **)&driver->cbs_b, driver->pages);
+    }
+
+    if (driver->pacer == PACER_PCM) pcm_setup();
+    else pwm_setup();
+}
+
+
+/*############################################################################*/
+
+
+/* Stop a channel and free its control blocks. Run with lock held. */
+static void channel_cleanup(driver_t *driver) {
+    if (driver->pages) {
+        /* Stop DMA */
+        driver_stop_dma(driver);
 
         /* Release DMA control blocks */
-        vc_destroy(dmah, cbs_v, cbs_pages);
+        vc_destroy(driver->handle, driver->cbs_v, driver->pages);
+        driver->pages = 0;
     }
 
-    /* Unmap registers */
-    munmap((void *)dma_reg,  4096);
-    munmap((void *)pwm_reg,  4096);
-    munmap((void *)cm_reg,   4096);
-    munmap((void *)gpio_reg, 4096);
+    dchUsed   &= ~(1 << driver->dch);
+    pacerUsed &= ~(1 << driver->pacer);
+}
+
+
+/*############################################################################*/
+
+
+/* Setup. Run before other functions.
+   dmaPages: Amount of pages to allocate for cbs_v.
+             Each page allows for 128 more control blocks in cbs_v.
+             Set this to 0 if you are not planning to use DMA.
+             A reminder that one page is 4096 bytes.
+             Try not to allocate more than 4096 pages (16 MiB) of memory. */
+void driver_setup(unsigned int dmaPages) {
+    pthread_mutex_lock(&lock);
+    registers_map();
+
+    if ((dchUsed & (1 << dflt.dch)) || (pacerUsed & (1 << PACER_PWM)))
+        fprintf(stderr, "ERROR: driver_setup(): DMA channel %u or PWM is "
+                        "already in use by driver_open().\n", dflt.dch);
+    dchUsed   |= 1 << dflt.dch;
+    pacerUsed |= 1 << PACER_PWM;
+
+    channel_setup(&dflt, dmaPages);
+    cbs_v = dflt.cbs_v;
+    cbs_b = dflt.cbs_b;
+
+    pthread_mutex_unlock(&lock);
+}
+
+
+/*############################################################################*/
+
+
+/* Cleanup. Run at end. */
+void driver_cleanup(void) {
+    pthread_mutex_lock(&lock);
+    channel_cleanup(&dflt);
+    registers_unmap();
+    pthread_mutex_unlock(&lock);
+}
+
+
+/*############################################################################*/
+
+
+/* Setup a DMA channel of its own, for playing on several channels at once.
+   dmach:    DMA channel to use (0, 4, 5 or 6).
+   pacer:    PACER_PWM or PACER_PCM.
+   dmaPages: Amount of pages to allocate for the control blocks.
+   Returns the channel, or NULL if the channel or pacer is already in use. */
+driver_t *driver_open(int dmach, int pacer, unsigned int dmaPages) {
+    driver_t *driver;
+
+    pthread_mutex_lock(&lock);
+    if ((dchUsed & (1 << dmach)) || (pacerUsed & (1 << pacer))) {
+        pthread_mutex_unlock(&lock);
+        fprintf(stderr, "ERROR: driver_open(): DMA channel %d or its pacer is "
+                        "already in use.\n", dmach);
+        return NULL;
+    }
+    dchUsed   |= 1 << dmach;
+    pacerUsed |= 1 << pacer;
+    registers_map();
+
+    driver = malloc(sizeof(driver_t));
+    memset(driver, 0, sizeof(*driver));
+    driver->dch   = dmach;
+    driver->pacer = pacer;
+    channel_setup(driver, dmaPages);
+
+    pthread_mutex_unlock(&lock);
+    return driver;
+}
+
+
+/*############################################################################*/
+
+
+/* Stop DMA on a channel from driver_open() and free it. */
+void driver_close(driver_t *driver) {
+    pthread_mutex_lock(&lock);
+    channel_cleanup(driver);
+    registers_unmap();
+    pthread_mutex_unlock(&lock);
+    free(driver);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the channel used by the functions that do not take a driver_t. */
+driver_t *driver_default(void) {
+    return &dflt;
 }
 
 
@@ -59,6 +59,7 @@ where X is 1 (for Pi1/Pi0) or 2 (for Pi2/Pi3) or 3 (for Pi4)."
 #define CM_BASE    (PHYS | 0x00101000)
 #define GPIO_BASE  (PHYS | 0x00200000)
 #define PWM_BASE   (PHYS | 0x0020C000)
+#define PCM_BASE   (PHYS | 0x00203000)
 
 /* These are the relative offsets for
    various locations of interest within registers.
@@ -81,6 +82,12 @@ where X is 1 (for Pi1/Pi0) or 2 (for Pi2/Pi3) or 3 (for Pi4)."
 #define PWM_FIF1      6        /* PWM Register, PWM FIFO Input                */
 #define PWM_RNG2      8        /* PWM Register, PWM Channel 2 Range           */
 #define PWM_DAT2      9        /* PWM Register, PWM Channel 2 Data            */
+#define PCM_CS        0        /* PCM Register, Control and Status            */
+#define PCM_FIFO      1        /* PCM Register, FIFO Data                     */
+#define PCM_MODE      2        /* PCM Register, Mode                          */
+#define PCM_TXC       4        /* PCM Register, Transmit Configuration        */
+#define PCM_DREQ      5        /* PCM Register, DMA Request Level             */
+#define PCM_INTSTC    7        /* PCM Register, Interrupt Status and Clear    */
 #define CM_PCMCTL     38       /* CM Register, PCM Clock Control              */
 #define CM_PCMDIV     39       /* CM Register, PCM Clock Divisor              */
 #define CM_PWMCTL     40       /* CM Register, PWM Clock Control              */
@@ -117,6 +124,18 @@ where X is 1 (for Pi1/Pi0) or 2 (for Pi2/Pi3) or 3 (for Pi4)."
 #define PWM_DMAC_PANIC(n) ((255&(n))<<8) /* Read and Write                    */
 #define PWM_DMAC_ENAB            (1<<31) /* Read and Write                    */
 
+/* Commands that may be sent to PCM.         Field type: */
+#define PCM_CS_EN                     (1<<0) /* Read and Write                */
+#define PCM_CS_TXON                   (1<<2) /* Read and Write                */
+#define PCM_CS_TXCLR                  (1<<3) /* Write 1 to activate           */
+#define PCM_CS_DMAEN                  (1<<9) /* Read and Write                */
+#define PCM_CS_STBY                  (1<<25) /* Read and Write                */
+#define PCM_MODE_FLEN(n)    ((1023&(n))<<10) /* Read and Write                */
+#define PCM_TXC_CH1WID(n)     ((15&(n))<<16) /* Read and Write                */
+#define PCM_TXC_CH1EN                (1<<30) /* Read and Write                */
+#define PCM_DREQ_TX(n)        ((127&(n))<<8) /* Read and Write                */
+#define PCM_DREQ_TX_PANIC(n) ((127&(n))<<24) /* Read and Write                */
+
 /* All writes to the Clock Manager register require bitwise OR with this passwd.
    The Clock Manager register must be undocumented for a good reason. */
                               /* Field type: */
@@ -141,6 +160,10 @@ where X is 1 (for Pi1/Pi0) or 2 (for Pi2/Pi3) or 3 (for Pi4)."
 #define CB_NO_WIDE_BURSTS   (1<<26)
 #define TIBASE              (CB_NO_WIDE_BURSTS | CB_WAIT_RESP)
 
+/* DREQ signals of peripherals, for CB_PERMAP(). */
+#define DREQ_PCM_TX  2
+#define DREQ_PWM     5
+
 /* Type for control blocks. */
 typedef struct cb_t {
     unsigned int ti;        /* Transfer Information                           */
@@ -157,6 +180,25 @@ typedef struct cb_t {
    DMA control blocks. */
 extern cb_t *cbs_v, *cbs_b;
 
+/* Peripherals that can time the delays of a DMA channel. Each one can only
+   time one channel at once, as a channel waits for room in its FIFO. */
+#define PACER_PWM 0
+#define PACER_PCM 1
+
+/* Type for a DMA channel with control blocks of its own, for using several
+   channels at once (see driver_open()). */
+typedef struct driver_t {
+    unsigned int dch;       /* DMA channel.                                   */
+    int pacer;              /* PACER_PWM or PACER_PCM.                        */
+    unsigned int permap;    /* DREQ of the pacer, for CB_PERMAP().            */
+    unsigned int fifo;      /* Address of the pacer's FIFO, for DMA. Delay
+                               control blocks write one word to it per
+                               microsecond.                                   */
+    cb_t *cbs_v, *cbs_b;    /* Control blocks, as cbs_v and cbs_b.            */
+    unsigned int pages;     /* Length of cbs_v in pages.                      */
+    unsigned int handle;    /* Return value of vc_create().                   */
+} driver_t;
+
 /* Setup. Run before other functions.
    dmaPages: Amount of pages to allocate for cbs_v.
              Each page allows for 128 more control blocks in cbs_v.
@@ -168,6 +210,22 @@ void driver_setup(unsigned int dmaPages);
 /* Cleanup. Run at end. */
 void driver_cleanup(void);
 
+/* Setup a DMA channel of its own, for playing on several channels at once.
+   This does not need driver_setup(), and the functions that do not take a
+   driver_t do not use it.
+   dmach:    DMA channel to use (0, 4, 5 or 6).
+   pacer:    PACER_PWM or PACER_PCM. driver_setup() uses PACER_PWM.
+   dmaPages: Amount of pages to allocate for the control blocks.
+   Returns the channel, or NULL if the channel or pacer is already in use. */
+driver_t *driver_open(int dmach, int pacer, unsigned int dmaPages);
+
+/* Stop DMA on a channel from driver_open() and free it. */
+void driver_close(driver_t *driver);
+
+/* Returns the channel used by the functions that do not take a driver_t, once
+   driver_setup() has been run. */
+driver_t *driver_default(void);
+
 /* Set pin mode to IN (0) or OUT (1). */
 /* You can also set to */
 /* ALT0 (4), ALT1 (5), ALT2 (6), ALT3 (7), ALT4 (3) or ALT5 (2). */
@@ -231,8 +289,34 @@ int dma_running(void);
 /* Returns the index of the DMA control block currently being output. */
 unsigned int dma_current_cb(void);
 
+/* The same as activate_dma(), stop_dma(), dma_running() and dma_current_cb(),
+   for a channel from driver_open() or driver_default(). */
+void driver_activate_dma(driver_t *driver, unsigned int index);
+void driver_stop_dma(driver_t *driver);
+int driver_dma_running(driver_t *driver);
+unsigned int driver_dma_current_cb(driver_t *driver);
+
+/* Returns the contents of DMA_DEBUG for the DMA channel in use.
+   Mask with DMA_DEBUG_READ_NOT_LAST_SET_ERROR, DMA_DEBUG_FIFO_ERROR or
+   DMA_DEBUG_READ_ERROR to check for individual errors. */
+unsigned int dma_debug(void);
+
+/* Clear error flags in DMA_DEBUG for the DMA channel in use.
+   flags: Any combination of the DMA_DEBUG_* error flags. */
+void dma_debug_clear(unsigned int flags);
+
+/* Returns the contents of PWM_STA.
+   Mask with PWM_STA_WERR, PWM_STA_RERR, PWM_STA_GAPO or PWM_STA_BERR to check
+   for individual errors. */
+unsigned int pwm_status(void);
+
+/* Clear error flags in PWM_STA.
+   flags: Any combination of PWM_STA_WERR, PWM_STA_RERR, PWM_STA_GAPO and
+          PWM_STA_BERR. */
+void pwm_status_clear(unsigned int flags);
+
 /* Get the physical address of a peripheral register location, for DMA purposes.
-   base: One of DMA_BASE, CM_BASE, GPIO_BASE, PWM_BASE.
+   base: One of DMA_BASE, CM_BASE, GPIO_BASE, PWM_BASE, PCM_BASE.
    offset: Offset in 32-bit words (for example GPIO_SET or DMA_CS or PWM_FIF1).
 */
 unsigned int periph(unsigned int base, unsigned int offset);
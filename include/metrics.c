@@ -0,0 +1,180 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* metrics - Counters of the song being played, kept in POSIX shared memory
+             so that other programs can watch them */
+
+#define _BSD_SOURCE
+
+#include <stdio.h>     /* fprintf(), stderr                                   */
+#include <string.h>    /* memset(), memcpy()                                  */
+#include <fcntl.h>     /* O_CREAT, O_RDWR, O_RDONLY                           */
+#include <unistd.h>    /* ftruncate(), close(), getpid()                      */
+#include <sys/mman.h>  /* shm_open(), shm_unlink(), mmap(), munmap()          */
+
+#include "metrics.h"
+
+/* Times metrics_read() tries to copy the counters before giving up. */
+#define METRICS_TRIES 1000
+
+
+
+
+/*############################################################################*/
+
+
+/* Make shared memory for the counters. */
+metrics_t *metrics_create(const char *name) {
+    metrics_t *m;
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+
+    if (fd < 0 || ftruncate(fd, sizeof(metrics_t))) {
+        fprintf(stderr, "ERROR: metrics_create(): Could not make shared "
+                        "memory %s.\n", name);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    m = mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+             0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        fprintf(stderr, "ERROR: metrics_create(): Could not map shared "
+                        "memory %s.\n", name);
+        return NULL;
+    }
+
+    /* Readers see the header last, once the rest is 0 */
+    m->magic = 0;
+    __sync_synchronize();
+    memset(m, 0, sizeof(metrics_t));
+    m->version = METRICS_VERSION;
+    m->pid     = getpid();
+    __sync_synchronize();
+    m->magic   = METRICS_MAGIC;
+    return m;
+}
+
+
+/*############################################################################*/
+
+
+/* Remove shared memory made by metrics_create(). */
+void metrics_destroy(metrics_t *m, const char *name) {
+    munmap(m, sizeof(metrics_t));
+    shm_unlink(name);
+}
+
+
+/*############################################################################*/
+
+
+/* Start writing the counters: readers that copy them from now on try again. */
+void metrics_write_begin(metrics_t *m) {
+    m->seq++;
+    __sync_synchronize();
+}
+
+
+/*############################################################################*/
+
+
+/* Finish writing the counters. */
+void metrics_write_end(metrics_t *m) {
+    __sync_synchronize();
+    m->seq++;
+}
+
+
+/*############################################################################*/
+
+
+/* Attach to shared memory made by a player, to read it. */
+const metrics_t *metrics_attach(const char *name) {
+    metrics_t *m;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: metrics_attach(): No shared memory %s, is a "
+                        "player publishing it?\n", name);
+        return NULL;
+    }
+    m = mmap(NULL, sizeof(metrics_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        fprintf(stderr, "ERROR: metrics_attach(): Could not map shared "
+                        "memory %s.\n", name);
+        return NULL;
+    }
+    if (m->magic != METRICS_MAGIC || m->version != METRICS_VERSION) {
+        fprintf(stderr, "ERROR: metrics_attach(): %s is not from this version "
+                        "of the player.\n", name);
+        munmap(m, sizeof(metrics_t));
+        return NULL;
+    }
+    return m;
+}
+
+
+/*############################################################################*/
+
+
+/* Detach from shared memory attached by metrics_attach(). */
+void metrics_detach(const metrics_t *m) {
+    munmap((void *)m, sizeof(metrics_t));
+}
+
+
+/*############################################################################*/
+
+
+/* Copy the counters, trying again if they were written meanwhile. */
+int metrics_read(const metrics_t *m, metrics_t *out) {
+    unsigned int seq, i;
+
+    for (i = 0; i < METRICS_TRIES; i++) {
+        seq = m->seq;
+        __sync_synchronize();
+        if (seq & 1) continue;
+        memcpy(out, (const void *)m, sizeof(metrics_t));
+        __sync_synchronize();
+        if (m->seq == seq) return 0;
+    }
+    return -1;
+}
+
+
+/*############################################################################*/
+
+
+/* Find a percentile of the generation times from the histogram. */
+unsigned long metrics_percentile(const metrics_t *m, double percent) {
+    unsigned long seen = 0;
+    double want = m->genBeats*percent/100;
+    unsigned int i;
+
+    if (!m->genBeats) return 0;
+    for (i = 0; i < METRICS_BUCKETS-1; i++) {
+        seen += m->genHist[i];
+        if (seen >= want) break;
+    }
+    /* No time in the bucket is more than the longest */
+    return i < METRICS_BUCKETS-1 && 1UL<<i < m->genMaxUs ? 1UL<<i
+                                                         : m->genMaxUs;
+}
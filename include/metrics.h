@@ -0,0 +1,111 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+
+/* metrics - Counters of the song being played, kept in POSIX shared memory
+             so that other programs can watch them */
+
+#pragma once
+
+#include "telemetry.h"  /* TM_CLASSES */
+
+/* Shared memory used by play-daemon and by play-metrics when none is given. */
+#define METRICS_NAME "/rpi-player"
+
+/* First word of the shared memory, and the version of metrics_t. */
+#define METRICS_MAGIC   0x52504D53
+#define METRICS_VERSION 1
+
+/* Buckets of the histogram of generation times. Bucket 0 counts beats that
+   took less than 1 us, bucket i (from 1) beats that took 2^(i-1) to 2^i us
+   and the last one beats that took longer. */
+#define METRICS_BUCKETS 20
+
+/* Counters in the shared memory. They are written by one thread, once for
+   every beat sent to DMA, with a sequence lock: seq is odd while they are
+   being written, so a reader copies them and tries again if seq was odd or
+   changed meanwhile (see metrics_read()). The writer never waits, and makes
+   no system calls. */
+typedef struct metrics_t {
+    unsigned int magic;        /* METRICS_MAGIC.                              */
+    unsigned int version;      /* METRICS_VERSION.                            */
+    volatile unsigned int seq; /* Sequence lock.                              */
+    int pid;                   /* Process of the player.                      */
+
+    unsigned int playing;      /* 1 while a song is playing.                  */
+    unsigned long songs;       /* Songs started.                              */
+    unsigned int beat;         /* Beats of the song sent to DMA.              */
+    unsigned int total;        /* Beats of the song (0 if not known).         */
+    unsigned long beats;       /* Beats sent to DMA altogether.               */
+
+    unsigned int ringFill;     /* Beats waiting in the pipeline.              */
+    unsigned int ringDepth;    /* Slots of the pipeline (0 without one).      */
+    unsigned long ringUs;      /* Microseconds of sound in the pipeline.      */
+
+    unsigned long dmaStartUs;  /* When DMA was last started (trace_now()).    */
+    unsigned long dmaSentUs;   /* Microseconds of sound sent to it since. The
+                                  slack is dmaStartUs + dmaSentUs - now.      */
+    unsigned long underruns;   /* Beats sent after DMA had run out.           */
+    unsigned long cbs;         /* Control blocks written.                     */
+
+    unsigned long genBeats;    /* Beats whose generation was timed (only with
+                                  -DTIMING=1 or -DTRACE=1).                   */
+    unsigned long genMaxUs;    /* Longest generation of a beat.               */
+    unsigned long genHist[METRICS_BUCKETS]; /* See METRICS_BUCKETS.           */
+
+    unsigned long errors[TM_CLASSES]; /* Telemetry (DMA and PWM errors) of
+                                         the default channel.                 */
+    unsigned long patternHits;   /* Patterns spliced from the cache.          */
+    unsigned long patternMisses; /* Patterns generated.                       */
+    unsigned int qosLevel;     /* Quality of service level (see qosEnable()). */
+} metrics_t;
+
+/* Make shared memory for the counters, or take over memory of that name left
+   by a player that has stopped.
+   name: Name of the shared memory (a slash followed by a name).
+   Returns the counters, all 0 but for the header, or NULL (after printing an
+   error). */
+metrics_t *metrics_create(const char *name);
+
+/* Remove shared memory made by metrics_create(). Readers still attached keep
+   the counters as they were last written. */
+void metrics_destroy(metrics_t *m, const char *name);
+
+/* Start and finish writing the counters. Only one thread may write them at
+   once. */
+void metrics_write_begin(metrics_t *m);
+void metrics_write_end(metrics_t *m);
+
+/* Attach to shared memory made by a player, to read it.
+   Returns the counters, or NULL (after printing an error). */
+const metrics_t *metrics_attach(const char *name);
+
+/* Detach from shared memory attached by metrics_attach(). */
+void metrics_detach(const metrics_t *m);
+
+/* Copy the counters, all written at once.
+   Returns 0, or -1 if they were being written every time they were tried. */
+int metrics_read(const metrics_t *m, metrics_t *out);
+
+/* Find a percentile of the generation times from the histogram.
+   percent: 0 to 100.
+   Returns the top of the bucket it is in (microseconds) or the longest time,
+   whichever is less, or 0 if no beat has been timed. */
+unsigned long metrics_percentile(const metrics_t *m, double percent);
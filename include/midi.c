@@ -0,0 +1,482 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* midi - Streaming Standard MIDI File reader */
+
+#define _BSD_SOURCE
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>     /* fprintf(), stderr                                   */
+#include <stdlib.h>    /* malloc(), free()                                    */
+#include <string.h>    /* memset(), memcmp()                                  */
+#include <unistd.h>    /* read(), pread()                                     */
+#include <math.h>      /* pow()                                               */
+
+#include "midi.h"
+
+
+
+
+/* MIDI channel used for percussion, which has no pitch and is not played. */
+#define DRUMS 9
+
+
+
+
+/*############################################################################*/
+
+
+/* Read exactly n bytes from the start of the file, or at offset if the file is
+   read with pread(). Returns 0 on success or -1. */
+static int readFully(midi_t *m, unsigned char *buf, long n, long offset) {
+    long got = 0, r;
+    while (got < n) {
+        if (m->format == 0)
+            r = read(m->fd, buf + got, n - got);
+        else
+            r = pread(m->fd, buf + got, n - got, offset + got);
+        if (r <= 0) return -1;
+        got += r;
+    }
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns a big-endian number of n bytes. */
+static unsigned long bigEndian(const unsigned char *p, int n) {
+    unsigned long v = 0;
+    while (n--) v = (v << 8) | *p++;
+    return v;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the next byte of a track, or -1 at the end of the track. */
+static int trackByte(midi_t *m, midi_track_t *t) {
+    long n;
+    if (t->pos == t->len) {
+        n = t->end - t->offset;
+        if (n <= 0) return -1;
+        if (n > MIDI_BUFFER) n = MIDI_BUFFER;
+        if (readFully(m, t->buf, n, t->offset)) {
+            fprintf(stderr, "ERROR: midiNext(): Cannot read MIDI file.\n");
+            m->error = 1;
+            return -1;
+        }
+        t->offset += n;
+        t->pos = 0;
+        t->len = n;
+    }
+    return t->buf[t->pos++];
+}
+
+
+/*############################################################################*/
+
+
+/* Returns a variable-length quantity from a track, or -1 at end of track. */
+static long trackNumber(midi_t *m, midi_track_t *t) {
+    long v = 0;
+    int b, i;
+    for (i = 0; i < 4; i++) {
+        if ((b = trackByte(m, t)) < 0) return -1;
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) return v;
+    }
+    return -1;
+}
+
+
+/*############################################################################*/
+
+
+/* Skip n bytes of a track. Returns 0 or -1 at end of track. */
+static int trackSkip(midi_t *m, midi_track_t *t, long n) {
+    while (n-- > 0)
+        if (trackByte(m, t) < 0) return -1;
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Read the time until the next event of a track, or mark it as done. */
+static void trackDelta(midi_t *m, midi_track_t *t) {
+    long delta = trackNumber(m, t);
+    if (delta < 0) t->done = 1;
+    else t->tick += delta;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the frequency (Hz) of a MIDI note number bent by some semitones. */
+static double noteFreq(int note, double bend) {
+    return 440 * pow(2, (note - 69 + bend) / 12);
+}
+
+
+/*############################################################################*/
+
+
+/* Add an event to be returned by midiNext(). */
+static void push(midi_t *m, unsigned long tick, int pin, double freq,
+                 misc_t *misc) {
+    event_t *e = &m->pending[m->pendingCount++];
+    e->tick = tick;
+    e->pin  = pin;
+    e->freq = freq;
+    e->duty = freq ? m->duty : 0;
+    e->misc = misc;
+}
+
+
+/*############################################################################*/
+
+
+/* Stop the note of a voice. */
+static void voiceOff(midi_t *m, midi_voice_t *v, unsigned long tick) {
+    v->channel = -1;
+    push(m, tick, v->pin, 0, NULL);
+}
+
+
+/*############################################################################*/
+
+
+/* Start a note on a free (or the oldest) voice. */
+static void midiNoteOn(midi_t *m, unsigned long tick, int ch, int note) {
+    midi_voice_t *v = NULL;
+    int i;
+
+    if (m->mode == MIDI_CHANNELS) {
+        v = &m->voice[ch % m->voices];
+    } else {
+        for (i = 0; i < m->voices && !v; i++)
+            if (m->voice[i].channel < 0) v = &m->voice[i];
+
+        /* No free voice: steal the one playing the oldest note */
+        if (!v) {
+            v = &m->voice[0];
+            for (i = 1; i < m->voices; i++)
+                if (m->voice[i].age < v->age) v = &m->voice[i];
+        }
+    }
+
+    v->channel = ch;
+    v->note    = note;
+    v->age     = ++m->age;
+    v->freq    = noteFreq(note, m->bend[ch]);
+    push(m, tick, v->pin, v->freq, NULL);
+}
+
+
+/*############################################################################*/
+
+
+/* Stop a note, if it is still playing. */
+static void midiNoteOff(midi_t *m, unsigned long tick, int ch, int note) {
+    int i;
+    for (i = 0; i < m->voices; i++)
+        if (m->voice[i].channel == ch && m->voice[i].note == note)
+            voiceOff(m, &m->voice[i], tick);
+}
+
+
+/*############################################################################*/
+
+
+/* Bend every note of a channel, using a short pitch slide. */
+static void pitchBend(midi_t *m, unsigned long tick, int ch, int value) {
+    midi_voice_t *v;
+    misc_t *mc;
+    int i;
+
+    m->bend[ch] = (value - 8192) / 8192.0 * m->bendRange[ch];
+
+    for (i = 0; i < m->voices; i++) {
+        v = &m->voice[i];
+        if (v->channel != ch) continue;
+
+        /* The pitch slide is only read while the event is playing, so
+           alternate between two of them */
+        mc = &v->bend[v->slot];
+        v->slot ^= 1;
+        memset(mc, 0, sizeof(*mc));
+        mc->usingPs = 1;
+        mc->freqTo  = noteFreq(v->note, m->bend[ch]);
+        mc->freqS   = 0;
+        mc->freqE   = 1.0 / m->division;
+
+        push(m, tick, v->pin, v->freq, mc);
+        v->freq = mc->freqTo;
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Read one event from a track. */
+static void trackEvent(midi_t *m, midi_track_t *t) {
+    int status, type, a = 0, b = 0, ch, i;
+    long len;
+
+    if ((status = trackByte(m, t)) < 0) goto end;
+
+    /* Running status: the status byte was left out */
+    if (status < 0x80) {
+        a = status;
+        status = t->status;
+        if (status < 0x80) {
+            fprintf(stderr, "ERROR: midiNext(): Invalid MIDI event.\n");
+            m->error = 1;
+            return;
+        }
+    } else if (status < 0xF0) {
+        t->status = status;
+        if ((a = trackByte(m, t)) < 0) goto end;
+    }
+
+    m->events++;
+    ch = status & 0x0F;
+
+    switch (status & 0xF0) {
+        case 0x80: /* Note off */
+        case 0x90: /* Note on */
+            if ((b = trackByte(m, t)) < 0) goto end;
+            if (ch == DRUMS) break;
+            if ((status & 0xF0) == 0x90 && b) midiNoteOn(m, t->tick, ch, a);
+            else midiNoteOff(m, t->tick, ch, a);
+            break;
+        case 0xA0: /* Key pressure */
+            if (trackByte(m, t) < 0) goto end;
+            break;
+        case 0xB0: /* Controller */
+            if ((b = trackByte(m, t)) < 0) goto end;
+            if (a == 101) m->rpn[ch] = (m->rpn[ch] & 0x7F) | (b << 7);
+            if (a == 100) m->rpn[ch] = (m->rpn[ch] & ~0x7F) | b;
+            if (a == 6 && m->rpn[ch] == 0) m->bendRange[ch] = b;
+            if (a == 120 || a == 123) {
+                for (i = 0; i < m->voices; i++)
+                    if (m->voice[i].channel == ch)
+                        voiceOff(m, &m->voice[i], t->tick);
+            }
+            break;
+        case 0xC0: /* Program change */
+        case 0xD0: /* Channel pressure */
+            break;
+        case 0xE0: /* Pitch bend */
+            if ((b = trackByte(m, t)) < 0) goto end;
+            if (ch != DRUMS) pitchBend(m, t->tick, ch, a | (b << 7));
+            break;
+        default:
+            if (status == 0xFF) { /* Meta event */
+                if ((type = trackByte(m, t)) < 0) goto end;
+                if ((len = trackNumber(m, t)) < 0) goto end;
+                if (type == 0x2F) goto end;
+                if (type == 0x51 && len == 3) {
+                    if ((a = trackByte(m, t)) < 0) goto end;
+                    if ((b = trackByte(m, t)) < 0) goto end;
+                    if ((i = trackByte(m, t)) < 0) goto end;
+                    m->tempo.us = (a << 16) | (b << 8) | i;
+                    if (m->tempo.us) push(m, t->tick, -1, 0, &m->tempo);
+                } else if (trackSkip(m, t, len)) goto end;
+            } else if (status == 0xF0 || status == 0xF7) { /* SysEx */
+                if ((len = trackNumber(m, t)) < 0) goto end;
+                if (trackSkip(m, t, len)) goto end;
+            }
+            break;
+    }
+
+    trackDelta(m, t);
+    return;
+
+end:
+    t->done = 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Start reading a Standard MIDI File (format 0 or 1).
+   Only the header is read; the tracks are read as events are needed.
+   Format 0 files are read sequentially, so fd may be a pipe. Format 1 files
+   are read with pread() from several places at once, so fd must be a file.
+   midi:   MIDI file state to set up.
+   fd:     File descriptor to read from. It is not closed by this library.
+   pins:   GPIO pin numbers (BCM) of the voices to play through.
+   voices: Amount of voices (1 to 32).
+   mode:   MIDI_CHANNELS or MIDI_NOTES.
+   Returns 0 on success, or -1 (after printing an error). */
+int midiOpen(midi_t *m, int fd, const int *pins, int voices, int mode) {
+    unsigned char h[14];
+    long offset, len;
+    unsigned int tracks, i;
+    midi_track_t *t;
+
+    memset(m, 0, sizeof(*m));
+    m->fd     = fd;
+    m->mode   = mode;
+    m->duty   = 0.5;
+    m->voices = (voices > 32) ? 32 : voices;
+    for (i = 0; i < (unsigned int)m->voices; i++) {
+        m->voice[i].pin     = pins[i];
+        m->voice[i].channel = -1;
+    }
+    for (i = 0; i < 16; i++) {
+        m->bendRange[i] = 2;
+        m->rpn[i]       = 0x3FFF;
+    }
+
+    /* Header chunk. It is read sequentially so that pipes work. */
+    if (readFully(m, h, 14, 0) || memcmp(h, "MThd", 4)) {
+        fprintf(stderr, "ERROR: midiOpen(): Not a MIDI file.\n");
+        return -1;
+    }
+    len        = bigEndian(h + 4, 4);
+    m->format  = bigEndian(h + 8, 2);
+    tracks     = bigEndian(h + 10, 2);
+    m->division = bigEndian(h + 12, 2);
+    if (m->format > 1 || (m->division & 0x8000) || !m->division ||
+        m->voices < 1) {
+        fprintf(stderr, "ERROR: midiOpen(): Only format 0 and 1 MIDI files "
+                        "with ticks per quarter note are supported.\n");
+        return -1;
+    }
+    offset = 8 + len;
+
+    /* Find each track chunk */
+    if (tracks > MIDI_TRACKS) {
+        fprintf(stderr, "WARNING: midiOpen(): Only the first %d tracks "
+                        "will be played.\n", MIDI_TRACKS);
+        tracks = MIDI_TRACKS;
+    }
+    t = &m->track[0];
+    if (m->format == 0) {
+        /* Sequential: skip the rest of the header, then skip chunks until
+           the track chunk is found */
+        for (len -= 6; len > 0; len--)
+            if (readFully(m, h, 1, 0)) goto truncated;
+        for (;;) {
+            if (readFully(m, h, 8, 0)) goto truncated;
+            len = bigEndian(h + 4, 4);
+            if (!memcmp(h, "MTrk", 4)) break;
+            for (; len > 0; len--)
+                if (readFully(m, h, 1, 0)) goto truncated;
+        }
+        t->offset = 0;
+        t->end    = len;
+        m->tracks = 1;
+    } else {
+        while (m->tracks < tracks) {
+            if (readFully(m, h, 8, offset)) break;
+            len = bigEndian(h + 4, 4);
+            if (!memcmp(h, "MTrk", 4)) {
+                t = &m->track[m->tracks++];
+                t->offset = offset + 8;
+                t->end    = offset + 8 + len;
+            }
+            offset += 8 + len;
+        }
+        if (!m->tracks) goto truncated;
+    }
+
+    /* Read the time of the first event of each track */
+    for (i = 0; i < m->tracks; i++) trackDelta(m, &m->track[i]);
+
+    return m->error ? -1 : 0;
+
+truncated:
+    fprintf(stderr, "ERROR: midiOpen(): MIDI file has no tracks.\n");
+    return -1;
+}
+
+
+/*############################################################################*/
+
+
+/* Get the next event, for eventPlayStream().
+   event: Filled in with the next event.
+   arg:   The midi_t being read.
+   Returns 1 if an event was returned, or 0 at the end of the file (or if the
+   file is invalid, in which case an error is printed and midi->error is 1). */
+int midiNext(event_t *event, void *arg) {
+    midi_t *m = arg;
+    midi_track_t *t;
+    unsigned int i;
+
+    for (;;) {
+        if (m->pendingNext < m->pendingCount) {
+            *event = m->pending[m->pendingNext++];
+            return 1;
+        }
+        m->pendingCount = 0;
+        m->pendingNext  = 0;
+        if (m->error) return 0;
+
+        /* Read from the track with the earliest next event */
+        t = NULL;
+        for (i = 0; i < m->tracks; i++)
+            if (!m->track[i].done && (!t || m->track[i].tick < t->tick))
+                t = &m->track[i];
+        if (!t) return 0;
+        trackEvent(m, t);
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Play a MIDI file through GPIO voices while it is being read.
+   Memory use does not depend on the length of the file.
+   Arguments are the same as for midiOpen().
+   Returns 0 after playing, or -1 if the file is invalid. */
+int midiPlay(int fd, const int *pins, int voices, int mode) {
+    midi_t *m = malloc(sizeof(midi_t));
+    unsigned int mask = 0;
+    int i, ret;
+
+    if (midiOpen(m, fd, pins, voices, mode)) {
+        free(m);
+        return -1;
+    }
+    for (i = 0; i < m->voices; i++) mask |= 1<<m->voice[i].pin;
+
+    /* 500000 microseconds per quarter note until a tempo event says
+       otherwise */
+    eventPlayStream(midiNext, m, mask, 500000, m->division);
+
+    ret = m->error ? -1 : 0;
+    free(m);
+    return ret;
+}
+
+
+/*############################################################################*/
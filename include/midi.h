@@ -0,0 +1,111 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* midi - Streaming Standard MIDI File reader */
+
+#pragma once
+
+#include "player.h"
+
+/* Bytes buffered for each track. */
+#define MIDI_BUFFER 512
+
+/* Largest amount of tracks that are read. Further tracks are ignored. */
+#define MIDI_TRACKS 32
+
+/* Ways of giving MIDI notes to GPIO voices, for midiOpen(). */
+#define MIDI_CHANNELS 0 /* Channel n plays through voice n (modulo voices).   */
+#define MIDI_NOTES    1 /* Each note plays through any free voice.            */
+
+/* State of one track. */
+typedef struct midi_track_t {
+    long offset;            /* File offset of next byte to buffer.            */
+    long end;               /* File offset of first byte after the track.     */
+    unsigned char buf[MIDI_BUFFER];
+    unsigned int pos;       /* Index of next byte to read from buf.           */
+    unsigned int len;       /* Amount of bytes in buf.                        */
+    unsigned long tick;     /* Tick of next event.                            */
+    unsigned char status;   /* Running status.                                */
+    char done;              /* 1 when end of track has been reached.          */
+} midi_track_t;
+
+/* State of one GPIO voice. */
+typedef struct midi_voice_t {
+    int pin;                /* GPIO pin number (BCM).                         */
+    int channel;            /* Channel of note being played, or -1 if none.   */
+    int note;               /* Note number being played.                      */
+    unsigned long age;      /* When the note started, for voice stealing.     */
+    double freq;            /* Frequency being played (Hz).                   */
+    misc_t bend[2];         /* Pitch slides for pitch bends.                  */
+    int slot;               /* Which of bend[] to use next.                   */
+} midi_voice_t;
+
+/* Type for an open MIDI file. Its size does not depend on the file. */
+typedef struct midi_t {
+    int fd;                 /* File being read.                               */
+    int format;             /* SMF format (0 or 1).                           */
+    unsigned int division;  /* Ticks per quarter note.                        */
+    unsigned int tracks;    /* Amount of tracks being read.                   */
+    midi_track_t track[MIDI_TRACKS];
+
+    int mode;               /* MIDI_CHANNELS or MIDI_NOTES.                   */
+    double duty;            /* Duty cycle of every note.                      */
+    int voices;             /* Amount of GPIO voices.                         */
+    midi_voice_t voice[32];
+    unsigned long age;      /* Counter for midi_voice_t.age.                  */
+
+    double bend[16];        /* Pitch bend of each channel, in semitones.      */
+    double bendRange[16];   /* Pitch bend range of each channel (semitones).  */
+    int rpn[16];            /* Registered parameter selected on each channel. */
+
+    misc_t tempo;           /* Tempo change, with the tempo in "us".          */
+
+    event_t pending[33];    /* Events waiting to be returned by midiNext().   */
+    int pendingCount;
+    int pendingNext;
+
+    unsigned long events;   /* Amount of MIDI events read so far.             */
+    int error;              /* 1 if the file was found to be invalid.         */
+} midi_t;
+
+/* Start reading a Standard MIDI File (format 0 or 1).
+   Only the header is read; the tracks are read as events are needed.
+   Format 0 files are read sequentially, so fd may be a pipe. Format 1 files
+   are read with pread() from several places at once, so fd must be a file.
+   midi:   MIDI file state to set up.
+   fd:     File descriptor to read from. It is not closed by this library.
+   pins:   GPIO pin numbers (BCM) of the voices to play through.
+   voices: Amount of voices (1 to 32).
+   mode:   MIDI_CHANNELS or MIDI_NOTES.
+   Returns 0 on success, or -1 (after printing an error). */
+int midiOpen(midi_t *midi, int fd, const int *pins, int voices, int mode);
+
+/* Get the next event, for eventPlayStream().
+   event: Filled in with the next event.
+   arg:   The midi_t being read.
+   Returns 1 if an event was returned, or 0 at the end of the file (or if the
+   file is invalid, in which case an error is printed and midi->error is 1). */
+int midiNext(event_t *event, void *arg);
+
+/* Play a MIDI file through GPIO voices while it is being read.
+   Memory use does not depend on the length of the file.
+   Arguments are the same as for midiOpen().
+   Returns 0 after playing, or -1 if the file is invalid. */
+int midiPlay(int fd, const int *pins, int voices, int mode);
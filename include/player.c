@@ -22,12 +22,25 @@
 
 #define _BSD_SOURCE
 
-#include <string.h>  /* memcpy(), memset()                                    */
+#include <stdio.h>   /* fprintf(), stderr                                     */
+#include <stdlib.h>  /* malloc(), realloc(), free(), qsort()                  */
+#include <string.h>  /* memcpy(), memset(), memcmp()                          */
 #include <unistd.h>  /* usleep()                                              */
-#include <math.h>    /* pow()                                                 */
+#include <math.h>    /* pow(), floor()                                        */
+#include <sys/time.h> /* gettimeofday()                                       */
+#include <pthread.h> /* pthread_create(), pthread_join()                      */
+#include <sched.h>   /* sched_yield()                                         */
+#include <time.h>    /* struct timespec                                       */
+#include <errno.h>   /* ETIMEDOUT                                             */
 
+#include "compile.h"
 #include "driver.h"
+#include "metrics.h"
 #include "player.h"
+#include "score.h"
+#include "telemetry.h"
+#include "tempo.h"
+#include "trace.h"
 
 
 
@@ -74,25 +87,336 @@ typedef struct pulse_t {
 
 } pulse_t;
 
-static unsigned int cbs_index = 0;
-static unsigned int cmd_index = 0;
-static unsigned int dma_laps = 0;
-static unsigned int dma_last = 0;
-static unsigned int cbs_laps = 0;
-static int firstWave = 1;
-static unsigned int wOutLength = 0;
+/* Largest amount of transitions generated at once by eventPlay(). Notes that
+   would need more are generated in several parts. */
+#define EVENT_PULSES (PAGES*32)
 
-static double  *(_freq[32]);
-static double  *(_duty[32]);
-static misc_t **(_misc[32]);
+/* Longest wave generated at once by eventPlay(), in microseconds. */
+#define EVENT_MAX_US (1<<24)
 
-static unsigned int pins;
-static wavegen_info_t _info[32];
+/* Type for the event list, with a sequence number to keep sorting stable. */
+typedef struct event_entry_t {
+    event_t event;
+    unsigned int seq;
+} event_entry_t;
 
-static unsigned int *cmdV, *cmdB, cmdH;
-static pulse_t wIn1[PAGES*64];
-static pulse_t wIn2[PAGES*64];
-static pulse_t wOut[PAGES*64];
+/* Most memory (bytes) used for cached pattern output. Patterns played after
+   this is reached are generated every time. */
+#define PATTERN_CACHE (16<<20)
+
+/* State of the player at the start of a pattern. The output of a pattern only
+   depends on the pattern and on this state. */
+typedef struct pattern_state_t {
+    unsigned int us;
+    unsigned int w_offset[32], v_offset[32], t_offset[32];
+    char w_on[32];
+    double vInt[32], tInt[32];
+    unsigned int vWth[32], tWth[32];
+} pattern_state_t;
+
+/* Cached output of one pattern, from one starting state. */
+typedef struct pattern_cache_t {
+    pattern_state_t start;  /* State before the pattern.                      */
+    pattern_state_t end;    /* State after the pattern.                       */
+    pulse_t *pulses;        /* Combined waveforms of every beat, in order.    */
+    unsigned int *lengths;  /* Transitions of each beat.                      */
+    unsigned int count;     /* Total transitions.                             */
+    unsigned long genUs;    /* Microseconds taken to generate the output.     */
+    struct pattern_cache_t *next;
+} pattern_cache_t;
+
+/* A pattern added with patternNew(). */
+typedef struct pattern_t {
+    unsigned int beats;
+    double  *(freq[32]);
+    double  *(duty[32]);
+    misc_t **(misc[32]);
+    pattern_cache_t *cache;
+} pattern_t;
+
+/* Microseconds the transmitter thread sleeps for when the pipeline is
+   empty, and the generator when it is full. */
+#define PIPELINE_POLL 250
+
+/* A beat in the pipeline. */
+typedef struct pipeline_slot_t {
+    unsigned int beat;      /* Beat number, for telemetry.                    */
+    unsigned int length;    /* Length of the combined waveform (transitions). */
+    unsigned int us;        /* Length of the combined waveform (microseconds).*/
+    unsigned long genUs;    /* Microseconds generating it took, see metrics.  */
+} pipeline_slot_t;
+
+/* Most threads that generate waveforms, see generatorThreads(). */
+#define GENERATOR_MAX 8
+
+/* Arguments of waveGen() for one pin in one beat, and what it returned. */
+typedef struct wavegen_job_t {
+    int pin;
+    double freqS, freqE;
+    unsigned int freqDelayS, freqDelayE;
+    double dutyS, dutyE;
+    unsigned int dutyDelayS, dutyDelayE;
+    double vIntensity, tIntensity;
+    unsigned int vWidth, tWidth;
+    unsigned int len;
+    double value;
+    unsigned int effectUs;  /* See waveGen(), set by the quality of service   */
+    unsigned int slideSteps; /* controller.                                   */
+    wavegen_info_t info;
+    unsigned long us;       /* Microseconds waveGen() took, for timing.       */
+} wavegen_job_t;
+
+/* A song played in the background by queuePlayAsync(), queuePlayFileAsync()
+   or queuePlayMemoryAsync(). Only one can play at a time on each player. */
+struct play_t {
+    player_t *player;       /* Player it plays on.                            */
+    pthread_t thread;
+    unsigned int us;        /* Beat length, when playing the queue.           */
+    unsigned int beats;     /* Beats, when playing the queue.                 */
+    char *path;             /* Score file, or NULL.                           */
+    const void *data;       /* Score in memory, or NULL.                      */
+    size_t length;          /* Bytes of score in memory.                      */
+    int result;             /* Return value of queuePlayFile().               */
+    int done;               /* 1 once the song has finished.                  */
+    struct timeval start;   /* When the song was started.                     */
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+};
+
+/* Slices kept in the control block ring at once by liveOpen(). */
+#define LIVE_SLICES 256
+
+/* A slice of sound written by liveOpen() that DMA has not finished yet. */
+typedef struct live_slice_t {
+    unsigned int cmd;        /* GPIO command of first transition (control
+                                blocks 2*cmd and onwards).                    */
+    unsigned int length;     /* Transitions.                                  */
+    int link;                /* Control block linking to this slice (the last
+                                one of the slice before), or -1.              */
+    unsigned long startUs;   /* Microseconds from liveOpen() to slice start.  */
+    wavegen_info_t info[32]; /* Phase of every pin at the start of the slice. */
+} live_slice_t;
+
+/* Everything a player changes while playing. Players do not share any of it,
+   so several of them can play at once on their own DMA channels. */
+struct player_t {
+    /* DMA channel and pacer given to playerNew(). dmach is -1 for the default
+       player, which uses driver_setup() and the channel given to
+       set_dmach(). */
+    int dmach, pacer;
+    driver_t *dma;
+    unsigned int claimed;   /* Pins claimed from other players (1<<pin).      */
+
+    unsigned int cbs_index;
+    unsigned int cmd_index;
+    unsigned int dma_laps;
+    unsigned int dma_last;
+    unsigned int cbs_laps;
+    int firstWave;
+    unsigned int wOutLength;
+
+    double  *(freq[32]);
+    double  *(duty[32]);
+    misc_t **(misc[32]);
+
+    unsigned int pins;
+    wavegen_info_t info[32];
+
+    event_entry_t *events;
+    unsigned int eventCount;
+    unsigned int eventSize;
+    unsigned int eventNext;
+
+    /* State of each pin while playing events */
+    double evFreq[32], evDuty[32];
+    misc_t *evMisc[32];
+    double evStart[32], evBeat[32];
+    double evVInt[32], evTInt[32];
+    unsigned int evVWth[32], evTWth[32];
+
+    /* Tempo while playing events. Tick times are computed from the last tempo
+       change so that rounding errors do not add up. */
+    double evAnchorUs;
+    unsigned int evAnchorTick;
+    unsigned int evUs;
+    unsigned int evTicks;
+
+    /* State of each pin between beats of play(): pitch slides (frequency
+       at the start and end, beats from start of song of the start and end,
+       and frequency reached), the same for duty cycle slides, and vibrato
+       and tremolo range and width. */
+    double initF[32], endF[32], freqAS[32], freqAE[32], freqTo[32];
+    double initD[32], endD[32], dutyAS[32], dutyAE[32], dutyTo[32];
+    double vInt[32], tInt[32];
+    unsigned int vWth[32], tWth[32];
+
+    /* Pins in the middle of a pitch slide (ff) or duty cycle slide (fd), and
+       beat length requested for the next beat, between beats of play() */
+    unsigned int ff, fd;
+    unsigned int changeUs;
+
+    /* Score being played by queuePlayFile(), or NULL when playing the queue */
+    const score_t *score;
+    unsigned int voice[32];
+
+    /* Tempo map given to queueTempo(), or NULL to use fixed beat lengths */
+    const tempo_t *tempo;
+
+    pattern_t *patterns;
+    unsigned int patternCount;
+    unsigned int patternSize;
+    unsigned long patternBytes;
+    pattern_stats_t patternStats;
+
+    /* Order list being played by patternPlay(), or NULL when not playing one */
+    const unsigned int *order;
+    pattern_t *pattern;
+    unsigned int patternStart;
+
+    /* Waveforms of each pin, kept by waveGen() while a song is being compiled
+       by queueCompile(). No hardware is used while compiling is 1. */
+    int compiling;
+    unsigned int *compileData;
+    unsigned int compileLength;
+    unsigned int compileSize;
+    unsigned int *compileIndex;
+    unsigned int compileBlocks;
+    unsigned int compileBlocksSize;
+    unsigned int compileTrans[PAGES*64];
+
+    unsigned int *cmdV, *cmdB, cmdH;
+
+    /* Pins whose level DMA has been told (1<<pin) since the song started,
+       and which of them it has been told to turn on. waveElide() leaves out
+       transitions that would not change them, into wSend. */
+    unsigned int levelKnown;
+    unsigned int level;
+    pulse_t wSend[PAGES*64];
+
+    pulse_t wIn1[PAGES*64];
+    pulse_t wIn2[PAGES*64];
+    pulse_t wOutBuf[PAGES*64];
+
+    /* Combined waveform being generated. This is wOutBuf, or the next free
+       slot of the pipeline while the pipeline is in use. */
+    pulse_t *wOut;
+
+    /* Pipeline between the generator (the thread that called queuePlay()) and
+       the transmitter thread, which writes control blocks. It is a ring with
+       one writer and one reader: only the generator writes ringHead and
+       ringUsIn, and only the transmitter writes ringTail and ringUsOut, so no
+       locks are needed. */
+    unsigned int pipelineDepth;
+    unsigned int ringDepth;
+    pipeline_slot_t *ring;
+    pulse_t *ringPulses;
+    volatile unsigned int ringHead;
+    volatile unsigned int ringTail;
+    volatile unsigned long ringUsIn;
+    volatile unsigned long ringUsOut;
+    volatile int ringDone;
+    pthread_t transmitter;
+    pipeline_stats_t pipelineStats;
+
+    /* Waveforms of a beat may be generated by worker threads as well as by the
+       thread playing, each taking the next pin that nobody has taken yet until
+       there are none left. jobNext holds the round (one round per beat) in its
+       upper bits and the next job in its lowest 8 bits, so that a worker that
+       is late for a round cannot take a job of the next one. Each pin has its
+       own buffer, and the waveforms are combined in order of pin afterwards. */
+    unsigned int generatorThreads;
+    unsigned int workers;
+    pthread_t worker[GENERATOR_MAX];
+    pthread_mutex_t workerLock;
+    pthread_cond_t workerWake;
+    unsigned int workerRound;
+    int workerQuit;
+    wavegen_job_t job[32];
+    unsigned int jobCount;
+    volatile unsigned int jobNext;
+    volatile unsigned int jobsDone;
+    pulse_t *jobWave[32];
+
+    play_t *playing;
+
+    /* Set by playerKeep(). kept is 1 while DMA is set up between songs. */
+    int keep;
+    int kept;
+
+    /* Interactive playing with liveOpen(). A thread keeps a short horizon of
+       slices written ahead of DMA. Notes given to noteOn() and noteOff() are
+       kept in liveFreq and liveDuty; slices that DMA is not about to reach
+       are then written again with the new notes. */
+    int live;
+    unsigned int liveSlice, liveHorizon, liveGuard;
+    live_slice_t liveRing[LIVE_SLICES];
+    unsigned int liveFirst, liveCount;
+    unsigned int liveCmd;
+    int liveLink;
+    unsigned long liveUs;
+    double liveFreq[32], liveDuty[32];
+    unsigned int liveChanged;
+    int liveQuit;
+    pthread_t liveThread;
+    pthread_mutex_t liveLock;
+    pthread_cond_t liveWake;
+
+    /* Set by playCancel(). Playing stops at the start of the next beat. */
+    volatile int cancel;
+
+    /* Progress of the song being played, for playPoll(). */
+    volatile unsigned int progressBeats;
+    volatile unsigned int progressTotal;
+    volatile unsigned long progressUs;
+
+    /* Timing of the song being played (see timingStats()), with the slack of
+       every beat kept in slack for the percentile. DMA was last started at
+       slackStartUs, and slackSentUs of sound have been sent to it since.
+       slackBeats counts every beat sent, underruns included. */
+    timing_stats_t timing;
+    unsigned long *slack;
+    unsigned long slackSize;
+    double slackSum;
+    unsigned long slackStartUs;
+    unsigned long slackSentUs;
+    unsigned long slackBeats;
+
+    /* Quality of service (see qosEnable()). DMA was last started at
+       qosStartUs, and qosSentUs of sound have been sent to it since; only the
+       thread sending beats to DMA writes them. qosCalm counts the beats in a
+       row with more than QOS_HIGH_US ahead, qosMeasured the beats measured,
+       and qosMute is the pin muted at QOS_MUTE, or -1. */
+    int qosEnabled;
+    unsigned int qosLevel;
+    unsigned int qosCalm;
+    int qosMute;
+    unsigned int qosSlowdown;
+    unsigned long qosMeasured;
+    qos_stats_t qos;
+    volatile unsigned long qosStartUs;
+    volatile unsigned long qosSentUs;
+
+    /* Counters published in shared memory (see metricsOpen()), or NULL. Only
+       the thread sending beats to DMA writes them while playing. genUs is
+       how long the beat being handed to waveTransmit() took to generate. */
+    metrics_t *metrics;
+    char *metricsName;
+    unsigned long genUs;
+};
+
+/* Player used by the functions that do not take one, set up on first use. */
+static player_t _player;
+static pthread_once_t _playerOnce = PTHREAD_ONCE_INIT;
+
+/* Pins claimed by players while they play (1<<pin). Players must not share
+   pins, as each one turns its pins on and off without knowing of the others. */
+static unsigned int _claimed = 0;
+static pthread_mutex_t _claimLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The trace (see trace.h) is opened when a song is first played. */
+#if TRACE
+static pthread_once_t _traceOnce = PTHREAD_ONCE_INIT;
+#endif
 
 
 
@@ -118,6 +442,175 @@ static double dmax(double a, double b) {
 /*############################################################################*/
 
 
+/* With TIMING 0 the timing code below is left out, and so are its calls.
+   The same goes for tracing with TRACE 0 (see trace.h), which records spans
+   at the same places. */
+#if TIMING || TRACE
+#   define TIMING_NOW()                  trace_now()
+#else
+#   define TIMING_NOW()                  0
+#endif
+#if TIMING
+#   define TIMING_ADD(p, phase, us, n)   timingAdd(p, phase, us, n)
+#   define TIMING_SENT(p, running, us)   timingSent(p, running, us)
+#   define TIMING_FINISH(p)              timingFinish(p)
+#else
+#   define TIMING_ADD(p, phase, us, n)   ((void)(us))
+#   define TIMING_SENT(p, running, us)   ((void)0)
+#   define TIMING_FINISH(p)              ((void)0)
+#endif
+#if TRACE
+#   define TRACE_SPAN(name, t, key, v)   trace_span(name, t, key, v)
+#   define TRACE_COUNTER(name, v)        trace_counter(name, v)
+#   define TRACE_THREAD(name)            trace_thread(name)
+#   define TRACE_OPEN()                  pthread_once(&_traceOnce, traceOpen)
+#else
+#   define TRACE_SPAN(name, t, key, v)   ((void)(t))
+#   define TRACE_COUNTER(name, v)        ((void)0)
+#   define TRACE_THREAD(name)            ((void)0)
+#   define TRACE_OPEN()                  ((void)0)
+#endif
+
+
+/*############################################################################*/
+
+
+#if TRACE
+/* Start tracing, unless the program already has. */
+static void traceOpen(void) {
+    trace_open(TRACE_FILE, TRACE_EVENTS);
+}
+#endif
+
+
+/*############################################################################*/
+
+
+/* Forget the timing of the last song. */
+static void timingReset(player_t *p) {
+    memset(&p->timing, 0, sizeof(p->timing));
+    p->slackBeats = 0;
+    p->slackSum   = 0;
+}
+
+
+/*############################################################################*/
+
+
+#if TIMING
+/* Count one part of playing.
+   phase: TIMING_DECODE, TIMING_GEN and so on.
+   us:    Microseconds it took.
+   n:     Transitions it generated, merged or wrote. */
+static void timingAdd(player_t *p, int phase, unsigned long us,
+                      unsigned int n) {
+    timing_phase_t *t = &p->timing.phase[phase];
+    t->count++;
+    t->us += us;
+    t->transitions += n;
+    if (us > t->maxUs) t->maxUs = us;
+}
+
+
+/*############################################################################*/
+
+
+/* Find the slack of a beat once it has been sent to DMA. DMA plays sound at
+   the rate it was written, so what it has played is the time since it was
+   started, and the rest of what was sent before this beat is still waiting.
+   running: 1 if DMA was running before the beat was sent, or 0 if it had
+            run out (or had not been started) and the beat started it again.
+   us:      Length of the beat (microseconds). */
+static void timingSent(player_t *p, int running, unsigned long us) {
+    unsigned long now = trace_now(), played, slack = 0, ms;
+    unsigned int bucket = 0;
+
+    if (!running) {
+        /* Only the first beat of a song may find DMA stopped */
+        if (p->slackBeats++) p->timing.underruns++;
+        p->slackStartUs = now;
+        p->slackSentUs  = us;
+        return;
+    }
+    p->slackBeats++;
+
+    played = now - p->slackStartUs;
+    if (played < p->slackSentUs) slack = p->slackSentUs - played;
+    p->slackSentUs += us;
+
+    if (p->timing.beats == p->slackSize) {
+        p->slackSize = p->slackSize ? p->slackSize*2 : 1024;
+        p->slack = realloc(p->slack, p->slackSize*sizeof(unsigned long));
+    }
+    p->slack[p->timing.beats++] = slack;
+
+    if (p->timing.beats == 1 || slack < p->timing.minSlackUs)
+        p->timing.minSlackUs = slack;
+    if (slack > p->timing.maxSlackUs) p->timing.maxSlackUs = slack;
+    p->slackSum += slack;
+
+    for (ms = slack/1000; ms && bucket < TIMING_BUCKETS-1; ms >>= 1) bucket++;
+    p->timing.hist[bucket]++;
+}
+
+
+/*############################################################################*/
+
+
+/* Compare two slacks, for qsort(). */
+static int timingCompare(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+
+/*############################################################################*/
+
+
+/* Work out the mean and percentile of the slack at the end of a song, and
+   print a summary to stderr. */
+static void timingFinish(player_t *p) {
+    static const char *name[TIMING_PHASES] = {
+        "decode", "gen", "merge", "emit", "wait", "stall"
+    };
+    timing_stats_t *t = &p->timing;
+    timing_phase_t *ph;
+    unsigned int i;
+
+    if (!p->slackBeats) return;
+    if (t->beats) {
+        t->avgSlackUs = p->slackSum/t->beats;
+        qsort(p->slack, t->beats, sizeof(unsigned long), timingCompare);
+        t->p99SlackUs = p->slack[(t->beats*99 + 99)/100 - 1];
+    }
+
+    fprintf(stderr, "timing: beats=%lu underruns=%lu slack min=%lu avg=%lu "
+                    "p99=%lu max=%lu us\n",
+            t->beats, t->underruns, t->minSlackUs, t->avgSlackUs,
+            t->p99SlackUs, t->maxSlackUs);
+    for (i = 0; i < TIMING_PHASES; i++) {
+        ph = &t->phase[i];
+        if (!ph->count) continue;
+        fprintf(stderr, "timing: %-6s count=%lu avg=%lu max=%lu total=%lu us",
+                name[i], ph->count, ph->us/ph->count, ph->maxUs, ph->us);
+        if (ph->transitions)
+            fprintf(stderr, ", %.0f transitions, %.1f ns each",
+                    ph->transitions, ph->us*1000/ph->transitions);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "timing: slack ms <1:%lu", t->hist[0]);
+    for (i = 1; i < TIMING_BUCKETS-1; i++)
+        if (t->hist[i])
+            fprintf(stderr, " %u-%u:%lu", 1u<<(i-1), 1u<<i, t->hist[i]);
+    fprintf(stderr, " >=%u:%lu\n", 1u<<(TIMING_BUCKETS-2),
+            t->hist[TIMING_BUCKETS-1]);
+}
+#endif
+
+
+/*############################################################################*/
+
+
 /* Calculate the frequency somewhere between two frequencies.
    For example interpolateFreq(c4, d4, 0.5) is the frequency of c sharp 4. */
 static double interpolateFreq(double freqStart, double freqEnd, double factor) {
@@ -182,7 +675,219 @@ static double tremolo(double base, double intensity, double width, double us) {
 /*############################################################################*/
 
 
-/* Generate a waveform and add it to the queue.
+/* Keep a waveform as the next block of the song being compiled.
+   wave:   The waveform.
+   length: Length of the waveform in transitions. */
+static void compileAdd(player_t *p, const pulse_t *wave, unsigned int length) {
+    unsigned int i;
+
+    /* Make space for the block and its index entry */
+    if (p->compileLength + 2 + 3*(length+1)/2 > p->compileSize) {
+        p->compileSize = 2*p->compileSize + 2 + 3*(length+1)/2;
+        p->compileData = realloc(p->compileData, p->compileSize*sizeof(int));
+    }
+    if (p->compileBlocks == p->compileBlocksSize) {
+        p->compileBlocksSize = p->compileBlocksSize ?
+                               2*p->compileBlocksSize : 256;
+        p->compileIndex = realloc(p->compileIndex,
+                                  p->compileBlocksSize*sizeof(int));
+    }
+
+    for (i = 0; i < length; i++) {
+        p->compileTrans[i] = wave[i].usDelay;
+        if (wave[i].gpioOn) p->compileTrans[i] |= COMPILED_ON;
+    }
+    p->compileIndex[p->compileBlocks++] = p->compileLength;
+    p->compileLength += compileEncode(p->compileData + p->compileLength,
+                                      p->compileTrans, length);
+}
+
+
+/*############################################################################*/
+
+
+/* Combine a waveform with the waveforms already in wOut.
+   wave:   The waveform, called wIn2 below.
+   length: Length of the waveform in transitions. */
+static void waveMerge(player_t *p, const pulse_t *wave, unsigned int length) {
+    /* Array index counters and delays */
+    unsigned int wIn1Counter, wIn2Counter, wOutCounter, elapsed;
+    unsigned int wIn1Delay, wIn2Delay;
+    /* 1 while wIn1 or wIn2 have transitions left */
+    int wIn1Left, wIn2Left;
+    unsigned long start = TIMING_NOW();
+
+    /* This is the first waveform */
+    if (p->firstWave) {
+        /* Recalculate combined waveform length */
+        p->wOutLength = length;
+        p->firstWave = 0;
+
+        /* Copy contents of wIn2 into wOut */
+        memcpy(p->wOut, wave, length*sizeof(pulse_t));
+    }
+
+    /* Other waveforms have been added before this one */
+    else {
+        /* Copy contents of wOut into wIn1 */
+        memcpy(p->wIn1, p->wOut, p->wOutLength*sizeof(pulse_t));
+        /* Delete contents of wOut */
+        memset(p->wOut, 0, PAGES*64*sizeof(pulse_t));
+
+        /* Array index counters */
+        wIn1Counter = 0;
+        wIn2Counter = 0;
+        wOutCounter = 0;
+
+        /* Microseconds of waveform that has been combined */
+        elapsed = 0;
+
+        /* Microseconds of wIn1 and wIn2 that have been added */
+        wIn1Delay = 0;
+        wIn2Delay = 0;
+
+        /* Stop when both waveforms have been added, or before running off
+           the end of wOut, since each pass adds up to two transitions */
+        while (wOutCounter + 2 <= PAGES*64) {
+            wIn1Left = wIn1Counter < p->wOutLength;
+            wIn2Left = wIn2Counter < length;
+            if (!wIn1Left && !wIn2Left) break;
+
+            /* A transition in wIn2 happens at the same time
+               as a transition in wIn1.
+               If this happens we insert both the wIn2 transition and the
+               wIn1 transition. */
+            if (wIn1Left && wIn2Left && wIn1Delay == wIn2Delay) {
+                /* Add the delay for the previous transition we inserted */
+                if (elapsed < wIn1Delay) {
+                    p->wOut[wOutCounter-1].usDelay += wIn1Delay - elapsed;
+                    elapsed = wIn1Delay;
+                }
+
+                /* Insert the wIn1 transition first */
+                p->wOut[wOutCounter].gpioOn  = p->wIn1[wIn1Counter].gpioOn;
+                p->wOut[wOutCounter].gpioOff = p->wIn1[wIn1Counter].gpioOff;
+
+                /* Recalculate index values */
+                wIn1Delay = elapsed + p->wIn1[wIn1Counter].usDelay;
+                wIn1Counter++;
+                wOutCounter++;
+
+                /* Add the delay for the previous transition we inserted */
+                if (elapsed < wIn2Delay) {
+                    p->wOut[wOutCounter-1].usDelay += wIn2Delay - elapsed;
+                    elapsed = wIn2Delay;
+                }
+
+                /* Then insert the wIn2 transition */
+                p->wOut[wOutCounter].gpioOn  = wave[wIn2Counter].gpioOn;
+                p->wOut[wOutCounter].gpioOff = wave[wIn2Counter].gpioOff;
+
+                /* Recalculate index values */
+                wIn2Delay = elapsed + wave[wIn2Counter].usDelay;
+                wIn2Counter++;
+                wOutCounter++;
+            }
+
+            /* A transition in wIn2 happens before the next
+               transition in wIn1, or wIn1 has none left.
+               If this happens we insert the wIn2 transition but not the
+               wIn1 transition. */
+            else if (wIn2Left && (!wIn1Left || wIn2Delay < wIn1Delay)) {
+                /* Add the delay for the previous transition we inserted */
+                if (elapsed < wIn2Delay) {
+                    p->wOut[wOutCounter-1].usDelay += wIn2Delay - elapsed;
+                    elapsed = wIn2Delay;
+                }
+
+                /* Insert the wIn2 transition */
+                p->wOut[wOutCounter].gpioOn  = wave[wIn2Counter].gpioOn;
+                p->wOut[wOutCounter].gpioOff = wave[wIn2Counter].gpioOff;
+
+                /* Recalculate index values */
+                wIn2Delay = elapsed + wave[wIn2Counter].usDelay;
+                wIn2Counter++;
+                wOutCounter++;
+            }
+
+            /* A transition in wIn1 happens before the next
+               transition in wIn2, or wIn2 has none left.
+               If this happens we insert the wIn1 transition but not the
+               wIn2 transition. */
+            else {
+                /* Add the delay for the previous transition we inserted */
+                if (elapsed < wIn1Delay) {
+                    p->wOut[wOutCounter-1].usDelay += wIn1Delay - elapsed;
+                    elapsed = wIn1Delay;
+                }
+
+                /* Insert the wIn1 transition */
+                p->wOut[wOutCounter].gpioOn  = p->wIn1[wIn1Counter].gpioOn;
+                p->wOut[wOutCounter].gpioOff = p->wIn1[wIn1Counter].gpioOff;
+
+                /* Recalculate index values */
+                wIn1Delay = elapsed + p->wIn1[wIn1Counter].usDelay;
+                wIn1Counter++;
+                wOutCounter++;
+            }
+        }
+
+        /* The last transition lasts until the end of the longer waveform */
+        if (wIn2Delay > wIn1Delay) wIn1Delay = wIn2Delay;
+        if (elapsed < wIn1Delay)
+            p->wOut[wOutCounter-1].usDelay += wIn1Delay - elapsed;
+
+        /* Recalculate combined waveform length */
+        p->wOutLength = wOutCounter;
+    }
+
+    TIMING_ADD(p, TIMING_MERGE, TIMING_NOW() - start, length);
+    TRACE_SPAN("merge", start, "transitions", p->wOutLength);
+}
+
+
+/*############################################################################*/
+
+
+/* Make the times waveGen() works out the frequency and duty cycle from
+   coarser, for the quality of service controller.
+   ffac, dfac: How far along the pitch and duty cycle slides are (0 to 1),
+               rounded down to a step of slideSteps (unless it is 0).
+   vUs, tUs:   Time of vibrato and tremolo, rounded down to a multiple of
+               effectUs (unless it is 0), or 0 if there is no vibrato or no
+               tremolo.
+   last:       What they were last time, updated.
+   Returns 1 if any of them has changed since last time, or 0 if the
+   frequency and duty cycle are the same as last time. */
+static int waveCoarse(double *ffac, double *dfac, unsigned int *vUs,
+                      unsigned int *tUs, double vIntensity, double tIntensity,
+                      unsigned int effectUs, unsigned int slideSteps,
+                      double *last) {
+    if (slideSteps) {
+        *ffac = floor(*ffac*slideSteps)/slideSteps;
+        *dfac = floor(*dfac*slideSteps)/slideSteps;
+    }
+    if (!vIntensity) *vUs = 0;
+    else if (effectUs) *vUs -= *vUs % effectUs;
+    if (!tIntensity) *tUs = 0;
+    else if (effectUs) *tUs -= *tUs % effectUs;
+
+    if (*ffac == last[0] && *dfac == last[1] && *vUs == last[2] &&
+        *tUs == last[3])
+        return 0;
+    last[0] = *ffac;
+    last[1] = *dfac;
+    last[2] = *vUs;
+    last[3] = *tUs;
+    return 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Generate a waveform. Add it to the queue with waveAdd().
+   wave:        Where to write the waveform (PAGES*64 transitions).
    pin:         GPIO pin (BCM number) to output to.
    freqS:       Frequency (Hz) at start of waveform.
    freqE:       Frequency (Hz) at end of waveform. If this is different from
@@ -204,8 +909,14 @@ static double tremolo(double base, double intensity, double width, double us) {
    v_offset:    Offset in microseconds for tremolo.
    w_offset:    Microseconds to add to beginning before wave starts.
    w_on:        1 if wave starts on, 0 if wave starts off.
-                Offset starts opposite. */
-static wavegen_info_t waveGen(int pin,
+                Offset starts opposite.
+   effectUs:    Microseconds between changes of vibrato and tremolo, or 0 to
+                change them at every transition.
+   slideSteps:  Steps of slides, or 0 for smooth slides. With this or
+                effectUs, the frequency and duty cycle are only worked out
+                again when something they depend on changes. */
+static wavegen_info_t waveGen(pulse_t *wave,
+                              int pin,
                            double freqS,
                            double freqE,
                          unsigned freqDelayS,
@@ -223,7 +934,9 @@ static wavegen_info_t waveGen(int pin,
                          unsigned v_offset,
                          unsigned t_offset,
                          unsigned w_offset,
-                             char w_on) {
+                             char w_on,
+                         unsigned effectUs,
+                         unsigned slideSteps) {
     /* Current frequency */
     double freq = freqS;
     /* Current duty cycle */
@@ -237,18 +950,20 @@ static wavegen_info_t waveGen(int pin,
     /* Length (microseconds) of waveform still waiting to be generated */
     unsigned int micros_left = len-w_offset;
     /* Average amount of microseconds between two transitions in main waveform*/
-    unsigned int micros;
+    unsigned int micros = 0;
     /* Microseconds waveform spends on after a transition from OFF to ON */
-    unsigned int micros_on;
+    unsigned int micros_on = 0;
     /* Microseconds waveform spends off after a transition from ON to OFF */
-    unsigned int micros_off;
+    unsigned int micros_off = 0;
+    /* 1 if the waveform ends in the middle of a transition */
+    int cut = 0;
     /* Return value of this function */
     wavegen_info_t info;
-
-    /* These are used later in the wave combination phase, but they are defined
-       here in order to conform to standards */
-    unsigned int wIn1Counter, wIn2Counter, wOutCounter, elapsed;
-    unsigned int wIn1Delay, wIn2Delay;
+    /* Time of vibrato and tremolo */
+    unsigned int vUs, tUs;
+    /* What the frequency and duty cycle were last worked out from, see
+       waveCoarse() */
+    double last[4] = {-1, -1, -1, -1};
 
     unsigned int i = 0;
     unsigned int p = 0;
@@ -257,17 +972,42 @@ static wavegen_info_t waveGen(int pin,
     vWidth = (vWidth) ? vWidth : 1;  /* vWidth cannot be 0 */
     tWidth = (tWidth) ? tWidth : 1;  /* tWidth cannot be 0 */
 
-    /* If frequency is 0 or duty cycle is 0 or 1, construct empty waveform */
+    /* The offset can only be longer than the waveform when waveforms are very
+       short (see eventPlay()) */
+    if (w_offset >= len) micros_left = len;
+
+    /* If frequency is 0 or duty cycle is 0 or 1, construct empty waveform.
+       The offset left over from the last note is silent too, so the empty
+       waveform is the whole length (otherwise every rest after a note would
+       shorten the song). */
     if (!freq || duty <= 0 || duty >= 1) {
-        wIn2[0].gpioOn  = 0;
-        wIn2[0].gpioOff = 1<<pin;
-        wIn2[0].usDelay = micros_left;
+        wave[0].gpioOn  = 0;
+        wave[0].gpioOff = 1<<pin;
+        wave[0].usDelay = len;
         info.w_offset = 0;
         info.w_on     = 1;
         info.v_offset = 0;
         info.t_offset = 0;
         info.length = 1;
-        info.micros = micros_left;
+        info.micros = len;
+    }
+
+    /* If the offset fills the whole waveform, only continue the offset */
+    else if (w_offset >= len) {
+        if (w_on&1) { /* offset is off */
+            wave[0].gpioOn  = 0;
+            wave[0].gpioOff = 1<<pin;
+        } else {      /* offset is on */
+            wave[0].gpioOn  = 1<<pin;
+            wave[0].gpioOff = 0;
+        }
+        wave[0].usDelay = len;
+        info.w_offset = w_offset - len;
+        info.w_on     = w_on;
+        info.v_offset = (len+v_offset) % vWidth;
+        info.t_offset = (len+t_offset) % tWidth;
+        info.length = 1;
+        info.micros = len;
     }
 
     /* Otherwise, construct waveform normally */
@@ -275,19 +1015,29 @@ static wavegen_info_t waveGen(int pin,
         /* Add in the offset if required */
         if (w_offset) {
             if ((p&1) == (w_on&1)) { /* transition is from OFF to ON */
-                wIn2[0].gpioOn  = 1<<pin;
-                wIn2[0].gpioOff = 0;
-                wIn2[0].usDelay = w_offset;
+                wave[0].gpioOn  = 1<<pin;
+                wave[0].gpioOff = 0;
+                wave[0].usDelay = w_offset;
             } else { /* transition is from ON to OFF */
-                wIn2[0].gpioOn  = 0;
-                wIn2[0].gpioOff = 1<<pin;
-                wIn2[0].usDelay = w_offset;
+                wave[0].gpioOn  = 0;
+                wave[0].gpioOff = 1<<pin;
+                wave[0].usDelay = w_offset;
             }
             i++;
         }
 
         /* Generate the main waveform */
         while (vfac <= value) {
+            /* Stop before running off the end of wave, which a pitch too
+               high or a beat too long for it would otherwise do: the rest
+               of the beat becomes one transition below */
+            if (i >= PAGES*64 - 1) {
+                info.w_offset = 0;
+                i--;
+                p--;
+                break;
+            }
+
             /* Recalculation of values */
             ffac = len - micros_left;
             ffac = dmax(dmin(ffac, freqDelayE), freqDelayS) - freqDelayS;
@@ -295,27 +1045,50 @@ static wavegen_info_t waveGen(int pin,
             dfac = len - micros_left;
             dfac = dmax(dmin(dfac, dutyDelayE), dutyDelayS) - dutyDelayS;
             dfac /= dutyDelayE - dutyDelayS;
-            freq = interpolateFreq(freqS, freqE, ffac);
-            freq = vibrato(freq, vIntensity, vWidth, len-micros_left+v_offset);
-            duty = interpolateDuty(dutyS, dutyE, dfac);
-            duty = tremolo(duty, tIntensity, tWidth, len-micros_left+t_offset);
-            micros     = 1000000/(2*freq);
-            micros_on  = 2*micros*duty;
-            micros_off = 2*micros-micros_on;
+            vUs = len-micros_left+v_offset;
+            tUs = len-micros_left+t_offset;
+            if (!(effectUs || slideSteps) ||
+                waveCoarse(&ffac, &dfac, &vUs, &tUs, vIntensity, tIntensity,
+                           effectUs, slideSteps, last)) {
+                freq = interpolateFreq(freqS, freqE, ffac);
+                freq = vibrato(freq, vIntensity, vWidth, vUs);
+                duty = interpolateDuty(dutyS, dutyE, dfac);
+                duty = tremolo(duty, tIntensity, tWidth, tUs);
+                micros     = 1000000/(2*freq);
+                micros_on  = 2*micros*duty;
+                micros_off = 2*micros-micros_on;
+            }
 
             if ((p&1) != (w_on&1)) { /* transition is from OFF to ON */
-                wIn2[i].gpioOn  = 1<<pin;
-                wIn2[i].gpioOff = 0;
-                wIn2[i].usDelay = micros_on;
+                wave[i].gpioOn  = 1<<pin;
+                wave[i].gpioOff = 0;
+                /* Waveform ends before the pin is turned off again, which
+                   only happens when it is shorter than a period: the rest is
+                   the next waveform's offset */
+                if (micros_on > micros_left) {
+                    wave[i].usDelay = micros_left;
+                    info.w_offset   = micros_on-micros_left;
+                    micros_left     = 0;
+                    cut             = 1;
+                    break;
+                }
+                wave[i].usDelay = micros_on;
                 micros_left -= micros_on;
                 if (micros_left < micros_off) {
                     info.w_offset = micros_off-micros_left;
                     break;
                 }
             } else { /* transition is from ON to OFF */
-                wIn2[i].gpioOn  = 0;
-                wIn2[i].gpioOff = 1<<pin;
-                wIn2[i].usDelay = micros_off;
+                wave[i].gpioOn  = 0;
+                wave[i].gpioOff = 1<<pin;
+                if (micros_off > micros_left) {
+                    wave[i].usDelay = micros_left;
+                    info.w_offset   = micros_off-micros_left;
+                    micros_left     = 0;
+                    cut             = 1;
+                    break;
+                }
+                wave[i].usDelay = micros_off;
                 micros_left -= micros_off;
                 if (micros_left < micros_on) {
                     info.w_offset = micros_on-micros_left;
@@ -338,10 +1111,15 @@ static wavegen_info_t waveGen(int pin,
             dfac = len-micros_left;
             dfac = dmax(dmin(dfac,dutyDelayE),dutyDelayS)-dutyDelayS;
             dfac /= dutyDelayE - dutyDelayS;
+            vUs = len-micros_left+v_offset;
+            tUs = len-micros_left+t_offset;
+            if (effectUs || slideSteps)
+                waveCoarse(&ffac, &dfac, &vUs, &tUs, vIntensity, tIntensity,
+                           effectUs, slideSteps, last);
             freq = interpolateFreq(freqS, freqE, ffac);
-            freq = vibrato(freq, vIntensity, vWidth, len-micros_left+v_offset);
+            freq = vibrato(freq, vIntensity, vWidth, vUs);
             duty = interpolateDuty(dutyS, dutyE, dfac);
-            duty = tremolo(duty, tIntensity, tWidth, len-micros_left+t_offset);
+            duty = tremolo(duty, tIntensity, tWidth, tUs);
             micros     = 1000000/(2*freq);
             micros_on  = 2*micros*duty;
             micros_off = 2*micros-micros_on;
@@ -349,22 +1127,22 @@ static wavegen_info_t waveGen(int pin,
             i++;
             p++;
             if ((p&1) != (w_on&1)) { /* transition is from OFF to ON */
-                wIn2[i].gpioOn  = 1<<pin;
-                wIn2[i].gpioOff = 0;
-                wIn2[i].usDelay = micros_left;
+                wave[i].gpioOn  = 1<<pin;
+                wave[i].gpioOff = 0;
+                wave[i].usDelay = micros_left;
             } else { /* transition is from ON to OFF */
-                wIn2[i].gpioOn  = 0;
-                wIn2[i].gpioOff = 1<<pin;
-                wIn2[i].usDelay = micros_left;
+                wave[i].gpioOn  = 0;
+                wave[i].gpioOff = 1<<pin;
+                wave[i].usDelay = micros_left;
             }
         }
         else if (micros_left) {
             p    = 0;
             w_on = 0;
             info.w_offset   = 0;
-            wIn2[i].gpioOn  = 0;
-            wIn2[i].gpioOff = 1<<pin;
-            wIn2[i].usDelay = micros_left;
+            wave[i].gpioOn  = 0;
+            wave[i].gpioOff = 1<<pin;
+            wave[i].usDelay = micros_left;
         }
         info.w_on = (p&1) == (w_on&1);
         info.length = ++i;
@@ -375,465 +1153,3160 @@ static wavegen_info_t waveGen(int pin,
        having the same length as a whole transition. If this happens the
        w_on property will be miscalculated, so we must set the tail length to 0.
    */
-    if (info.w_offset == micros)
+    if (info.w_offset == micros && !cut)
         info.w_offset = 0;
 
-    /* Combine waveform with other previously added ones */
+    return info;
+}
 
-    /* This is the first waveform */
-    if (firstWave) {
-        /* Recalculate combined waveform length */
-        wOutLength = info.length;
-        firstWave = 0;
 
-        /* Copy contents of wIn2 into wOut */
-        memcpy(wOut, wIn2, info.length*sizeof(pulse_t));
-    }
+/*############################################################################*/
 
-    /* Other waveforms have been added before this one */
-    else {
-        /* Copy contents of wOut into wIn1 */
-        memcpy(wIn1, wOut, wOutLength*sizeof(pulse_t));
-        /* Delete contents of wOut */
-        memset(wOut, 0, PAGES*64*sizeof(pulse_t));
 
-        /* Array index counters */
-        wIn1Counter = 0;
-        wIn2Counter = 0;
-        wOutCounter = 0;
+/* Add a waveform generated by waveGen() to the queue.
+   wave:   The waveform.
+   length: Length of the waveform in transitions. */
+static void waveAdd(player_t *p, const pulse_t *wave, unsigned int length) {
+    /* Keep the waveform of this pin if the song is being compiled */
+    if (p->compiling) compileAdd(p, wave, length);
 
-        /* Microseconds of waveform that has been combined */
-        elapsed = 0;
+    /* Combine waveform with other previously added ones */
+    waveMerge(p, wave, length);
+}
 
-        /* Microseconds of wIn1 and wIn2 that have been added */
-        wIn1Delay = 0;
-        wIn2Delay = 0;
 
-        while (wIn1Counter <= wOutLength && wIn2Counter <= info.length) {
-            /* A transition in wIn2 happens at the same time
-               as a transition in wIn1.
-               If this happens we insert both the wIn2 transition and the
-               wIn1 transition. */
-            if (wIn1Delay == wIn2Delay) {
-                /* Add the delay for the previous transition we inserted */
-                if (elapsed < wIn1Delay) {
-                    wOut[wOutCounter-1].usDelay += wIn1Delay - elapsed;
-                    elapsed = wIn1Delay;
-                }
+/*############################################################################*/
 
-                /* Insert the wIn1 transition first */
-                wOut[wOutCounter].gpioOn  = wIn1[wIn1Counter].gpioOn;
-                wOut[wOutCounter].gpioOff = wIn1[wIn1Counter].gpioOff;
 
-                /* Recalculate index values */
-                wIn1Delay = elapsed + wIn1[wIn1Counter].usDelay;
-                wIn1Counter++;
-                wOutCounter++;
+/* Write the two control blocks of one transition, linked to the control
+   block after them.
+   cmd:   Index of the GPIO command of the transition. Its control blocks are
+          2*cmd and 2*cmd+1.
+   pulse: The transition. */
+static void cbWrite(player_t *p, unsigned int cmd, const pulse_t *pulse) {
+    cb_t *cbsV = p->dma->cbs_v, *cbsB = p->dma->cbs_b;
+    unsigned int cb = 2*cmd;
 
-                /* Add the delay for the previous transition we inserted */
-                if (elapsed < wIn2Delay) {
-                    wOut[wOutCounter-1].usDelay += wIn2Delay - elapsed;
-                    elapsed = wIn2Delay;
-                }
+    /* Copy over the GPIO on/off commands from pulse for DMA to read */
+    p->cmdV[cmd]  = pulse->gpioOn;
+    p->cmdV[cmd] |= pulse->gpioOff;
 
-                /* Then insert the wIn2 transition */
-                wOut[wOutCounter].gpioOn  = wIn2[wIn2Counter].gpioOn;
-                wOut[wOutCounter].gpioOff = wIn2[wIn2Counter].gpioOff;
+    /* Turn GPIO on/off */
+    if (pulse->gpioOn)
+        cbsV[cb].dest_ad = periph(GPIO_BASE, GPIO_SET);
+    else
+        cbsV[cb].dest_ad = periph(GPIO_BASE, GPIO_CLR);
+    cbsV[cb].ti          =  TIBASE;
+    cbsV[cb].source_ad   =  (unsigned int)&p->cmdB[cmd];
+    cbsV[cb].txfr_len    =  4;
+    cbsV[cb].nextconbk   =  (unsigned int)&cbsB[cb+1];
+    cb++;
 
-                /* Recalculate index values */
-                wIn2Delay = elapsed + wIn2[wIn2Counter].usDelay;
-                wIn2Counter++;
-                wOutCounter++;
-            }
+    /* Delay */
+    cbsV[cb].ti          =  TIBASE | CB_DEST_DREQ | CB_PERMAP(p->dma->permap);
+    cbsV[cb].source_ad   =  (unsigned int)&p->cmdB[0];
+    cbsV[cb].dest_ad     =  p->dma->fifo;
+    cbsV[cb].txfr_len    =  4 * pulse->usDelay;
+    cbsV[cb].nextconbk   =  (unsigned int)&cbsB[cb+1];
+}
 
-            /* A transition in wIn2 happens before the next
-               transition in wIn1.
-               If this happens we insert the wIn2 transition but not the
-               wIn1 transition. */
-            else if (wIn2Delay < wIn1Delay) {
-                /* Add the delay for the previous transition we inserted */
-                if (elapsed < wIn2Delay) {
-                    wOut[wOutCounter-1].usDelay += wIn2Delay - elapsed;
-                    elapsed = wIn2Delay;
-                }
 
-                /* Insert the wIn2 transition */
-                wOut[wOutCounter].gpioOn  = wIn2[wIn2Counter].gpioOn;
-                wOut[wOutCounter].gpioOff = wIn2[wIn2Counter].gpioOff;
+/*############################################################################*/
 
-                /* Recalculate index values */
-                wIn2Delay = elapsed + wIn2[wIn2Counter].usDelay;
-                wIn2Counter++;
-                wOutCounter++;
-            }
 
-            /* A transition in wIn1 happens before the next
-               transition in wIn2.
-               If this happens we insert the wIn1 transition but not the
-               wIn2 transition. */
-            else {
-                /* Add the delay for the previous transition we inserted */
-                if (elapsed < wIn1Delay) {
-                    wOut[wOutCounter-1].usDelay += wIn1Delay - elapsed;
-                    elapsed = wIn1Delay;
-                }
+/* Find the control block DMA is at. If it is before the one found last
+   time, DMA has gone back to the first control block, so dma_laps is
+   incremented. Control blocks are only written behind DMA while this is
+   being checked, so DMA cannot go round and pass dma_last unnoticed. */
+static unsigned int dmaPosition(player_t *p) {
+    unsigned int cb = driver_dma_current_cb(p->dma);
+    if (cb < p->dma_last) p->dma_laps++;
+    p->dma_last = cb;
+    return cb;
+}
 
-                /* Insert the wIn1 transition */
-                wOut[wOutCounter].gpioOn  = wIn1[wIn1Counter].gpioOn;
-                wOut[wOutCounter].gpioOff = wIn1[wIn1Counter].gpioOff;
 
-                /* Recalculate index values */
-                wIn1Delay = elapsed + wIn1[wIn1Counter].usDelay;
-                wIn1Counter++;
-                wOutCounter++;
-            }
-        }
+/*############################################################################*/
 
-        /* Recalculate combined waveform length */
-        wOutLength = wOutCounter;
-    }
 
-    return info;
+/* Check for DMA and PWM errors. Telemetry only follows the default DMA
+   channel, so other players are not checked. */
+static void telemetrySample(player_t *p, unsigned int beat) {
+    if (p->dmach < 0) telemetry_sample(beat);
 }
 
 
 /*############################################################################*/
 
 
-/* Transmit all queued waveforms. Deletes queued waveforms upon being run.
+/* Leave out the parts of transitions that would not change the level of a
+   pin, such as the transition silent pins make at the start of every beat,
+   and transitions that are then left with no pins. Their delays are added to
+   the transition before them, so that one delay control block takes the
+   place of several. Only the first transition of the beat stays even with
+   no pins, if it has a delay, as the delay before it has been written.
+   wave:   Combined waveform.
+   length: Length of wave in transitions.
+   Returns the length of the waveform left in wSend. */
+static unsigned int waveElide(player_t *p, const pulse_t *wave,
+                              unsigned int length) {
+    pulse_t *out = p->wSend;
+    unsigned int i, n = 0, on, off;
+
+    for (i = 0; i < length; i++) {
+        on  = wave[i].gpioOn  & ~(p->levelKnown &  p->level);
+        off = wave[i].gpioOff & ~(p->levelKnown & ~p->level);
+        p->levelKnown |= on | off;
+        p->level       = (p->level | on) & ~off;
+
+        if (!on && !off && n) {
+            out[n-1].usDelay += wave[i].usDelay;
+            continue;
+        }
+        /* Nothing happens at the start of the beat before the next one */
+        if (!on && !off && !wave[i].usDelay) continue;
+        out[n].gpioOn  = on;
+        out[n].gpioOff = off;
+        out[n].usDelay = wave[i].usDelay;
+        n++;
+    }
+    /* Something has to be written, even if nothing changes */
+    if (!n) {
+        out[0].gpioOn  = 0;
+        out[0].gpioOff = 0;
+        out[0].usDelay = 0;
+        n = 1;
+    }
+    return n;
+}
+
+
+/*############################################################################*/
+
+
+/* Write control blocks for a combined waveform and start DMA if needed.
    Please note that if no control blocks are available for the waveform,
-   this function sleeps until enough can be made available, and then adds it. */
-static void waveTransmit(void) {
-    int dmaRunning = dma_running();
+   this function sleeps until enough can be made available, and then adds it.
+   Transitions that would not change any pin are left out (see
+   waveElide()).
+   beat:   Beat being transmitted, used for telemetry.
+   wave:   Combined waveform.
+   length: Length of wave in transitions. */
+static void waveSend(player_t *p, unsigned int beat, const pulse_t *wave,
+                     unsigned int length) {
+    cb_t *cbsV = p->dma->cbs_v, *cbsB = p->dma->cbs_b;
+    int dmaRunning;
 
     unsigned int wave_index = 0;
-    if (!dmaRunning) cmd_index = 0;
-    if (!dmaRunning) cbs_index = 0;
+    unsigned long us = 0;
+    unsigned long start = TIMING_NOW(), waited = 0, t;
+
+    length = waveElide(p, wave, length);
+    wave   = p->wSend;
+
+    /* If DMA has stopped, everything written has been played, so start again
+       from the first control block */
+    dmaRunning = driver_dma_running(p->dma);
+    if (!dmaRunning) {
+        /* DMA ran out before this beat, unless it is the first */
+        if (p->progressBeats) p->qos.underruns++;
+        p->qosStartUs = trace_now();
+        p->qosSentUs  = 0;
+        p->cmd_index = 0;
+        p->cbs_index = 0;
+        p->cbs_laps  = 0;
+        p->dma_laps  = 0;
+        p->dma_last  = 0;
+    }
+    /* Notice if DMA went back to the first control block since last time */
+    else dmaPosition(p);
 
     /* No control blocks left to accomodate new waveform? No problem!
        Just recycle old unused control blocks, starting from the beginning */
-    if (cmd_index + wOutLength >= PAGES*64) {
+    if (p->cmd_index + length >= PAGES*64) {
         /* Point last written control block back to first control block */
-        cbs_v[cbs_index-1].nextconbk = (unsigned int)&cbs_b[0];
+        cbsV[p->cbs_index-1].nextconbk = (unsigned int)&cbsB[0];
 
         /* Wait until DMA reads first control block of this iteration
            (so as to prevent writing over unread control blocks) */
-        while (cbs_laps == dma_laps + 1) {
-            /* Increment dma_laps if current DMA index < previous DMA index
-               (because it means DMA went back to first control block) */
-            if (dmaRunning) dma_last = dma_current_cb();
-            usleep(2500);
-            if (dma_current_cb() < dma_last) dma_laps++;
+        if (p->cbs_laps == p->dma_laps + 1) {
+            t = TIMING_NOW();
+            do {
+                usleep(2500);
+                dmaPosition(p);
+                telemetrySample(p, beat);
+                TRACE_COUNTER("dma_cb", p->dma_last);
+            } while (p->cbs_laps == p->dma_laps + 1);
+            waited += TIMING_NOW() - t;
+            TRACE_SPAN("wait", t, "beat", beat);
         }
 
         /* Reset indices to point back to first control block */
-        cmd_index = 0;
-        cbs_index = 0;
+        p->cmd_index = 0;
+        p->cbs_index = 0;
 
         /* Increment cbs_laps */
-        cbs_laps++;
+        p->cbs_laps++;
     }
 
     /* Prevent DMA from stopping when it reaches last written control block */
-    if (cbs_index)
-        cbs_v[cbs_index-1].nextconbk = (unsigned int)&cbs_b[cbs_index];
+    if (p->cbs_index)
+        cbsV[p->cbs_index-1].nextconbk = (unsigned int)&cbsB[p->cbs_index];
 
-    /* Manually create each control block using info from wOut */
-    for (; wave_index < wOutLength; cmd_index++, wave_index++) {
-        /* Wait until DMA has read this control block before recycling it
-           (so as to prevent writing over unread control blocks) */
-        while (cbs_laps == dma_laps + 1 && dma_current_cb() <= cbs_index) {
-            /* Increment dma_laps if current DMA index < previous DMA index
-               (because it means DMA went back to first control block) */
-            if (dmaRunning) dma_last = dma_current_cb();
-            usleep(2500);
-            if (dma_current_cb() < dma_last) dma_laps++;
-        }
-
-        /* Copy over the GPIO on/off commands from wOut for DMA to read */
-        cmdV[cmd_index]  = wOut[wave_index].gpioOn;
-        cmdV[cmd_index] |= wOut[wave_index].gpioOff;
-
-        /* Turn GPIO on/off */
-        if (wOut[wave_index].gpioOn)
-            cbs_v[cbs_index].dest_ad = periph(GPIO_BASE, GPIO_SET);
-        else
-            cbs_v[cbs_index].dest_ad = periph(GPIO_BASE, GPIO_CLR);
-        cbs_v[cbs_index].ti          =  TIBASE;
-        cbs_v[cbs_index].source_ad   =  (unsigned int)&cmdB[cmd_index];
-        cbs_v[cbs_index].txfr_len    =  4;
-        cbs_v[cbs_index].nextconbk   =  (unsigned int)&cbs_b[cbs_index+1];
-        cbs_index++;
-
-        /* Delay */
-        cbs_v[cbs_index].ti          =  TIBASE | CB_DEST_DREQ | CB_PERMAP(5);
-        cbs_v[cbs_index].source_ad   =  (unsigned int)&cmdB[0];
-        cbs_v[cbs_index].dest_ad     =  periph(PWM_BASE, PWM_FIF1);
-        cbs_v[cbs_index].txfr_len    =  4 * wOut[wave_index].usDelay;
-        cbs_v[cbs_index].nextconbk   =  (unsigned int)&cbs_b[cbs_index+1];
-        cbs_index++;
+    /* Manually create each control block using info from wave */
+    for (; wave_index < length; p->cmd_index++, wave_index++) {
+        /* Wait until DMA has read both control blocks of this transition
+           before recycling them (so as to prevent writing over unread control
+           blocks, or the delay DMA is in the middle of) */
+        if (p->cbs_laps == p->dma_laps + 1 &&
+            dmaPosition(p) <= p->cbs_index + 1) {
+            t = TIMING_NOW();
+            do {
+                usleep(2500);
+                telemetrySample(p, beat);
+                TRACE_COUNTER("dma_cb", p->dma_last);
+            } while (p->cbs_laps == p->dma_laps + 1 &&
+                     dmaPosition(p) <= p->cbs_index + 1);
+            waited += TIMING_NOW() - t;
+            TRACE_SPAN("wait", t, "beat", beat);
+        }
+
+        cbWrite(p, p->cmd_index, &wave[wave_index]);
+        p->cbs_index += 2;
+        us += wave[wave_index].usDelay;
     }
     /* Cause DMA to stop when it reaches last written control block */
-    cbs_v[cbs_index-1].nextconbk = 0;
+    cbsV[p->cbs_index-1].nextconbk = 0;
+
+    if (!dmaRunning) driver_activate_dma(p->dma, 0);
+
+    /* Check for DMA and PWM errors once per beat */
+    telemetrySample(p, beat);
+
+    TIMING_SENT(p, dmaRunning, us);
+    if (waited) TIMING_ADD(p, TIMING_WAIT, waited, 0);
+    TIMING_ADD(p, TIMING_EMIT, TIMING_NOW() - start - waited, length);
+    TRACE_SPAN("emit", start, "beat", beat);
+    TRACE_COUNTER("dma_cb", dmaPosition(p));
+    TRACE_COUNTER("cb_written", p->cbs_index);
+
+    /* Progress, for playPoll() */
+    p->progressBeats = beat + 1;
+    p->progressUs   += us;
+    p->qosSentUs    += us;
+}
+
+
+/*############################################################################*/
+
+
+/* Publish the counters of a beat just sent to DMA, if metricsOpen() was used.
+   This only writes memory, so it is called on the thread sending beats.
+   beat:   Beat sent.
+   length: Transitions of the beat.
+   genUs:  Microseconds generating it took, or 0 if it was not timed. */
+static void metricsBeat(player_t *p, unsigned int beat, unsigned int length,
+                        unsigned long genUs) {
+    metrics_t *m = p->metrics;
+    telemetry_t tm;
+    unsigned int i = 0;
+    unsigned long us;
+
+    if (!m) return;
+    metrics_write_begin(m);
+    m->beat       = beat + 1;
+    m->total      = p->progressTotal;
+    m->beats++;
+    m->ringFill   = p->ringDepth ? p->ringHead - p->ringTail : 0;
+    m->ringDepth  = p->ringDepth;
+    m->ringUs     = p->ringDepth ? p->ringUsIn - p->ringUsOut : 0;
+    m->dmaStartUs = p->qosStartUs;
+    m->dmaSentUs  = p->qosSentUs;
+    m->underruns  = p->qos.underruns;
+    m->cbs       += 2*length;
+    if (genUs) {
+        for (us = genUs; us && i < METRICS_BUCKETS-1; us >>= 1) i++;
+        m->genHist[i]++;
+        m->genBeats++;
+        if (genUs > m->genMaxUs) m->genMaxUs = genUs;
+    }
+    if (p->dmach < 0) {
+        telemetry_read(&tm);
+        for (i = 0; i < TM_CLASSES; i++) m->errors[i] = tm.cls[i].count;
+    }
+    m->patternHits   = p->patternStats.hits;
+    m->patternMisses = p->patternStats.misses;
+    m->qosLevel      = p->qosLevel;
+    metrics_write_end(m);
+}
+
+
+/*############################################################################*/
+
+
+/* Publish that a song has started or finished, if metricsOpen() was used.
+   playing: 1 if it has started, 0 if it has finished. */
+static void metricsSong(player_t *p, int playing) {
+    metrics_t *m = p->metrics;
+
+    if (!m) return;
+    metrics_write_begin(m);
+    m->playing = playing;
+    if (playing) {
+        m->songs++;
+        m->beat  = 0;
+        m->total = 0;
+    }
+    m->qosLevel = p->qosLevel;
+    metrics_write_end(m);
+}
+
+
+/*############################################################################*/
+
+
+/* Transmitter thread: send the beats in the pipeline to DMA, in order, until
+   the generator has finished. */
+static void *pipelineRun(void *arg) {
+    player_t *p = arg;
+    pipeline_slot_t *slot;
+    unsigned int tail = p->ringTail, fill;
+    unsigned long ahead, idle = 0;
+    int empty = 0;
+
+    TRACE_THREAD("transmitter");
+    for (;;) {
+        /* Nothing to send: wait for the generator */
+        if (tail == p->ringHead) {
+            if (p->ringDone) {
+                __sync_synchronize();
+                if (tail == p->ringHead) break;
+                continue;
+            }
+            /* DMA may run out while waiting if the generator is behind */
+            if (!empty && tail) {
+                p->pipelineStats.starved++;
+                empty = 1;
+                idle  = TIMING_NOW();
+            }
+            usleep(PIPELINE_POLL);
+            continue;
+        }
+        if (empty) TRACE_SPAN("starved", idle, NULL, 0);
+        empty = 0;
+        /* Read the slot only after seeing that it has been written */
+        __sync_synchronize();
+        slot = &p->ring[tail % p->ringDepth];
+
+        /* Beats and microseconds generated ahead of the one being sent.
+           The minimum is only kept once the ring has been full, so that
+           the first beats and the last ones do not count. */
+        fill  = p->ringHead - tail;
+        ahead = p->ringUsIn - p->ringUsOut;
+        p->pipelineStats.beats++;
+        p->pipelineStats.fill += fill;
+        p->pipelineStats.aheadUs += ahead;
+        if (fill > p->pipelineStats.maxFill) p->pipelineStats.maxFill = fill;
+        if (p->pipelineStats.stalls && !p->ringDone &&
+            (!p->pipelineStats.minAheadUs ||
+             ahead < p->pipelineStats.minAheadUs))
+            p->pipelineStats.minAheadUs = ahead;
+
+        /* Beats still waiting when the song is cancelled are not played */
+        if (!p->cancel) {
+            waveSend(p, slot->beat,
+                     p->ringPulses + (tail % p->ringDepth)*PAGES*64,
+                     slot->length);
+            metricsBeat(p, slot->beat, slot->length, slot->genUs);
+        }
+
+        /* Give the slot back to the generator */
+        p->ringUsOut += slot->us;
+        __sync_synchronize();
+        p->ringTail = ++tail;
+    }
+    return NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Start the transmitter thread, if the pipeline is enabled. The generator
+   then generates each beat into the next free slot of the pipeline. */
+static void pipelineOpen(player_t *p) {
+    memset(&p->pipelineStats, 0, sizeof(p->pipelineStats));
+    /* Interactive playing writes control blocks itself */
+    p->ringDepth = p->live ? 0 : p->pipelineDepth;
+    if (!p->ringDepth) return;
+
+    p->ring       = malloc(p->ringDepth*sizeof(pipeline_slot_t));
+    p->ringPulses = malloc(p->ringDepth*PAGES*64*sizeof(pulse_t));
+    p->ringHead   = 0;
+    p->ringTail   = 0;
+    p->ringUsIn   = 0;
+    p->ringUsOut  = 0;
+    p->ringDone   = 0;
+    p->pipelineStats.depth = p->ringDepth;
+
+    if (pthread_create(&p->transmitter, NULL, pipelineRun, p)) {
+        fprintf(stderr, "ERROR: pipelineOpen(): Could not start transmitter "
+                        "thread, not using the pipeline.\n");
+        free(p->ring);
+        free(p->ringPulses);
+        p->ringDepth = 0;
+        p->pipelineStats.depth = 0;
+        return;
+    }
+    p->wOut = p->ringPulses;
+}
+
+
+/*############################################################################*/
+
+
+/* Wait for the transmitter thread to send every beat and stop it. */
+static void pipelineClose(player_t *p) {
+    if (!p->ringDepth) return;
+
+    __sync_synchronize();
+    p->ringDone = 1;
+    pthread_join(p->transmitter, NULL);
+
+    free(p->ring);
+    free(p->ringPulses);
+    p->ringDepth = 0;
+    p->wOut = p->wOutBuf;
+
+    if (p->pipelineStats.beats)
+        fprintf(stderr, "pipeline: depth=%u beats=%lu avg ahead=%.1f beats "
+                        "%lu us, min ahead=%lu us, stalls=%lu starved=%lu\n",
+                p->pipelineStats.depth, p->pipelineStats.beats,
+                (double)p->pipelineStats.fill/p->pipelineStats.beats,
+                p->pipelineStats.aheadUs/p->pipelineStats.beats,
+                p->pipelineStats.minAheadUs,
+                p->pipelineStats.stalls, p->pipelineStats.starved);
+}
 
-    if (!dmaRunning) activate_dma(0);
+
+/*############################################################################*/
+
+
+/* Transmit all queued waveforms. Deletes queued waveforms upon being run.
+   Without the pipeline, this writes control blocks for the waveform in wOut
+   (see waveSend()). With it, the waveform is handed to the transmitter
+   thread, and this sleeps until the pipeline has a free slot for the next.
+   beat: Beat being transmitted, used for telemetry. */
+static void waveTransmit(player_t *p, unsigned int beat) {
+    pipeline_slot_t *slot;
+    unsigned int i, us = 0;
+    unsigned long start;
+
+    /* Nothing is sent to DMA while compiling */
+    if (p->compiling) {
+        p->wOutLength = 0;
+        p->firstWave = 1;
+        return;
+    }
+
+    if (!p->ringDepth) {
+        waveSend(p, beat, p->wOut, p->wOutLength);
+        metricsBeat(p, beat, p->wOutLength, p->genUs);
+    } else {
+        for (i = 0; i < p->wOutLength; i++) us += p->wOut[i].usDelay;
+        slot = &p->ring[p->ringHead % p->ringDepth];
+        slot->beat   = beat;
+        slot->length = p->wOutLength;
+        slot->us     = us;
+        slot->genUs  = p->genUs;
+        p->ringUsIn   += us;
+        /* Make the slot visible to the transmitter only once written */
+        __sync_synchronize();
+        p->ringHead++;
+
+        /* Wait for the transmitter to free a slot (backpressure) */
+        if (p->ringHead - p->ringTail == p->ringDepth) {
+            p->pipelineStats.stalls++;
+            start = TIMING_NOW();
+            while (p->ringHead - p->ringTail == p->ringDepth)
+                usleep(PIPELINE_POLL);
+            TIMING_ADD(p, TIMING_STALL, TIMING_NOW() - start, 0);
+            TRACE_SPAN("stall", start, "beat", beat);
+        }
+        __sync_synchronize();
+        p->wOut = p->ringPulses + (p->ringHead % p->ringDepth)*PAGES*64;
+    }
 
     /* Consume previous waveforms */
-    wOutLength = 0;
-    firstWave = 1;
+    p->wOutLength = 0;
+    p->firstWave = 1;
+    p->genUs = 0;
 }
 
 
 /*############################################################################*/
 
 
-/* Add a voice to the queue.
-   pin:    GPIO pin number (BCM) through which the voice plays.
-   freqs:  Array of frequencies (Hz). A zero (0) indicates pin should be off.
-   duties: Array of duty cycles (0 to 1, exclusive).
-   misc:   Array of misc_t pointers containing extra data. This may be NULL. */
-void queueAdd(int pin, double *freqs, double *duties, misc_t **misc) {
-    pins      |= 1<<pin;
-    _freq[pin] = freqs;
-    _duty[pin] = duties;
-    _misc[pin] = misc;
+/* Run waveGen() for one job.
+   wave: Where to write the waveform. */
+static void waveJob(player_t *p, wavegen_job_t *job, pulse_t *wave) {
+    wavegen_info_t *info = &p->info[job->pin];
+    unsigned long start = TIMING_NOW();
+
+    job->info = waveGen(wave,
+                        job->pin,
+                        job->freqS, job->freqE,
+                        job->freqDelayS, job->freqDelayE,
+                        job->dutyS, job->dutyE,
+                        job->dutyDelayS, job->dutyDelayE,
+                        job->vIntensity, job->vWidth,
+                        job->tIntensity, job->tWidth,
+                        job->len, job->value,
+                        info->v_offset, info->t_offset,
+                        info->w_offset, info->w_on,
+                        job->effectUs, job->slideSteps);
+    job->us = TIMING_NOW() - start;
+    TRACE_SPAN("gen", start, "pin", job->pin);
 }
 
 
 /*############################################################################*/
 
 
-/* Play queue. This function also consumes the queue.
-   us:    Length of each beat in microseconds (60000000/BPM).
-   beats: Total number of queued beats. */
-void queuePlay(unsigned int us, unsigned int beats) {
-    unsigned int beat;
-    unsigned int pin;
-    unsigned int _pins;
+/* Take the next job of a round that nobody has taken yet.
+   Returns the job number, or -1 if there are none left. */
+static int waveClaim(player_t *p, unsigned int round) {
+    unsigned int next;
+    for (;;) {
+        next = p->jobNext;
+        __sync_synchronize();
+        if (next>>8 != round || (next & 0xFF) >= p->jobCount) return -1;
+        if (__sync_bool_compare_and_swap(&p->jobNext, next, next + 1))
+            return next & 0xFF;
+    }
+}
 
-    static double value;
-    static double freqAS[32], freqAE[32];
-    static double dutyAS[32], dutyAE[32];
-    static char ifc = 0;
-    static unsigned int ff = 0, fd = 0;
-    static double initF[32], endF[32];
-    static double initD[32], endD[32];
-    static double facF[32], facD[32];
-    static double freqFrom[32], freqTo[32], _freqTo[32], freqRS[32], freqRE[32];
-    static double dutyFrom[32], dutyTo[32], _dutyTo[32], dutyRS[32], dutyRE[32];
-    static double vIntensity[32], _vIntensity[32];
-    static double tIntensity[32], _tIntensity[32];
-    static unsigned int vWidth[32], _vWidth[32];
-    static unsigned int tWidth[32], _tWidth[32];
-    static unsigned int changeUs = 0;
-
-    /* Setup DMA, allocate pages for control blocks */
-    driver_setup(PAGES);
-
-    /* Make pages for DMA to receive GPIO commands from */
-    cmdH = vc_create((void **)&cmdV, (void **)&cmdB, PAGES);
 
-    /* Set initial "w_offset" value to 0, initial "w_on" value to 1,
-       initial "t_offset" and "v_offset" values to 0 and
-       initial intensity and width values to 0 */
-    for (pin = 0; pin < 32; pin++) {
-        _info[pin].v_offset = 0;
-        _info[pin].t_offset = 0;
-        _vIntensity[pin]    = 0;
-        _vWidth[pin]        = 0;
-        _tIntensity[pin]    = 0;
-        _tWidth[pin]        = 0;
-        _info[pin].w_offset = 0;
-        _info[pin].w_on     = 1;
+/*############################################################################*/
+
+
+/* Worker thread: help generate the waveforms of each beat. */
+static void *generatorRun(void *arg) {
+    player_t *p = arg;
+    unsigned int round = 0;
+    int job;
+
+    TRACE_THREAD("generator");
+    for (;;) {
+        /* Sleep until the next beat */
+        pthread_mutex_lock(&p->workerLock);
+        while (p->workerRound == round && !p->workerQuit)
+            pthread_cond_wait(&p->workerWake, &p->workerLock);
+        round = p->workerRound;
+        pthread_mutex_unlock(&p->workerLock);
+        if (p->workerQuit) break;
+
+        while ((job = waveClaim(p, round)) >= 0) {
+            waveJob(p, &p->job[job], p->jobWave[p->job[job].pin]);
+            __sync_fetch_and_add(&p->jobsDone, 1);
+        }
     }
+    return NULL;
+}
 
-    /* This loops through each beat. Generates one waveform per beat. */
-    for (beat = 0; beat < beats; beat++) {
-        /* Change global beat length if it was requested */
-        if (changeUs) {
-            us = changeUs;
-            changeUs = 0;
+
+/*############################################################################*/
+
+
+/* Start the worker threads, if more than one thread is to generate. */
+static void generatorOpen(player_t *p) {
+    unsigned int i;
+
+    p->workerQuit  = 0;
+    p->workerRound = 0;
+    p->jobNext     = 0;
+    for (i = 0; i + 1 < p->generatorThreads && i < GENERATOR_MAX; i++) {
+        if (pthread_create(&p->worker[i], NULL, generatorRun, p)) {
+            fprintf(stderr, "ERROR: generatorOpen(): Could not start worker "
+                            "thread, using %u threads.\n", i + 1);
+            break;
         }
-        /* This loops through each pin. Run waveGen() once for each pin
-           in order to produce one combined waveform on several pins. */
-        for (_pins = pins, pin = 0; pin < 32; _pins >>= 1, pin++) {
-            if (_pins&1) {
-                freqFrom[pin]=(ff&pins&(1<<pin))?_freqTo[pin]:_freq[pin][beat];
-                freqTo[pin]  = _freq[pin][beat];
-                freqRS[pin]  = 0;
-                freqRE[pin]  = us;
-                dutyFrom[pin]=(fd&pins&(1<<pin))?_dutyTo[pin]:_duty[pin][beat];
-                dutyTo[pin]  = _duty[pin][beat];
-                dutyRS[pin]  = 0;
-                dutyRE[pin]  = us;
-                value        = 1;
-
-                /* Record properties from misc */
-                /* Check if there are misc properties for current pin, beat */
-                ifc = _misc[pin] && _misc[pin][beat];
-                /* If the note value is defined and non-zero, change
-                   the note value from its default value of 1. */
-                if (ifc&&_misc[pin][beat]->value)
-                    value = _misc[pin][beat]->value;
-                /* If the usingPs property is on or if pitch slide is
-                   already on, adjust frequency to correspond */
-                if ((ifc&&_misc[pin][beat]->usingPs)||(ff&pins&(1<<pin))) {
-                    /* If this is the first beat of the pitch slide */
-                    if (!(ff&pins&(1<<pin))) {
-                        ff |= 1<<pin;
-                        /* Record initial frequency */
-                        initF[pin]  = _freq[pin][beat];
-                        /* Record desired ending frequency */
-                        endF[pin]   = _misc[pin][beat]->freqTo;
-                        /* Relative microseconds offset of slide start */
-                        freqRS[pin] = _misc[pin][beat]->freqS * us;
-                        /* Relative microseconds offset of slide end */
-                        freqRE[pin] = _misc[pin][beat]->freqE * us;
-                        /* Amount of beats from start of song of slide start */
-                        freqAS[pin] = _misc[pin][beat]->freqS + beat;
-                        /* Amount of beats from start of song of slide end */
-                        freqAE[pin] = _misc[pin][beat]->freqE + beat;
-                    }
-                    /* Compute where the ending frequency of the current beat
-                       should be between the starting and ending frequencies
-                       of the entire pitch slide, expressed as a
-                       double between 0 and 1 */
-                    facF[pin] = (beat+1-freqAS[pin])/(freqAE[pin]-freqAS[pin]);
-                    facF[pin] = dmax(dmin(facF[pin],1),0);
-                    /* Using this data compute the actual ending frequency for
-                       this beat */
-                    freqTo[pin] = endF[pin];
-                    freqTo[pin] =
-                        interpolateFreq(initF[pin],freqTo[pin],facF[pin]);
-                    /* Record this ending frequency for later use, as it is the
-                       starting frequency for the next beat */
-                    _freqTo[pin] = freqTo[pin];
-                    /* If the factor is 1 (indicating the end of the slide
-                       occurred somewhere within the current beat) stop
-                       doing frequency slide */
-                    if (facF[pin] >= 1 && (ff&pins&(1<<pin))) ff&=~(1<<pin);
-                }
-                /* If the usingDs property is on or if dutycycle slide is
-                   already on, adjust dutycycle to correspond */
-                if ((ifc&&_misc[pin][beat]->usingDs)||(fd&pins&(1<<pin))) {
-                    /* If this is the first beat of the dutycycle slide */
-                    if (!(fd&pins&(1<<pin))) {
-                        fd |= 1<<pin;
-                        /* Record initial dutycycle */
-                        initD[pin]  = _duty[pin][beat];
-                        /* Record desired ending dutycycle */
-                        endD[pin]   = _misc[pin][beat]->dutyTo;
-                        /* Relative microseconds offset of slide start */
-                        dutyRS[pin] = _misc[pin][beat]->dutyS * us;
-                        /* Relative microseconds offset of slide end */
-                        dutyRE[pin] = _misc[pin][beat]->dutyE * us;
-                        /* Amount of beats from start of song of slide start */
-                        dutyAS[pin] = _misc[pin][beat]->dutyS + beat;
-                        /* Amount of beats from start of song of slide end */
-                        dutyAE[pin] = _misc[pin][beat]->dutyE + beat;
-                    }
-                    /* Compute where the ending dutycycle of the current beat
-                       should be between the starting and ending dutycycle
-                       of the entire dutycycle slide, expressed as a
-                       double between 0 and 1 */
-                    facD[pin] = (beat+1-dutyAS[pin])/(dutyAE[pin]-dutyAS[pin]);
-                    facD[pin] = dmax(dmin(facD[pin],1),0);
-                    /* Using this data compute the actual ending dutycycle for
-                       this beat */
-                    dutyTo[pin] = endD[pin];
-                    dutyTo[pin] =
-                        interpolateFreq(initD[pin],dutyTo[pin],facD[pin]);
-                    /* Record this ending dutycycle for later use, as it is the
-                       starting dutycycle for the next beat */
-                    _dutyTo[pin] = dutyTo[pin];
-                    /* If the factor is 1 (indicating the end of the slide
-                       occurred somewhere within the current beat) stop
-                       doing dutycycle slide */
-                    if (facD[pin] >= 1 && (fd&pins&(1<<pin))) fd&=~(1<<pin);
-                }
-                /* If the usingV property is on, modify vibrato parameters */
-                if (ifc&&_misc[pin][beat]->usingV) {
-                    vIntensity[pin]  = _misc[pin][beat]->vInt;
-                    vWidth[pin]      = _misc[pin][beat]->vWth;
-                    _vIntensity[pin] = vIntensity[pin];
-                    _vWidth[pin]     = vWidth[pin];
-                }
-                /* If the usingV property is off, restore vibrato parameters */
-                else {
-                    vIntensity[pin] = _vIntensity[pin];
-                    vWidth[pin]     = _vWidth[pin];
-                }
-                /* If the usingT property is on, modify tremolo parameters */
-                if (ifc&&_misc[pin][beat]->usingT) {
-                    tIntensity[pin]  = _misc[pin][beat]->tInt;
-                    tWidth[pin]      = _misc[pin][beat]->tWth;
-                    _tIntensity[pin] = tIntensity[pin];
-                    _tWidth[pin]     = tWidth[pin];
-                }
-                /* If the usingT property is off, restore tremolo parameters */
-                else {
-                    tIntensity[pin] = _tIntensity[pin];
-                    tWidth[pin]     = _tWidth[pin];
-                }
-                /* If the us property is non-zero, change the global beat length
-                   next beat */
-                if (ifc&&_misc[pin][beat]->us)
-                    changeUs = _misc[pin][beat]->us;
+    }
+    p->workers = i;
+}
 
-                /* Set GPIO pin mode to output */
-                gpio_mode(pin, OUT);
-                /* Run waveGen() */
-                _info[pin] = waveGen(
-                    pin,                             /*       int pin         */
-                    freqFrom[pin],                   /*    double freqS       */
-                    freqTo[pin],                     /*    double freqE       */
-                    dmin(us, freqRS[pin]),           /*  unsigned freqDelayS  */
-                    dmin(us, freqRE[pin]),           /*  unsigned freqDelayE  */
-                    dutyFrom[pin],                   /*    double dutyS       */
-                    dutyTo[pin],                     /*    double dutyE       */
-                    dmin(us, dutyRS[pin]),           /*  unsigned dutyDelayS  */
-                    dmin(us, dutyRE[pin]),           /*  unsigned dutyDelayE  */
-                    vIntensity[pin],                 /*    double vIntensity  */
-                    vWidth[pin],                     /*  unsigned vWidth      */
-                    tIntensity[pin],                 /*    double tIntensity  */
-                    tWidth[pin],                     /*  unsigned tWidth      */
-                    us,                              /*  unsigned len         */
-                    value,                           /*    double value       */
-                    _info[pin].v_offset,             /*  unsigned v_offset    */
-                    _info[pin].t_offset,             /*  unsigned t_offset    */
-                    _info[pin].w_offset,             /*  unsigned w_offset    */
-                    _info[pin].w_on);                /*      char w_on        */
-            }
+
+/*############################################################################*/
+
+
+/* Stop the worker threads and free their buffers. */
+static void generatorClose(player_t *p) {
+    unsigned int i;
+
+    pthread_mutex_lock(&p->workerLock);
+    p->workerQuit = 1;
+    pthread_cond_broadcast(&p->workerWake);
+    pthread_mutex_unlock(&p->workerLock);
+    for (i = 0; i < p->workers; i++) pthread_join(p->worker[i], NULL);
+    p->workers = 0;
+
+    for (i = 0; i < 32; i++) {
+        free(p->jobWave[i]);
+        p->jobWave[i] = NULL;
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Generate the waveforms of the jobs in job and add them to the queue, in
+   order. Worker threads generate them at the same time, if there are any.
+   jobs: Amount of jobs. */
+static void waveJobs(player_t *p, unsigned int jobs) {
+    unsigned int i, round;
+    int job;
+
+    /* On one thread, each waveform is added as soon as it is generated */
+    if (!p->workers || jobs < 2) {
+        for (i = 0; i < jobs; i++) {
+            waveJob(p, &p->job[i], p->wIn2);
+            TIMING_ADD(p, TIMING_GEN, p->job[i].us, p->job[i].info.length);
+            waveAdd(p, p->wIn2, p->job[i].info.length);
+            p->info[p->job[i].pin] = p->job[i].info;
         }
+        return;
+    }
 
-        /* Run waveTransmit() to send the combined waveform to DMA.
-           This function sometimes unpredictably sleeps on its own. */
-        waveTransmit();
+    for (i = 0; i < jobs; i++)
+        if (!p->jobWave[p->job[i].pin])
+            p->jobWave[p->job[i].pin] = malloc(PAGES*64*sizeof(pulse_t));
+
+    /* Start a round, with the jobs written before they can be taken */
+    round      = (p->workerRound + 1) & 0xFFFFFF;
+    p->jobCount  = jobs;
+    p->jobsDone  = 0;
+    __sync_synchronize();
+    p->jobNext   = round<<8;
+    pthread_mutex_lock(&p->workerLock);
+    p->workerRound = round;
+    pthread_cond_broadcast(&p->workerWake);
+    pthread_mutex_unlock(&p->workerLock);
+
+    /* Generate along with the workers, then wait for the jobs they took */
+    while ((job = waveClaim(p, round)) >= 0) {
+        waveJob(p, &p->job[job], p->jobWave[p->job[job].pin]);
+        __sync_fetch_and_add(&p->jobsDone, 1);
     }
+    while (p->jobsDone != jobs) sched_yield();
+    __sync_synchronize();
 
-    /* Sleep for remaining amount of time until DMA stops */
-    while (dma_running()) usleep(1000);
+    for (i = 0; i < jobs; i++) {
+        TIMING_ADD(p, TIMING_GEN, p->job[i].us, p->job[i].info.length);
+        waveAdd(p, p->jobWave[p->job[i].pin], p->job[i].info.length);
+        p->info[p->job[i].pin] = p->job[i].info;
+    }
+}
 
-    /* Ensure that DMA has stopped */
-    stop_dma();
 
-    /* Turn GPIO pins off */
-    for (_pins = pins, pin = 0; pin < 32; _pins >>= 1, pin++)
-        if (_pins&1) gpio_write(pin, 0);
+/*############################################################################*/
 
-    /* Consume queue */
-    pins       = 0;
-    cbs_index  = 0;
-    cmd_index  = 0;
-    dma_laps   = 0;
-    dma_last   = 0;
-    cbs_laps   = 0;
-    wOutLength = 0;
-    firstWave  = 1;
-
-    /* Free resources */
-    vc_destroy(cmdH, cmdV, PAGES);
-    driver_cleanup();
+
+/* Claim pins for a player, so that no other player plays them at once.
+   mask: Pins (1<<pin). Pins the player has already claimed may be included.
+   Returns 0, or -1 if another player has claimed one of them. */
+static int pinsClaim(player_t *p, unsigned int mask) {
+    unsigned int taken;
+
+    pthread_mutex_lock(&_claimLock);
+    mask &= ~p->claimed;
+    taken = mask & _claimed;
+    if (!taken) {
+        _claimed   |= mask;
+        p->claimed |= mask;
+    }
+    pthread_mutex_unlock(&_claimLock);
+
+    if (!taken) return 0;
+    fprintf(stderr, "ERROR: pinsClaim(): Pins 0x%x are being played by another "
+                    "player.\n", taken);
+    return -1;
+}
+
+
+/*############################################################################*/
+
+
+/* Give back the pins claimed by a player. */
+static void pinsRelease(player_t *p) {
+    pthread_mutex_lock(&_claimLock);
+    _claimed  &= ~p->claimed;
+    p->claimed = 0;
+    pthread_mutex_unlock(&_claimLock);
+}
+
+
+/*############################################################################*/
+
+
+/* Setup the DMA channel of a player, and pages for DMA to receive GPIO
+   commands from. The default player uses driver_setup(), so that set_dmach()
+   still works. Returns 0, or -1 if the channel could not be set up. */
+static int dmaOpen(player_t *p) {
+    if (p->dmach < 0) {
+        driver_setup(PAGES);
+        p->dma = driver_default();
+    }
+    else if (!(p->dma = driver_open(p->dmach, p->pacer, PAGES))) return -1;
+
+    p->cmdH = vc_create((void **)&p->cmdV, (void **)&p->cmdB, PAGES);
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Free what dmaOpen() set up. */
+static void dmaClose(player_t *p) {
+    vc_destroy(p->cmdH, p->cmdV, PAGES);
+    if (p->dmach < 0) driver_cleanup();
+    else driver_close(p->dma);
+    p->dma = NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Setup DMA and reset the state of every pin. Run before generating waves.
+   Returns 0, or -1 if the pins in p->pins or DMA could not be had. */
+static int playerOpen(player_t *p) {
+    unsigned int pin;
+
+    if (!p->compiling) {
+        if (pinsClaim(p, p->pins)) return -1;
+
+        if (!p->kept) {
+            /* Setup DMA, allocate pages for control blocks */
+            if (dmaOpen(p)) {
+                pinsRelease(p);
+                return -1;
+            }
+            p->kept = p->keep;
+        }
+        /* DMA is still set up from the last song (see playerKeep()). Live
+           slices are written from the first control block, so it must have
+           finished. */
+        else if (p->live) while (driver_dma_running(p->dma)) usleep(1000);
+
+        /* Start counting DMA and PWM errors from zero */
+        if (p->dmach < 0) telemetry_reset();
+        metricsSong(p, 1);
+
+        /* Pins may have been changed since the last song */
+        p->levelKnown = 0;
+
+        /* Send beats to DMA from their own thread */
+        pipelineOpen(p);
+    }
+
+    /* Time this song from the start */
+    timingReset(p);
+    TRACE_OPEN();
+    TRACE_THREAD("player");
+
+    /* Start the threads that help generate waveforms */
+    generatorOpen(p);
+
+    /* Set initial "w_offset" value to 0, initial "w_on" value to 1,
+       initial "t_offset" and "v_offset" values to 0 */
+    for (pin = 0; pin < 32; pin++) {
+        p->info[pin].v_offset = 0;
+        p->info[pin].t_offset = 0;
+        p->info[pin].w_offset = 0;
+        p->info[pin].w_on     = 1;
+    }
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Wait for DMA to finish, turn pins off and free resources. Consumes queue.
+   beat: Last beat (or tick) number, used for telemetry. */
+static void playerClose(player_t *p, unsigned int beat) {
+    unsigned int pin;
+    unsigned int _pins;
+    unsigned int beats;
+    unsigned long start;
+    pulse_t off;
+
+    generatorClose(p);
+
+    /* Nothing was sent to DMA while compiling */
+    if (p->compiling) {
+        p->pins = 0;
+        return;
+    }
+
+    /* Let the transmitter thread send the last beats */
+    pipelineClose(p);
+
+    /* With playerKeep(), the next song follows straight on. The pins are
+       turned off when DMA reaches the end of this one, unless the next song
+       has been sent by then. */
+    if (p->keep && p->kept && !p->cancel && !p->live) {
+        off.gpioOn  = 0;
+        off.gpioOff = p->pins;
+        off.usDelay = 1;
+        beats = p->progressBeats;
+        waveSend(p, beat, &off, 1);
+        p->progressBeats = beats;
+        if (p->dmach < 0) telemetry_flush();
+        TIMING_FINISH(p);
+        pinsRelease(p);
+        metricsSong(p, 0);
+
+        p->pins       = 0;
+        p->wOutLength = 0;
+        p->firstWave  = 1;
+        return;
+    }
+
+    /* Sleep for remaining amount of time until DMA stops, unless the song
+       was cancelled, in which case it stops now */
+    start = TIMING_NOW();
+    while (!p->cancel && driver_dma_running(p->dma)) {
+        usleep(1000);
+        telemetrySample(p, beat);
+    }
+    TRACE_SPAN("drain", start, "beat", beat);
+    if (p->dmach < 0) telemetry_flush();
+    TIMING_FINISH(p);
+
+    /* Ensure that DMA has stopped */
+    driver_stop_dma(p->dma);
+
+    /* Turn GPIO pins off */
+    for (_pins = p->pins, pin = 0; pin < 32; _pins >>= 1, pin++)
+        if (_pins&1) gpio_write(pin, 0);
+    pinsRelease(p);
+    metricsSong(p, 0);
+
+    /* Consume queue */
+    p->pins       = 0;
+    p->cbs_index  = 0;
+    p->cmd_index  = 0;
+    p->dma_laps   = 0;
+    p->dma_last   = 0;
+    p->cbs_laps   = 0;
+    p->wOutLength = 0;
+    p->firstWave  = 1;
+
+    /* Free resources, unless they are kept for the next song */
+    if (p->keep) {
+        p->kept = 1;
+        return;
+    }
+    dmaClose(p);
+    p->kept = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Look up the frequency, duty cycle and misc_t of a pin in a beat, either from
+   the queue, from the score being played or from the pattern being played. */
+static void noteGet(player_t *p, unsigned int pin, unsigned int beat,
+                    double *freq, double *duty, misc_t **misc) {
+    unsigned int v, e;
+    if (p->pattern) {
+        beat -= p->patternStart;
+        if (p->pattern->freq[pin]) {
+            *freq = p->pattern->freq[pin][beat];
+            *duty = p->pattern->duty[pin][beat];
+            *misc = p->pattern->misc[pin] ? p->pattern->misc[pin][beat] : NULL;
+        } else { /* pin is silent in this pattern */
+            *freq = 0;
+            *duty = 0;
+            *misc = NULL;
+        }
+    } else if (p->score) {
+        v = p->voice[pin];
+        e = scoreEffect(p->score, v, beat);
+        *freq = p->score->pitch[scorePitch(p->score, v, beat)];
+        *duty = p->score->duty[scoreDuty(p->score, v, beat)];
+        *misc = e ? &p->score->effect[e-1] : NULL;
+    } else {
+        *freq = p->freq[pin][beat];
+        *duty = p->duty[pin][beat];
+        *misc = p->misc[pin] ? p->misc[pin][beat] : NULL;
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Add a voice to the queue.
+   pin:    GPIO pin number (BCM) through which the voice plays.
+   freqs:  Array of frequencies (Hz). A zero (0) indicates pin should be off.
+   duties: Array of duty cycles (0 to 1, exclusive).
+   misc:   Array of misc_t pointers containing extra data. This may be NULL. */
+void playerQueueAdd(player_t *p, int pin, double *freqs, double *duties,
+                    misc_t **misc) {
+    p->pins     |= 1<<pin;
+    p->freq[pin] = freqs;
+    p->duty[pin] = duties;
+    p->misc[pin] = misc;
+}
+
+
+/*############################################################################*/
+
+
+/* Record the state that the output of the next pattern depends on.
+   us: Current beat length. */
+static void patternState(player_t *p, pattern_state_t *state, unsigned int us) {
+    unsigned int pin;
+
+    /* Cleared so that states can be compared with memcmp() */
+    memset(state, 0, sizeof(*state));
+    state->us = us;
+    for (pin = 0; pin < 32; pin++) {
+        if (!(p->pins & (1<<pin))) continue;
+        state->w_offset[pin] = p->info[pin].w_offset;
+        state->v_offset[pin] = p->info[pin].v_offset;
+        state->t_offset[pin] = p->info[pin].t_offset;
+        state->w_on[pin]     = p->info[pin].w_on;
+        state->vInt[pin]     = p->vInt[pin];
+        state->vWth[pin]     = p->vWth[pin];
+        state->tInt[pin]     = p->tInt[pin];
+        state->tWth[pin]     = p->tWth[pin];
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Put the player back into a state recorded by patternState(). */
+static void patternRestore(player_t *p, const pattern_state_t *state,
+                           unsigned int *us) {
+    unsigned int pin;
+
+    *us = state->us;
+    for (pin = 0; pin < 32; pin++) {
+        if (!(p->pins & (1<<pin))) continue;
+        p->info[pin].w_offset = state->w_offset[pin];
+        p->info[pin].v_offset = state->v_offset[pin];
+        p->info[pin].t_offset = state->t_offset[pin];
+        p->info[pin].w_on     = state->w_on[pin];
+        p->vInt[pin] = state->vInt[pin];
+        p->vWth[pin] = state->vWth[pin];
+        p->tInt[pin] = state->tInt[pin];
+        p->tWth[pin] = state->tWth[pin];
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the cached output of the pattern being played from a state, or NULL
+   if it has not been generated from that state yet. */
+static pattern_cache_t *patternFind(player_t *p, const pattern_state_t *state) {
+    pattern_cache_t *c;
+    for (c = p->pattern->cache; c; c = c->next)
+        if (!memcmp(&c->start, state, sizeof(*state))) return c;
+    return NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Free cached output. */
+static void patternFree(player_t *p, pattern_cache_t *c) {
+    p->patternBytes -= c->count*sizeof(pulse_t);
+    free(c->pulses);
+    free(c->lengths);
+    free(c);
+}
+
+
+/*############################################################################*/
+
+
+/* Add the combined waveform of one beat to output being cached.
+   Returns the cache entry, or NULL if the cache is full (the entry is then
+   freed). */
+static pattern_cache_t *patternRecord(player_t *p, pattern_cache_t *c,
+                                      unsigned int beat) {
+    pulse_t *pulses;
+
+    if (p->patternBytes + p->wOutLength*sizeof(pulse_t) > PATTERN_CACHE) {
+        patternFree(p, c);
+        return NULL;
+    }
+    pulses = realloc(c->pulses, (c->count + p->wOutLength)*sizeof(pulse_t));
+    if (!pulses) {
+        patternFree(p, c);
+        return NULL;
+    }
+
+    memcpy(pulses + c->count, p->wOut, p->wOutLength*sizeof(pulse_t));
+    c->pulses        = pulses;
+    c->lengths[beat] = p->wOutLength;
+    c->count        += p->wOutLength;
+    p->patternBytes   += p->wOutLength*sizeof(pulse_t);
+    return c;
+}
+
+
+/*############################################################################*/
+
+
+/* Get the quality of service controller ready for a song. The voice muted at
+   QOS_MUTE is the last voice of the score, or the highest pin of the queue;
+   with less than two voices, nothing is muted. */
+static void qosReset(player_t *p) {
+    unsigned int pin, voices = 0;
+
+    memset(&p->qos, 0, sizeof(p->qos));
+    p->qosLevel = QOS_FULL;
+    p->qosCalm  = 0;
+    p->qosMute  = -1;
+    p->qosMeasured = 0;
+    for (pin = 0; pin < 32; pin++) {
+        if (!(p->pins & (1u<<pin))) continue;
+        voices++;
+        if (p->qosMute < 0 || !p->score ||
+            p->voice[pin] > p->voice[p->qosMute])
+            p->qosMute = pin;
+    }
+    if (voices < 2) p->qosMute = -1;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the microseconds of sound sent to DMA (or waiting in the pipeline)
+   that DMA has not played yet. */
+static unsigned long qosAhead(player_t *p) {
+    unsigned long sent = p->qosSentUs, start = p->qosStartUs, now;
+    double ahead = 0;
+
+    /* Beats still in the pipeline */
+    if (p->ringDepth) ahead = (double)p->ringUsIn - p->ringUsOut;
+    if (driver_dma_running(p->dma)) {
+        now = trace_now();
+        ahead += (double)sent - (now - start);
+    }
+    return ahead > 0 ? (unsigned long)ahead : 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Step the quality of service down when too little sound is ready ahead of
+   DMA, and back up when there has been plenty for a while (see qosEnable()).
+   What is ready is measured once a beat has been generated, before it is
+   sent, so that it is what DMA had left to play while the beat was being
+   generated. The new level is used from the next beat on.
+   beat: Beat that has just been generated. */
+static void qosControl(player_t *p, unsigned int beat) {
+    unsigned int level = p->qosLevel, top;
+    unsigned long ahead;
+
+    p->qos.beats[level]++;
+    /* Nothing is ahead of DMA before the first beat has been sent */
+    if (!p->qosEnabled || p->compiling || !p->progressBeats) return;
+
+    ahead = qosAhead(p);
+    if (!p->qosMeasured++ || ahead < p->qos.minAheadUs)
+        p->qos.minAheadUs = ahead;
+
+    top = p->qosMute < 0 ? QOS_EDGES : QOS_MUTE;
+    if (ahead < QOS_LOW_US) {
+        p->qosCalm = 0;
+        if (level < top) level++;
+    } else if (ahead > QOS_HIGH_US && level > QOS_FULL) {
+        if (++p->qosCalm >= QOS_HOLD) {
+            p->qosCalm = 0;
+            level--;
+        }
+    } else p->qosCalm = 0;
+
+    if (level != p->qosLevel) {
+        fprintf(stderr, "qos: beat %u level %u -> %u, %lu us ahead\n",
+                beat + 1, p->qosLevel, level, ahead);
+        TRACE_COUNTER("qos", level);
+        p->qosLevel = level;
+        p->qos.changes++;
+        if (level > p->qos.maxLevel) p->qos.maxLevel = level;
+    }
+    p->qos.level = level;
+}
+
+
+/*############################################################################*/
+
+
+/* Make transitions of the combined waveform in wOut that turn pins the same
+   way (on, or off) within some microseconds of the first one at once, at the
+   time of the first one, so that they need fewer control blocks.
+   tolerance: Microseconds. */
+static void waveCoalesce(player_t *p, unsigned int tolerance) {
+    pulse_t *w = p->wOut;
+    unsigned int i, g = 0, after = 0;
+
+    if (!p->wOutLength) return;
+    for (i = 1; i < p->wOutLength; i++) {
+        after += w[i-1].usDelay;
+        if (after <= tolerance && !w[g].gpioOn == !w[i].gpioOn &&
+            !w[g].gpioOff == !w[i].gpioOff) {
+            w[g].gpioOn  |= w[i].gpioOn;
+            w[g].gpioOff |= w[i].gpioOff;
+            w[g].usDelay += w[i].usDelay;
+            continue;
+        }
+        w[++g] = w[i];
+        after  = 0;
+    }
+    p->wOutLength = g + 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns microseconds elapsed since a time. */
+static unsigned long patternElapsed(const struct timeval *from) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - from->tv_sec)*1000000 + (now.tv_usec - from->tv_usec);
+}
+
+
+/*############################################################################*/
+
+
+/* Play the queue, the score in score if it is not NULL, or the order list in
+   order if it is not NULL.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of beats. */
+static void play(player_t *p, unsigned int us, unsigned int beats) {
+    unsigned int beat;
+    unsigned int pin;
+    unsigned int _pins;
+    unsigned int tempo = 0;
+    double freq, duty;
+    misc_t *misc;
+    unsigned int entry = 0, entryEnd = 0, b;
+    pattern_state_t state;
+    pattern_cache_t *cache, *rec = NULL;
+    pulse_t *pulses;
+    struct timeval genStart;
+    unsigned long start;
+
+    wavegen_job_t *job;
+    unsigned int jobs;
+    double freqFrom, freqTo, freqRS, freqRE, facF;
+    double dutyFrom, dutyTo, dutyRS, dutyRE, facD;
+    double value;
+
+    if (playerOpen(p)) {
+        p->pins = 0;
+        return;
+    }
+
+    p->progressBeats = 0;
+    p->progressTotal = beats;
+    p->progressUs    = 0;
+    qosReset(p);
+
+    /* Vibrato and tremolo start off */
+    for (pin = 0; pin < 32; pin++) {
+        p->vInt[pin] = 0;
+        p->vWth[pin] = 0;
+        p->tInt[pin] = 0;
+        p->tWth[pin] = 0;
+    }
+
+    /* This loops through each beat. Generates one waveform per beat. */
+    for (beat = 0; beat < beats && !p->cancel; beat++) {
+        /* Change global beat length if it was requested */
+        if (p->changeUs) {
+            us = p->changeUs;
+            p->changeUs = 0;
+        }
+        /* Scores store beat length changes separately from misc_t */
+        while (p->score && tempo < p->score->header->tempos &&
+               p->score->tempo[tempo].beat <= beat)
+            us = p->score->tempo[tempo++].us;
+        /* A tempo map gives every beat its own length, found from where the
+           beat starts and ends so that rounding does not build up */
+        if (p->tempo)
+            us = tempoStart(p->tempo, beat+1) - tempoStart(p->tempo, beat);
+        /* Start of the next pattern of the order list */
+        if (p->order && beat == entryEnd) {
+            /* Cache the output of the previous pattern, unless a slide is
+               still going on, as the next pattern would then depend on it */
+            if (rec && !((p->ff|p->fd)&p->pins)) {
+                patternState(p, &rec->end, us);
+                rec->next      = p->pattern->cache;
+                p->pattern->cache = rec;
+            } else if (rec) patternFree(p, rec);
+            rec = NULL;
+
+            p->pattern      = &p->patterns[p->order[entry++]];
+            p->patternStart = beat;
+            entryEnd      = beat + p->pattern->beats;
+
+            if (!p->tempo && !((p->ff|p->fd)&p->pins)) {
+                patternState(p, &state, us);
+                if ((cache = patternFind(p, &state))) {
+                    /* Splice the cached output instead of generating it */
+                    pulses = cache->pulses;
+                    for (b = 0; b < p->pattern->beats; b++) {
+                        p->wOutLength = cache->lengths[b];
+                        memcpy(p->wOut, pulses, p->wOutLength*sizeof(pulse_t));
+                        pulses += p->wOutLength;
+                        waveTransmit(p, beat + b);
+                    }
+                    patternRestore(p, &cache->end, &us);
+                    p->patternStats.hits++;
+                    p->patternStats.bytes += cache->count*sizeof(pulse_t);
+                    p->patternStats.us    += cache->genUs;
+                    beat = entryEnd - 1;
+                    continue;
+                }
+                /* Not generated from this state before: record it, unless
+                   it is not generated at full quality (see qosEnable()) */
+                if (p->qosLevel == QOS_FULL) {
+                    rec = malloc(sizeof(pattern_cache_t));
+                    rec->start   = state;
+                    rec->pulses  = NULL;
+                    rec->lengths = malloc(p->pattern->beats*
+                                          sizeof(unsigned int));
+                    rec->count   = 0;
+                    rec->genUs   = 0;
+                }
+            }
+            p->patternStats.misses++;
+        }
+        if (rec) gettimeofday(&genStart, NULL);
+        start = TIMING_NOW();
+        /* This loops through each pin. Run waveGen() once for each pin
+           in order to produce one combined waveform on several pins. */
+        for (jobs = 0, _pins = p->pins, pin = 0; pin < 32; _pins >>= 1, pin++) {
+            if (_pins&1) {
+                noteGet(p, pin, beat, &freq, &duty, &misc);
+                freqFrom = (p->ff&(1<<pin)) ? p->freqTo[pin] : freq;
+                freqTo   = freq;
+                freqRS   = 0;
+                freqRE   = us;
+                dutyFrom = (p->fd&(1<<pin)) ? p->dutyTo[pin] : duty;
+                dutyTo   = duty;
+                dutyRS   = 0;
+                dutyRE   = us;
+                /* If the note value is defined and non-zero, change
+                   the note value from its default value of 1. */
+                value    = misc && misc->value ? misc->value : 1;
+
+                /* If the usingPs property is on or if pitch slide is
+                   already on, adjust frequency to correspond */
+                if ((misc&&misc->usingPs)||(p->ff&(1<<pin))) {
+                    /* If this is the first beat of the pitch slide */
+                    if (!(p->ff&(1<<pin))) {
+                        p->ff |= 1<<pin;
+                        /* Record initial frequency */
+                        p->initF[pin]  = freq;
+                        /* Record desired ending frequency */
+                        p->endF[pin]   = misc->freqTo;
+                        /* Relative microseconds offset of slide start */
+                        freqRS         = misc->freqS * us;
+                        /* Relative microseconds offset of slide end */
+                        freqRE         = misc->freqE * us;
+                        /* Amount of beats from start of song of slide start */
+                        p->freqAS[pin] = misc->freqS + beat;
+                        /* Amount of beats from start of song of slide end */
+                        p->freqAE[pin] = misc->freqE + beat;
+                    }
+                    /* Compute where the ending frequency of the current beat
+                       should be between the starting and ending frequencies
+                       of the entire pitch slide, expressed as a
+                       double between 0 and 1 */
+                    facF = (beat+1-p->freqAS[pin])/
+                           (p->freqAE[pin]-p->freqAS[pin]);
+                    facF = dmax(dmin(facF,1),0);
+                    /* Using this data compute the actual ending frequency for
+                       this beat, which is also the starting frequency for the
+                       next beat */
+                    freqTo = interpolateFreq(p->initF[pin], p->endF[pin],
+                                             facF);
+                    p->freqTo[pin] = freqTo;
+                    /* If the factor is 1 (indicating the end of the slide
+                       occurred somewhere within the current beat) stop
+                       doing frequency slide */
+                    if (facF >= 1) p->ff &= ~(1<<pin);
+                }
+                /* If the usingDs property is on or if dutycycle slide is
+                   already on, adjust dutycycle to correspond */
+                if ((misc&&misc->usingDs)||(p->fd&(1<<pin))) {
+                    /* If this is the first beat of the dutycycle slide */
+                    if (!(p->fd&(1<<pin))) {
+                        p->fd |= 1<<pin;
+                        /* Record initial dutycycle */
+                        p->initD[pin]  = duty;
+                        /* Record desired ending dutycycle */
+                        p->endD[pin]   = misc->dutyTo;
+                        /* Relative microseconds offset of slide start */
+                        dutyRS         = misc->dutyS * us;
+                        /* Relative microseconds offset of slide end */
+                        dutyRE         = misc->dutyE * us;
+                        /* Amount of beats from start of song of slide start */
+                        p->dutyAS[pin] = misc->dutyS + beat;
+                        /* Amount of beats from start of song of slide end */
+                        p->dutyAE[pin] = misc->dutyE + beat;
+                    }
+                    /* Compute where the ending dutycycle of the current beat
+                       should be between the starting and ending dutycycle
+                       of the entire dutycycle slide, expressed as a
+                       double between 0 and 1 */
+                    facD = (beat+1-p->dutyAS[pin])/
+                           (p->dutyAE[pin]-p->dutyAS[pin]);
+                    facD = dmax(dmin(facD,1),0);
+                    /* Using this data compute the actual ending dutycycle for
+                       this beat, which is also the starting dutycycle for the
+                       next beat */
+                    dutyTo = interpolateFreq(p->initD[pin], p->endD[pin],
+                                             facD);
+                    p->dutyTo[pin] = dutyTo;
+                    /* If the factor is 1 (indicating the end of the slide
+                       occurred somewhere within the current beat) stop
+                       doing dutycycle slide */
+                    if (facD >= 1) p->fd &= ~(1<<pin);
+                }
+                /* If the usingV property is on, modify vibrato parameters.
+                   They stay in use until they are modified again. */
+                if (misc&&misc->usingV) {
+                    p->vInt[pin] = misc->vInt;
+                    p->vWth[pin] = misc->vWth;
+                }
+                /* If the usingT property is on, modify tremolo parameters */
+                if (misc&&misc->usingT) {
+                    p->tInt[pin] = misc->tInt;
+                    p->tWth[pin] = misc->tWth;
+                }
+                /* If the us property is non-zero, change the global beat length
+                   next beat */
+                if (misc&&misc->us)
+                    p->changeUs = misc->us;
+
+                /* Set GPIO pin mode to output */
+                if (!p->compiling) gpio_mode(pin, OUT);
+                /* Waveform of this pin, generated by waveJobs() */
+                job = &p->job[jobs++];
+                job->pin        = pin;
+                job->freqS      = freqFrom;
+                job->freqE      = freqTo;
+                job->freqDelayS = dmin(us, freqRS);
+                job->freqDelayE = dmin(us, freqRE);
+                job->dutyS      = dutyFrom;
+                job->dutyE      = dutyTo;
+                job->dutyDelayS = dmin(us, dutyRS);
+                job->dutyDelayE = dmin(us, dutyRE);
+                job->vIntensity = p->vInt[pin];
+                job->vWidth     = p->vWth[pin];
+                job->tIntensity = p->tInt[pin];
+                job->tWidth     = p->tWth[pin];
+                job->len        = us;
+                job->value      = value;
+                job->effectUs   = p->qosLevel >= QOS_EFFECTS ?
+                                  QOS_EFFECT_US : 0;
+                job->slideSteps = p->qosLevel >= QOS_SLIDES ?
+                                  QOS_SLIDE_STEPS : 0;
+                /* A muted voice is a rest */
+                if (p->qosLevel >= QOS_MUTE && (int)pin == p->qosMute) {
+                    job->freqS = 0;
+                    job->freqE = 0;
+                }
+            }
+        }
+        TIMING_ADD(p, TIMING_DECODE, TIMING_NOW() - start, 0);
+        TRACE_SPAN("decode", start, "beat", beat);
+
+        /* Run waveGen() for every pin and combine the waveforms */
+        waveJobs(p, jobs);
+        TRACE_SPAN("generate", start, "beat", beat);
+
+        /* Keep a copy of the combined waveform if it is being cached */
+        if (rec) {
+            rec->genUs += patternElapsed(&genStart);
+            rec = patternRecord(p, rec, beat - p->patternStart);
+        }
+
+        if (p->qosLevel >= QOS_EDGES) waveCoalesce(p, QOS_EDGE_US);
+        /* Take longer over the beat, for qosSlowdown() */
+        if (p->qosSlowdown)
+            usleep((unsigned long)p->wOutLength*p->qosSlowdown/1000);
+        /* How long the beat took, for metricsOpen() */
+        p->genUs = TIMING_NOW() - start;
+
+        /* Step the quality of service up or down for the next beat. A
+           pattern stepped down during is not cached, as it is not all at
+           full quality. */
+        qosControl(p, beat);
+        if (rec && p->qosLevel != QOS_FULL) {
+            patternFree(p, rec);
+            rec = NULL;
+        }
+
+        /* Run waveTransmit() to send the combined waveform to DMA.
+           This function sometimes unpredictably sleeps on its own. */
+        waveTransmit(p, beat);
+    }
+
+    /* Output of the last pattern is not needed again */
+    if (rec) patternFree(p, rec);
+    p->pattern = NULL;
+
+    playerClose(p, beats);
+}
+
+
+/*############################################################################*/
+
+
+/* Play queue. This function also consumes the queue.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats. */
+void playerQueuePlay(player_t *p, unsigned int us, unsigned int beats) {
+    play(p, us, beats);
+}
+
+
+/*############################################################################*/
+
+
+/* Play an open score through the pins of its voices. */
+static void scorePlay(player_t *p, score_t *score) {
+    unsigned int v;
+
+    p->pins = 0;
+    for (v = 0; v < score->header->voices; v++) {
+        p->pins |= 1<<score->voice[v].pin;
+        p->voice[score->voice[v].pin] = v;
+    }
+
+    p->score = score;
+    play(p, score->header->us, score->header->beats);
+    p->score = NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Play a score file (see score.h) without copying it into the queue.
+   Anything already in the queue is discarded.
+   path: Score file, as written by queueSave().
+   Returns 0 after playing, or -1 if the file could not be opened. */
+int playerQueuePlayFile(player_t *p, const char *path) {
+    score_t score;
+
+    if (scoreOpen(&score, path)) return -1;
+    scorePlay(p, &score);
+    scoreClose(&score);
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Play a score that is already in memory (the contents of a score file).
+   data:   The score.
+   length: Bytes of score.
+   Returns 0 after playing, or -1 if the score is invalid. */
+int playerQueuePlayMemory(player_t *p, const void *data, size_t length) {
+    score_t score;
+
+    if (scoreOpenMemory(&score, data, length)) return -1;
+    scorePlay(p, &score);
+    scoreClose(&score);
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Save the queue to a score file (see score.h) instead of playing it.
+   This function also consumes the queue. It does not use any hardware.
+   path:  Score file to write.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   Returns 0 on success, or -1 if the file could not be written. */
+int playerQueueSave(player_t *p, const char *path, unsigned int us,
+                    unsigned int beats) {
+    int ret = scoreWrite(path, us, beats, p->pins, p->freq, p->duty, p->misc);
+    p->pins = 0;
+    return ret;
+}
+
+
+/*############################################################################*/
+
+
+/* Use a tempo map (see tempo.h) for the beat lengths of everything played
+   from now on, instead of fixed beat lengths. Beat length changes in misc_t
+   and in score files are then ignored, and patterns are not cached.
+   tempo: Tempo map, or NULL to go back to fixed beat lengths. It must stay
+          valid while it is in use. */
+void playerQueueTempo(player_t *p, const tempo_t *tempo) {
+    p->tempo = tempo;
+}
+
+
+/*############################################################################*/
+
+
+/* Compile the queue, or the score in score, into a header.
+   path:  Header to write.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of beats.
+   Returns 0 on success, or -1 if the header could not be written. */
+static int compile(player_t *p, const char *path, unsigned int us,
+                   unsigned int beats) {
+    compiled_t song;
+    unsigned int pinList[32];
+    unsigned int pin;
+    int ret;
+
+    song.voices = 0;
+    for (pin = 0; pin < 32; pin++)
+        if (p->pins & (1<<pin)) pinList[song.voices++] = pin;
+
+    /* Play without hardware, keeping every waveform generated */
+    p->compiling       = 1;
+    p->compileLength = 0;
+    p->compileBlocks = 0;
+    play(p, us, beats);
+    p->compiling       = 0;
+
+    song.beats = beats;
+    song.pins  = pinList;
+    song.index = p->compileIndex;
+    song.data  = p->compileData;
+    ret = compileWrite(path, &song, p->compileLength);
+
+    free(p->compileData);
+    free(p->compileIndex);
+    p->compileData       = NULL;
+    p->compileIndex      = NULL;
+    p->compileSize       = 0;
+    p->compileBlocksSize = 0;
+    return ret;
+}
+
+
+/*############################################################################*/
+
+
+/* Compile the queue into a header (see compile.h) instead of playing it.
+   This function also consumes the queue. It does not use any hardware.
+   path:  Header to write. The song is declared as a compiled_t named after
+          the file, for example "song.rpc.h" declares "song".
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   Returns 0 on success, or -1 if the header could not be written. */
+int playerQueueCompile(player_t *p, const char *path, unsigned int us,
+                       unsigned int beats) {
+    return compile(p, path, us, beats);
+}
+
+
+/*############################################################################*/
+
+
+/* Compile a score file (see score.h) into a header (see compile.h).
+   Anything already in the queue is discarded.
+   score: Score file, as written by queueSave().
+   path:  Header to write, as for queueCompile().
+   Returns 0 on success, or -1 if a file could not be read or written. */
+int playerQueueCompileFile(player_t *p, const char *score, const char *path) {
+    score_t s;
+    unsigned int v;
+    int ret;
+
+    if (scoreOpen(&s, score)) return -1;
+
+    p->pins = 0;
+    for (v = 0; v < s.header->voices; v++) {
+        p->pins |= 1<<s.voice[v].pin;
+        p->voice[s.voice[v].pin] = v;
+    }
+
+    p->score = &s;
+    ret = compile(p, path, s.header->us, s.header->beats);
+    p->score = NULL;
+
+    scoreClose(&s);
+    return ret;
+}
+
+
+/*############################################################################*/
+
+
+/* Play a compiled song (see compile.h). No waveforms are generated: the
+   transitions of each voice are copied from the song and combined.
+   song: Song declared by a header written by queueCompile(). */
+void playerCompiledPlay(player_t *p, const compiled_t *song) {
+    const unsigned int *block;
+    unsigned int beat, v, pin, i, n, k;
+
+    for (v = 0; v < song->voices; v++) p->pins |= 1<<song->pins[v];
+    if (playerOpen(p)) {
+        p->pins = 0;
+        return;
+    }
+    for (v = 0; v < song->voices; v++) gpio_mode(song->pins[v], OUT);
+
+    for (beat = 0; beat < song->beats; beat++) {
+        for (v = 0; v < song->voices; v++) {
+            pin   = 1<<song->pins[v];
+            block = song->data + song->index[beat*song->voices + v];
+            n     = *block++;
+
+            /* Expand each run into wIn2 */
+            for (i = 0; i < n; block += 3) {
+                for (k = 0; k < block[0] && i < n; k++) {
+                    p->wIn2[i].gpioOn  = (block[1] & COMPILED_ON) ? pin : 0;
+                    p->wIn2[i].gpioOff = (block[1] & COMPILED_ON) ? 0 : pin;
+                    p->wIn2[i].usDelay = block[1] & ~COMPILED_ON;
+                    if (++i == n) break;
+                    p->wIn2[i].gpioOn  = (block[2] & COMPILED_ON) ? pin : 0;
+                    p->wIn2[i].gpioOff = (block[2] & COMPILED_ON) ? 0 : pin;
+                    p->wIn2[i].usDelay = block[2] & ~COMPILED_ON;
+                    i++;
+                }
+            }
+
+            waveMerge(p, p->wIn2, n);
+        }
+
+        waveTransmit(p, beat);
+    }
+
+    playerClose(p, song->beats);
+}
+
+
+/*############################################################################*/
+
+
+/* Add an empty pattern, for patternPlay().
+   beats: Length of the pattern in beats.
+   Returns the number of the pattern, or -1 if beats is 0. */
+int playerPatternNew(player_t *p, unsigned int beats) {
+    pattern_t *pat;
+
+    if (!beats) {
+        fprintf(stderr, "ERROR: patternNew(): Patterns need at least one "
+                        "beat.\n");
+        return -1;
+    }
+
+    if (p->patternCount == p->patternSize) {
+        p->patternSize = p->patternSize ? 2*p->patternSize : 64;
+        p->patterns = realloc(p->patterns, p->patternSize*sizeof(pattern_t));
+    }
+
+    pat = &p->patterns[p->patternCount];
+    memset(pat, 0, sizeof(*pat));
+    pat->beats = beats;
+    return p->patternCount++;
+}
+
+
+/*############################################################################*/
+
+
+/* Add a voice to a pattern. Pins that are not added to a pattern are silent
+   while it plays.
+   pattern: Number returned by patternNew().
+   The other arguments are the same as for queueAdd(), with one entry in each
+   array for every beat of the pattern. */
+void playerPatternAdd(player_t *p, int pattern, int pin,
+                      double *freqs, double *duties, misc_t **misc) {
+    pattern_t *pat = &p->patterns[pattern];
+    p->pins          |= 1<<pin;
+    pat->freq[pin] = freqs;
+    pat->duty[pin] = duties;
+    pat->misc[pin] = misc;
+}
+
+
+/*############################################################################*/
+
+
+/* Play patterns in the order of an order list. This function also consumes
+   the patterns.
+   The combined waveforms of each pattern are kept, together with the state of
+   every pin (wave, vibrato and tremolo phase) at the start of the pattern.
+   When a pattern is played again from the same state, the kept waveforms are
+   sent to DMA again instead of being generated.
+   us:     Length of each beat in microseconds (60000000/BPM).
+   order:  Numbers of the patterns to play, in order.
+   length: Amount of entries in order. */
+void playerPatternPlay(player_t *p, unsigned int us, const unsigned int *order,
+                       unsigned int length) {
+    pattern_cache_t *c, *next;
+    unsigned int beats = 0, i;
+
+    for (i = 0; i < length; i++) beats += p->patterns[order[i]].beats;
+
+    memset(&p->patternStats, 0, sizeof(p->patternStats));
+    p->order = order;
+    play(p, us, beats);
+    p->order = NULL;
+
+    fprintf(stderr, "patterns: hits=%lu misses=%lu saved=%lu bytes, "
+                    "%lu us of generation\n",
+            p->patternStats.hits, p->patternStats.misses,
+            p->patternStats.bytes, p->patternStats.us);
+
+    /* Consume patterns */
+    for (i = 0; i < p->patternCount; i++) {
+        for (c = p->patterns[i].cache; c; c = next) {
+            next = c->next;
+            patternFree(p, c);
+        }
+    }
+    p->patternCount = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Copy the cache statistics of the last patternPlay() into *out. */
+void playerPatternStats(player_t *p, pattern_stats_t *out) {
+    *out = p->patternStats;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns 1 if two parts of the queue contain the same notes. */
+static int queueSame(player_t *p, unsigned int a, unsigned int b,
+                     unsigned int beats) {
+    unsigned int pin, i;
+    misc_t *ma, *mb;
+
+    for (pin = 0; pin < 32; pin++) {
+        if (!(p->pins & (1<<pin))) continue;
+        if (memcmp(p->freq[pin] + a, p->freq[pin] + b, beats*sizeof(double)) ||
+            memcmp(p->duty[pin] + a, p->duty[pin] + b, beats*sizeof(double)))
+            return 0;
+        for (i = 0; p->misc[pin] && i < beats; i++) {
+            ma = p->misc[pin][a + i];
+            mb = p->misc[pin][b + i];
+            if (ma != mb && (!ma || !mb || memcmp(ma, mb, sizeof(misc_t))))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Play the queue as patterns (see patternPlay()). The queue is cut into parts
+   of the same length, and parts that repeat an earlier part are played as the
+   same pattern. This function also consumes the queue.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   size:  Length of each part in beats (for example the length of a bar). */
+void playerQueuePlayPatterns(player_t *p, unsigned int us, unsigned int beats,
+                             unsigned int size) {
+    unsigned int *order;
+    unsigned int length, i, j, n, pin;
+    int pat;
+
+    size   = size ? size : 1;
+    length = (beats + size - 1) / size;
+    order  = malloc(length*sizeof(unsigned int));
+
+    for (i = 0; i < length; i++) {
+        n = (i == length - 1) ? beats - i*size : size;
+
+        /* Look for an earlier part with the same notes */
+        for (j = 0; j < i; j++) {
+            if (p->patterns[order[j]].beats == n &&
+                queueSame(p, j*size, i*size, n)) break;
+        }
+        if (j < i) {
+            order[i] = order[j];
+            continue;
+        }
+
+        pat = playerPatternNew(p, n);
+        for (pin = 0; pin < 32; pin++) {
+            if (!(p->pins & (1<<pin))) continue;
+            p->patterns[pat].freq[pin] = p->freq[pin] + i*size;
+            p->patterns[pat].duty[pin] = p->duty[pin] + i*size;
+            p->patterns[pat].misc[pin] = p->misc[pin] ? p->misc[pin] + i*size
+                                                      : NULL;
+        }
+        order[i] = pat;
+    }
+
+    playerPatternPlay(p, us, order, length);
+
+    free(order);
+}
+
+
+/*############################################################################*/
+
+
+/* Add a note to the event list. Unlike queueAdd(), only the notes themselves
+   are stored, so held notes and rests take no memory, and a note is generated
+   as one continuous wave however long it is.
+   pin:    GPIO pin number (BCM) through which the note plays, or -1 to only
+           change the tempo (with misc->us).
+   start:  Tick (from start of song) at which the note starts.
+   length: Length of the note in ticks.
+   freq:   Frequency (Hz).
+   duty:   Duty cycle (0 to 1, exclusive).
+   misc:   Extra data. This may be NULL. The fields are used as in queueAdd(),
+           except that slide offsets are in beats from the start of the note,
+           the note value is ignored (use a shorter length instead), and
+           a non-zero "us" changes the beat length from the start of the note.
+   Notes on the same pin must not overlap. */
+void playerEventAdd(player_t *p, int pin, unsigned int start,
+                    unsigned int length, double freq, double duty,
+                    misc_t *misc) {
+    event_entry_t *e;
+
+    /* Make space for two more events */
+    if (p->eventCount + 2 > p->eventSize) {
+        p->eventSize = p->eventSize ? 2*p->eventSize : 256;
+        p->events = realloc(p->events, p->eventSize*sizeof(event_entry_t));
+    }
+
+    /* Start of note */
+    e = &p->events[p->eventCount++];
+    e->event.tick = start;
+    e->event.pin  = pin;
+    e->event.freq = freq;
+    e->event.duty = duty;
+    e->event.misc = misc;
+    e->seq        = p->eventCount;
+    if (pin < 0) return;
+    p->pins |= 1<<pin;
+
+    /* End of note */
+    e = &p->events[p->eventCount++];
+    e->event.tick = start + length;
+    e->event.pin  = pin;
+    e->event.freq = 0;
+    e->event.duty = 0;
+    e->event.misc = NULL;
+    e->seq        = p->eventCount;
+}
+
+
+/*############################################################################*/
+
+
+/* Compare events for qsort(). Events are sorted by tick, with the ends of
+   notes before the starts of notes so that back-to-back notes work. */
+static int eventCompare(const void *a, const void *b) {
+    const event_entry_t *x = a, *y = b;
+    if (x->event.tick != y->event.tick)
+        return (x->event.tick < y->event.tick) ? -1 : 1;
+    if (!x->event.freq != !y->event.freq)
+        return (!x->event.freq) ? -1 : 1;
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the events added with eventAdd(), in order, for eventPlayStream(). */
+static int eventListNext(event_t *event, void *arg) {
+    player_t *p = arg;
+    if (p->eventNext >= p->eventCount) return 0;
+    *event = p->events[p->eventNext++].event;
+    return 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Play the event list. This function also consumes the event list.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   ticks: Amount of ticks per beat. */
+void playerEventPlay(player_t *p, unsigned int us, unsigned int ticks) {
+    qsort(p->events, p->eventCount, sizeof(event_entry_t), eventCompare);
+    p->eventNext = 0;
+
+    playerEventPlayStream(p, eventListNext, p, p->pins, us, ticks);
+
+    /* Consume event list */
+    free(p->events);
+    p->events     = NULL;
+    p->eventCount = 0;
+    p->eventSize  = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the time in microseconds from the start of the song of a tick. */
+static double eventTime(player_t *p, unsigned int tick) {
+    if (p->tempo)
+        return floor(tempoTime(p->tempo, tick / p->evTicks,
+                               (double)(tick % p->evTicks) / p->evTicks)
+                     + 1e-6);
+    return p->evAnchorUs +
+           floor((double)(tick - p->evAnchorTick) * p->evUs / p->evTicks);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns how far (0 to 1) a slide from time a to time b is at time t. */
+static double slidePos(double a, double b, double t) {
+    if (t <= a) return 0;
+    if (t >= b) return 1;
+    return (t - a) / (b - a);
+}
+
+
+/*############################################################################*/
+
+
+/* Start playing an event.
+   now:  Time in microseconds from the start of the song.
+   tick: Tick of the event. */
+static void eventApply(player_t *p, const event_t *ev, double now,
+                       unsigned int tick) {
+    misc_t *m = ev->misc;
+    int pin = ev->pin;
+
+    /* Tempo change, unless a tempo map is in use */
+    if (m && m->us && !p->tempo) {
+        p->evAnchorUs   = now;
+        p->evAnchorTick = tick;
+        p->evUs         = m->us;
+    }
+    if (pin < 0 || pin > 31) return;
+
+    /* Pins start when their first event is reached, unless another player
+       is playing them */
+    if (pinsClaim(p, 1<<pin)) return;
+    p->pins |= 1<<pin;
+    gpio_mode(pin, OUT);
+
+    p->evFreq[pin]  = ev->freq;
+    p->evDuty[pin]  = ev->duty;
+    p->evMisc[pin]  = m;
+    p->evStart[pin] = now;
+    p->evBeat[pin]  = p->evUs;
+    if (p->tempo)
+        p->evBeat[pin] = tempoTime(p->tempo, tick / p->evTicks + 1, 0) -
+                      tempoTime(p->tempo, tick / p->evTicks, 0);
+
+    /* Vibrato and tremolo settings last until they are changed again */
+    if (m && m->usingV) {
+        p->evVInt[pin] = m->vInt;
+        p->evVWth[pin] = m->vWth;
+    }
+    if (m && m->usingT) {
+        p->evTInt[pin] = m->tInt;
+        p->evTWth[pin] = m->tWth;
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Generate and transmit one wave for every pin, from time s to time e
+   (microseconds from the start of the song).
+   tick: Tick at which the wave starts, used for telemetry. */
+static void eventSpan(player_t *p, double s, double e, unsigned int tick) {
+    unsigned int len = e - s;
+    unsigned int pin;
+    unsigned int _pins;
+    double freqS, freqE, freqDS, freqDE;
+    double dutyS, dutyE, dutyDS, dutyDE;
+    double rs, re, a, b;
+    misc_t *m;
+    unsigned long start;
+
+    for (_pins = p->pins, pin = 0; pin < 32; _pins >>= 1, pin++) {
+        if (!(_pins&1)) continue;
+        m  = p->evMisc[pin];
+        rs = s - p->evStart[pin];
+        re = e - p->evStart[pin];
+
+        /* Pitch slide, with offsets in beats from start of note */
+        freqS = freqE = p->evFreq[pin];
+        freqDS = 0;
+        freqDE = len;
+        if (m && m->usingPs && p->evFreq[pin]) {
+            a = m->freqS * p->evBeat[pin];
+            b = m->freqE * p->evBeat[pin];
+            freqS = interpolateFreq(p->evFreq[pin], m->freqTo,
+                                    slidePos(a,b,rs));
+            freqE = interpolateFreq(p->evFreq[pin], m->freqTo,
+                                    slidePos(a,b,re));
+            if (freqS != freqE) {
+                freqDS = dmax(dmin(a - rs, len), 0);
+                freqDE = dmax(dmin(b - rs, len), 0);
+            }
+        }
+
+        /* Dutycycle slide, with offsets in beats from start of note */
+        dutyS = dutyE = p->evDuty[pin];
+        dutyDS = 0;
+        dutyDE = len;
+        if (m && m->usingDs) {
+            a = m->dutyS * p->evBeat[pin];
+            b = m->dutyE * p->evBeat[pin];
+            dutyS = interpolateDuty(p->evDuty[pin], m->dutyTo,
+                                    slidePos(a,b,rs));
+            dutyE = interpolateDuty(p->evDuty[pin], m->dutyTo,
+                                    slidePos(a,b,re));
+            if (dutyS != dutyE) {
+                dutyDS = dmax(dmin(a - rs, len), 0);
+                dutyDE = dmax(dmin(b - rs, len), 0);
+            }
+        }
+
+        /* A silent pin drops the rest of its last period, so that its wave
+           is as long as the others */
+        if (!freqS || dutyS <= 0 || dutyS >= 1) p->info[pin].w_offset = 0;
+
+        start = TIMING_NOW();
+        p->info[pin] = waveGen(p->wIn2, pin, freqS, freqE, freqDS, freqDE,
+                               dutyS, dutyE, dutyDS, dutyDE,
+                               p->evVInt[pin], p->evVWth[pin],
+                               p->evTInt[pin], p->evTWth[pin],
+                               len, 1,
+                               p->info[pin].v_offset,
+                               p->info[pin].t_offset,
+                               p->info[pin].w_offset,
+                               p->info[pin].w_on, 0, 0);
+        TIMING_ADD(p, TIMING_GEN, TIMING_NOW() - start, p->info[pin].length);
+        TRACE_SPAN("gen", start, "pin", pin);
+        waveAdd(p, p->wIn2, p->info[pin].length);
+    }
+
+    waveTransmit(p, tick);
+}
+
+
+/*############################################################################*/
+
+
+/* Generate and transmit every pin from time s to time e (microseconds from the
+   start of the song). The time is only split into several waves if the
+   waves would not otherwise fit into the wave buffers.
+   tick: Tick at which the time starts, used for telemetry. */
+static void eventRender(player_t *p, double s, double e, unsigned int tick) {
+    unsigned int pin;
+    unsigned int _pins;
+    double rate = 0;
+    double f, chunk, parts, i;
+    misc_t *m;
+
+    if (!p->pins || e <= s) return;
+
+    /* Estimate highest amount of transitions per microsecond */
+    for (_pins = p->pins, pin = 0; pin < 32; _pins >>= 1, pin++) {
+        if (!(_pins&1) || !p->evFreq[pin]) continue;
+        m = p->evMisc[pin];
+        f = p->evFreq[pin];
+        if (m && m->usingPs) f = dmax(f, m->freqTo);
+        f *= pow(2, p->evVInt[pin]/1200);
+        rate += 2*f/1000000;
+    }
+
+    /* Split into equal parts that fit */
+    chunk = rate ? EVENT_PULSES/rate : EVENT_MAX_US;
+    chunk = dmin(chunk, EVENT_MAX_US);
+    parts = ceil((e - s) / chunk);
+    for (i = 0; i < parts; i++)
+        eventSpan(p, s + floor((e-s)*i/parts), s + floor((e-s)*(i+1)/parts),
+                  tick);
+}
+
+
+/*############################################################################*/
+
+
+/* Play events as they are produced, without storing them.
+   next:  Function called to get each event, in order of tick. It should fill
+          in *event and return 1, or return 0 when there are no more events.
+   arg:   Passed to next().
+   startPins: Pins (1<<pin) that are to be silent until their first event.
+              Other pins start when their first event is reached.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   ticks: Amount of ticks per beat. */
+void playerEventPlayStream(player_t *p,
+                           int (*next)(event_t *event, void *arg), void *arg,
+                           unsigned int startPins, unsigned int us,
+                           unsigned int ticks) {
+    event_t ev;
+    unsigned int tick = 0;
+    unsigned int pin;
+    double now = 0, end;
+    int have;
+
+    p->pins = startPins;
+    if (playerOpen(p)) {
+        p->pins = 0;
+        return;
+    }
+
+    for (pin = 0; pin < 32; pin++) {
+        p->evFreq[pin] = 0;
+        p->evDuty[pin] = 0;
+        p->evMisc[pin] = NULL;
+        p->evVInt[pin] = 0;
+        p->evVWth[pin] = 0;
+        p->evTInt[pin] = 0;
+        p->evTWth[pin] = 0;
+        if (startPins & (1<<pin)) gpio_mode(pin, OUT);
+    }
+    p->evAnchorUs   = 0;
+    p->evAnchorTick = 0;
+    p->evUs         = us;
+    p->evTicks      = ticks ? ticks : 1;
+
+    /* Generate everything up to each event, then start the event */
+    for (have = next(&ev, arg); have; have = next(&ev, arg)) {
+        if (ev.tick > tick) {
+            end = eventTime(p, ev.tick);
+            eventRender(p, now, end, tick);
+            tick = ev.tick;
+            now  = end;
+        }
+        eventApply(p, &ev, now, tick);
+    }
+
+    playerClose(p, tick);
+}
+
+
+/*############################################################################*/
+
+
+/* Set how many beats may be generated ahead of the beat being sent to DMA.
+   depth: Beats to generate ahead, or 0 to generate and send beats on one
+          thread. */
+void playerPipelineDepth(player_t *p, unsigned int depth) {
+    p->pipelineDepth = depth;
+}
+
+
+/*############################################################################*/
+
+
+/* Copy the statistics of the pipeline during the last song into *out. */
+void playerPipelineStats(player_t *p, pipeline_stats_t *out) {
+    *out = p->pipelineStats;
+}
+
+
+/*############################################################################*/
+
+
+/* Set how many threads generate the waveforms of different pins.
+   threads: Threads, including the one playing (1 to 8). */
+void playerGeneratorThreads(player_t *p, unsigned int threads) {
+    p->generatorThreads = threads;
+}
+
+
+/*############################################################################*/
+
+
+/* Copy the timing of the last song into *out. */
+void playerTimingStats(player_t *p, timing_stats_t *out) {
+    *out = p->timing;
+}
+
+
+/*############################################################################*/
+
+
+/* Keep DMA set up after each song, so that the next one starts without
+   setting it up again and follows straight on from the last one.
+   keep: 1 to keep DMA set up, or 0 to free it once the last song has
+         finished. */
+void playerKeepDma(player_t *p, int keep) {
+    p->keep = keep;
+    if (keep || !p->kept || p->playing || p->live) return;
+
+    /* Let DMA finish the last song (its pins then turn off) */
+    while (driver_dma_running(p->dma)) usleep(1000);
+    driver_stop_dma(p->dma);
+
+    p->cbs_index = 0;
+    p->cmd_index = 0;
+    p->dma_laps  = 0;
+    p->dma_last  = 0;
+    p->cbs_laps  = 0;
+
+    dmaClose(p);
+    p->kept = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Enable or disable the quality of service controller.
+   on: 1 to enable, 0 to always play at full quality. */
+void playerQosEnable(player_t *p, int on) {
+    p->qosEnabled = on;
+}
+
+
+/*############################################################################*/
+
+
+/* Copy the quality of service of the last song into *out. */
+void playerQosStats(player_t *p, qos_stats_t *out) {
+    *out = p->qos;
+}
+
+
+/*############################################################################*/
+
+
+/* Make the player sleep for every transition it generates.
+   ns: Nanoseconds per transition, or 0 to play at full speed. */
+void playerQosSlowdown(player_t *p, unsigned int ns) {
+    p->qosSlowdown = ns;
+}
+
+
+/*############################################################################*/
+
+
+/* Publish the counters of the player in shared memory.
+   name: Name of the shared memory, such as METRICS_NAME.
+   Returns 0, or -1 if it could not be made. */
+int playerMetricsOpen(player_t *p, const char *name) {
+    metrics_t *m;
+
+    if (p->playing) {
+        fprintf(stderr, "ERROR: playerMetricsOpen(): A song is playing.\n");
+        return -1;
+    }
+    playerMetricsClose(p);
+    if (!(m = metrics_create(name))) return -1;
+    p->metricsName = malloc(strlen(name) + 1);
+    strcpy(p->metricsName, name);
+    p->metrics = m;
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Stop publishing the counters and remove the shared memory. */
+void playerMetricsClose(player_t *p) {
+    if (!p->metrics) return;
+    metrics_destroy(p->metrics, p->metricsName);
+    free(p->metricsName);
+    p->metrics     = NULL;
+    p->metricsName = NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Find the time some microseconds from now, for pthread_cond_timedwait().
+   until: Filled in with the time.
+   us:    Microseconds from now. */
+static void timeAfter(struct timespec *until, unsigned long us) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    until->tv_sec  = now.tv_sec + us/1000000;
+    until->tv_nsec = (now.tv_usec + us%1000000)*1000L;
+    if (until->tv_nsec >= 1000000000L) {
+        until->tv_sec++;
+        until->tv_nsec -= 1000000000L;
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Background thread of queuePlayAsync() and queuePlayFileAsync(). */
+static void *playRun(void *arg) {
+    play_t *play = arg;
+    player_t *p = play->player;
+
+    if (play->path) play->result = playerQueuePlayFile(p, play->path);
+    else if (play->data)
+        play->result = playerQueuePlayMemory(p, play->data, play->length);
+    else playerQueuePlay(p, play->us, play->beats);
+
+    pthread_mutex_lock(&play->lock);
+    p->cancel    = 0;
+    play->done = 1;
+    pthread_cond_broadcast(&play->finished);
+    pthread_mutex_unlock(&play->lock);
+    return NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Start playing in the background.
+   path:         Score file, or NULL.
+   data, length: Score in memory, or NULL. Without either, the queue is played.
+   us, beats:    Beat length and beats, when playing the queue.
+   Returns the handle of the song, or NULL if another one is playing. */
+static play_t *playAsync(player_t *p, const char *path, const void *data,
+                         size_t length, unsigned int us, unsigned int beats) {
+    play_t *play;
+
+    if (p->playing || p->live) {
+        fprintf(stderr, "ERROR: queuePlayAsync(): A song is already "
+                        "playing.\n");
+        return NULL;
+    }
+
+    play = malloc(sizeof(play_t));
+    memset(play, 0, sizeof(*play));
+    play->player = p;
+    play->us     = us;
+    play->beats  = beats;
+    play->data   = data;
+    play->length = length;
+    if (path) {
+        play->path = malloc(strlen(path) + 1);
+        strcpy(play->path, path);
+    }
+    pthread_mutex_init(&play->lock, NULL);
+    pthread_cond_init(&play->finished, NULL);
+    gettimeofday(&play->start, NULL);
+
+    p->cancel        = 0;
+    p->progressBeats = 0;
+    p->progressTotal = path || data ? 0 : beats;
+    p->progressUs    = 0;
+
+    if (pthread_create(&play->thread, NULL, playRun, play)) {
+        fprintf(stderr, "ERROR: queuePlayAsync(): Could not start thread.\n");
+        pthread_cond_destroy(&play->finished);
+        pthread_mutex_destroy(&play->lock);
+        free(play->path);
+        free(play);
+        return NULL;
+    }
+    p->playing = play;
+    return play;
+}
+
+
+/*############################################################################*/
+
+
+/* Play queue in the background. This function also consumes the queue.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   Returns the handle of the song, or NULL if another one is playing. */
+play_t *playerQueuePlayAsync(player_t *p, unsigned int us, unsigned int beats) {
+    return playAsync(p, NULL, NULL, 0, us, beats);
+}
+
+
+/*############################################################################*/
+
+
+/* Play a score file in the background.
+   path: Score file, as written by queueSave().
+   Returns the handle of the song, or NULL if another one is playing. */
+play_t *playerQueuePlayFileAsync(player_t *p, const char *path) {
+    return playAsync(p, path, NULL, 0, 0, 0);
+}
+
+
+/*############################################################################*/
+
+
+/* Play a score that is already in memory in the background.
+   data:   The score. It must stay valid until the song has finished.
+   length: Bytes of score.
+   Returns the handle of the song, or NULL if another one is playing. */
+play_t *playerQueuePlayMemoryAsync(player_t *p, const void *data,
+                                   size_t length) {
+    return playAsync(p, NULL, data, length, 0, 0);
+}
+
+
+/*############################################################################*/
+
+
+/* Get the progress of a song played in the background.
+   play: Handle of the song.
+   out:  Filled in with the progress. This may be NULL.
+   Returns 1 while the song is playing, or 0 once it has finished. */
+int playPoll(play_t *play, play_progress_t *out) {
+    player_t *p = play->player;
+    struct timeval now;
+    int done;
+
+    pthread_mutex_lock(&play->lock);
+    done = play->done;
+    pthread_mutex_unlock(&play->lock);
+
+    if (out) {
+        gettimeofday(&now, NULL);
+        out->beats     = p->progressBeats;
+        out->total     = p->progressTotal;
+        out->us        = p->progressUs;
+        out->elapsedUs = (now.tv_sec - play->start.tv_sec)*1000000UL
+                       + now.tv_usec - play->start.tv_usec;
+    }
+    return !done;
+}
+
+
+/*############################################################################*/
+
+
+/* Wait for a song played in the background to finish.
+   play: Handle of the song.
+   ms:   Longest time to wait in milliseconds, or 0 to wait until it finishes.
+   Returns 0 once the song has finished, or -1 if it is still playing. */
+int playWait(play_t *play, unsigned int ms) {
+    struct timespec until;
+    int ret = 0;
+
+    timeAfter(&until, ms*1000UL);
+
+    pthread_mutex_lock(&play->lock);
+    while (!play->done && ret != ETIMEDOUT) {
+        if (ms) ret = pthread_cond_timedwait(&play->finished, &play->lock,
+                                             &until);
+        else pthread_cond_wait(&play->finished, &play->lock);
+    }
+    ret = play->done ? 0 : -1;
+    pthread_mutex_unlock(&play->lock);
+    return ret;
+}
+
+
+/*############################################################################*/
+
+
+/* Stop a song played in the background. It stops at the start of the next
+   beat, and pins are then turned off and DMA is released. This returns
+   without waiting for that; use playWait() or playFree() to wait.
+   play: Handle of the song. */
+void playCancel(play_t *play) {
+    player_t *p = play->player;
+
+    pthread_mutex_lock(&play->lock);
+    if (!play->done) p->cancel = 1;
+    pthread_mutex_unlock(&play->lock);
+}
+
+
+/*############################################################################*/
+
+
+/* Wait for a song played in the background to finish, and free its handle.
+   play: Handle of the song.
+   Returns what queuePlayFile() returned when playing a score file, or 0. */
+int playFree(play_t *play) {
+    player_t *p = play->player;
+    int result;
+
+    pthread_join(play->thread, NULL);
+    result = play->result;
+    pthread_cond_destroy(&play->finished);
+    pthread_mutex_destroy(&play->lock);
+    free(play->path);
+    free(play);
+    p->playing = NULL;
+    return result;
+}
+
+
+/*############################################################################*/
+
+
+/* Forget the slices that DMA has finished. */
+static void liveRetire(player_t *p) {
+    live_slice_t *slice;
+    unsigned int cmd, i;
+
+    /* DMA stopped: everything written has been played */
+    if (!driver_dma_running(p->dma)) {
+        p->liveCount = 0;
+        return;
+    }
+
+    cmd = driver_dma_current_cb(p->dma)/2;
+    for (i = 0; i < p->liveCount; i++) {
+        slice = &p->liveRing[(p->liveFirst + i) % LIVE_SLICES];
+        if (cmd >= slice->cmd && cmd < slice->cmd + slice->length) break;
+    }
+    /* Keep every slice if DMA is not in any of them */
+    if (i == p->liveCount) return;
+
+    p->liveFirst  = (p->liveFirst + i) % LIVE_SLICES;
+    p->liveCount -= i;
+}
+
+
+/*############################################################################*/
+
+
+/* Write one slice after the last one, and start DMA if it has stopped.
+   freq, duty: Note of each pin. */
+static void liveRender(player_t *p, const double *freq, const double *duty) {
+    cb_t *cbsV = p->dma->cbs_v;
+    live_slice_t *slice;
+    wavegen_job_t *job;
+    unsigned int pin, jobs = 0, i;
+    int running;
+
+    for (pin = 0; pin < 32; pin++) {
+        if (!(p->pins & (1<<pin))) continue;
+        job = &p->job[jobs++];
+        job->pin        = pin;
+        job->freqS      = freq[pin];
+        job->freqE      = freq[pin];
+        job->freqDelayS = 0;
+        job->freqDelayE = p->liveSlice;
+        job->dutyS      = duty[pin];
+        job->dutyE      = duty[pin];
+        job->dutyDelayS = 0;
+        job->dutyDelayE = p->liveSlice;
+        job->vIntensity = 0;
+        job->vWidth     = 0;
+        job->tIntensity = 0;
+        job->tWidth     = 0;
+        job->len        = p->liveSlice;
+        job->value      = 1;
+        job->effectUs   = 0;
+        job->slideSteps = 0;
+    }
+
+    /* Keep the phase of every pin, in case the slice is written again */
+    slice = &p->liveRing[(p->liveFirst + p->liveCount) % LIVE_SLICES];
+    memcpy(slice->info, p->info, sizeof(p->info));
+    waveJobs(p, jobs);
+
+    /* Start again from the first control block if the slice does not fit */
+    if (p->liveCmd + p->wOutLength >= PAGES*64) p->liveCmd = 0;
+    slice->cmd     = p->liveCmd;
+    slice->length  = p->wOutLength;
+    slice->link    = p->liveLink;
+    slice->startUs = p->liveUs;
+
+    for (i = 0; i < p->wOutLength; i++) cbWrite(p, p->liveCmd + i, &p->wOut[i]);
+    cbsV[2*(p->liveCmd + p->wOutLength) - 1].nextconbk = 0;
+
+    /* Link the slice in only once it has been written. cbWrite() linked its
+       first control block to the second, the bus address of which is one
+       control block past that of the first. */
+    running = driver_dma_running(p->dma);
+    if (p->liveLink >= 0)
+        cbsV[p->liveLink].nextconbk = cbsV[2*p->liveCmd].nextconbk
+                                    - sizeof(cb_t);
+    if (running) p->liveCount++;
+    else {
+        /* Nothing else is left to play */
+        p->liveFirst = (p->liveFirst + p->liveCount) % LIVE_SLICES;
+        p->liveCount = 1;
+        driver_activate_dma(p->dma, 2*p->liveCmd);
+    }
+
+    p->liveLink   = 2*(p->liveCmd + p->wOutLength) - 1;
+    p->liveCmd   += p->wOutLength;
+    p->liveUs    += p->liveSlice;
+    p->wOutLength = 0;
+    p->firstWave  = 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Drop the slices that DMA will not reach within the guard distance, so that
+   they are written again with the new notes. The pins then carry on from the
+   phase they had at the start of the first slice dropped. */
+static void liveSplice(player_t *p) {
+    cb_t *cbsV = p->dma->cbs_v;
+    live_slice_t *slice = NULL;
+    unsigned long from;
+    unsigned int i;
+
+    /* DMA is somewhere in the first slice */
+    if (!p->liveCount) return;
+    from = p->liveRing[p->liveFirst].startUs + p->liveSlice + p->liveGuard;
+    for (i = 1; i < p->liveCount; i++) {
+        slice = &p->liveRing[(p->liveFirst + i) % LIVE_SLICES];
+        if (slice->startUs >= from) break;
+    }
+    if (i == p->liveCount) return;
+
+    /* Unlink the slices first. Should DMA get there anyway, it stops, and
+       liveRender() starts it again. */
+    if (slice->link >= 0) cbsV[slice->link].nextconbk = 0;
+
+    memcpy(p->info, slice->info, sizeof(p->info));
+    p->liveCmd   = slice->cmd;
+    p->liveLink  = slice->link;
+    p->liveUs    = slice->startUs;
+    p->liveCount = i;
+}
+
+
+/*############################################################################*/
+
+
+/* Thread of liveOpen(): keep the horizon written, with the latest notes. */
+static void *liveRun(void *arg) {
+    player_t *p = arg;
+    double freq[32], duty[32];
+    struct timespec until;
+    unsigned int changed;
+    int quit;
+
+    TRACE_THREAD("live");
+    for (;;) {
+        /* Sleep for half a slice, or until a note changes */
+        pthread_mutex_lock(&p->liveLock);
+        if (!p->liveChanged && !p->liveQuit) {
+            timeAfter(&until, p->liveSlice/2);
+            pthread_cond_timedwait(&p->liveWake, &p->liveLock, &until);
+        }
+        changed = p->liveChanged;
+        quit    = p->liveQuit;
+        p->liveChanged = 0;
+        memcpy(freq, p->liveFreq, sizeof(freq));
+        memcpy(duty, p->liveDuty, sizeof(duty));
+        pthread_mutex_unlock(&p->liveLock);
+        if (quit) break;
+
+        liveRetire(p);
+        if (changed) liveSplice(p);
+        while (!p->liveCount ||
+               p->liveUs - p->liveRing[p->liveFirst].startUs < p->liveHorizon)
+            liveRender(p, freq, duty);
+    }
+    return NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Start playing notes as they are given by noteOn() and noteOff().
+   livePins: Pins (1<<pin) that notes may be played on.
+   slice:    Length of each part of sound written to DMA, in microseconds.
+   horizon:  How far ahead of DMA sound is written, in microseconds.
+   Returns 0, or -1 if a song is playing. */
+int playerLiveOpen(player_t *p, unsigned int livePins, unsigned int slice,
+                   unsigned int horizon) {
+    unsigned int pin;
+
+    if (p->playing || p->live) {
+        fprintf(stderr, "ERROR: liveOpen(): A song is already playing.\n");
+        return -1;
+    }
+
+    p->live        = 1;
+    p->liveSlice   = slice ? slice : LIVE_SLICE;
+    p->liveHorizon = horizon ? horizon : LIVE_HORIZON;
+    p->liveGuard   = LIVE_GUARD;
+    if (p->liveHorizon > (LIVE_SLICES-2)*p->liveSlice)
+        p->liveHorizon = (LIVE_SLICES-2)*p->liveSlice;
+
+    p->pins = livePins;
+    if (playerOpen(p)) {
+        p->pins = 0;
+        p->live = 0;
+        return -1;
+    }
+    for (pin = 0; pin < 32; pin++) {
+        p->liveFreq[pin] = 0;
+        p->liveDuty[pin] = 0.5;
+        if (p->pins & (1<<pin)) gpio_mode(pin, OUT);
+    }
+    p->liveFirst   = 0;
+    p->liveCount   = 0;
+    p->liveCmd     = 0;
+    p->liveLink    = -1;
+    p->liveUs      = 0;
+    p->liveChanged = 0;
+    p->liveQuit    = 0;
+
+    if (pthread_create(&p->liveThread, NULL, liveRun, p)) {
+        fprintf(stderr, "ERROR: liveOpen(): Could not start thread.\n");
+        playerClose(p, 0);
+        p->live = 0;
+        return -1;
+    }
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Play a note on a pin until the next noteOn() or noteOff() for that pin.
+   pin:  GPIO pin number (BCM), one of those given to liveOpen().
+   freq: Frequency (Hz). A zero (0) turns the pin off.
+   duty: Duty cycle (0 to 1, exclusive). */
+void playerNoteOn(player_t *p, int pin, double freq, double duty) {
+    pthread_mutex_lock(&p->liveLock);
+    p->liveFreq[pin] = freq;
+    p->liveDuty[pin] = duty;
+    p->liveChanged  |= 1<<pin;
+    pthread_cond_signal(&p->liveWake);
+    pthread_mutex_unlock(&p->liveLock);
+}
+
+
+/*############################################################################*/
+
+
+/* Stop playing a note on a pin.
+   pin: GPIO pin number (BCM), one of those given to liveOpen(). */
+void playerNoteOff(player_t *p, int pin) {
+    playerNoteOn(p, pin, 0, p->liveDuty[pin]);
+}
+
+
+/*############################################################################*/
+
+
+/* Stop playing notes. What has been written to DMA is played first, and then
+   pins are turned off and resources are freed. */
+void playerLiveClose(player_t *p) {
+    if (!p->live) return;
+
+    pthread_mutex_lock(&p->liveLock);
+    p->liveQuit = 1;
+    pthread_cond_signal(&p->liveWake);
+    pthread_mutex_unlock(&p->liveLock);
+    pthread_join(p->liveThread, NULL);
+
+    playerClose(p, 0);
+    p->live = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Reset a player to its state before it has played anything. */
+static void playerInit(player_t *p, int dmach, int pacer) {
+    memset(p, 0, sizeof(*p));
+    p->dmach            = dmach;
+    p->pacer            = pacer;
+    p->firstWave        = 1;
+    p->wOut             = p->wOutBuf;
+    p->pipelineDepth    = PIPELINE_DEPTH;
+    p->generatorThreads = GENERATOR_THREADS;
+    p->qosEnabled       = QOS;
+    pthread_mutex_init(&p->workerLock, NULL);
+    pthread_cond_init(&p->workerWake, NULL);
+    pthread_mutex_init(&p->liveLock, NULL);
+    pthread_cond_init(&p->liveWake, NULL);
+}
+
+
+/*############################################################################*/
+
+
+/* Make a new player.
+   dmach: DMA channel (0, 4, 5 or 6) not used by any other player.
+   pacer: PACER_PWM or PACER_PCM.
+   Returns the player, or NULL if the arguments are not valid. */
+player_t *playerNew(int dmach, int pacer) {
+    player_t *p;
+
+    if (dmach != 0 && dmach != 4 && dmach != 5 && dmach != 6) {
+        fprintf(stderr, "ERROR: playerNew(): Use DMA channel 0, 4, 5 or 6.\n");
+        return NULL;
+    }
+    if (pacer != PACER_PWM && pacer != PACER_PCM) {
+        fprintf(stderr, "ERROR: playerNew(): Use PACER_PWM or PACER_PCM.\n");
+        return NULL;
+    }
+
+    p = malloc(sizeof(player_t));
+    if (p) playerInit(p, dmach, pacer);
+    return p;
+}
+
+
+/*############################################################################*/
+
+
+/* Free a player made by playerNew(). Nothing may be playing on it. */
+void playerDelete(player_t *p) {
+    pattern_cache_t *c, *next;
+    unsigned int i;
+
+    if (!p || p == &_player) return;
+
+    /* Free DMA if it was kept set up */
+    playerKeepDma(p, 0);
+    playerMetricsClose(p);
+
+    for (i = 0; i < p->patternCount; i++) {
+        for (c = p->patterns[i].cache; c; c = next) {
+            next = c->next;
+            patternFree(p, c);
+        }
+    }
+    free(p->patterns);
+    free(p->events);
+    free(p->slack);
+
+    pthread_cond_destroy(&p->liveWake);
+    pthread_mutex_destroy(&p->liveLock);
+    pthread_cond_destroy(&p->workerWake);
+    pthread_mutex_destroy(&p->workerLock);
+    free(p);
+}
+
+
+/*############################################################################*/
+
+
+/* Set up the default player, once. */
+static void playerDefaultInit(void) {
+    playerInit(&_player, -1, PACER_PWM);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the default player, used by the functions that do not take one. */
+player_t *playerDefault(void) {
+    pthread_once(&_playerOnce, playerDefaultInit);
+    return &_player;
+}
+
+
+/*############################################################################*/
+
+
+/* The functions below are the ones programs used before there were several
+   players, and play on the default player. */
+void queueAdd(int pin, double *freqs, double *duties, misc_t **misc) {
+    playerQueueAdd(playerDefault(), pin, freqs, duties, misc);
+}
+
+
+/*############################################################################*/
+
+
+void queuePlay(unsigned int us, unsigned int beats) {
+    playerQueuePlay(playerDefault(), us, beats);
+}
+
+
+/*############################################################################*/
+
+
+int queuePlayFile(const char *path) {
+    return playerQueuePlayFile(playerDefault(), path);
+}
+
+
+/*############################################################################*/
+
+
+int queuePlayMemory(const void *data, size_t length) {
+    return playerQueuePlayMemory(playerDefault(), data, length);
+}
+
+
+/*############################################################################*/
+
+
+int queueSave(const char *path, unsigned int us, unsigned int beats) {
+    return playerQueueSave(playerDefault(), path, us, beats);
+}
+
+
+/*############################################################################*/
+
+
+void queueTempo(const tempo_t *tempo) {
+    playerQueueTempo(playerDefault(), tempo);
+}
+
+
+/*############################################################################*/
+
+
+int queueCompile(const char *path, unsigned int us, unsigned int beats) {
+    return playerQueueCompile(playerDefault(), path, us, beats);
+}
+
+
+/*############################################################################*/
+
+
+int queueCompileFile(const char *score, const char *path) {
+    return playerQueueCompileFile(playerDefault(), score, path);
+}
+
+
+/*############################################################################*/
+
+
+void compiledPlay(const compiled_t *song) {
+    playerCompiledPlay(playerDefault(), song);
+}
+
+
+/*############################################################################*/
+
+
+int patternNew(unsigned int beats) {
+    return playerPatternNew(playerDefault(), beats);
+}
+
+
+/*############################################################################*/
+
+
+void patternAdd(int pattern, int pin,
+                double *freqs, double *duties, misc_t **misc) {
+    playerPatternAdd(playerDefault(), pattern, pin, freqs, duties, misc);
+}
+
+
+/*############################################################################*/
+
+
+void patternPlay(unsigned int us, const unsigned int *order,
+                 unsigned int length) {
+    playerPatternPlay(playerDefault(), us, order, length);
+}
+
+
+/*############################################################################*/
+
+
+void patternStats(pattern_stats_t *out) {
+    playerPatternStats(playerDefault(), out);
+}
+
+
+/*############################################################################*/
+
+
+void queuePlayPatterns(unsigned int us, unsigned int beats,
+                       unsigned int size) {
+    playerQueuePlayPatterns(playerDefault(), us, beats, size);
+}
+
+
+/*############################################################################*/
+
+
+void eventAdd(int pin, unsigned int start, unsigned int length,
+              double freq, double duty, misc_t *misc) {
+    playerEventAdd(playerDefault(), pin, start, length, freq, duty, misc);
+}
+
+
+/*############################################################################*/
+
+
+void eventPlay(unsigned int us, unsigned int ticks) {
+    playerEventPlay(playerDefault(), us, ticks);
+}
+
+
+/*############################################################################*/
+
+
+void eventPlayStream(int (*next)(event_t *event, void *arg), void *arg,
+                     unsigned int startPins, unsigned int us,
+                     unsigned int ticks) {
+    playerEventPlayStream(playerDefault(), next, arg, startPins, us, ticks);
+}
+
+
+/*############################################################################*/
+
+
+void pipelineDepth(unsigned int depth) {
+    playerPipelineDepth(playerDefault(), depth);
+}
+
+
+/*############################################################################*/
+
+
+void pipelineStats(pipeline_stats_t *out) {
+    playerPipelineStats(playerDefault(), out);
+}
+
+
+/*############################################################################*/
+
+
+void generatorThreads(unsigned int threads) {
+    playerGeneratorThreads(playerDefault(), threads);
+}
+
+
+/*############################################################################*/
+
+
+void timingStats(timing_stats_t *out) {
+    playerTimingStats(playerDefault(), out);
+}
+
+
+/*############################################################################*/
+
+
+void playerKeep(int keep) {
+    playerKeepDma(playerDefault(), keep);
+}
+
+
+/*############################################################################*/
+
+
+void qosEnable(int on) {
+    playerQosEnable(playerDefault(), on);
+}
+
+
+/*############################################################################*/
+
+
+void qosStats(qos_stats_t *out) {
+    playerQosStats(playerDefault(), out);
+}
+
+
+/*############################################################################*/
+
+
+void qosSlowdown(unsigned int ns) {
+    playerQosSlowdown(playerDefault(), ns);
+}
+
+
+/*############################################################################*/
+
+
+int metricsOpen(const char *name) {
+    return playerMetricsOpen(playerDefault(), name);
+}
+
+
+/*############################################################################*/
+
+
+void metricsClose(void) {
+    playerMetricsClose(playerDefault());
+}
+
+
+/*############################################################################*/
+
+
+play_t *queuePlayAsync(unsigned int us, unsigned int beats) {
+    return playerQueuePlayAsync(playerDefault(), us, beats);
+}
+
+
+/*############################################################################*/
+
+
+play_t *queuePlayFileAsync(const char *path) {
+    return playerQueuePlayFileAsync(playerDefault(), path);
+}
+
+
+/*############################################################################*/
+
+
+play_t *queuePlayMemoryAsync(const void *data, size_t length) {
+    return playerQueuePlayMemoryAsync(playerDefault(), data, length);
+}
+
+
+/*############################################################################*/
+
+
+int liveOpen(unsigned int livePins, unsigned int slice, unsigned int horizon) {
+    return playerLiveOpen(playerDefault(), livePins, slice, horizon);
+}
+
+
+/*############################################################################*/
+
+
+void noteOn(int pin, double freq, double duty) {
+    playerNoteOn(playerDefault(), pin, freq, duty);
+}
+
+
+/*############################################################################*/
+
+
+void noteOff(int pin) {
+    playerNoteOff(playerDefault(), pin);
+}
+
+
+/*############################################################################*/
+
+
+void liveClose(void) {
+    playerLiveClose(playerDefault());
 }
 
 
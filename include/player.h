@@ -22,9 +22,62 @@
 
 #pragma once
 
+#include <stddef.h> /* size_t */
+
 /* Pages for DMA control blocks. */
 #define PAGES 128
 
+/* Beats that may be generated ahead of the beat being sent to DMA, see
+   pipelineDepth(). 0 generates and sends beats on one thread. */
+#ifndef PIPELINE_DEPTH
+#   define PIPELINE_DEPTH 0
+#endif
+
+/* Defaults for liveOpen(), in microseconds: the length of each part of sound
+   written to DMA, how far ahead of DMA it is written, and how far ahead of
+   DMA a note change may start. */
+#ifndef LIVE_SLICE
+#   define LIVE_SLICE   1000
+#endif
+#ifndef LIVE_HORIZON
+#   define LIVE_HORIZON 8000
+#endif
+#ifndef LIVE_GUARD
+#   define LIVE_GUARD   1000
+#endif
+
+/* Threads that generate waveforms, see generatorThreads(). */
+#ifndef GENERATOR_THREADS
+#   define GENERATOR_THREADS 1
+#endif
+
+/* Time each part of playing and the slack of every beat, see timingStats().
+   Build with -DTIMING=1 ("make pi2 TIMING=1") to enable. With 0, the timing
+   code is left out altogether. */
+#ifndef TIMING
+#   define TIMING 0
+#endif
+
+/* Make effects coarser when too little sound is ready ahead of DMA, see
+   qosEnable(). Build with -DQOS=1 ("make pi0 QOS=1") to enable it from the
+   start. */
+#ifndef QOS
+#   define QOS 0
+#endif
+
+/* Defaults of the quality of service controller: it steps down a level when
+   less than QOS_LOW_US microseconds of sound are ready ahead of DMA, and up
+   again once more than QOS_HIGH_US have been for QOS_HOLD beats in a row. */
+#ifndef QOS_LOW_US
+#   define QOS_LOW_US  20000
+#endif
+#ifndef QOS_HIGH_US
+#   define QOS_HIGH_US 100000
+#endif
+#ifndef QOS_HOLD
+#   define QOS_HOLD    16
+#endif
+
 
 
 
@@ -72,10 +125,499 @@ void queueAdd(int pin, double *freqs, double *duties, misc_t **misc);
    beats: Total number of queued beats. */
 void queuePlay(unsigned int us, unsigned int beats);
 
+/* Play a score file (see score.h) without copying it into the queue.
+   Anything already in the queue is discarded.
+   path: Score file, as written by queueSave().
+   Returns 0 after playing, or -1 if the file could not be opened. */
+int queuePlayFile(const char *path);
+
+/* Play a score that is already in memory (the contents of a score file),
+   for example one received over a socket.
+   data:   The score.
+   length: Bytes of score.
+   Returns 0 after playing, or -1 if the score is invalid. */
+int queuePlayMemory(const void *data, size_t length);
+
+/* Type for songs played in the background by queuePlayAsync(). */
+typedef struct play_t play_t;
+
+/* Progress of a song played in the background, see playPoll(). */
+typedef struct play_progress_t {
+    unsigned int beats;      /* Beats sent to DMA so far.                     */
+    unsigned int total;      /* Beats in the song (0 until a score file has
+                                been opened).                                 */
+    unsigned long us;        /* Microseconds of sound sent to DMA so far.     */
+    unsigned long elapsedUs; /* Microseconds since the song was started.      */
+} play_progress_t;
+
+/* Play queue in the background, returning straight away. This function also
+   consumes the queue. Only one song can play at a time, and the arrays given
+   to queueAdd() must stay valid until it has finished.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   Returns the handle of the song, to be freed with playFree(), or NULL if
+   another song is playing. */
+play_t *queuePlayAsync(unsigned int us, unsigned int beats);
+
+/* Play a score file (see score.h) in the background, returning straight
+   away. Anything already in the queue is discarded.
+   path: Score file, as written by queueSave().
+   Returns the handle of the song, as for queuePlayAsync(). */
+play_t *queuePlayFileAsync(const char *path);
+
+/* Play a score that is already in memory in the background, returning
+   straight away. The memory must stay valid until the song has finished.
+   data:   The score.
+   length: Bytes of score.
+   Returns the handle of the song, as for queuePlayAsync(). */
+play_t *queuePlayMemoryAsync(const void *data, size_t length);
+
+/* Get the progress of a song played in the background.
+   play: Handle of the song.
+   out:  Filled in with the progress. This may be NULL.
+   Returns 1 while the song is playing, or 0 once it has finished. */
+int playPoll(play_t *play, play_progress_t *out);
+
+/* Wait for a song played in the background to finish.
+   play: Handle of the song.
+   ms:   Longest time to wait in milliseconds, or 0 to wait until it finishes.
+   Returns 0 once the song has finished, or -1 if it is still playing. */
+int playWait(play_t *play, unsigned int ms);
+
+/* Stop a song played in the background. It stops at the start of the next
+   beat, without playing what has already been sent to DMA, and then pins are
+   turned off and DMA is released. This returns without waiting for that; use
+   playWait() or playFree() to wait.
+   play: Handle of the song. */
+void playCancel(play_t *play);
+
+/* Wait for a song played in the background to finish, and free its handle.
+   play: Handle of the song.
+   Returns -1 if it was a score file that could not be opened, otherwise 0. */
+int playFree(play_t *play);
+
+/* Save the queue to a score file (see score.h) instead of playing it.
+   This function also consumes the queue. It does not use any hardware.
+   path:  Score file to write.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   Returns 0 on success, or -1 if the file could not be written. */
+int queueSave(const char *path, unsigned int us, unsigned int beats);
+
+/* Use a tempo map (see tempo.h) for the beat lengths of everything played
+   from now on, instead of fixed beat lengths. Beat length changes in misc_t
+   and in score files are then ignored, and patterns are not cached.
+   tempo: Tempo map, or NULL to go back to fixed beat lengths. It must stay
+          valid while it is in use. */
+struct tempo_t;
+void queueTempo(const struct tempo_t *tempo);
+
+/* Compile the queue into a header (see compile.h) instead of playing it.
+   This function also consumes the queue. It does not use any hardware.
+   path:  Header to write. The song is declared as a compiled_t named after
+          the file, for example "song.rpc.h" declares "song".
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   Returns 0 on success, or -1 if the header could not be written. */
+int queueCompile(const char *path, unsigned int us, unsigned int beats);
+
+/* Compile a score file (see score.h) into a header (see compile.h).
+   Anything already in the queue is discarded.
+   score: Score file, as written by queueSave().
+   path:  Header to write, as for queueCompile().
+   Returns 0 on success, or -1 if a file could not be read or written. */
+int queueCompileFile(const char *score, const char *path);
+
+/* Statistics of the pattern cache, see patternPlay(). */
+typedef struct pattern_stats_t {
+    unsigned long hits;   /* Patterns played from the cache.                  */
+    unsigned long misses; /* Patterns that had to be generated.               */
+    unsigned long bytes;  /* Bytes of waveforms taken from the cache.         */
+    unsigned long us;     /* Microseconds of generation saved by the cache.   */
+} pattern_stats_t;
+
+/* Add an empty pattern, for patternPlay().
+   beats: Length of the pattern in beats.
+   Returns the number of the pattern, or -1 if beats is 0. */
+int patternNew(unsigned int beats);
+
+/* Add a voice to a pattern. Pins that are not added to a pattern are silent
+   while it plays.
+   pattern: Number returned by patternNew().
+   The other arguments are the same as for queueAdd(), with one entry in each
+   array for every beat of the pattern. */
+void patternAdd(int pattern, int pin,
+                double *freqs, double *duties, misc_t **misc);
+
+/* Play patterns in the order of an order list. This function also consumes
+   the patterns. A pattern that is played again from the same state is not
+   generated again, and cache statistics are printed to stderr at the end.
+   us:     Length of each beat in microseconds (60000000/BPM).
+   order:  Numbers of the patterns to play, in order.
+   length: Amount of entries in order. */
+void patternPlay(unsigned int us, const unsigned int *order,
+                 unsigned int length);
+
+/* Copy the cache statistics of the last patternPlay() into *out. */
+void patternStats(pattern_stats_t *out);
+
+/* Play the queue as patterns (see patternPlay()). The queue is cut into parts
+   of the same length, and parts that repeat an earlier part are played as the
+   same pattern. This function also consumes the queue.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   beats: Total number of queued beats.
+   size:  Length of each part in beats (for example the length of a bar). */
+void queuePlayPatterns(unsigned int us, unsigned int beats, unsigned int size);
+
+/* Start playing notes as they are given by noteOn() and noteOff(), for
+   playing from a live controller. Only a short horizon of sound is written
+   ahead of DMA. When a note changes, the part of it that DMA will not reach
+   within LIVE_GUARD microseconds is written again, so changes are heard
+   within about slice + LIVE_GUARD microseconds. Waves carry on from where
+   they were, so changes do not pop.
+   livePins: Pins (1<<pin) that notes may be played on.
+   slice:    Length of each part of sound written to DMA, in microseconds, or
+             0 for LIVE_SLICE.
+   horizon:  How far ahead of DMA sound is written, in microseconds, or 0 for
+             LIVE_HORIZON. If sound is not written in time, it stops until the
+             next part is written, so this should be a few slices.
+   Returns 0, or -1 if a song is playing. */
+int liveOpen(unsigned int livePins, unsigned int slice, unsigned int horizon);
+
+/* Play a note on a pin until the next noteOn() or noteOff() for that pin.
+   This may be called from any thread while liveOpen() is in use.
+   pin:  GPIO pin number (BCM), one of those given to liveOpen().
+   freq: Frequency (Hz). A zero (0) turns the pin off.
+   duty: Duty cycle (0 to 1, exclusive). */
+void noteOn(int pin, double freq, double duty);
+
+/* Stop playing a note on a pin, as noteOn(pin, 0, duty).
+   pin: GPIO pin number (BCM), one of those given to liveOpen(). */
+void noteOff(int pin);
+
+/* Stop playing notes. What has been written to DMA is played first, and then
+   pins are turned off and resources are freed. */
+void liveClose(void);
+
+/* Type for events given to eventPlayStream(). From "tick" onwards, the pin
+   plays "freq" with "duty" until the next event for the same pin. */
+typedef struct event_t {
+    unsigned int tick; /* Tick (from start of song) at which event happens.   */
+    int pin;           /* GPIO pin number (BCM), or -1 for a tempo change.    */
+    double freq;       /* Frequency (Hz). A zero (0) turns the pin off.       */
+    double duty;       /* Duty cycle (0 to 1, exclusive).                     */
+    misc_t *misc;      /* Extra data, see eventAdd(). This may be NULL.       */
+} event_t;
+
+/* Add a note to the event list. Unlike queueAdd(), only the notes themselves
+   are stored, so held notes and rests take no memory, and a note is generated
+   as one continuous wave however long it is.
+   pin:    GPIO pin number (BCM) through which the note plays, or -1 to only
+           change the tempo (with misc->us).
+   start:  Tick (from start of song) at which the note starts.
+   length: Length of the note in ticks.
+   freq:   Frequency (Hz).
+   duty:   Duty cycle (0 to 1, exclusive).
+   misc:   Extra data. This may be NULL. The fields are used as in queueAdd(),
+           except that slide offsets are in beats from the start of the note,
+           the note value is ignored (use a shorter length instead), and
+           a non-zero "us" changes the beat length from the start of the note.
+   Notes on the same pin must not overlap. */
+void eventAdd(int pin, unsigned int start, unsigned int length,
+              double freq, double duty, misc_t *misc);
+
+/* Play the event list. This function also consumes the event list.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   ticks: Amount of ticks per beat. */
+void eventPlay(unsigned int us, unsigned int ticks);
+
+/* Play events as they are produced, without storing them.
+   next:  Function called to get each event, in order of tick. It should fill
+          in *event and return 1, or return 0 when there are no more events.
+   arg:   Passed to next().
+   startPins: Pins (1<<pin) that are to be silent until their first event.
+              Other pins start when their first event is reached.
+   us:    Length of each beat in microseconds (60000000/BPM).
+   ticks: Amount of ticks per beat. */
+void eventPlayStream(int (*next)(event_t *event, void *arg), void *arg,
+                     unsigned int startPins, unsigned int us,
+                     unsigned int ticks);
+
+/* When a program is compiled with -DSCORE_OUT='"file"', queuePlay() saves the
+   queue to that score file instead of playing it. "make scores" uses this to
+   convert the songs in this repository to score files. */
+#ifdef SCORE_OUT
+#   define queuePlay(us, beats) queueSave(SCORE_OUT, us, beats)
+#endif
+
+/* In the same way, when a program is compiled with -DCOMPILE_OUT='"file"',
+   queuePlay() compiles the queue into that header. "make compiled" uses this
+   to compile the songs in this repository. */
+#ifdef COMPILE_OUT
+#   define queuePlay(us, beats) queueCompile(COMPILE_OUT, us, beats)
+#endif
+
+/* In the same way, when a program is compiled with -DGOLDEN_OUT='"file"' and
+   linked with golden-score.c and the stub driver, queuePlay() plays the queue
+   and writes the hashes of what was sent to DMA to that golden file (see
+   golden-score.c). "make roundtrip" uses this to check that the songs in
+   this repository play the same from their score files. */
+#ifdef GOLDEN_OUT
+int queueGolden(const char *path, unsigned int us, unsigned int beats);
+#   define queuePlay(us, beats) queueGolden(GOLDEN_OUT, us, beats)
+#endif
+
+/* When a program is compiled with -DPATTERN_BEATS=n, queuePlay() plays the
+   queue with queuePlayPatterns(), cutting it into patterns of n beats. With
+   -DGOLDEN_OUT too, queueGolden() plays it this way, which "make roundtrip"
+   uses to check that patterns play the same as the whole queue. */
+#if defined(PATTERN_BEATS) && !defined(SCORE_OUT) && !defined(COMPILE_OUT) && \
+    !defined(GOLDEN_OUT)
+#   define queuePlay(us, beats) queuePlayPatterns(us, beats, PATTERN_BEATS)
+#endif
+
 /* Set DMA channel to use. You can use channel 0, 4, 5 or 6. Default 5.
    Run this before queuePlay(). */
 void set_dmach(int dmach);
 
+/* Statistics of the pipeline, see pipelineDepth(). */
+typedef struct pipeline_stats_t {
+    unsigned int depth;       /* Depth of the pipeline (beats).               */
+    unsigned long beats;      /* Beats sent through the pipeline.             */
+    unsigned long fill;       /* Sum over every beat of the beats generated
+                                 ahead of it (including itself).              */
+    unsigned long aheadUs;    /* Sum over every beat of the microseconds
+                                 generated ahead of it (including itself).    */
+    unsigned long minAheadUs; /* Fewest microseconds generated ahead of a
+                                 beat, once the pipeline had been full.       */
+    unsigned int maxFill;     /* Most beats generated ahead of a beat.        */
+    unsigned long stalls;     /* Times the generator waited for a free slot.  */
+    unsigned long starved;    /* Times the transmitter waited for a beat.     */
+} pipeline_stats_t;
+
+/* Generate beats on the calling thread while another thread writes control
+   blocks for them, so that neither waits for the other. Up to depth beats are
+   generated ahead of the beat being sent to DMA; when that many are waiting,
+   generation sleeps until DMA catches up. Statistics are printed to stderr
+   after playing.
+   depth: Beats to generate ahead, or 0 to generate and send beats on one
+          thread. The default is PIPELINE_DEPTH ("make pi2", "make pi3" and
+          "make pi4" use 8). Each beat uses PAGES*768 bytes.
+   Run this before queuePlay(). */
+void pipelineDepth(unsigned int depth);
+
+/* Copy the statistics of the pipeline during the last song into *out. */
+void pipelineStats(pipeline_stats_t *out);
+
+/* Generate the waveforms of different pins on several threads at once, each
+   thread taking the next pin that is left, and then combine them in order.
+   The result is the same as with one thread.
+   threads: Threads, including the one playing (1 to 8). The default is
+            GENERATOR_THREADS. Each pin then uses PAGES*768 bytes.
+   Run this before queuePlay(). */
+void generatorThreads(unsigned int threads);
+
+/* Parts of playing timed by timingStats(). */
+#define TIMING_DECODE 0 /* Working out the notes of a beat from the queue, a
+                           score or patterns.                                 */
+#define TIMING_GEN    1 /* One waveGen() call (the waveform of one pin).      */
+#define TIMING_MERGE  2 /* Combining the waveform of one pin with the others. */
+#define TIMING_EMIT   3 /* Writing the control blocks of a beat, apart from
+                           waiting.                                           */
+#define TIMING_WAIT   4 /* Waiting for DMA to free control blocks.            */
+#define TIMING_STALL  5 /* Waiting for a free slot of the pipeline.           */
+#define TIMING_PHASES 6
+
+/* Buckets of the slack histogram. Bucket 0 counts beats with less than 1 ms
+   of slack, bucket i (from 1) beats with 2^(i-1) to 2^i ms and the last one
+   beats with more. */
+#define TIMING_BUCKETS 16
+
+/* Time taken by one part of playing. */
+typedef struct timing_phase_t {
+    unsigned long count;      /* Times it was done.                           */
+    unsigned long us;         /* Microseconds taken altogether.               */
+    unsigned long maxUs;      /* Most microseconds taken at once.             */
+    double transitions;       /* Transitions generated, merged or written
+                                 (0 for the other parts).                     */
+} timing_phase_t;
+
+/* Timing of a song. The slack of a beat is how many microseconds of sound
+   were still waiting for DMA when the beat was sent to it. A beat with little
+   slack was nearly too late; one sent after DMA had run out is an underrun. */
+typedef struct timing_stats_t {
+    timing_phase_t phase[TIMING_PHASES];
+    unsigned long beats;      /* Beats sent while DMA was running.            */
+    unsigned long underruns;  /* Beats sent after DMA had run out.            */
+    unsigned long minSlackUs; /* Least slack of those beats.                  */
+    unsigned long avgSlackUs; /* Mean slack.                                  */
+    unsigned long p99SlackUs; /* 99th percentile of the slack.                */
+    unsigned long maxSlackUs; /* Most slack.                                  */
+    unsigned long hist[TIMING_BUCKETS]; /* Beats by slack, see
+                                           TIMING_BUCKETS.                    */
+} timing_stats_t;
+
+/* Copy the timing of the last song into *out. Everything is 0 unless the
+   player was built with -DTIMING=1, in which case a summary is also printed
+   to stderr after each song. Beats of songs being compiled or saved are not
+   timed. */
+void timingStats(timing_stats_t *out);
+
+/* Levels of quality of service, from full quality down. Each level also does
+   what the ones above it do. */
+#define QOS_FULL    0   /* Everything as written.                             */
+#define QOS_EFFECTS 1   /* Vibrato and tremolo change every QOS_EFFECT_US
+                           microseconds rather than at every transition.     */
+#define QOS_SLIDES  2   /* Slides go in QOS_SLIDE_STEPS steps.                */
+#define QOS_EDGES   3   /* Edges of different pins less than QOS_EDGE_US
+                           apart are made at once, by the first one's control
+                           blocks.                                            */
+#define QOS_MUTE    4   /* The voice with the lowest priority is muted: the
+                           last voice of a score, or the highest pin of the
+                           queue. Only used with more than one voice.         */
+#define QOS_LEVELS  5
+
+#define QOS_EFFECT_US   2000
+#define QOS_SLIDE_STEPS 8
+#define QOS_EDGE_US     8
+
+/* Quality of service during a song. */
+typedef struct qos_stats_t {
+    unsigned int level;       /* Level at the end of the song.                */
+    unsigned int maxLevel;    /* Lowest quality reached.                      */
+    unsigned long changes;    /* Times the level changed.                     */
+    unsigned long beats[QOS_LEVELS]; /* Beats generated at each level.        */
+    unsigned long underruns;  /* Beats sent after DMA had run out.            */
+    unsigned long minAheadUs; /* Least sound ready ahead of DMA when a beat
+                                 had been generated, while enabled.           */
+} qos_stats_t;
+
+/* Rather than let DMA run out when beats cannot be generated fast enough,
+   make them quicker to generate. Before each beat, the sound already sent to
+   DMA (and waiting in the pipeline) that DMA has not played yet is measured;
+   with less than QOS_LOW_US the player steps down one level (see QOS_FULL and
+   the rest), at most once a beat, and once there has been more than
+   QOS_HIGH_US for QOS_HOLD beats it steps back up. Every change is printed
+   to stderr with the beat it happened at. Patterns are not cached while the
+   level is not QOS_FULL.
+   on: 1 to enable, 0 to always play at full quality (the default, unless
+       built with QOS=1).
+   Run this before queuePlay(). */
+void qosEnable(int on);
+
+/* Copy the quality of service of the last song into *out. */
+void qosStats(qos_stats_t *out);
+
+/* Make the player take longer over each beat, to try the quality of service
+   controller on a machine that is fast enough (see stub_realtime() in
+   stub.h). The player sleeps for ns nanoseconds for every transition sent to
+   DMA, after they have been generated.
+   ns: Nanoseconds per transition, or 0 to play at full speed. */
+void qosSlowdown(unsigned int ns);
+
+/* Publish counters of the songs being played in POSIX shared memory, for
+   dashboards and for play-metrics, which prints them (see metrics.h). They
+   are written once for every beat sent to DMA, by the thread sending it,
+   without locks or system calls, so watching them does not change how
+   the song is played. Generation times are only counted when built with
+   -DTIMING=1 or -DTRACE=1.
+   name: Name of the shared memory (a slash and a name, such as
+         METRICS_NAME).
+   Returns 0, or -1 if it could not be made or a song is playing. */
+int metricsOpen(const char *name);
+
+/* Stop publishing the counters and remove the shared memory. */
+void metricsClose(void);
+
+/* Keep DMA set up after each song instead of freeing it, for programs that
+   play many songs. The next song then starts without setting DMA up again,
+   and is sent to DMA straight after the last one, so that there is no gap
+   between them as long as it starts before the last one has finished. The
+   pins of a song are turned off when DMA reaches its end. Songs stopped with
+   playCancel() stop at once, as usual.
+   keep: 1 to keep DMA set up, or 0 to free it again. If no song is playing,
+         this waits for DMA to finish the last one first; otherwise DMA is
+         freed when the song playing has finished. */
+void playerKeep(int keep);
+
+/* DMA and PWM error counters are collected during queuePlay().
+   See telemetry.h for reading them (telemetry_read()) and for printing them
+   periodically (telemetry_dump_every()). */
+
+/* Type for players. A player has its own queue, patterns, event list,
+   settings and DMA channel, so that several players can play at once, each
+   from its own thread (or in the background) and at its own tempo. Players
+   must use different pins: a pin being played by one player cannot be played
+   by another one until it has finished. The functions above use the default
+   player, see playerDefault(). */
+typedef struct player_t player_t;
+
+/* Make a new player.
+   dmach: DMA channel (0, 4, 5 or 6) not used by any other player.
+   pacer: What paces DMA: PACER_PWM or PACER_PCM (see driver.h). Players
+          playing at the same time need different pacers, so at most two can
+          play at once.
+   Returns the player, or NULL if the arguments are not valid. */
+player_t *playerNew(int dmach, int pacer);
+
+/* Free a player made by playerNew(). Nothing may be playing on it. */
+void playerDelete(player_t *p);
+
+/* Returns the default player, used by the functions that do not take one. It
+   uses the DMA channel given to set_dmach() and is paced by PWM. */
+player_t *playerDefault(void);
+
+/* The same as the functions without "player" in front (queueAdd() for
+   playerQueueAdd() and so on), on player p. playerKeepDma() is the same as
+   playerKeep(), and playerCompiledPlay() is declared in compile.h. */
+void playerQueueAdd(player_t *p, int pin, double *freqs, double *duties,
+                    misc_t **misc);
+void playerQueuePlay(player_t *p, unsigned int us, unsigned int beats);
+int playerQueuePlayFile(player_t *p, const char *path);
+int playerQueuePlayMemory(player_t *p, const void *data, size_t length);
+play_t *playerQueuePlayAsync(player_t *p, unsigned int us,
+                             unsigned int beats);
+play_t *playerQueuePlayFileAsync(player_t *p, const char *path);
+play_t *playerQueuePlayMemoryAsync(player_t *p, const void *data,
+                                   size_t length);
+int playerQueueSave(player_t *p, const char *path, unsigned int us,
+                    unsigned int beats);
+void playerQueueTempo(player_t *p, const struct tempo_t *tempo);
+int playerQueueCompile(player_t *p, const char *path, unsigned int us,
+                       unsigned int beats);
+int playerQueueCompileFile(player_t *p, const char *score, const char *path);
+int playerPatternNew(player_t *p, unsigned int beats);
+void playerPatternAdd(player_t *p, int pattern, int pin,
+                      double *freqs, double *duties, misc_t **misc);
+void playerPatternPlay(player_t *p, unsigned int us,
+                       const unsigned int *order, unsigned int length);
+void playerPatternStats(player_t *p, pattern_stats_t *out);
+void playerQueuePlayPatterns(player_t *p, unsigned int us, unsigned int beats,
+                             unsigned int size);
+void playerEventAdd(player_t *p, int pin, unsigned int start,
+                    unsigned int length, double freq, double duty,
+                    misc_t *misc);
+void playerEventPlay(player_t *p, unsigned int us, unsigned int ticks);
+void playerEventPlayStream(player_t *p,
+                           int (*next)(event_t *event, void *arg), void *arg,
+                           unsigned int startPins, unsigned int us,
+                           unsigned int ticks);
+int playerLiveOpen(player_t *p, unsigned int livePins, unsigned int slice,
+                   unsigned int horizon);
+void playerNoteOn(player_t *p, int pin, double freq, double duty);
+void playerNoteOff(player_t *p, int pin);
+void playerLiveClose(player_t *p);
+void playerPipelineDepth(player_t *p, unsigned int depth);
+void playerPipelineStats(player_t *p, pipeline_stats_t *out);
+void playerGeneratorThreads(player_t *p, unsigned int threads);
+void playerTimingStats(player_t *p, timing_stats_t *out);
+void playerKeepDma(player_t *p, int keep);
+void playerQosEnable(player_t *p, int on);
+void playerQosStats(player_t *p, qos_stats_t *out);
+void playerQosSlowdown(player_t *p, unsigned int ns);
+int playerMetricsOpen(player_t *p, const char *name);
+void playerMetricsClose(player_t *p);
+
 
 
 
@@ -0,0 +1,493 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* score - Binary score files that can be played without parsing */
+
+#define _BSD_SOURCE
+
+#include <stdio.h>     /* fprintf(), fopen(), fwrite(), stderr                */
+#include <stdlib.h>    /* malloc(), calloc(), free()                          */
+#include <string.h>    /* memcmp(), memcpy(), memset()                        */
+#include <math.h>      /* pow(), fabs()                                       */
+#include <fcntl.h>     /* open()                                              */
+#include <unistd.h>    /* close()                                             */
+#include <sys/mman.h>  /* mmap(), munmap()                                    */
+#include <sys/stat.h>  /* fstat()                                             */
+
+#include "score.h"
+
+
+
+
+/* Largest amount of entries in the pitch, duty cycle and effect tables,
+   since note columns use 16-bit indices. */
+#define TABLE_MAX 65535
+
+/* Largest beat number, for slides given in beats. */
+#define BEAT_MAX 4294967295.0
+
+
+
+
+/*############################################################################*/
+
+
+/* Returns the offset of the first byte after a table. Sets *ok to 0 if the
+   table does not fit inside a file of the given length. */
+static size_t section(size_t offset, size_t count, size_t size,
+                      size_t length, int *ok) {
+    if (count > (length - offset) / size) {
+        *ok = 0;
+        return length;
+    }
+    return offset + count*size;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns 1 if x is from lo to hi, and 0 if it is not (or is not a number,
+   as comparisons with NaN are always false). */
+static int within(double x, double lo, double hi) {
+    return x >= lo && x <= hi;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns 0 if the values of an effect can be played, or -1 if not. Only
+   the settings the effect uses are checked, as the others are ignored. */
+static int effectCheck(const score_effect_t *e) {
+    if (!within(e->value, 0, 1)) return -1;
+    /* Slides are worked out from ratios, and from where they start to where
+       they end */
+    if (e->usingPs && (!within(e->freqTo, 0, SCORE_FREQ_MAX) || !e->freqTo ||
+                       !within(e->freqS, 0, 1) || e->freqS == 1 ||
+                       !within(e->freqE, e->freqS, BEAT_MAX) ||
+                       e->freqE == e->freqS))
+        return -1;
+    if (e->usingDs && (!within(e->dutyTo, 0, 1) ||
+                       !within(e->dutyS, 0, 1) || e->dutyS == 1 ||
+                       !within(e->dutyE, e->dutyS, BEAT_MAX) ||
+                       e->dutyE == e->dutyS))
+        return -1;
+    if (e->usingV && !within(e->vInt, -SCORE_CENTS_MAX, SCORE_CENTS_MAX))
+        return -1;
+    if (e->usingT && !within(e->tInt, -1, 1)) return -1;
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Check that every beat fits in the player's waveforms, following the
+   slides and vibrato of each voice through the score as the player does.
+   Each voice is taken to be at its highest pitch for the whole beat, and
+   waveGen() makes about one transition for every 1000000/(2*pitch)
+   microseconds, plus a few at the ends, to which merging adds two.
+   e: Effect table.
+   Returns 0, or -1 (after printing an error). */
+static int beatCheck(const score_t *score, const score_effect_t *e) {
+    const score_header_t *h = score->header;
+    const score_effect_t *m;
+    double slideTop[32], slideS[32], slideE[32], dutyS[32], dutyE[32];
+    double vibrato[32], freq;
+    char slide[32], dutySlide[32];
+    unsigned int us = h->us, tempo = 0, v, b, micros, effect;
+    unsigned long need;
+
+    for (v = 0; v < h->voices; v++) {
+        slide[v]     = 0;
+        dutySlide[v] = 0;
+        vibrato[v]   = 1;
+    }
+
+    for (b = 0; b < h->beats; b++) {
+        while (tempo < h->tempos && score->tempo[tempo].beat <= b)
+            us = score->tempo[tempo++].us;
+
+        for (need = 0, v = 0; v < h->voices; v++) {
+            freq   = score->pitch[scorePitch(score, v, b)];
+            effect = scoreEffect(score, v, b);
+            m      = effect ? &e[effect-1] : NULL;
+
+            /* A slide goes from the pitch it starts at, which it cannot if
+               that is silence */
+            if (m && m->usingPs && !slide[v]) {
+                if (!freq) break;
+                slide[v]    = 1;
+                slideTop[v] = freq > m->freqTo ? freq : m->freqTo;
+                slideS[v]   = m->freqS + b;
+                slideE[v]   = m->freqE + b;
+            }
+            if (m && m->usingDs && !dutySlide[v]) {
+                if (score->duty[scoreDuty(score, v, b)] <= 0) break;
+                dutySlide[v] = 1;
+                dutyS[v]     = m->dutyS + b;
+                dutyE[v]     = m->dutyE + b;
+            }
+            if (m && m->usingV) vibrato[v] = pow(2, fabs(m->vInt)/1200);
+
+            if (slide[v] && slideTop[v] > freq) freq = slideTop[v];
+            freq *= vibrato[v];
+            if (freq > 0) {
+                micros = 1000000/(2*freq);
+                need  += us/micros + 4;
+            }
+            else need += 1;
+            need += 2;
+
+            /* The slide ends in the beat its end is in */
+            if (slide[v] && (b + 1 - slideS[v])/(slideE[v] - slideS[v]) >= 1)
+                slide[v] = 0;
+            if (dutySlide[v] && (b + 1 - dutyS[v])/(dutyE[v] - dutyS[v]) >= 1)
+                dutySlide[v] = 0;
+        }
+        if (v < h->voices) {
+            fprintf(stderr, "ERROR: scoreOpen(): Voice %u slides from "
+                            "silence in beat %u.\n", v, b);
+            return -1;
+        }
+        if (need >= PAGES*64) {
+            fprintf(stderr, "ERROR: scoreOpen(): Beat %u needs %lu "
+                            "transitions, more than the %u that fit.\n", b,
+                    need, PAGES*64 - 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Open a score that is already in memory (the contents of a score file).
+   The memory must stay valid and unchanged until scoreClose().
+   Returns 0 on success, or -1 (after printing an error) if it is invalid. */
+int scoreOpenMemory(score_t *score, const void *data, size_t length) {
+    const char *base = data;
+    const score_header_t *h = data;
+    const score_effect_t *e;
+    size_t offset = sizeof(score_header_t);
+    unsigned int i, v, b;
+    int ok = 1;
+
+    memset(score, 0, sizeof(*score));
+
+    if (length < sizeof(score_header_t) ||
+        memcmp(h->magic, SCORE_MAGIC, 4)) {
+        fprintf(stderr, "ERROR: scoreOpen(): Not a score file.\n");
+        return -1;
+    }
+    if (h->version != SCORE_VERSION) {
+        fprintf(stderr, "ERROR: scoreOpen(): Unsupported score version %u.\n",
+                h->version);
+        return -1;
+    }
+
+    /* Locate each section, checking that it fits inside the file */
+    score->header = h;
+    score->voice  = (const score_voice_t *)(base + offset);
+    offset = section(offset, h->voices, sizeof(score_voice_t), length, &ok);
+    score->pitch  = (const double *)(base + offset);
+    offset = section(offset, h->pitches, sizeof(double), length, &ok);
+    score->duty   = (const double *)(base + offset);
+    offset = section(offset, h->duties, sizeof(double), length, &ok);
+    e = (const score_effect_t *)(base + offset);
+    offset = section(offset, h->effects, sizeof(score_effect_t), length, &ok);
+    score->tempo  = (const score_tempo_t *)(base + offset);
+    offset = section(offset, h->tempos, sizeof(score_tempo_t), length, &ok);
+    score->notes  = (const unsigned short *)(base + offset);
+    if (h->voices > 32) ok = 0;
+    else if (h->voices)
+        section(offset, h->beats, 3*h->voices*sizeof(short), length, &ok);
+    if (!ok || !h->us) {
+        fprintf(stderr, "ERROR: scoreOpen(): Score file is truncated.\n");
+        return -1;
+    }
+
+    /* Check that every index is inside its table, so that the player never
+       has to */
+    for (v = 0; v < h->voices; v++) {
+        if (score->voice[v].pin > 31) ok = 0;
+        for (b = 0; b < h->beats; b++) {
+            if (scorePitch(score, v, b)  >= h->pitches) ok = 0;
+            if (scoreDuty(score, v, b)   >= h->duties)  ok = 0;
+            if (scoreEffect(score, v, b) >  h->effects) ok = 0;
+        }
+    }
+    for (i = 1; i < h->tempos; i++)
+        if (score->tempo[i].beat < score->tempo[i-1].beat) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "ERROR: scoreOpen(): Score file is corrupt.\n");
+        return -1;
+    }
+
+    /* Check that every value can be played, so that the player never has to
+       either */
+    for (i = 0; i < h->pitches; i++)
+        if (!within(score->pitch[i], 0, SCORE_FREQ_MAX)) ok = 0;
+    for (i = 0; i < h->duties; i++)
+        if (!within(score->duty[i], 0, 1)) ok = 0;
+    for (i = 0; i < h->effects; i++)
+        if (effectCheck(&e[i])) ok = 0;
+    if (h->us > SCORE_US_MAX) ok = 0;
+    for (i = 0; i < h->tempos; i++)
+        if (!score->tempo[i].us || score->tempo[i].us > SCORE_US_MAX) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "ERROR: scoreOpen(): Score file has values that "
+                        "cannot be played.\n");
+        return -1;
+    }
+    if (beatCheck(score, e)) return -1;
+
+    /* Convert effect table to misc_t */
+    score->effect = calloc(h->effects + 1, sizeof(misc_t));
+    for (i = 0; i < h->effects; i++) {
+        score->effect[i].value   = e[i].value;
+        score->effect[i].usingPs = e[i].usingPs;
+        score->effect[i].freqTo  = e[i].freqTo;
+        score->effect[i].freqS   = e[i].freqS;
+        score->effect[i].freqE   = e[i].freqE;
+        score->effect[i].usingDs = e[i].usingDs;
+        score->effect[i].dutyTo  = e[i].dutyTo;
+        score->effect[i].dutyS   = e[i].dutyS;
+        score->effect[i].dutyE   = e[i].dutyE;
+        score->effect[i].usingV  = e[i].usingV;
+        score->effect[i].vInt    = e[i].vInt;
+        score->effect[i].vWth    = e[i].vWth;
+        score->effect[i].usingT  = e[i].usingT;
+        score->effect[i].tInt    = e[i].tInt;
+        score->effect[i].tWth    = e[i].tWth;
+        score->effect[i].us      = 0;
+    }
+
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Open a score file by mapping it into memory.
+   Returns 0 on success, or -1 (after printing an error) if the file cannot be
+   read or is not a valid score file. */
+int scoreOpen(score_t *score, const char *path) {
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+        fprintf(stderr, "ERROR: scoreOpen(): Cannot read %s.\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: scoreOpen(): Cannot map %s.\n", path);
+        return -1;
+    }
+
+    if (scoreOpenMemory(score, map, st.st_size)) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    score->map       = map;
+    score->mapLength = st.st_size;
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Close a score opened with scoreOpen() or scoreOpenMemory(). */
+void scoreClose(score_t *score) {
+    free(score->effect);
+    if (score->map) munmap(score->map, score->mapLength);
+    memset(score, 0, sizeof(*score));
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the index of value in table, adding it to the table if needed.
+   Returns -1 if the table is full. */
+static long tableIndex(double *table, unsigned int *count, double value) {
+    unsigned int i;
+    for (i = 0; i < *count; i++)
+        if (table[i] == value) return i;
+    if (*count == TABLE_MAX) return -1;
+    table[*count] = value;
+    return (*count)++;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the index of an effect in table, adding it to the table if needed.
+   Returns -1 if the table is full. */
+static long effectIndex(score_effect_t *table, unsigned int *count,
+                        const misc_t *m) {
+    score_effect_t e;
+    unsigned int i;
+
+    /* Zero fill, so that padding compares equal */
+    memset(&e, 0, sizeof(e));
+    e.value   = m->value;
+    e.usingPs = m->usingPs;
+    e.freqTo  = m->freqTo;
+    e.freqS   = m->freqS;
+    e.freqE   = m->freqE;
+    e.usingDs = m->usingDs;
+    e.dutyTo  = m->dutyTo;
+    e.dutyS   = m->dutyS;
+    e.dutyE   = m->dutyE;
+    e.usingV  = m->usingV;
+    e.vInt    = m->vInt;
+    e.vWth    = m->vWth;
+    e.usingT  = m->usingT;
+    e.tInt    = m->tInt;
+    e.tWth    = m->tWth;
+
+    for (i = 0; i < *count; i++)
+        if (!memcmp(&table[i], &e, sizeof(e))) return i;
+    if (*count == TABLE_MAX) return -1;
+    table[*count] = e;
+    return (*count)++;
+}
+
+
+/*############################################################################*/
+
+
+/* Write a score file from arrays in the same format as given to queueAdd().
+   path:   File to write.
+   us:     Length of each beat in microseconds at the start of the score.
+   beats:  Total number of beats.
+   pins:   Pins in use (1<<pin).
+   freqs:  Frequency arrays, indexed by pin.
+   duties: Duty cycle arrays, indexed by pin.
+   misc:   misc_t pointer arrays, indexed by pin. These may be NULL.
+   Returns 0 on success, or -1 (after printing an error). */
+int scoreWrite(const char *path,
+               unsigned int us,
+               unsigned int beats,
+               unsigned int pins,
+               double **freqs,
+               double **duties,
+               misc_t ***misc) {
+    score_header_t h;
+    score_voice_t voice[32];
+    double *pitch, *duty;
+    score_effect_t *effect;
+    score_tempo_t *tempo;
+    unsigned short *notes;
+    unsigned int pin, v, b;
+    long p, d, e;
+    misc_t *m;
+    FILE *f;
+    int ret = -1;
+
+    memset(&h, 0, sizeof(h));
+    memset(voice, 0, sizeof(voice));
+    memcpy(h.magic, SCORE_MAGIC, 4);
+    h.version = SCORE_VERSION;
+    h.us      = us;
+    h.beats   = beats;
+
+    for (pin = 0; pin < 32; pin++)
+        if (pins & (1<<pin)) voice[h.voices++].pin = pin;
+
+    pitch  = malloc(TABLE_MAX * sizeof(double));
+    duty   = malloc(TABLE_MAX * sizeof(double));
+    effect = malloc(TABLE_MAX * sizeof(score_effect_t));
+    tempo  = malloc((beats + 1) * sizeof(score_tempo_t));
+    notes  = malloc((3*h.voices*beats + 1) * sizeof(short));
+
+    for (v = 0; v < h.voices; v++) {
+        pin = voice[v].pin;
+        for (b = 0; b < beats; b++) {
+            m = misc[pin] ? misc[pin][b] : NULL;
+            p = tableIndex(pitch, &h.pitches, freqs[pin][b]);
+            d = tableIndex(duty,  &h.duties,  duties[pin][b]);
+            e = m ? effectIndex(effect, &h.effects, m) + 1 : 0;
+            if (p < 0 || d < 0 || e < 0) {
+                fprintf(stderr, "ERROR: scoreWrite(): Too many distinct "
+                                "notes or effects.\n");
+                goto done;
+            }
+            notes[(3*v+0)*beats + b] = p;
+            notes[(3*v+1)*beats + b] = d;
+            notes[(3*v+2)*beats + b] = e;
+        }
+    }
+
+    /* A beat length change in a misc_t applies from the next beat.
+       If several pins change it in the same beat, the highest pin wins. */
+    for (b = 0; b + 1 < beats; b++) {
+        for (v = h.voices; v-- > 0;) {
+            pin = voice[v].pin;
+            m = misc[pin] ? misc[pin][b] : NULL;
+            if (m && m->us) {
+                tempo[h.tempos].beat = b + 1;
+                tempo[h.tempos].us   = m->us;
+                h.tempos++;
+                break;
+            }
+        }
+    }
+
+    f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "ERROR: scoreWrite(): Cannot write %s.\n", path);
+        goto done;
+    }
+    fwrite(&h,     sizeof(h),              1,           f);
+    fwrite(voice,  sizeof(score_voice_t),  h.voices,    f);
+    fwrite(pitch,  sizeof(double),         h.pitches,   f);
+    fwrite(duty,   sizeof(double),         h.duties,    f);
+    fwrite(effect, sizeof(score_effect_t), h.effects,   f);
+    fwrite(tempo,  sizeof(score_tempo_t),  h.tempos,    f);
+    fwrite(notes,  sizeof(short),          3*h.voices*beats, f);
+    if (fclose(f)) {
+        fprintf(stderr, "ERROR: scoreWrite(): Cannot write %s.\n", path);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    free(pitch);
+    free(duty);
+    free(effect);
+    free(tempo);
+    free(notes);
+    return ret;
+}
+
+
+/*############################################################################*/
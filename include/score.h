@@ -0,0 +1,166 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* score - Binary score files that can be played without parsing */
+
+#pragma once
+
+#include <stddef.h>  /* size_t */
+
+#include "player.h"
+
+/* A score file is laid out as follows. All values are little-endian and every
+   section starts at a multiple of 8 bytes from the start of the file, so that
+   the file may be mmap()ed and read in place.
+
+       score_header_t          Header
+       score_voice_t[voices]   Voice table (one entry per GPIO pin)
+       double[pitches]         Pitch table (frequencies in Hz)
+       double[duties]          Duty cycle table
+       score_effect_t[effects] Effect table
+       score_tempo_t[tempos]   Tempo events, sorted by beat
+       unsigned short[...]     Note columns
+
+   The note columns contain three arrays of "beats" indices per voice, in voice
+   order: pitch indices (into the pitch table), duty cycle indices (into the
+   duty cycle table) and effect indices (0 for no effect, otherwise 1 plus an
+   index into the effect table). */
+
+/* First four bytes of every score file. */
+#define SCORE_MAGIC   "RPSC"
+
+/* Version of the score file layout written by scoreWrite(). */
+#define SCORE_VERSION 1
+
+/* Largest values score files may hold, as checked by scoreOpenMemory().
+   Pitches above SCORE_FREQ_MAX (and vibrato above SCORE_CENTS_MAX cents)
+   would make periods too short to be written as whole microseconds, and
+   beats longer than SCORE_US_MAX (one beat a minute) are no use to any song.
+   Beats must also need no more transitions, with every voice played, than
+   the player can hold in one beat (PAGES*64). */
+#define SCORE_FREQ_MAX  20000
+#define SCORE_CENTS_MAX 1200
+#define SCORE_US_MAX    60000000
+
+/* Score file header. */
+typedef struct score_header_t {
+    char magic[4];         /* SCORE_MAGIC                                     */
+    unsigned int version;  /* SCORE_VERSION                                   */
+    unsigned int us;       /* Initial length of each beat in microseconds.    */
+    unsigned int beats;    /* Amount of beats in each note column.            */
+    unsigned int voices;   /* Amount of entries in the voice table.           */
+    unsigned int pitches;  /* Amount of entries in the pitch table.           */
+    unsigned int duties;   /* Amount of entries in the duty cycle table.      */
+    unsigned int effects;  /* Amount of entries in the effect table.          */
+    unsigned int tempos;   /* Amount of tempo events.                         */
+    unsigned int reserved; /* Always 0.                                       */
+} score_header_t;
+
+/* Score file voice table entry. */
+typedef struct score_voice_t {
+    unsigned int pin;      /* GPIO pin number (BCM) through which voice plays.*/
+    unsigned int reserved; /* Always 0.                                       */
+} score_voice_t;
+
+/* Score file effect table entry. Same meaning as the fields of misc_t,
+   except that tempo changes are stored separately as tempo events. */
+typedef struct score_effect_t {
+    double value;
+    double freqTo;
+    double freqS;
+    double freqE;
+    double dutyTo;
+    double dutyS;
+    double dutyE;
+    double vInt;
+    double tInt;
+    unsigned int vWth;
+    unsigned int tWth;
+    unsigned char usingPs;
+    unsigned char usingDs;
+    unsigned char usingV;
+    unsigned char usingT;
+    unsigned char reserved[4];
+} score_effect_t;
+
+/* Score file tempo event. */
+typedef struct score_tempo_t {
+    unsigned int beat;     /* Beat from which the new beat length applies.    */
+    unsigned int us;       /* New length of each beat in microseconds.        */
+} score_tempo_t;
+
+/* An open score. Everything except "effect" points into the mapped file. */
+typedef struct score_t {
+    const score_header_t *header;
+    const score_voice_t  *voice;
+    const double         *pitch;
+    const double         *duty;
+    const score_tempo_t  *tempo;
+    const unsigned short *notes;
+
+    /* Effect table converted to misc_t, so that it can be used by the player
+       in the same way as misc_t pointers given to queueAdd(). */
+    misc_t *effect;
+
+    /* Mapped file, or NULL if the score was opened from memory. */
+    void *map;
+    size_t mapLength;
+} score_t;
+
+/* Open a score file by mapping it into memory.
+   Returns 0 on success, or -1 (after printing an error) if the file cannot be
+   read or is not a valid score file. */
+int scoreOpen(score_t *score, const char *path);
+
+/* Open a score that is already in memory (the contents of a score file).
+   The memory must stay valid and unchanged until scoreClose(). Every index
+   and value is checked (see SCORE_FREQ_MAX), so a score that opens can be
+   played whoever made it.
+   Returns 0 on success, or -1 (after printing an error) if it is invalid. */
+int scoreOpenMemory(score_t *score, const void *data, size_t length);
+
+/* Close a score opened with scoreOpen() or scoreOpenMemory(). */
+void scoreClose(score_t *score);
+
+/* Index of the pitch of a voice in a beat. */
+#define scorePitch(s, v, b) ((s)->notes[(3*(v)+0)*(s)->header->beats + (b)])
+
+/* Index of the duty cycle of a voice in a beat. */
+#define scoreDuty(s, v, b)  ((s)->notes[(3*(v)+1)*(s)->header->beats + (b)])
+
+/* Index (plus 1) of the effect of a voice in a beat, 0 if there is none. */
+#define scoreEffect(s, v, b) ((s)->notes[(3*(v)+2)*(s)->header->beats + (b)])
+
+/* Write a score file from arrays in the same format as given to queueAdd().
+   path:   File to write.
+   us:     Length of each beat in microseconds at the start of the score.
+   beats:  Total number of beats.
+   pins:   Pins in use (1<<pin).
+   freqs:  Frequency arrays, indexed by pin.
+   duties: Duty cycle arrays, indexed by pin.
+   misc:   misc_t pointer arrays, indexed by pin. These may be NULL.
+   Returns 0 on success, or -1 (after printing an error). */
+int scoreWrite(const char *path,
+               unsigned int us,
+               unsigned int beats,
+               unsigned int pins,
+               double **freqs,
+               double **duties,
+               misc_t ***misc);
@@ -0,0 +1,503 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* stub - The functions of driver.h without any hardware, for running the
+          player on any Linux machine. Link this instead of driver.o.
+          Control blocks are written to ordinary memory, and DMA finishes
+          them as soon as it is started, so nothing waits for DMA, unless
+          stub_realtime() is used. */
+
+#include <stdlib.h>   /* malloc(), calloc(), realloc(), free()                */
+#include <sys/time.h> /* gettimeofday()                                       */
+#include <pthread.h>  /* pthread_mutex_lock(), pthread_mutex_unlock()         */
+
+#include "stub.h"
+
+/* Most blocks of memory from vc_create() at once. */
+#define STUB_BLOCKS 16
+
+
+
+
+cb_t *cbs_v, *cbs_b;
+
+/* Channel used by the functions that do not take a driver_t. */
+static driver_t dflt = {5, PACER_PWM, DREQ_PWM, 0, NULL, NULL, 0, 0};
+
+/* Memory from vc_create(), to find what a bus address points to. Bus
+   addresses are only 32 bits, so on a 64 bit machine they are the low bits
+   of the virtual address. */
+static struct {
+    char *virt;
+    unsigned int length;
+} blocks[STUB_BLOCKS];
+
+/* Functions given to stub_record() and stub_record_cbs(), and what is
+   passed to them. */
+static void (*recordFn)(const stub_pulse_t *, unsigned int, void *) = NULL;
+static void (*recordCbsFn)(const stub_cb_t *, unsigned int, void *) = NULL;
+static void *recordArg, *recordCbsArg;
+static stub_pulse_t *recorded = NULL;
+static stub_cb_t *recordedCbs = NULL;
+static unsigned int recordedSize = 0, recordedCbsSize = 0;
+
+/* With stub_realtime(), the channel DMA is running on, the control block it
+   is at, and when it reached it (microseconds). Only one channel runs at
+   once. */
+static int realtime = 0;
+static struct {
+    driver_t *driver;
+    cb_t *cb;
+    double at;
+} running = {NULL, NULL, 0};
+static pthread_mutex_t runningLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+/*############################################################################*/
+
+
+/* Setup. Control blocks are allocated with vc_create(). */
+void driver_setup(unsigned int dmaPages) {
+    dflt.fifo  = periph(PWM_BASE, PWM_FIF1);
+    dflt.pages = dmaPages;
+    if (dmaPages)
+        dflt.handle = vc_create((void **)&dflt.cbs_v, (void **)&dflt.cbs_b,
+                                dmaPages);
+    cbs_v = dflt.cbs_v;
+    cbs_b = dflt.cbs_b;
+}
+
+
+/*############################################################################*/
+
+
+/* Cleanup. Run at end. */
+void driver_cleanup(void) {
+    if (dflt.pages) vc_destroy(dflt.handle, dflt.cbs_v, dflt.pages);
+    dflt.pages = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Setup a channel of its own. Any channel and pacer may be used at once. */
+driver_t *driver_open(int dmach, int pacer, unsigned int dmaPages) {
+    driver_t *driver = calloc(1, sizeof(driver_t));
+
+    driver->dch    = dmach;
+    driver->pacer  = pacer;
+    driver->permap = pacer == PACER_PCM ? DREQ_PCM_TX : DREQ_PWM;
+    driver->fifo   = pacer == PACER_PCM ? periph(PCM_BASE, PCM_FIFO)
+                                        : periph(PWM_BASE, PWM_FIF1);
+    driver->pages  = dmaPages;
+    driver->handle = vc_create((void **)&driver->cbs_v,
+                               (void **)&driver->cbs_b, dmaPages);
+    return driver;
+}
+
+
+/*############################################################################*/
+
+
+/* Free a channel from driver_open(). */
+void driver_close(driver_t *driver) {
+    vc_destroy(driver->handle, driver->cbs_v, driver->pages);
+    free(driver);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the channel used by the functions that do not take a driver_t. */
+driver_t *driver_default(void) {
+    return &dflt;
+}
+
+
+/*############################################################################*/
+
+
+/* GPIO pins are not there: setting them does nothing, and they read as an
+   output at LOW. */
+void gpio_mode(int pin, int mode) {
+    (void)pin;
+    (void)mode;
+}
+
+int gpio_read_mode(int pin) {
+    (void)pin;
+    return 1;
+}
+
+void gpio_write(int pin, int level) {
+    (void)pin;
+    (void)level;
+}
+
+int gpio_read(int pin) {
+    (void)pin;
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Allocate memory. Its bus address is its virtual address. */
+unsigned int vc_create(void **virtAddr, void **busAddr, unsigned int pages) {
+    unsigned int i;
+
+    *virtAddr = calloc(pages, 4096);
+    *busAddr  = *virtAddr;
+    for (i = 0; i < STUB_BLOCKS; i++) {
+        if (!blocks[i].virt) {
+            blocks[i].virt   = *virtAddr;
+            blocks[i].length = pages*4096;
+            break;
+        }
+    }
+    return 1;
+}
+
+
+/*############################################################################*/
+
+
+/* Free memory allocated using vc_create(). */
+void vc_destroy(unsigned int handle, void *virtAddr, unsigned int pages) {
+    unsigned int i;
+
+    (void)handle;
+    (void)pages;
+    for (i = 0; i < STUB_BLOCKS; i++)
+        if (blocks[i].virt == virtAddr) blocks[i].virt = NULL;
+    free(virtAddr);
+}
+
+
+/*############################################################################*/
+
+
+/* Find the memory from vc_create() that a bus address points into.
+   offset: Set to the offset of the address from the start of the memory.
+   Returns the index of the memory in blocks, or -1 if it is not in any. */
+static int busFind(unsigned int bus, unsigned int *offset) {
+    int i;
+
+    for (i = 0; i < STUB_BLOCKS; i++) {
+        *offset = bus - (unsigned int)(unsigned long)blocks[i].virt;
+        if (blocks[i].virt && *offset < blocks[i].length) return i;
+    }
+    return -1;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns what a bus address from vc_create() points to, or NULL. */
+static void *busToVirt(unsigned int bus) {
+    unsigned int offset;
+    int i = busFind(bus, &offset);
+    return i < 0 ? NULL : blocks[i].virt + offset;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns a bus address relative to the memory it points into, or the
+   address itself if it is not in memory from vc_create(). */
+static unsigned int busRelative(unsigned int bus) {
+    unsigned int offset;
+    return busFind(bus, &offset) < 0 ? bus : offset;
+}
+
+
+/*############################################################################*/
+
+
+/* Add a control block to recordedCbs.
+   length: Control blocks in recordedCbs so far. */
+static void cbRecord(const cb_t *cb, unsigned int length) {
+    unsigned int set = periph(GPIO_BASE, GPIO_SET);
+    unsigned int clr = periph(GPIO_BASE, GPIO_CLR);
+    unsigned int *word;
+    stub_cb_t *out;
+
+    if (length == recordedCbsSize) {
+        recordedCbsSize = recordedCbsSize ? 2*recordedCbsSize : 1024;
+        recordedCbs = realloc(recordedCbs, recordedCbsSize*sizeof(stub_cb_t));
+    }
+    out = &recordedCbs[length];
+    out->ti     = cb->ti;
+    out->source = busRelative(cb->source_ad);
+    out->dest   = cb->dest_ad;
+    out->length = cb->txfr_len;
+    out->next   = cb->nextconbk ? busRelative(cb->nextconbk) : STUB_END;
+    word        = busToVirt(cb->source_ad);
+    out->word   = (cb->dest_ad == set || cb->dest_ad == clr) && word ? *word
+                                                                     : 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Call the functions given to stub_record() and stub_record_cbs() with the
+   control blocks of a channel, from the one at index until the last. */
+static void dmaRecord(driver_t *driver, unsigned int index) {
+    unsigned int set = periph(GPIO_BASE, GPIO_SET);
+    unsigned int clr = periph(GPIO_BASE, GPIO_CLR);
+    unsigned int length = 0, steps = driver->pages*4096/sizeof(cb_t), *cmd;
+    unsigned int cbs = 0;
+    cb_t *cb = &driver->cbs_v[index];
+
+    if (!recordFn && !recordCbsFn) return;
+
+    /* Stop after as many control blocks as there are, if they form a loop */
+    for (; cb && steps; steps--) {
+        if (recordCbsFn) cbRecord(cb, cbs++);
+
+        /* Transitions are a GPIO command followed by a delay */
+        if (cb->dest_ad == set || cb->dest_ad == clr) {
+            if (length == recordedSize) {
+                recordedSize = recordedSize ? 2*recordedSize : 1024;
+                recorded = realloc(recorded,
+                                   recordedSize*sizeof(stub_pulse_t));
+            }
+            cmd = busToVirt(cb->source_ad);
+            recorded[length].set = cb->dest_ad == set && cmd ? *cmd : 0;
+            recorded[length].clr = cb->dest_ad == clr && cmd ? *cmd : 0;
+            recorded[length].us  = 0;
+            length++;
+        }
+        else if (length) recorded[length-1].us += cb->txfr_len/4;
+
+        cb = cb->nextconbk ? busToVirt(cb->nextconbk) : NULL;
+    }
+
+    if (recordFn) recordFn(recorded, length, recordArg);
+    if (recordCbsFn) recordCbsFn(recordedCbs, cbs, recordCbsArg);
+}
+
+
+/*############################################################################*/
+
+
+/* Have a function called with the transitions of the control blocks each time
+   DMA is started. */
+void stub_record(void (*fn)(const stub_pulse_t *pulses, unsigned int length,
+                            void *arg), void *arg) {
+    recordFn  = fn;
+    recordArg = arg;
+}
+
+
+/*############################################################################*/
+
+
+/* Have a function called with the control blocks each time DMA is started. */
+void stub_record_cbs(void (*fn)(const stub_cb_t *cbs, unsigned int length,
+                                void *arg), void *arg) {
+    recordCbsFn  = fn;
+    recordCbsArg = arg;
+}
+
+
+/*############################################################################*/
+
+
+/* Make DMA take as long as the delays of its control blocks. */
+void stub_realtime(int on) {
+    realtime = on;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the time in microseconds. */
+static double stubNow(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec*1e6 + now.tv_usec;
+}
+
+
+/*############################################################################*/
+
+
+/* Move DMA on a channel along its control blocks by the time since it was
+   last moved on. Delays take txfr_len/4 microseconds, as the pacer takes a
+   word every microsecond, and everything else takes no time. The next
+   control block is only read once DMA gets to it, so blocks linked on while
+   DMA is running are followed, as they are by the real thing.
+   Returns 1 if DMA is still running on the channel, 0 if not. */
+static int dmaAdvance(driver_t *driver) {
+    double now = stubNow(), us;
+    int result;
+
+    pthread_mutex_lock(&runningLock);
+    while (running.driver == driver && running.cb) {
+        us = running.cb->dest_ad == driver->fifo ? running.cb->txfr_len/4 : 0;
+        if (now < running.at + us) break;
+        running.at += us;
+        running.cb  = running.cb->nextconbk ?
+                      busToVirt(running.cb->nextconbk) : NULL;
+    }
+    if (running.driver == driver && !running.cb) running.driver = NULL;
+    result = running.driver == driver;
+    pthread_mutex_unlock(&runningLock);
+    return result;
+}
+
+
+/*############################################################################*/
+
+
+/* Start DMA on a channel at a control block, with stub_realtime(). */
+static void dmaStart(driver_t *driver, unsigned int index) {
+    if (!realtime) return;
+    pthread_mutex_lock(&runningLock);
+    running.driver = driver;
+    running.cb     = &driver->cbs_v[index];
+    running.at     = stubNow();
+    pthread_mutex_unlock(&runningLock);
+}
+
+
+/*############################################################################*/
+
+
+/* Stop DMA on a channel. */
+static void dmaStop(driver_t *driver) {
+    pthread_mutex_lock(&runningLock);
+    if (running.driver == driver) running.driver = NULL;
+    pthread_mutex_unlock(&runningLock);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the index of the control block DMA is at on a channel. */
+static unsigned int dmaCurrent(driver_t *driver) {
+    unsigned int index = 0;
+
+    dmaAdvance(driver);
+    pthread_mutex_lock(&runningLock);
+    if (running.driver == driver) index = running.cb - driver->cbs_v;
+    pthread_mutex_unlock(&runningLock);
+    return index;
+}
+
+
+/*############################################################################*/
+
+
+/* Set DMA channel to use. */
+void set_dmach(int dmach) {
+    dflt.dch = dmach;
+}
+
+
+/*############################################################################*/
+
+
+/* Get maximum length (in bytes) of cbs_v. */
+unsigned int cbs_len(void) {
+    return 4096*dflt.pages;
+}
+
+
+/*############################################################################*/
+
+
+/* DMA finishes at once: it is never running, and is always at the first
+   control block. With stub_realtime(), it runs for as long as the delays of
+   the control blocks take instead. */
+void activate_dma(unsigned int index) {
+    driver_activate_dma(&dflt, index);
+}
+
+void stop_dma(void) {
+    driver_stop_dma(&dflt);
+}
+
+int dma_running(void) {
+    return driver_dma_running(&dflt);
+}
+
+unsigned int dma_current_cb(void) {
+    return driver_dma_current_cb(&dflt);
+}
+
+void driver_activate_dma(driver_t *driver, unsigned int index) {
+    dmaRecord(driver, index);
+    dmaStart(driver, index);
+}
+
+void driver_stop_dma(driver_t *driver) {
+    dmaStop(driver);
+}
+
+int driver_dma_running(driver_t *driver) {
+    return dmaAdvance(driver);
+}
+
+unsigned int driver_dma_current_cb(driver_t *driver) {
+    return dmaCurrent(driver);
+}
+
+
+/*############################################################################*/
+
+
+/* No errors are ever seen. */
+unsigned int dma_debug(void) {
+    return 0;
+}
+
+void dma_debug_clear(unsigned int flags) {
+    (void)flags;
+}
+
+unsigned int pwm_status(void) {
+    return 0;
+}
+
+void pwm_status_clear(unsigned int flags) {
+    (void)flags;
+}
+
+
+/*############################################################################*/
+
+
+/* Get the physical address of a peripheral register location, for DMA
+   purposes. */
+unsigned int periph(unsigned int base, unsigned int offset) {
+    return ((base + offset*4) & 0x00FFFFFF) | 0x7E000000;
+}
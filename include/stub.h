@@ -0,0 +1,76 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+
+/* stub - The functions of driver.h without any hardware, for running the
+          player on any Linux machine. Link stub.o instead of driver.o. */
+
+#pragma once
+
+#include "driver.h"
+
+/* A transition made by the control blocks given to DMA. */
+typedef struct stub_pulse_t {
+    unsigned int set;       /* Pins turned on (1<<pin).                       */
+    unsigned int clr;       /* Pins turned off (1<<pin).                      */
+    unsigned int us;        /* Delay after the transition (microseconds).     */
+} stub_pulse_t;
+
+/* Have a function called with the transitions of the control blocks each time
+   DMA is started, which the player does once for every beat it sends, since
+   DMA always finishes at once. The pulses are only valid during the call.
+   fn:  Function to call, or NULL to stop calling it.
+   arg: Passed to fn. */
+void stub_record(void (*fn)(const stub_pulse_t *pulses, unsigned int length,
+                            void *arg), void *arg);
+
+/* A control block given to DMA, with the addresses of memory from vc_create()
+   made relative to the start of that memory, so that it is the same on
+   every run. Peripheral addresses are left as they are. */
+typedef struct stub_cb_t {
+    unsigned int ti;        /* Transfer information.                          */
+    unsigned int source;    /* Source address.                                */
+    unsigned int dest;      /* Destination address.                           */
+    unsigned int length;    /* Bytes transferred.                             */
+    unsigned int next;      /* Next control block, or STUB_END.               */
+    unsigned int word;      /* Word read from source by GPIO commands (pins
+                               set or cleared), 0 for other control blocks.   */
+} stub_cb_t;
+
+/* next of the last control block. */
+#define STUB_END 0xFFFFFFFFU
+
+/* Have a function called with the control blocks each time DMA is started,
+   in the order DMA would read them. It is called after the function given to
+   stub_record(), if there is one. The control blocks are only valid during
+   the call.
+   fn:  Function to call, or NULL to stop calling it.
+   arg: Passed to fn. */
+void stub_record_cbs(void (*fn)(const stub_cb_t *cbs, unsigned int length,
+                                void *arg), void *arg);
+
+/* Make DMA take as long as the delays of its control blocks, as the real
+   thing does, rather than finish at once, so that the player waits for it
+   and can fall behind (see qosSlowdown() in player.h). Only one channel runs
+   at once. The functions given to stub_record() and stub_record_cbs() are
+   still called each time DMA is started, but only with the control blocks
+   written by then.
+   on: 1 to take as long as the real thing, 0 to finish at once. */
+void stub_realtime(int on);
@@ -0,0 +1,217 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* telemetry - Counters for DMA and PWM errors observed during playback */
+
+#define _BSD_SOURCE
+
+#include <stdio.h>     /* fprintf(), fflush()                                 */
+#include <string.h>    /* memset()                                            */
+#include <sys/time.h>  /* gettimeofday()                                      */
+
+#include "driver.h"
+#include "telemetry.h"
+
+
+
+
+/* Error flags of DMA_DEBUG, in the same order as the TM_DMA_* classes. */
+static const unsigned int dma_flags[3] = {
+    DMA_DEBUG_READ_NOT_LAST_SET_ERROR,
+    DMA_DEBUG_FIFO_ERROR,
+    DMA_DEBUG_READ_ERROR
+};
+
+/* Error flags of PWM_STA, in the same order as the TM_PWM_* classes. */
+static const unsigned int pwm_flags[4] = {
+    PWM_STA_WERR,
+    PWM_STA_RERR,
+    PWM_STA_GAPO,
+    PWM_STA_BERR
+};
+
+/* Names of the error classes, for telemetry_name(). */
+static const char *names[TM_CLASSES] = {
+    "dma-read-last",
+    "dma-fifo",
+    "dma-read",
+    "pwm-werr",
+    "pwm-rerr",
+    "pwm-gapo",
+    "pwm-berr"
+};
+
+/* Current counters. */
+static telemetry_t tm;
+
+/* File to periodically print counters to, or NULL. */
+static FILE *dumpFile = NULL;
+
+/* Minimum milliseconds between periodic prints. */
+static unsigned int dumpMs = 0;
+
+/* Time of last periodic print. */
+static struct timeval dumpLast;
+
+
+
+
+/*############################################################################*/
+
+
+/* Record an error of class cls. */
+static void record(int cls, unsigned int cb, unsigned int beat) {
+    if (!tm.cls[cls].count) {
+        tm.cls[cls].first_cb   = cb;
+        tm.cls[cls].first_beat = beat;
+    }
+    tm.cls[cls].count++;
+    tm.cls[cls].last_cb   = cb;
+    tm.cls[cls].last_beat = beat;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns milliseconds elapsed between two times. */
+static unsigned long elapsed_ms(struct timeval *from, struct timeval *to) {
+    return (to->tv_sec - from->tv_sec)*1000 +
+           (to->tv_usec - from->tv_usec)/1000;
+}
+
+
+/*############################################################################*/
+
+
+/* Reset all counters to 0. This is called automatically by queuePlay(). */
+void telemetry_reset(void) {
+    memset(&tm, 0, sizeof(tm));
+    gettimeofday(&dumpLast, NULL);
+}
+
+
+/*############################################################################*/
+
+
+/* Read DMA_DEBUG and PWM_STA, count any error flags that are set and then
+   clear them so that the next sample only sees new errors.
+   Only two register reads are done unless an error is found.
+   beat: Beat being generated when the sample was taken, for correlation. */
+void telemetry_sample(unsigned int beat) {
+    unsigned int debug = dma_debug() & (DMA_DEBUG_READ_NOT_LAST_SET_ERROR |
+                                        DMA_DEBUG_FIFO_ERROR              |
+                                        DMA_DEBUG_READ_ERROR);
+    unsigned int sta   = pwm_status() & (PWM_STA_WERR | PWM_STA_RERR |
+                                         PWM_STA_GAPO | PWM_STA_BERR);
+    unsigned int cb;
+    struct timeval now;
+    int i;
+
+    tm.samples++;
+
+    if (debug || sta) {
+        cb = dma_current_cb();
+        tm.errors++;
+
+        for (i = 0; i < 3; i++)
+            if (debug & dma_flags[i]) record(TM_DMA_READ_LAST + i, cb, beat);
+        for (i = 0; i < 4; i++)
+            if (sta & pwm_flags[i]) record(TM_PWM_WERR + i, cb, beat);
+
+        /* Clear the flags we saw so that they are only counted once */
+        if (debug) dma_debug_clear(debug);
+        if (sta)   pwm_status_clear(sta);
+    }
+
+    /* Periodic print, if requested */
+    if (dumpFile) {
+        gettimeofday(&now, NULL);
+        if (elapsed_ms(&dumpLast, &now) >= dumpMs) {
+            telemetry_dump(dumpFile);
+            dumpLast = now;
+        }
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Copy the current counters into *out. */
+void telemetry_read(telemetry_t *out) {
+    *out = tm;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns a short name for an error class (0 to TM_CLASSES-1). */
+const char *telemetry_name(int cls) {
+    return (cls >= 0 && cls < TM_CLASSES) ? names[cls] : "unknown";
+}
+
+
+/*############################################################################*/
+
+
+/* Print the current counters to a file (for example stderr). */
+void telemetry_dump(FILE *f) {
+    int i;
+    fprintf(f, "telemetry: samples=%lu errors=%lu\n", tm.samples, tm.errors);
+    for (i = 0; i < TM_CLASSES; i++) {
+        if (!tm.cls[i].count) continue;
+        fprintf(f, "telemetry:   %-14s count=%lu first=cb%u/beat%u "
+                   "last=cb%u/beat%u\n",
+                names[i],
+                tm.cls[i].count,
+                tm.cls[i].first_cb, tm.cls[i].first_beat,
+                tm.cls[i].last_cb,  tm.cls[i].last_beat);
+    }
+    fflush(f);
+}
+
+
+/*############################################################################*/
+
+
+/* Periodically print the counters while playing.
+   f:  File to print to (for example stderr). NULL disables periodic printing.
+   ms: Minimum amount of milliseconds between prints.
+   The counters are also printed once more when queuePlay() finishes. */
+void telemetry_dump_every(FILE *f, unsigned int ms) {
+    dumpFile = f;
+    dumpMs   = ms;
+    gettimeofday(&dumpLast, NULL);
+}
+
+
+/*############################################################################*/
+
+
+/* Print the counters to the file given to telemetry_dump_every(), if any.
+   This is called automatically at the end of queuePlay(). */
+void telemetry_flush(void) {
+    if (dumpFile) telemetry_dump(dumpFile);
+}
+
+
+/*############################################################################*/
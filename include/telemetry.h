@@ -0,0 +1,79 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* telemetry - Counters for DMA and PWM errors observed during playback */
+
+#pragma once
+
+#include <stdio.h>  /* FILE */
+
+/* Error classes counted by telemetry_sample(). */
+#define TM_DMA_READ_LAST 0 /* DMA_DEBUG: READ_LAST_NOT_SET_ERROR              */
+#define TM_DMA_FIFO      1 /* DMA_DEBUG: FIFO_ERROR                           */
+#define TM_DMA_READ      2 /* DMA_DEBUG: READ_ERROR                           */
+#define TM_PWM_WERR      3 /* PWM_STA:   FIFO write error                     */
+#define TM_PWM_RERR      4 /* PWM_STA:   FIFO read error (FIFO underrun)      */
+#define TM_PWM_GAPO      5 /* PWM_STA:   Gap occurred on a PWM channel        */
+#define TM_PWM_BERR      6 /* PWM_STA:   Bus error                            */
+#define TM_CLASSES       7
+
+/* Counters for one error class. */
+typedef struct tm_class_t {
+    unsigned long count;     /* Amount of samples in which error was seen.    */
+    unsigned int first_cb;   /* Control block index when first seen.          */
+    unsigned int first_beat; /* Beat number when first seen.                  */
+    unsigned int last_cb;    /* Control block index when last seen.           */
+    unsigned int last_beat;  /* Beat number when last seen.                   */
+} tm_class_t;
+
+/* Type for telemetry counters. */
+typedef struct telemetry_t {
+    unsigned long samples;      /* Amount of times registers were sampled.    */
+    unsigned long errors;       /* Amount of samples that saw any error.      */
+    tm_class_t cls[TM_CLASSES]; /* Counters for each error class.             */
+} telemetry_t;
+
+/* Reset all counters to 0. This is called automatically by queuePlay(). */
+void telemetry_reset(void);
+
+/* Read DMA_DEBUG and PWM_STA, count any error flags that are set and then
+   clear them so that the next sample only sees new errors.
+   Only two register reads are done unless an error is found.
+   beat: Beat being generated when the sample was taken, for correlation. */
+void telemetry_sample(unsigned int beat);
+
+/* Copy the current counters into *out. */
+void telemetry_read(telemetry_t *out);
+
+/* Returns a short name for an error class (0 to TM_CLASSES-1). */
+const char *telemetry_name(int cls);
+
+/* Print the current counters to a file (for example stderr). */
+void telemetry_dump(FILE *f);
+
+/* Periodically print the counters while playing.
+   f:  File to print to (for example stderr). NULL disables periodic printing.
+   ms: Minimum amount of milliseconds between prints.
+   The counters are also printed once more when queuePlay() finishes. */
+void telemetry_dump_every(FILE *f, unsigned int ms);
+
+/* Print the counters to the file given to telemetry_dump_every(), if any.
+   This is called automatically at the end of queuePlay(). */
+void telemetry_flush(void);
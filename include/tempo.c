@@ -0,0 +1,206 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* tempo - Tempo maps with beat start times that do not drift */
+
+#include <stdio.h>     /* fprintf(), stderr                                   */
+#include <stdlib.h>    /* realloc(), free()                                   */
+#include <math.h>      /* floor()                                             */
+
+#include "tempo.h"
+
+
+
+
+/*############################################################################*/
+
+
+/* Returns the length of beat k (from 0) of a tempo change. */
+static double length(const tempo_event_t *e, unsigned int k) {
+    if (k >= e->ramp) return e->to;
+    return e->from + (e->to - e->from) * k / e->ramp;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the time from the start of a tempo change to the start of its
+   beat k (from 0). Ramps are summed in closed form: beat j of a ramp of n
+   beats is from + (to-from)*j/n long. */
+static double offset(const tempo_event_t *e, unsigned int k) {
+    double k1 = (k < e->ramp) ? k : e->ramp;
+    double t  = k1*e->from;
+    if (e->ramp) t += (e->to - e->from) * (k1*(k1-1)/2) / e->ramp;
+    return t + (k - k1)*e->to;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the tempo change in effect at a beat. */
+static const tempo_event_t *find(const tempo_t *tempo, unsigned int beat) {
+    unsigned int lo = 0, hi = tempo->count, mid;
+
+    /* Last event with event.beat <= beat (the first event is at beat 0) */
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (tempo->event[mid].beat <= beat) lo = mid;
+        else hi = mid;
+    }
+    return &tempo->event[lo];
+}
+
+
+/*############################################################################*/
+
+
+/* Add a tempo change. */
+static int add(tempo_t *tempo, const char *func, unsigned int beat,
+               unsigned int ramp, double num, double den) {
+    tempo_event_t *last = &tempo->event[tempo->count-1];
+    tempo_event_t *e;
+
+    if (beat < last->beat || num <= 0 || den <= 0) {
+        fprintf(stderr, "ERROR: %s(): Tempo changes must be added in order "
+                        "and be positive.\n", func);
+        return -1;
+    }
+
+    /* A change at the same beat as the last one replaces it */
+    if (beat == last->beat && tempo->count > 1) {
+        tempo->count--;
+        last--;
+    }
+
+    if (tempo->count == tempo->size) {
+        tempo->size *= 2;
+        tempo->event = realloc(tempo->event,
+                               tempo->size*sizeof(tempo_event_t));
+        last = &tempo->event[tempo->count-1];
+    }
+
+    e = &tempo->event[tempo->count];
+    if (beat == 0) e = last;
+    else tempo->count++;
+
+    e->beat  = beat;
+    e->ramp  = ramp;
+    e->from  = (beat == 0) ? num/den : length(last, beat - last->beat);
+    e->to    = num/den;
+    e->start = (beat == 0) ? 0 : last->start + offset(last, beat - last->beat);
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Start a tempo map.
+   us: Length of each beat in microseconds until the first tempo change. */
+void tempoInit(tempo_t *tempo, unsigned int us) {
+    tempo->size  = 16;
+    tempo->count = 1;
+    tempo->event = malloc(tempo->size*sizeof(tempo_event_t));
+    tempo->event[0].beat  = 0;
+    tempo->event[0].ramp  = 0;
+    tempo->event[0].from  = us;
+    tempo->event[0].to    = us;
+    tempo->event[0].start = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Free a tempo map. */
+void tempoFree(tempo_t *tempo) {
+    free(tempo->event);
+    tempo->event = NULL;
+    tempo->count = 0;
+    tempo->size  = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Change the beat length from a beat onwards. Tempo changes must be added in
+   order of beat.
+   beat: First beat with the new length.
+   num, den: New beat length in microseconds is num/den.
+   Returns 0 on success, or -1 (after printing an error). */
+int tempoSet(tempo_t *tempo, unsigned int beat, double num, double den) {
+    return add(tempo, "tempoSet", beat, 0, num, den);
+}
+
+
+/*############################################################################*/
+
+
+/* Change the tempo from a beat onwards, in beats per minute.
+   bpm, den: New tempo is bpm/den beats per minute (for example 1205/10 for
+             120.5 BPM).
+   Returns 0 on success, or -1 (after printing an error). */
+int tempoBpm(tempo_t *tempo, unsigned int beat, double bpm, double den) {
+    return add(tempo, "tempoBpm", beat, 0, 60000000*den, bpm);
+}
+
+
+/*############################################################################*/
+
+
+/* Change the beat length gradually (accelerando or ritardando). The length of
+   each beat moves linearly from the length before the ramp to num/den over
+   "beats" beats, and stays at num/den after the ramp.
+   Returns 0 on success, or -1 (after printing an error). */
+int tempoRamp(tempo_t *tempo, unsigned int beat, unsigned int beats,
+              double num, double den) {
+    return add(tempo, "tempoRamp", beat, beats, num, den);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the time (microseconds from the start of the song) of a point in a
+   beat.
+   beat:     Beat number.
+   fraction: Point in the beat (0 for its start, up to 1 for its end). */
+double tempoTime(const tempo_t *tempo, unsigned int beat, double fraction) {
+    const tempo_event_t *e = find(tempo, beat);
+    unsigned int k = beat - e->beat;
+    return e->start + offset(e, k) + fraction*length(e, k);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the start of a beat, in whole microseconds. The length of a beat is
+   tempoStart(beat+1) - tempoStart(beat), so that every beat ends exactly where
+   the next one starts. */
+unsigned long tempoStart(const tempo_t *tempo, unsigned int beat) {
+    return floor(tempoTime(tempo, beat, 0) + 1e-6);
+}
+
+
+/*############################################################################*/
@@ -0,0 +1,91 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* tempo - Tempo maps with beat start times that do not drift */
+
+#pragma once
+
+/* A tempo map gives the length of every beat in fractions of a microsecond,
+   so that tempos such as 140 BPM (428571.43 microseconds per beat) do not
+   drift from wall time. Each tempo change is given as a fraction num/den,
+   and is kept as the double nearest to it, which is out by less than a
+   nanosecond per beat. The start time of a beat is never found by adding up
+   beat lengths: it is computed directly from the last tempo change, so that
+   error is not added again for every beat, and a song would take billions
+   of beats to be a microsecond out.
+
+   Tempo changes may be immediate (tempoSet(), tempoBpm()) or ramps
+   (tempoRamp()), in which the beat length changes linearly from beat to beat.
+   Numerators and denominators may be any whole numbers up to 2^53, which
+   doubles hold exactly. */
+
+/* One tempo change. */
+typedef struct tempo_event_t {
+    unsigned int beat;  /* Beat from which the change applies.                */
+    unsigned int ramp;  /* Length of ramp in beats, 0 for an immediate change.*/
+    double from;        /* Beat length (microseconds) at the first beat.      */
+    double to;          /* Beat length (microseconds) after the ramp.         */
+    double start;       /* Start time of the first beat (microseconds).       */
+} tempo_event_t;
+
+/* A tempo map. */
+typedef struct tempo_t {
+    tempo_event_t *event;
+    unsigned int count;
+    unsigned int size;
+} tempo_t;
+
+/* Start a tempo map.
+   us: Length of each beat in microseconds until the first tempo change. */
+void tempoInit(tempo_t *tempo, unsigned int us);
+
+/* Free a tempo map. */
+void tempoFree(tempo_t *tempo);
+
+/* Change the beat length from a beat onwards. Tempo changes must be added in
+   order of beat.
+   beat: First beat with the new length.
+   num, den: New beat length in microseconds is num/den.
+   Returns 0 on success, or -1 (after printing an error). */
+int tempoSet(tempo_t *tempo, unsigned int beat, double num, double den);
+
+/* Change the tempo from a beat onwards, in beats per minute.
+   bpm, den: New tempo is bpm/den beats per minute (for example 1205/10 for
+             120.5 BPM).
+   Returns 0 on success, or -1 (after printing an error). */
+int tempoBpm(tempo_t *tempo, unsigned int beat, double bpm, double den);
+
+/* Change the beat length gradually (accelerando or ritardando). The length of
+   each beat moves linearly from the length before the ramp to num/den over
+   "beats" beats, and stays at num/den after the ramp.
+   Returns 0 on success, or -1 (after printing an error). */
+int tempoRamp(tempo_t *tempo, unsigned int beat, unsigned int beats,
+              double num, double den);
+
+/* Returns the time (microseconds from the start of the song) of a point in a
+   beat.
+   beat:     Beat number.
+   fraction: Point in the beat (0 for its start, up to 1 for its end). */
+double tempoTime(const tempo_t *tempo, unsigned int beat, double fraction);
+
+/* Returns the start of a beat, in whole microseconds. The length of a beat is
+   tempoStart(beat+1) - tempoStart(beat), so that every beat ends exactly where
+   the next one starts. */
+unsigned long tempoStart(const tempo_t *tempo, unsigned int beat);
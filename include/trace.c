@@ -0,0 +1,277 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* trace - Timestamped spans of what the player was doing, written out as
+           Chrome trace JSON (for chrome://tracing or ui.perfetto.dev) */
+
+#define _BSD_SOURCE
+
+#include <stdio.h>     /* fopen(), fprintf(), fclose(), stderr                */
+#include <stdlib.h>    /* malloc(), free(), atexit()                          */
+#include <string.h>    /* strlen(), strcpy()                                  */
+#include <sys/time.h>  /* gettimeofday()                                      */
+#include <pthread.h>   /* pthread_key_create(), pthread_getspecific()         */
+
+#include "trace.h"
+
+
+
+
+/* A recorded event. */
+typedef struct trace_event_t {
+    const char *name;
+    const char *key;        /* Name of value, or NULL.                        */
+    unsigned long ts;       /* Start (trace_now()).                           */
+    unsigned long dur;      /* Length (microseconds). Not used by counters.   */
+    long value;
+    char counter;           /* 1 for a counter, 0 for a span.                 */
+} trace_event_t;
+
+/* Events of one thread. A thread takes a ring that is not busy when it first
+   records an event and gives it back when it ends, so a thread started later
+   may carry on in the same ring. */
+typedef struct trace_ring_t {
+    const char *name;       /* Name of the last thread using it, or NULL.     */
+    volatile int busy;      /* 1 while a thread is using it.                  */
+    unsigned long head;     /* Events recorded. The latest is head-1.         */
+    trace_event_t *events;
+} trace_ring_t;
+
+static trace_ring_t rings[TRACE_THREADS];
+static trace_event_t *pool = NULL;
+static unsigned int size = 0;        /* Events in each ring.                  */
+static volatile int tracing = 0;     /* 1 between trace_open() and
+                                        trace_close().                        */
+static char *file = NULL;            /* File given to trace_open().           */
+static unsigned long origin;         /* trace_now() at trace_open().          */
+
+/* Ring of each thread */
+static pthread_key_t ringKey;
+static pthread_once_t ringOnce = PTHREAD_ONCE_INIT;
+
+
+
+
+/*############################################################################*/
+
+
+/* Give a ring back when its thread ends. */
+static void ringRelease(void *ring) {
+    ((trace_ring_t *)ring)->busy = 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Set up what is only set up once per program. */
+static void traceInit(void) {
+    pthread_key_create(&ringKey, ringRelease);
+    atexit(trace_close);
+}
+
+
+/*############################################################################*/
+
+
+/* Returns the ring of the calling thread, taking one if it has none yet, or
+   NULL if there are none left. */
+static trace_ring_t *ringGet(void) {
+    trace_ring_t *ring = pthread_getspecific(ringKey);
+    unsigned int i;
+
+    if (ring) return ring;
+    for (i = 0; i < TRACE_THREADS; i++) {
+        if (__sync_bool_compare_and_swap(&rings[i].busy, 0, 1)) {
+            pthread_setspecific(ringKey, &rings[i]);
+            return &rings[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Start recording events.
+   path:   File to write the events to.
+   events: Events kept for each thread.
+   Returns 0, or -1 if memory could not be allocated. */
+int trace_open(const char *path, unsigned int events) {
+    unsigned int i;
+
+    pthread_once(&ringOnce, traceInit);
+    if (tracing) return 0;
+
+    pool = malloc((size_t)TRACE_THREADS*events*sizeof(trace_event_t));
+    file = malloc(strlen(path) + 1);
+    if (!pool || !file || !events) {
+        fprintf(stderr, "ERROR: trace_open(): Could not allocate memory for "
+                        "%u events.\n", events);
+        free(pool);
+        free(file);
+        pool = NULL;
+        file = NULL;
+        return -1;
+    }
+    strcpy(file, path);
+
+    /* Rings already taken by running threads stay theirs */
+    size = events;
+    for (i = 0; i < TRACE_THREADS; i++) {
+        rings[i].head   = 0;
+        rings[i].events = pool + i*size;
+    }
+    origin = trace_now();
+    __sync_synchronize();
+    tracing = 1;
+    return 0;
+}
+
+
+/*############################################################################*/
+
+
+/* Write the events of a ring, oldest first.
+   tid: Number of the ring, shown as the thread in the trace. */
+static void ringWrite(FILE *f, const trace_ring_t *ring, unsigned int tid,
+                      int *first) {
+    const trace_event_t *ev;
+    unsigned long i = ring->head > size ? ring->head - size : 0;
+
+    if (ring->name) {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                   "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                *first ? "" : ",", tid, ring->name);
+        *first = 0;
+    }
+
+    for (; i < ring->head; i++) {
+        ev = &ring->events[i % size];
+        fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%lu,",
+                *first ? "" : ",", ev->name, ev->counter ? "C" : "X",
+                ev->ts - origin);
+        if (!ev->counter) fprintf(f, "\"dur\":%lu,", ev->dur);
+        fprintf(f, "\"pid\":1,\"tid\":%u", tid);
+        if (ev->counter)
+            fprintf(f, ",\"args\":{\"%s\":%ld}", ev->name, ev->value);
+        else if (ev->key)
+            fprintf(f, ",\"args\":{\"%s\":%ld}", ev->key, ev->value);
+        fprintf(f, "}");
+        *first = 0;
+    }
+}
+
+
+/*############################################################################*/
+
+
+/* Write the events to the file given to trace_open() and stop recording. */
+void trace_close(void) {
+    FILE *f;
+    unsigned int i;
+    int first = 1;
+
+    if (!tracing) return;
+    tracing = 0;
+    __sync_synchronize();
+
+    f = fopen(file, "w");
+    if (!f)
+        fprintf(stderr, "ERROR: trace_close(): Could not write %s.\n", file);
+    else {
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        for (i = 0; i < TRACE_THREADS; i++) ringWrite(f, &rings[i], i, &first);
+        fprintf(f, "\n]}\n");
+        fclose(f);
+    }
+
+    for (i = 0; i < TRACE_THREADS; i++) rings[i].events = NULL;
+    free(pool);
+    free(file);
+    pool = NULL;
+    file = NULL;
+}
+
+
+/*############################################################################*/
+
+
+/* Returns microseconds from some point in the past. Only differences of
+   these are used, so wrapping around does not matter. */
+unsigned long trace_now(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec*1000000UL + now.tv_usec;
+}
+
+
+/*############################################################################*/
+
+
+/* Name the calling thread in the trace. */
+void trace_thread(const char *name) {
+    trace_ring_t *ring;
+
+    pthread_once(&ringOnce, traceInit);
+    if ((ring = ringGet())) ring->name = name;
+}
+
+
+/*############################################################################*/
+
+
+/* Record an event in the ring of the calling thread. */
+static void record(const char *name, unsigned long ts, unsigned long dur,
+                   const char *key, long value, char counter) {
+    trace_ring_t *ring;
+    trace_event_t *ev;
+
+    if (!tracing || !(ring = ringGet()) || !ring->events) return;
+
+    ev = &ring->events[ring->head % size];
+    ev->name    = name;
+    ev->key     = key;
+    ev->ts      = ts;
+    ev->dur     = dur;
+    ev->value   = value;
+    ev->counter = counter;
+    ring->head++;
+}
+
+
+/*############################################################################*/
+
+
+/* Record a span of time on the calling thread, from start until now. */
+void trace_span(const char *name, unsigned long start, const char *key,
+                long value) {
+    record(name, start, trace_now() - start, key, value, 0);
+}
+
+
+/*############################################################################*/
+
+
+/* Record the value of a counter at this time on the calling thread. */
+void trace_counter(const char *name, long value) {
+    record(name, trace_now(), 0, NULL, value, 1);
+}
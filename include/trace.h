@@ -0,0 +1,78 @@
+/*
+ * ***** BEGIN GPL LICENSE BLOCK *****
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * ***** END GPL LICENSE BLOCK *****
+ */
+
+/* trace - Timestamped spans of what the player was doing, written out as
+           Chrome trace JSON (for chrome://tracing or ui.perfetto.dev) */
+
+#pragma once
+
+/* Record what the player does while playing, see trace_open(). Build with
+   -DTRACE=1 ("make pi2 TRACE=1") to enable. With 0, the player does not call
+   any of the functions below. */
+#ifndef TRACE
+#   define TRACE 0
+#endif
+
+/* File written when the player opens the trace itself. */
+#ifndef TRACE_FILE
+#   define TRACE_FILE "trace.json"
+#endif
+
+/* Events kept for each thread when the player opens the trace itself. Once a
+   thread has recorded this many, each new event replaces its oldest one. */
+#ifndef TRACE_EVENTS
+#   define TRACE_EVENTS 32768
+#endif
+
+/* Most threads that can record events at once. Events of threads that start
+   when all are in use are dropped. */
+#define TRACE_THREADS 12
+
+/* Start recording events. Memory for every thread is allocated here, so that
+   recording an event never allocates or takes a lock. The events are written
+   to the file when trace_close() is called or the program exits. With
+   -DTRACE=1, the player calls this with TRACE_FILE and TRACE_EVENTS when it
+   first plays, unless it has already been called.
+   path:   File to write the events to.
+   events: Events kept for each thread.
+   Returns 0, or -1 if memory could not be allocated. */
+int trace_open(const char *path, unsigned int events);
+
+/* Write the events to the file given to trace_open() and stop recording. Run
+   this while nothing is playing. */
+void trace_close(void);
+
+/* Returns microseconds from some point in the past, for trace_span(). */
+unsigned long trace_now(void);
+
+/* Name the calling thread in the trace. name must stay valid. */
+void trace_thread(const char *name);
+
+/* Record a span of time on the calling thread, from start until now.
+   name:  What was done. Must stay valid (a string literal).
+   start: When it began (trace_now()).
+   key:   Name of value in the trace (a string literal), or NULL for none.
+   value: Beat, pin or anything else that tells spans apart. */
+void trace_span(const char *name, unsigned long start, const char *key,
+                long value);
+
+/* Record the value of a counter at this time on the calling thread.
+   name:  Name of the counter (a string literal). */
+void trace_counter(const char *name, long value);
@@ -0,0 +1,114 @@
+#define _BSD_SOURCE
+
+#include <stdio.h>      /* printf(), fprintf(), fopen(), fread(), stderr       */
+#include <stdlib.h>     /* malloc(), free()                                    */
+#include <string.h>     /* strcmp(), strlen(), strncpy(), memset()             */
+#include <unistd.h>     /* read(), write(), close()                            */
+#include <sys/socket.h> /* socket(), connect()                                 */
+#include <sys/un.h>     /* struct sockaddr_un                                  */
+
+#include "include/daemon.h"
+
+
+
+/* Write all of a buffer. Returns 0, or -1 if the connection failed. */
+static int writeAll(int fd, const char *buf, size_t length) {
+    ssize_t n;
+    while (length) {
+        n = write(fd, buf, length);
+        if (n <= 0) return -1;
+        buf    += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/* Read a whole file into memory. Returns it, or NULL. */
+static char *readFile(const char *path, size_t *length) {
+    FILE *f = fopen(path, "rb");
+    char *data;
+    long size;
+
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = size > 0 ? malloc(size) : NULL;
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *length = size;
+    return data;
+}
+
+
+
+/* Send a command to play-daemon and print its answer. Does not need root.
+   Usage: ./play-ctl [-s socket] play file.rps
+          ./play-ctl [-s socket] queue file.rps
+          ./play-ctl [-s socket] stop
+          ./play-ctl [-s socket] status */
+int main(int argc, char **argv) {
+    const char *path = DAEMON_SOCKET;
+    struct sockaddr_un addr;
+    char line[DAEMON_LINE], reply[512];
+    char *score = NULL;
+    size_t length = 0;
+    ssize_t n;
+    int fd, arg = 1, got = 0;
+
+    if (argc > 2 && !strcmp(argv[1], "-s")) {
+        path = argv[2];
+        arg  = 3;
+    }
+    if (argc - arg == 2 && (!strcmp(argv[arg], "play") ||
+                            !strcmp(argv[arg], "queue"))) {
+        score = readFile(argv[arg+1], &length);
+        if (!score) {
+            fprintf(stderr, "ERROR: main(): Could not read %s.\n",
+                    argv[arg+1]);
+            return 1;
+        }
+        sprintf(line, "%s %lu\n", argv[arg], (unsigned long)length);
+    }
+    else if (argc - arg == 1 && (!strcmp(argv[arg], "stop") ||
+                                 !strcmp(argv[arg], "status")))
+        sprintf(line, "%s\n", argv[arg]);
+    else {
+        fprintf(stderr, "Usage: %s [-s socket] play|queue file.rps\n"
+                        "       %s [-s socket] stop|status\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "ERROR: main(): Could not connect to %s. "
+                        "Is play-daemon running?\n", path);
+        return 1;
+    }
+
+    if (writeAll(fd, line, strlen(line)) ||
+        (score && writeAll(fd, score, length))) {
+        fprintf(stderr, "ERROR: main(): Could not send command.\n");
+        return 1;
+    }
+    free(score);
+
+    /* The answer is one line */
+    while (got < (int)sizeof(reply)-1 &&
+           (n = read(fd, reply + got, sizeof(reply)-1 - got)) > 0) {
+        got += n;
+        if (reply[got-1] == '\n') break;
+    }
+    reply[got] = 0;
+    close(fd);
+
+    printf("%s", reply);
+    return strncmp(reply, "ok", 2) ? 1 : 0;
+}
@@ -0,0 +1,396 @@
+#define _BSD_SOURCE
+
+#include <stdio.h>      /* printf(), fprintf(), sprintf(), sscanf(), stderr    */
+#include <stdlib.h>     /* malloc(), free()                                    */
+#include <string.h>     /* strcmp(), strlen(), strncpy(), memcpy()             */
+#include <errno.h>      /* errno, EINTR, EAGAIN                                */
+#include <signal.h>     /* signal(), SIGINT, SIGTERM, SIGPIPE                  */
+#include <fcntl.h>      /* fcntl(), O_NONBLOCK                                 */
+#include <unistd.h>     /* read(), write(), close(), unlink()                  */
+#include <poll.h>       /* poll()                                              */
+#include <sys/time.h>   /* gettimeofday()                                      */
+#include <sys/stat.h>   /* chmod()                                             */
+#include <sys/socket.h> /* socket(), bind(), listen(), accept()                */
+#include <sys/un.h>     /* struct sockaddr_un                                  */
+
+#include "include/daemon.h"
+#include "include/metrics.h"
+#include "include/player.h"
+#include "include/score.h"
+
+/* Largest amount of clients connected at once. */
+#define CLIENTS 16
+
+/* A score waiting to be played. */
+typedef struct job_t {
+    unsigned long id;
+    void *data;             /* Score, as received.                            */
+    size_t length;          /* Bytes of score.                                */
+    struct job_t *next;
+} job_t;
+
+/* A connected client. */
+typedef struct client_t {
+    int fd;                 /* Socket, or -1 if this entry is free.           */
+    char line[DAEMON_LINE]; /* Command line being received.                   */
+    unsigned int used;      /* Bytes of line received.                        */
+    char *score;            /* Score being received after "play" or "queue".  */
+    size_t want;            /* Bytes of score expected.                       */
+    size_t got;             /* Bytes of score received.                       */
+    int queue;              /* 1 for "queue", 0 for "play".                   */
+} client_t;
+
+static client_t client[CLIENTS];
+static job_t *head = NULL, *tail = NULL;
+static unsigned long queued = 0;
+
+/* Job playing */
+static job_t *current = NULL;
+static play_t *playing = NULL;
+static struct timeval due;  /* When it was asked for, if nothing was playing.  */
+static int started = 0;     /* 1 once its first beat was sent to DMA, or if it
+                               is not timed.                                  */
+
+/* Counters for "status" */
+static unsigned long jobs = 0, played = 0, commands = 0;
+static unsigned long cmdUs = 0, cmdMaxUs = 0;
+static unsigned long startUs = 0, startMaxUs = 0;
+
+static volatile int quit = 0;
+
+
+
+/* Microseconds since a time. */
+static unsigned long usSince(const struct timeval *t) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - t->tv_sec)*1000000UL + now.tv_usec - t->tv_usec;
+}
+
+/* Stop on SIGINT and SIGTERM. */
+static void onSignal(int sig) {
+    (void)sig;
+    quit = 1;
+}
+
+
+
+/* Start the next job in the queue, if any.
+   since: When it was asked for, or NULL if it follows the last job (it is
+          then sent to DMA as soon as there is room, so it is not timed). */
+static void jobStart(const struct timeval *since) {
+    if (playing || !head) return;
+
+    current = head;
+    head = head->next;
+    if (!head) tail = NULL;
+    queued--;
+
+    playing = queuePlayMemoryAsync(current->data, current->length);
+    if (!playing) {
+        free(current->data);
+        free(current);
+        current = NULL;
+        return;
+    }
+    started = !since;
+    if (since) due = *since;
+}
+
+/* Forget the job playing, and start the next one. */
+static void jobDone(void) {
+    playFree(playing);
+    free(current->data);
+    free(current);
+    playing = NULL;
+    current = NULL;
+    played++;
+
+    jobStart(NULL);
+}
+
+/* Follow the job playing: note when its first beat reaches DMA, and start
+   the next job once it has finished. */
+static void jobsCheck(void) {
+    play_progress_t progress;
+    int running;
+
+    if (!playing) return;
+
+    running = playPoll(playing, &progress);
+    if (!started && progress.beats) {
+        started = 1;
+        startUs = usSince(&due);
+        if (startUs > startMaxUs) startMaxUs = startUs;
+    }
+    if (!running) jobDone();
+}
+
+/* Stop playing and forget the queue. */
+static void jobsStop(void) {
+    job_t *job;
+
+    if (playing) {
+        playCancel(playing);
+        playFree(playing);
+        free(current->data);
+        free(current);
+        playing = NULL;
+        current = NULL;
+        played++;
+    }
+    while (head) {
+        job = head;
+        head = head->next;
+        free(job->data);
+        free(job);
+    }
+    tail   = NULL;
+    queued = 0;
+}
+
+
+
+/* Close a client's connection. */
+static void clientClose(client_t *c) {
+    close(c->fd);
+    free(c->score);
+    c->fd    = -1;
+    c->score = NULL;
+}
+
+/* Answer a command.
+   c:        Client that sent it.
+   received: When the command had been received. */
+static void clientReply(client_t *c, const char *reply,
+                        const struct timeval *received) {
+    unsigned long us;
+
+    if (write(c->fd, reply, strlen(reply)) < 0) {
+        clientClose(c);
+        return;
+    }
+
+    us = usSince(received);
+    cmdUs += us;
+    if (us > cmdMaxUs) cmdMaxUs = us;
+    commands++;
+}
+
+/* Carry out a "play" or "queue" command, once its score has been received. */
+static void clientScore(client_t *c, const struct timeval *received) {
+    char reply[64];
+    score_t score;
+    job_t *job;
+
+    /* Only valid scores are queued, so that the client hears about it */
+    if (scoreOpenMemory(&score, c->score, c->want)) {
+        free(c->score);
+        c->score = NULL;
+        clientReply(c, "error invalid score\n", received);
+        return;
+    }
+    scoreClose(&score);
+
+    if (!c->queue) jobsStop();
+
+    job = malloc(sizeof(job_t));
+    job->id     = ++jobs;
+    job->data   = c->score;
+    job->length = c->want;
+    job->next   = NULL;
+    if (tail) tail->next = job;
+    else head = job;
+    tail = job;
+    queued++;
+    c->score = NULL;
+
+    jobStart(received);
+
+    sprintf(reply, "ok %lu\n", job->id);
+    clientReply(c, reply, received);
+}
+
+/* Carry out a command line. */
+static void clientLine(client_t *c, const struct timeval *received) {
+    char reply[256], word[16];
+    unsigned long bytes = 0;
+    play_progress_t progress;
+
+    word[0] = 0;
+    sscanf(c->line, "%15s %lu", word, &bytes);
+
+    if (!strcmp(word, "play") || !strcmp(word, "queue")) {
+        /* The score cannot be skipped, so the connection is closed */
+        if (!bytes || bytes > DAEMON_MAX_SCORE) {
+            clientReply(c, "error bad score length\n", received);
+            if (c->fd >= 0) clientClose(c);
+            return;
+        }
+        c->score = malloc(bytes);
+        c->want  = bytes;
+        c->got   = 0;
+        c->queue = word[0] == 'q';
+        if (!c->score) {
+            clientReply(c, "error out of memory\n", received);
+            if (c->fd >= 0) clientClose(c);
+        }
+    }
+
+    else if (!strcmp(word, "stop")) {
+        jobsStop();
+        clientReply(c, "ok\n", received);
+    }
+
+    else if (!strcmp(word, "status")) {
+        progress.beats = 0;
+        progress.total = 0;
+        if (playing) playPoll(playing, &progress);
+        sprintf(reply, "ok job=%lu beat=%u beats=%u queued=%lu played=%lu "
+                       "commands=%lu cmd_us=%lu/%lu start_us=%lu/%lu\n",
+                current ? current->id : 0, progress.beats, progress.total,
+                queued, played, commands,
+                commands ? cmdUs/commands : 0, cmdMaxUs,
+                startUs, startMaxUs);
+        clientReply(c, reply, received);
+    }
+
+    else clientReply(c, "error unknown command\n", received);
+}
+
+/* Read what a client has sent, and carry out its commands. */
+static void clientRead(client_t *c) {
+    char buf[4096];
+    struct timeval received;
+    ssize_t n;
+    size_t i = 0, take;
+
+    n = read(c->fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        clientClose(c);
+        return;
+    }
+
+    while (i < (size_t)n && c->fd >= 0) {
+        /* Score of a "play" or "queue" command */
+        if (c->score) {
+            take = c->want - c->got;
+            if (take > n - i) take = n - i;
+            memcpy(c->score + c->got, buf + i, take);
+            c->got += take;
+            i      += take;
+            if (c->got == c->want) {
+                gettimeofday(&received, NULL);
+                clientScore(c, &received);
+            }
+            continue;
+        }
+
+        /* Command line */
+        if (buf[i] == '\n') {
+            c->line[c->used] = 0;
+            c->used = 0;
+            i++;
+            gettimeofday(&received, NULL);
+            clientLine(c, &received);
+            continue;
+        }
+        if (c->used == DAEMON_LINE-1) {
+            clientClose(c);
+            return;
+        }
+        c->line[c->used++] = buf[i++];
+    }
+}
+
+
+
+/* Keep DMA set up and play scores sent over a Unix domain socket, one after
+   the other without gaps (see include/daemon.h for the commands). Counters
+   of what is playing are published in shared memory for ./play-metrics.
+   Usage: sudo ./play-daemon [socket]
+   Stops on SIGINT or SIGTERM. */
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DAEMON_SOCKET;
+    struct sockaddr_un addr;
+    struct pollfd fds[CLIENTS+1];
+    client_t *owner[CLIENTS+1];
+    int listener, fd, i, n;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [socket]\n", argv[0]);
+        return 1;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: main(): Socket path is too long.\n");
+        return 1;
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    unlink(path);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr))
+        || listen(listener, CLIENTS)) {
+        fprintf(stderr, "ERROR: main(): Could not listen on %s.\n", path);
+        return 1;
+    }
+    /* Anybody may play sound; only this program touches the hardware */
+    chmod(path, 0666);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < CLIENTS; i++) {
+        client[i].fd    = -1;
+        client[i].score = NULL;
+    }
+
+    playerKeep(1);
+    /* Playing goes on without the counters if they cannot be published */
+    metricsOpen(METRICS_NAME);
+    printf("Listening on %s\n", path);
+
+    while (!quit) {
+        fds[0].fd     = listener;
+        fds[0].events = POLLIN;
+        for (n = 1, i = 0; i < CLIENTS; i++) {
+            if (client[i].fd < 0) continue;
+            fds[n].fd     = client[i].fd;
+            fds[n].events = POLLIN;
+            owner[n++]    = &client[i];
+        }
+
+        /* While playing, look at the job every millisecond */
+        if (poll(fds, n, playing ? 1 : -1) < 0 && errno != EINTR) break;
+        jobsCheck();
+
+        for (i = 1; i < n; i++)
+            if (fds[i].revents) clientRead(owner[i]);
+
+        if (fds[0].revents & POLLIN) {
+            fd = accept(listener, NULL, NULL);
+            for (i = 0; fd >= 0 && i < CLIENTS && client[i].fd >= 0; i++);
+            if (fd < 0) continue;
+            if (i == CLIENTS) {
+                close(fd);
+                continue;
+            }
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            client[i].fd   = fd;
+            client[i].used = 0;
+        }
+    }
+
+    jobsStop();
+    playerKeep(0);
+    metricsClose();
+    for (i = 0; i < CLIENTS; i++)
+        if (client[i].fd >= 0) clientClose(&client[i]);
+    close(listener);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#define _BSD_SOURCE
+
+#include <stdio.h>      /* printf(), fprintf(), fflush(), stderr               */
+#include <stdlib.h>     /* atoi()                                              */
+#include <string.h>     /* strcmp()                                            */
+#include <unistd.h>     /* usleep()                                            */
+
+#include "include/metrics.h"
+#include "include/telemetry.h"
+#include "include/trace.h"
+
+
+
+/* Print one line of counters.
+   last:   Counters printed last time, for rates.
+   lastUs: When they were read (trace_now()), or 0 the first time. */
+static void print(const metrics_t *m, const metrics_t *last,
+                  unsigned long now, unsigned long lastUs) {
+    unsigned long errors = 0, patterns = m->patternHits + m->patternMisses;
+    double slack = 0;
+    int i;
+
+    /* DMA plays sound at the rate it was written, so what is left of it is
+       what was sent less the time since DMA was started */
+    if (m->playing && m->dmaStartUs)
+        slack = (double)m->dmaStartUs + m->dmaSentUs - now;
+    for (i = 0; i < TM_CLASSES; i++) errors += m->errors[i];
+
+    printf("metrics: %s beat=%u/%u ring=%u/%u %lu us slack=%.0f us "
+           "underruns=%lu cb/s=%.0f", m->playing ? "playing" : "idle",
+           m->beat, m->total, m->ringFill, m->ringDepth, m->ringUs,
+           slack > 0 ? slack : 0, m->underruns,
+           lastUs && now != lastUs ?
+           (m->cbs - last->cbs)*1e6/(now - lastUs) : 0.0);
+    if (m->genBeats)
+        printf(" gen p50=%lu p99=%lu max=%lu us",
+               metrics_percentile(m, 50), metrics_percentile(m, 99),
+               m->genMaxUs);
+    printf(" errors=%lu", errors);
+    for (i = 0; i < TM_CLASSES; i++)
+        if (m->errors[i])
+            printf(" %s=%lu", telemetry_name(i), m->errors[i]);
+    printf(" patterns=%lu/%lu", m->patternHits, patterns);
+    if (patterns) printf(" (%.0f%%)", 100.0*m->patternHits/patterns);
+    printf(" qos=%u\n", m->qosLevel);
+    fflush(stdout);
+}
+
+
+
+/* Print the counters a player publishes in shared memory (see metricsOpen()
+   in player.h), such as play-daemon, which publishes METRICS_NAME. Does not
+   need root, and does not slow the player down: the counters are only read.
+   Usage: ./play-metrics [-i ms] [-n count] [name]
+   A line is printed every -i milliseconds (1000), -n times (until stopped
+   with 0, the default). Control blocks per second are worked out between
+   lines. Generation times are only there when the player was built with
+   TIMING=1 or TRACE=1; they are percentiles of every beat so far, rounded
+   up to a power of two microseconds. */
+int main(int argc, char **argv) {
+    const char *name = METRICS_NAME;
+    const metrics_t *shared;
+    metrics_t m, last;
+    unsigned long now, lastUs = 0;
+    unsigned int ms = 1000, count = 0, printed = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-i") && i+1 < argc) ms = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n") && i+1 < argc)
+            count = atoi(argv[++i]);
+        else if (argv[i][0] == '/' && i == argc-1) name = argv[i];
+        else break;
+    }
+    if (i < argc || !ms) {
+        fprintf(stderr, "Usage: %s [-i ms] [-n count] [name]\n", argv[0]);
+        return 1;
+    }
+
+    if (!(shared = metrics_attach(name))) return 1;
+    memset(&last, 0, sizeof(last));
+    for (;;) {
+        now = trace_now();
+        if (metrics_read(shared, &m)) {
+            fprintf(stderr, "ERROR: main(): Counters of %s kept changing.\n",
+                    name);
+            metrics_detach(shared);
+            return 1;
+        }
+        print(&m, &last, now, lastUs);
+        last   = m;
+        lastUs = now;
+        if (count && ++printed == count) break;
+        usleep(ms*1000);
+    }
+    metrics_detach(shared);
+    return 0;
+}
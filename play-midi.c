@@ -0,0 +1,47 @@
+#include <stdio.h>    /* fprintf(), stderr                                    */
+#include <stdlib.h>   /* atoi()                                               */
+#include <string.h>   /* strcmp()                                             */
+#include <fcntl.h>    /* open()                                               */
+#include <unistd.h>   /* close()                                              */
+
+#include "include/midi.h"
+
+
+
+/* Play a Standard MIDI File while it is being read.
+   Usage: sudo ./play-midi file.mid [channels|notes] [pins...]
+   A file of "-" is read from standard input (format 0 files only).
+   "channels" plays MIDI channel n through the nth pin; "notes" (the default)
+   plays each note through any free pin. Pins default to 21 20 16 13. */
+int main(int argc, char **argv) {
+    int pins[32] = {21, 20, 16, 13};
+    int voices = 4, mode = MIDI_NOTES, fd, ret, i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file.mid [channels|notes] [pins...]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 2) {
+        if      (!strcmp(argv[2], "channels")) mode = MIDI_CHANNELS;
+        else if (!strcmp(argv[2], "notes"))    mode = MIDI_NOTES;
+        else {
+            fprintf(stderr, "ERROR: Unknown mode \"%s\".\n", argv[2]);
+            return 1;
+        }
+    }
+    if (argc > 3) {
+        for (i = 3, voices = 0; i < argc && voices < 32; i++)
+            pins[voices++] = atoi(argv[i]);
+    }
+
+    if (!strcmp(argv[1], "-")) fd = 0;
+    else if ((fd = open(argv[1], O_RDONLY)) < 0) {
+        fprintf(stderr, "ERROR: Cannot open \"%s\".\n", argv[1]);
+        return 1;
+    }
+
+    ret = midiPlay(fd, pins, voices, mode);
+    if (fd) close(fd);
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#include <stdio.h>    /* fprintf(), stderr                                    */
+
+#include "include/player.h"
+
+
+
+/* Play a score file made with "make scores" or queueSave().
+   Usage: sudo ./play-score file.rps */
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s file.rps\n", argv[0]);
+        return 1;
+    }
+
+    return queuePlayFile(argv[1]) ? 1 : 0;
+}
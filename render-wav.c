@@ -0,0 +1,309 @@
+#include <stdio.h>    /* fopen(), fwrite(), fseek(), fclose(), fprintf()      */
+#include <stdlib.h>   /* malloc(), free(), atof(), atoi()                     */
+#include <string.h>   /* strlen(), strcpy(), strcmp(), strchr()               */
+#include <math.h>     /* sin(), cos()                                         */
+
+#include "include/player.h"
+#include "include/score.h"
+#include "include/stub.h"
+
+#ifndef M_PI
+#   define M_PI 3.14159265358979323846
+#endif
+
+/* Samples written to the file at once. */
+#define RENDER_BUFFER 4096
+
+/* Cut-off (Hz) of the filter that takes out the DC of the square waves. */
+#define RENDER_DC 20.0
+
+/* Models of what the sound comes out of. */
+#define MODEL_FLAT    0     /* Nothing but the DC filter.                     */
+#define MODEL_SPEAKER 1     /* Resonant low-pass at its resonance.            */
+#define MODEL_PIEZO   2     /* Band-pass at its resonance.                    */
+
+
+
+/* Second order filter (see the "Audio EQ Cookbook" by R. Bristow-Johnson). */
+typedef struct biquad_t {
+    double num[3];          /* Coefficients of the input.                     */
+    double den[3];          /* Coefficients of the output (den[0] is 1).      */
+    double x1, x2, y1, y2;
+} biquad_t;
+
+/* Song being rendered. */
+typedef struct render_t {
+    FILE *f;
+    double rate;            /* Samples per second.                            */
+    double gain[32];        /* Gain of each pin.                              */
+    unsigned int level;     /* Pins that are on (1<<pin).                     */
+    double now;             /* Time (microseconds).                           */
+
+    double mix;             /* Sum of the gains of the pins that are on.      */
+    unsigned long next;     /* Sample after the one held.                     */
+    double held;            /* Sample next-1, which edges may still change.   */
+    double carry;           /* What edges add to sample next.                 */
+
+    int model;
+    biquad_t speaker;
+    double dcX, dcY, dcA;   /* DC filter.                                     */
+
+    unsigned char out[2*RENDER_BUFFER]; /* Samples, little-endian.            */
+    unsigned int outLength;
+    unsigned long samples;  /* Samples written.                               */
+    int clipped;            /* 1 if any sample was too loud.                  */
+} render_t;
+
+
+
+/* Set up a low-pass (band = 0) or band-pass (band = 1) filter. */
+static void biquadInit(biquad_t *bq, double rate, double freq, double q,
+                       int band) {
+    double w = 2*M_PI*freq/rate, alpha = sin(w)/(2*q), norm = 1 + alpha;
+
+    if (band) {
+        bq->num[0] = alpha/norm;
+        bq->num[1] = 0;
+        bq->num[2] = -alpha/norm;
+    } else {
+        bq->num[0] = (1 - cos(w))/2/norm;
+        bq->num[1] = (1 - cos(w))/norm;
+        bq->num[2] = (1 - cos(w))/2/norm;
+    }
+    bq->den[1] = -2*cos(w)/norm;
+    bq->den[2] = (1 - alpha)/norm;
+    bq->den[0] = 1;
+    bq->x1 = bq->x2 = bq->y1 = bq->y2 = 0;
+}
+
+/* Filter a sample. */
+static double biquad(biquad_t *bq, double x) {
+    double y = bq->num[0]*x + bq->num[1]*bq->x1 + bq->num[2]*bq->x2
+             - bq->den[1]*bq->y1 - bq->den[2]*bq->y2;
+    bq->x2 = bq->x1;
+    bq->x1 = x;
+    bq->y2 = bq->y1;
+    bq->y1 = y;
+    return y;
+}
+
+
+
+/* Pass a sample through the speaker model and write it. */
+static void emit(render_t *r, double x) {
+    double y;
+    int sample;
+
+    /* Square waves are 0 when off, so take out their DC first */
+    r->dcY = r->dcA*(r->dcY + x - r->dcX);
+    r->dcX = x;
+    y = r->model == MODEL_FLAT ? r->dcY : biquad(&r->speaker, r->dcY);
+
+    if (y > 1 || y < -1) {
+        r->clipped = 1;
+        y = y > 0 ? 1 : -1;
+    }
+    sample = (int)(y*32767);
+    r->out[r->outLength++] = sample & 0xFF;
+    r->out[r->outLength++] = (sample >> 8) & 0xFF;
+    r->samples++;
+    if (r->outLength == sizeof(r->out)) {
+        fwrite(r->out, 1, r->outLength, r->f);
+        r->outLength = 0;
+    }
+}
+
+/* Write every sample before time t (in samples), holding back the last one,
+   which edges at t may still change. */
+static void advance(render_t *r, double t) {
+    while (r->next <= t) {
+        if (r->next) emit(r, r->held);
+        r->held  = r->mix + r->carry;
+        r->carry = 0;
+        r->next++;
+    }
+}
+
+/* Add a step in the mix at time t (in samples). Instead of jumping from one
+   sample to the next, the step is smoothed over the samples either side of
+   it with a polynomial band-limited step (polyBLEP), so that its harmonics
+   above the Nyquist frequency do not alias back into the audible range. */
+static void step(render_t *r, double t, double height) {
+    double d;
+
+    advance(r, t);
+    d = t - (r->next - 1);
+    r->held  += height*(1 - d)*(1 - d)/2;
+    r->carry -= height*d*d/2;
+    r->mix   += height;
+}
+
+/* Add the transitions of a beat, for stub_record(). */
+static void record(const stub_pulse_t *pulses, unsigned int length,
+                   void *arg) {
+    render_t *r = arg;
+    unsigned int i, pin, on, off;
+    double t;
+
+    for (i = 0; i < length; i++) {
+        on  = pulses[i].set & ~r->level;
+        off = pulses[i].clr &  r->level;
+        if (on | off) {
+            t = r->now*r->rate/1e6;
+            for (pin = 0; pin < 32; pin++) {
+                if (on  & (1u<<pin)) step(r, t,  r->gain[pin]);
+                if (off & (1u<<pin)) step(r, t, -r->gain[pin]);
+            }
+            r->level = (r->level | on) & ~off;
+        }
+        r->now += pulses[i].us;
+    }
+}
+
+
+
+/* Write a little-endian number of n bytes. */
+static void putLittle(FILE *f, unsigned long v, int n) {
+    while (n--) {
+        fputc(v & 0xFF, f);
+        v >>= 8;
+    }
+}
+
+/* Write the header of a mono 16 bit WAV file with some samples. */
+static void wavHeader(FILE *f, unsigned long rate, unsigned long samples) {
+    fwrite("RIFF", 1, 4, f);
+    putLittle(f, 36 + 2*samples, 4);
+    fwrite("WAVEfmt ", 1, 8, f);
+    putLittle(f, 16, 4);
+    putLittle(f, 1, 2);          /* PCM    */
+    putLittle(f, 1, 2);          /* Mono   */
+    putLittle(f, rate, 4);
+    putLittle(f, 2*rate, 4);     /* Bytes per second */
+    putLittle(f, 2, 2);          /* Bytes per sample */
+    putLittle(f, 16, 2);
+    fwrite("data", 1, 4, f);
+    putLittle(f, 2*samples, 4);
+}
+
+
+
+/* Play a score with the stub driver and write what it sounds like.
+   gain:  Gain of each pin, or 0 to share the volume between the pins.
+   model: MODEL_FLAT, MODEL_SPEAKER or MODEL_PIEZO.
+   freq:  Resonance of the speaker or piezo (Hz).
+   q:     Q of the resonance.
+   Returns 0, or -1 (after printing an error). */
+static int render(const char *score, const char *path, unsigned int rate,
+                  const double *gain, int model, double freq, double q) {
+    static render_t r;
+    score_t s;
+    unsigned int v, pins = 0, pin;
+    int result;
+
+    if (scoreOpen(&s, score)) return -1;
+    for (v = 0; v < s.header->voices; v++) pins |= 1u<<s.voice[v].pin;
+    scoreClose(&s);
+
+    memset(&r, 0, sizeof(r));
+    if (!(r.f = fopen(path, "wb"))) {
+        fprintf(stderr, "ERROR: render(): Could not write %s.\n", path);
+        return -1;
+    }
+    r.rate  = rate;
+    r.model = model;
+    r.dcA   = 1/(1 + 2*M_PI*RENDER_DC/rate);
+    if (model != MODEL_FLAT)
+        biquadInit(&r.speaker, rate, freq, q, model == MODEL_PIEZO);
+    for (v = 0, pin = 0; pin < 32; pin++) v += (pins >> pin) & 1;
+    for (pin = 0; pin < 32; pin++)
+        if (pins & (1u<<pin)) r.gain[pin] = gain[pin] ? gain[pin] : 1.0/v;
+
+    /* The sizes are filled in at the end */
+    wavHeader(r.f, rate, 0);
+
+    stub_record(record, &r);
+    result = queuePlayFile(score);
+    stub_record(NULL, NULL);
+
+    advance(&r, r.now*rate/1e6);
+    emit(&r, r.held);
+    fwrite(r.out, 1, r.outLength, r.f);
+
+    fseek(r.f, 0, SEEK_SET);
+    wavHeader(r.f, rate, r.samples);
+    if (fclose(r.f) || result) {
+        fprintf(stderr, "ERROR: render(): Could not write %s.\n", path);
+        return -1;
+    }
+    if (r.clipped)
+        fprintf(stderr, "WARNING: render(): %s is clipped, lower the gains "
+                        "with -g.\n", path);
+    return 0;
+}
+
+
+
+/* Write what a score file would sound like as a WAV file, without a Pi.
+   Usage: ./render-wav [-r rate] [-m flat|speaker|piezo] [-f Hz] [-q Q]
+                       [-g pin:gain ...] file.rps [file.wav]
+   Without a second file, the sound is written next to the score with .wav
+   instead of .rps. Build with "make wav", which links the stub driver
+   instead of the real one. The waves are made by the same code as when
+   playing through DMA, and read back from the control blocks. Their edges
+   are band-limited, so high notes do not alias, then passed through a model
+   of a speaker (a resonant low-pass) or a piezo buzzer (a band-pass), with
+   its resonance at -f Hz (4000) and a Q of -q (1). By default the pins share
+   the volume evenly; -g sets the gain of a pin (1 is full scale). The sample
+   rate (-r) is 44100 by default. */
+int main(int argc, char **argv) {
+    static const char *models[3] = {"flat", "speaker", "piezo"};
+    double gain[32], freq = 4000, q = 1;
+    unsigned int rate = 44100;
+    int model = MODEL_PIEZO, i, m, result;
+    const char *score = NULL, *wav = NULL;
+    char *path = NULL;
+    size_t length;
+
+    memset(gain, 0, sizeof(gain));
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i+1 < argc) rate = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i+1 < argc) freq = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-q") && i+1 < argc) q = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && i+1 < argc) {
+            for (m = 0; m < 3 && strcmp(argv[i+1], models[m]); m++);
+            if (m == 3) break;
+            model = m;
+            i++;
+        }
+        else if (!strcmp(argv[i], "-g") && i+1 < argc &&
+                 strchr(argv[i+1], ':') &&
+                 atoi(argv[i+1]) >= 0 && atoi(argv[i+1]) < 32) {
+            gain[atoi(argv[i+1])] = atof(strchr(argv[i+1], ':') + 1);
+            i++;
+        }
+        else if (argv[i][0] == '-') break;
+        else if (!score) score = argv[i];
+        else if (!wav) wav = argv[i];
+        else break;
+    }
+    if (i < argc || !score || !rate || freq <= 0 || freq >= rate/2.0 ||
+        q <= 0) {
+        fprintf(stderr, "Usage: %s [-r rate] [-m flat|speaker|piezo] [-f Hz] "
+                        "[-q Q] [-g pin:gain ...] file.rps [file.wav]\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (!wav) {
+        length = strlen(score);
+        path = malloc(length + 5);
+        strcpy(path, score);
+        if (length > 4 && !strcmp(path + length - 4, ".rps")) length -= 4;
+        strcpy(path + length, ".wav");
+        wav = path;
+    }
+    result = render(score, wav, rate, gain, model, freq, q);
+    free(path);
+    return result ? 1 : 0;
+}
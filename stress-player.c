@@ -0,0 +1,87 @@
+#include <stdio.h>    /* printf(), fprintf(), stderr                          */
+#include <stdlib.h>   /* atoi()                                               */
+#include <string.h>   /* strcmp()                                             */
+
+#include "include/player.h"
+#include "include/stub.h"
+
+/* Names of the quality of service levels, in order. */
+static const char *levels[QOS_LEVELS] = {"full", "effects", "slides",
+                                         "edges", "mute"};
+
+
+
+/* Play a score file with the generator slowed down, and print how the
+   quality of service controller coped.
+   ns:      Nanoseconds to sleep for every transition generated.
+   depth:   Beats of the pipeline.
+   seconds: Longest time to play for, or 0 to play the whole song.
+   Returns 0, or -1 (after printing an error). */
+static int stress(const char *path, unsigned int ns, unsigned int depth,
+                  unsigned int seconds) {
+    play_t *play;
+    play_progress_t progress;
+    qos_stats_t qos;
+    unsigned int level;
+
+    pipelineDepth(depth);
+    qosSlowdown(ns);
+    if (!(play = queuePlayFileAsync(path))) {
+        fprintf(stderr, "ERROR: stress(): Could not play %s.\n", path);
+        return -1;
+    }
+    if (seconds && playWait(play, seconds*1000)) {
+        playPoll(play, &progress);
+        printf("stress: %s: stopped after %u of %u beats\n", path,
+               progress.beats, progress.total);
+        playCancel(play);
+    }
+    if (playFree(play)) return -1;
+
+    qosStats(&qos);
+    printf("stress: %s: %lu changes, lowest quality %s, %lu underruns, "
+           "min ahead %lu us\n", path, qos.changes, levels[qos.maxLevel],
+           qos.underruns, qos.minAheadUs);
+    for (level = 0; level < QOS_LEVELS; level++)
+        printf("stress: %s: %-8s %lu beats\n", path, levels[level],
+               qos.beats[level]);
+    return 0;
+}
+
+
+
+/* Check the quality of service controller (see qosEnable()) without a Pi.
+   Usage: ./stress-player [-n ns] [-p depth] [-s seconds] [-o] file.rps
+   Build with "make stress", which links the stub driver with DMA taking as
+   long as it would on a Pi (see stub_realtime()), so that songs take as long
+   as they should. The generator sleeps for -n nanoseconds (3000000) for
+   every transition, so that it cannot keep up with a busy song, and the
+   controller steps down until it can. Every change of level is printed to
+   stderr, with the beat it happened at. With -o the controller is left off,
+   to compare.
+   The pipeline is -p beats deep (8). At most -s seconds (the whole song) are
+   played. How many times DMA ran out is printed rather than failing, as
+   a slow enough player runs out however little it plays; the exit status
+   is only 1 if the song could not be played. */
+int main(int argc, char **argv) {
+    unsigned int ns = 3000000, depth = 8, seconds = 0;
+    int i, on = 1;
+
+    for (i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "-n") && i+2 < argc) ns = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i+2 < argc) depth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s") && i+2 < argc)
+            seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-o")) on = 0;
+        else break;
+    }
+    if (i != argc - 1 || argv[i][0] == '-') {
+        fprintf(stderr, "Usage: %s [-n ns] [-p depth] [-s seconds] [-o] "
+                        "file.rps\n", argv[0]);
+        return 1;
+    }
+
+    stub_realtime(1);
+    qosEnable(on);
+    return stress(argv[i], ns, depth, seconds) ? 1 : 0;
+}